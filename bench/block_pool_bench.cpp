@@ -0,0 +1,364 @@
+/*
+ * block_pool_bench.cpp
+ *
+ * Host benchmark for the block pools against heap4. An allocation trace is
+ * replayed twice: once entirely through heap4 (pvPortMalloc() and
+ * vPortFree()), and once with every allocation that's freed again going to the
+ * smallest size class of block pools that fits it. Allocations that are never
+ * freed are startup allocations and stay on heap4 in both runs. The pools are
+ * sized from the trace itself: each class gets as many blocks as it ever had
+ * in use at once. For each run it reports the time per allocation and free,
+ * failures, and fragmentation. For heap4 that's how much of the free heap
+ * wasn't in its largest block at the worst point. For the pools it's the
+ * bytes lost rounding requests up to a block, and the RAM the pools take
+ * against heap4's peak. Reading the clock costs more than a pool allocation
+ * does here, so its cost is shown on its own.
+ *
+ * The trace is synthetic unless ALLOC_TRACE_FILE names one recorded by the
+ * host application (HOST_ALLOC_TRACE_FILE; see host/pico_host.c). The
+ * synthetic one is a burst of startup allocations, then transient objects
+ * the size of datagrams, log lines and pixel packets, with random lifetimes.
+ *
+ *   ALLOC_TRACE_FILE   "+ address size" and "- address" lines
+ *   ALLOC_BENCH_OPS    operations in the synthetic trace (200000)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+#include "block_pool.h"
+
+extern "C" {
+    #include "FreeRTOS.h"
+}
+
+
+#define CLASS_COUNT         8
+#define STATS_EVERY         64
+
+static const size_t class_sizes[CLASS_COUNT] = { 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+
+
+typedef struct {
+    bool alloc;
+    uint32_t id;
+    size_t size;
+    bool startup;           // never freed
+} trace_op_t;
+
+
+typedef struct {
+    uint64_t alloc_ns;
+    uint64_t alloc_max_ns;
+    uint64_t free_ns;
+    uint64_t free_max_ns;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;
+    double worst_fragmentation;
+} run_stats_t;
+
+
+static uint32_t rng_state = 1;
+
+static uint32_t next_random() {
+    rng_state = rng_state * 1664525 + 1013904223;
+    return rng_state >> 8;
+}
+
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/***
+ * Addresses in a recorded trace are reused once freed, so each allocation
+ * gets an id of its own.
+ */
+static bool load_trace(const char *path, std::vector<trace_op_t> *ops) {
+    std::map<std::string, uint32_t> live;
+    FILE *f = fopen(path, "r");
+    char op, address[64];
+    unsigned long size;
+    uint32_t next_id = 0;
+
+    if(f == NULL) {
+        perror(path);
+        return false;
+    }
+    while(fscanf(f, " %c %63s", &op, address) == 2) {
+        if(op == '+' && fscanf(f, "%lu", &size) == 1) {
+            live[address] = next_id;
+            ops->push_back({ true, next_id++, (size_t)size, false });
+        }
+        else if(op == '-' && live.count(address)) {
+            ops->push_back({ false, live[address], 0, false });
+            live.erase(address);
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+
+static void make_trace(uint32_t count, std::vector<trace_op_t> *ops) {
+    std::vector<std::pair<uint32_t, uint32_t>> pending;   // free at op, id
+    uint32_t next_id = 0;
+
+    // Task stacks, queues and the like, at startup
+    for(int i = 0; i < 24; i++) {
+        ops->push_back({ true, next_id++, (size_t)(64 + next_random() % 4096), false });
+    }
+
+    while(ops->size() < count) {
+        uint32_t now = (uint32_t)ops->size();
+        uint32_t kind = next_random() % 10;
+        size_t size;
+
+        for(size_t i = 0; i < pending.size(); ) {
+            if(pending[i].first <= now) {
+                ops->push_back({ false, pending[i].second, 0, false });
+                pending[i] = pending.back();
+                pending.pop_back();
+            }
+            else {
+                i++;
+            }
+        }
+
+        if(kind < 5) {
+            size = 40 + next_random() % 60;             // NTP and LAN time datagrams
+        }
+        else if(kind < 9) {
+            size = 100 + next_random() % 140;           // log lines
+        }
+        else {
+            size = 600 + next_random() % 1000;          // pixel packets
+        }
+        pending.push_back({ now + 1 + next_random() % 200, next_id });
+        ops->push_back({ true, next_id++, size, false });
+    }
+
+    for(size_t i = 0; i < pending.size(); i++) {
+        ops->push_back({ false, pending[i].second, 0, false });
+    }
+}
+
+
+static void mark_startup(std::vector<trace_op_t> *ops, uint32_t ids) {
+    std::vector<bool> freed(ids, false);
+
+    for(size_t i = 0; i < ops->size(); i++) {
+        if(!(*ops)[i].alloc) {
+            freed[(*ops)[i].id] = true;
+        }
+    }
+    for(size_t i = 0; i < ops->size(); i++) {
+        if((*ops)[i].alloc) {
+            (*ops)[i].startup = !freed[(*ops)[i].id];
+        }
+    }
+}
+
+
+static int size_class(size_t size) {
+    for(int i = 0; i < CLASS_COUNT; i++) {
+        if(size <= class_sizes[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+static void time_op(uint64_t ns, uint64_t *total, uint64_t *max) {
+    *total += ns;
+    if(ns > *max) {
+        *max = ns;
+    }
+}
+
+
+static double heap_fragmentation() {
+    HeapStats_t stats;
+
+    vPortGetHeapStats(&stats);
+    if(stats.xAvailableHeapSpaceInBytes == 0) {
+        return 0.0;
+    }
+    return 1.0 - (double)stats.xSizeOfLargestFreeBlockInBytes / stats.xAvailableHeapSpaceInBytes;
+}
+
+
+/***
+ * Replays the trace. With pools, transient allocations go to them and
+ * startup ones to heap4; without, everything goes to heap4. Either way
+ * everything transient is freed by the end.
+ */
+static run_stats_t replay(const std::vector<trace_op_t> *ops, uint32_t ids, block_pool_t *const *pools) {
+    std::vector<void *> blocks(ids, NULL);
+    std::vector<int> classes(ids, -1);
+    run_stats_t stats;
+    uint64_t start, ns;
+
+    memset(&stats, 0, sizeof(stats));
+
+    for(size_t i = 0; i < ops->size(); i++) {
+        const trace_op_t *op = &(*ops)[i];
+
+        if(op->alloc) {
+            int c = (pools != NULL && !op->startup) ? size_class(op->size) : -1;
+            start = now_ns();
+            blocks[op->id] = c >= 0 ? block_pool_alloc(pools[c], op->size) : pvPortMalloc(op->size);
+            ns = now_ns() - start;
+            classes[op->id] = c;
+
+            if(op->startup) {
+                continue;
+            }
+            time_op(ns, &stats.alloc_ns, &stats.alloc_max_ns);
+            stats.allocs++;
+            if(blocks[op->id] == NULL) {
+                stats.failures++;
+            }
+        }
+        else {
+            if(blocks[op->id] == NULL) {
+                continue;
+            }
+            start = now_ns();
+            if(classes[op->id] >= 0) {
+                block_pool_free(pools[classes[op->id]], blocks[op->id]);
+            }
+            else {
+                vPortFree(blocks[op->id]);
+            }
+            ns = now_ns() - start;
+            blocks[op->id] = NULL;
+            time_op(ns, &stats.free_ns, &stats.free_max_ns);
+            stats.frees++;
+        }
+
+        if(pools == NULL && i % STATS_EVERY == 0) {
+            double fragmentation = heap_fragmentation();
+            if(fragmentation > stats.worst_fragmentation) {
+                stats.worst_fragmentation = fragmentation;
+            }
+        }
+    }
+
+    for(uint32_t id = 0; id < ids; id++) {
+        if(blocks[id] != NULL) {
+            if(classes[id] >= 0) {
+                block_pool_free(pools[classes[id]], blocks[id]);
+            }
+            else {
+                vPortFree(blocks[id]);
+            }
+        }
+    }
+    return stats;
+}
+
+
+static void print_run(const char *name, const run_stats_t *s) {
+    printf("BENCH ALLOC %-10s: ALLOC %6.1f ns (MAX %6llu), FREE %6.1f ns (MAX %6llu), %lu ALLOCATIONS, %lu FAILED\n",
+           name, s->allocs ? (double)s->alloc_ns / s->allocs : 0.0, (unsigned long long)s->alloc_max_ns,
+           s->frees ? (double)s->free_ns / s->frees : 0.0, (unsigned long long)s->free_max_ns,
+           (unsigned long)s->allocs, (unsigned long)s->failures);
+}
+
+
+int main() {
+    const char *path = getenv("ALLOC_TRACE_FILE");
+    const char *env = getenv("ALLOC_BENCH_OPS");
+    std::vector<trace_op_t> ops;
+    uint32_t ids = 0;
+    uint32_t in_use[CLASS_COUNT] = { 0 };
+    uint32_t peak[CLASS_COUNT] = { 0 };
+    uint64_t requested = 0, rounded = 0;
+    uint32_t too_big = 0;
+
+    if(path != NULL) {
+        if(!load_trace(path, &ops)) {
+            return 1;
+        }
+    }
+    else {
+        make_trace(env != NULL ? (uint32_t)strtoul(env, NULL, 0) : 200000, &ops);
+    }
+    for(size_t i = 0; i < ops.size(); i++) {
+        if(ops[i].alloc && ops[i].id + 1 > ids) {
+            ids = ops[i].id + 1;
+        }
+    }
+    mark_startup(&ops, ids);
+
+    // Size each class for the most it ever has in use at once
+    std::vector<int> classes(ids, -1);
+    for(size_t i = 0; i < ops.size(); i++) {
+        if(ops[i].alloc && !ops[i].startup) {
+            int c = size_class(ops[i].size);
+            classes[ops[i].id] = c;
+            if(c < 0) {
+                too_big++;
+                continue;
+            }
+            requested += ops[i].size;
+            rounded += class_sizes[c];
+            if(++in_use[c] > peak[c]) {
+                peak[c] = in_use[c];
+            }
+        }
+        else if(!ops[i].alloc && classes[ops[i].id] >= 0) {
+            in_use[classes[ops[i].id]]--;
+        }
+    }
+
+    block_pool_t pool_storage[CLASS_COUNT];
+    block_pool_t *pools[CLASS_COUNT];
+    std::vector<std::vector<uint64_t>> storage(CLASS_COUNT);
+    size_t pool_bytes = 0;
+    for(int c = 0; c < CLASS_COUNT; c++) {
+        storage[c].resize(class_sizes[c] / sizeof(uint64_t) * (peak[c] ? peak[c] : 1));
+        block_pool_init(&pool_storage[c], "BENCH", storage[c].data(), class_sizes[c], peak[c] ? peak[c] : 1);
+        pools[c] = &pool_storage[c];
+        pool_bytes += class_sizes[c] * peak[c];
+    }
+
+    uint64_t start = now_ns();
+    volatile uint64_t sink = 0;
+    for(int i = 0; i < 100000; i++) {
+        sink += now_ns();
+    }
+    printf("BENCH ALLOC TIMER READ: %6.1f ns, INCLUDED IN EVERY TIME BELOW\n", (double)(now_ns() - start) / 100000);
+
+    size_t free_before = xPortGetFreeHeapSize();
+    run_stats_t heap = replay(&ops, ids, NULL);
+    size_t heap_peak = free_before - xPortGetMinimumEverFreeHeapSize();
+    run_stats_t pooled = replay(&ops, ids, pools);
+
+    printf("BENCH ALLOC TRACE     : %lu OPERATIONS, %lu ALLOCATIONS, %lu TOO BIG FOR A POOL\n",
+           (unsigned long)ops.size(), (unsigned long)ids, (unsigned long)too_big);
+    print_run("HEAP4", &heap);
+    print_run("POOLS", &pooled);
+    printf("BENCH ALLOC HEAP4     : WORST FRAGMENTATION %.1f%% OF FREE SPACE OUTSIDE THE LARGEST BLOCK, "
+           "PEAK %lu BYTES\n", heap.worst_fragmentation * 100.0, (unsigned long)heap_peak);
+    printf("BENCH ALLOC POOLS     : %lu BYTES OF BLOCKS, %.1f%% LOST TO ROUNDING UP\n",
+           (unsigned long)pool_bytes, rounded ? 100.0 * (rounded - requested) / rounded : 0.0);
+    for(int c = 0; c < CLASS_COUNT; c++) {
+        if(peak[c]) {
+            printf("    CLASS %4lu: %lu BLOCKS, %lu ALLOCATIONS, %lu FAILED\n", (unsigned long)class_sizes[c],
+                   (unsigned long)peak[c], (unsigned long)pools[c]->allocs, (unsigned long)pools[c]->failed);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * clock_discipline_bench.cpp
+ *
+ * Host benchmark for DisciplinedClock. A virtual local timer runs off by a
+ * fixed number of ppm from true time, and a virtual NTP server answers at the
+ * poll interval the clock asks for (a burst at a time), over a link with a base one-way delay and
+ * random jitter on each leg. Samples are built the way NetworkTime builds them
+ * from lwIP's SNTP client (roundtrip-compensated, with the local timer read at
+ * send and receive). Every virtual second the clock is compared with true
+ * time.
+ *
+ * For each scenario it reports how long the clock took to get and stay within
+ * 1ms, the worst and RMS error after that, the RMS error over the second half
+ * of the run, how far it ever got ahead of or behind true time, the steps,
+ * spikes and samples it took, and how well it learned the timer's frequency
+ * error. The last line is the real CPU cost of a to_utc_us() call.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "disciplined_clock.h"
+
+
+#define RUN_SECONDS         (6 * 3600)
+#define SETTLED_US          1000
+#define READ_ITERATIONS     10000000
+
+
+static uint32_t rng_state = 1;
+
+static uint32_t next_random() {
+    rng_state = rng_state * 1664525 + 1013904223;
+    return rng_state >> 8;
+}
+
+
+typedef struct {
+    const char *name;
+    double drift_ppm;           // how much faster true time runs than the local timer
+    uint32_t delay_us;          // one-way
+    uint32_t jitter_us;         // +/- on each leg
+    int64_t start_offset_us;    // true time when the local timer reads 0
+    int64_t spike_us;           // one sample this far off, an hour in
+} scenario_t;
+
+
+static uint64_t local_at(const scenario_t *s, int64_t true_us) {
+    return (uint64_t)((double)(true_us - s->start_offset_us) / (1.0 + s->drift_ppm / 1e6));
+}
+
+
+static uint32_t leg(const scenario_t *s) {
+    int64_t d = (int64_t)s->delay_us;
+    if(s->jitter_us) {
+        d += (int64_t)(next_random() % (2 * s->jitter_us + 1)) - (int64_t)s->jitter_us;
+    }
+    return d < 0 ? 0 : (uint32_t)d;
+}
+
+
+/***
+ * One SNTP exchange starting at true time true_us, fed to the clock the way
+ * NetworkTime does it.
+ */
+static void exchange(const scenario_t *s, DisciplinedClock &clock, int64_t true_us, bool spike) {
+    uint32_t up = leg(s);
+    uint32_t down = leg(s);
+    uint64_t t1_local = local_at(s, true_us);
+    int64_t t2 = true_us + up;
+    int64_t t3 = t2 + 50;
+    uint64_t t4_local = local_at(s, t3 + down);
+    int64_t t1 = clock.to_utc_us(t1_local);
+    int64_t t4 = clock.to_utc_us(t4_local);
+    uint32_t delay = (uint32_t)(t4_local - t1_local);
+    int64_t reference;
+
+    if(clock.is_synchronized()) {
+        reference = t4 + ((t2 - t1) + (t3 - t4)) / 2;
+    }
+    else {
+        reference = t3 + delay / 2;
+    }
+    if(spike) {
+        reference += s->spike_us;
+    }
+
+    clock.update(t4_local, reference, delay);
+}
+
+
+static void run(const scenario_t *s) {
+    DisciplinedClock clock;
+    int64_t next_poll_us = s->start_offset_us;
+    int64_t settled_at_us = -1;
+    int64_t max_ahead_us = 0, max_behind_us = 0, max_settled_us = 0;
+    double settled_sum = 0.0, late_sum = 0.0;
+    uint32_t settled_count = 0, late_count = 0;
+    bool spiked = false;
+
+    rng_state = 1;
+
+    for(int64_t t = 0; t < (int64_t)RUN_SECONDS * 1000000; t += 1000000) {
+        int64_t true_us = s->start_offset_us + t;
+
+        while(next_poll_us <= true_us) {
+            bool spike = s->spike_us != 0 && !spiked && next_poll_us - s->start_offset_us >= 3600000000LL;
+            exchange(s, clock, next_poll_us, spike);
+            spiked = spiked || spike;
+            next_poll_us += (int64_t)clock.get_poll_interval_ms() * 1000;
+        }
+
+        int64_t error = clock.to_utc_us(local_at(s, true_us)) - true_us;
+        if(clock.is_synchronized()) {
+            max_ahead_us = error > max_ahead_us ? error : max_ahead_us;
+            max_behind_us = error < max_behind_us ? error : max_behind_us;
+        }
+
+        if(t >= (int64_t)RUN_SECONDS * 1000000 / 2) {
+            late_sum += (double)error * (double)error;
+            late_count++;
+        }
+
+        if(error > SETTLED_US || error < -SETTLED_US || !clock.is_synchronized()) {
+            settled_at_us = -1;
+            settled_sum = 0.0;
+            settled_count = 0;
+            max_settled_us = 0;
+        }
+        else {
+            if(settled_at_us < 0) {
+                settled_at_us = t;
+            }
+            settled_sum += (double)error * (double)error;
+            settled_count++;
+            max_settled_us = std::abs(error) > max_settled_us ? std::abs(error) : max_settled_us;
+        }
+    }
+
+    const clock_stats_t *stats = clock.get_stats();
+    if(settled_at_us >= 0) {
+        printf("BENCH CLOCK %-20s: WITHIN 1ms AFTER %5.0f s, THEN MAX %4lld us, RMS %4.0f us; ",
+               s->name, settled_at_us / 1e6, (long long)max_settled_us, std::sqrt(settled_sum / settled_count));
+    }
+    else {
+        printf("BENCH CLOCK %-20s: NEVER STAYED WITHIN 1ms;                    ", s->name);
+    }
+    printf("RMS %5.0f us OVER LAST %d h, RANGE %+7lld/%+7lld us, %lu SAMPLES, %lu STEPS, %lu SPIKES, "
+           "FREQ %+8.3f ppm (TRUE %+8.3f), POLL %lu s\n",
+           std::sqrt(late_sum / late_count), RUN_SECONDS / 7200, (long long)max_behind_us, (long long)max_ahead_us,
+           (unsigned long)stats->samples, (unsigned long)stats->steps, (unsigned long)stats->spikes,
+           stats->freq_ppb / 1000.0, s->drift_ppm, (unsigned long)(stats->poll_ms / 1000));
+}
+
+
+int main() {
+    static const scenario_t scenarios[] = {
+        { "PERFECT LINK",      0.0,   1000,     0, 1760000000000000LL, 0 },
+        { "CRYSTAL +30 PPM",   30.0,  2000,   500, 1760000000000000LL, 0 },
+        { "CRYSTAL -45 PPM",  -45.0,  2000,   500, 1760000000000000LL, 0 },
+        { "WIFI 20+/-5 ms",    20.0, 20000,  5000, 1760000000000000LL, 0 },
+        { "BAD WIFI 30+/-20",  20.0, 30000, 20000, 1760000000000000LL, 0 },
+        { "500 ms SPIKE",      20.0,  2000,   500, 1760000000000000LL, 500000 },
+    };
+
+    for(size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        run(&scenarios[i]);
+    }
+
+    {
+        DisciplinedClock clock;
+        volatile int64_t sink = 0;
+
+        clock.update(0, 1760000000000000LL, 1000);
+        clock.update(60000000, 1760000060001000LL, 1000);
+
+        auto start = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < READ_ITERATIONS; i++) {
+            sink = clock.to_utc_us(60000000 + i);
+        }
+        auto end = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(end - start).count();
+        (void)sink;
+
+        printf("BENCH CLOCK READ: %.1f ns/to_utc_us()\n", seconds * 1e9 / READ_ITERATIONS);
+    }
+
+    return 0;
+}
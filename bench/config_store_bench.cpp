@@ -0,0 +1,167 @@
+/*
+ * config_store_bench.cpp
+ *
+ * Host benchmark for the boot-time read/verify path of the configuration
+ * store, against a RAM-backed flash emulator. Times load() with the log in a
+ * few states (empty, one record, full, wrapped many times, and with a torn
+ * newest record it has to fall back from), then does a long run of saves and
+ * shows how evenly the erases were spread over the sectors.
+ *
+ * On the Pico the reads come through XIP, so absolute numbers will differ;
+ * the bytes read and records CRC-checked per load carry over directly.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "config_store.h"
+#include "ram_flash.h"
+
+
+#define LOAD_ITERATIONS     100000
+#define WEAR_SAVES          100000
+
+
+static void fill_config(led_strip_config_t *config, uint32_t n) {
+    memset(config, 0, sizeof(led_strip_config_t));
+    snprintf(config->wifi_ssid, sizeof(config->wifi_ssid), "bench");
+    snprintf(config->wifi_password, sizeof(config->wifi_password), "password-%lu", (unsigned long)n);
+    config->use_dhcp = false;
+    config->ip[0] = 10; config->ip[3] = (uint8_t)n;
+    config->netmask[0] = 255; config->netmask[1] = 255; config->netmask[2] = 255;
+    config->gateway[0] = 10; config->gateway[3] = 1;
+    config->strip_length = 300 + n % 100;
+}
+
+
+static void time_load(const char *name, RamFlash &flash) {
+    ConfigStore& store = ConfigStore::getInstance();
+    led_strip_config_t config;
+    bool found = false;
+
+    store.set_flash(&flash);
+    uint32_t scanned_before = store.get_stats()->records_scanned;
+    uint32_t crc_failures_before = store.get_stats()->crc_failures;
+    uint64_t bytes_before = flash.get_bytes_read();
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < LOAD_ITERATIONS; i++) {
+        found = store.load(&config);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    printf("BENCH LOAD %-22s: %7.1f ns/LOAD, %5.1f BYTES READ, %4.2f RECORDS CHECKED, %4.2f CRC FAILURES, "
+           "FOUND %s (SEQUENCE %lu)\n",
+           name, seconds * 1e9 / LOAD_ITERATIONS,
+           (double)(flash.get_bytes_read() - bytes_before) / LOAD_ITERATIONS,
+           (double)(store.get_stats()->records_scanned - scanned_before) / LOAD_ITERATIONS,
+           (double)(store.get_stats()->crc_failures - crc_failures_before) / LOAD_ITERATIONS,
+           found ? "YES" : "NO", (unsigned long)store.get_stats()->sequence);
+}
+
+
+static void save_n(RamFlash &flash, uint32_t count) {
+    ConfigStore& store = ConfigStore::getInstance();
+    led_strip_config_t config;
+
+    store.set_flash(&flash);
+    for(uint32_t n = 0; n < count; n++) {
+        fill_config(&config, n);
+        store.save(&config);
+    }
+}
+
+
+/***
+ * Leaves a copy of the newest record in the next slot with a higher sequence
+ * number and one byte of the payload missing, which is what a power cut in the
+ * middle of programming looks like.
+ */
+static void tear_next_record(RamFlash &flash) {
+    ConfigStore& store = ConfigStore::getInstance();
+    led_strip_config_t config;
+    config_record_t record;
+    uint8_t *memory = flash.get_memory();
+    int slots = (int)(flash.get_size() / CONFIG_STORE_RECORD_SIZE);
+
+    store.set_flash(&flash);
+    store.load(&config);
+    for(int slot = 0; slot < slots; slot++) {
+        memcpy(&record, &memory[slot * CONFIG_STORE_RECORD_SIZE], sizeof(record));
+        if(record.sequence == store.get_stats()->sequence) {
+            int next = (slot + 1) % slots;
+            record.sequence++;
+            record.config.strip_length = 0xffffffff;
+            memcpy(&memory[next * CONFIG_STORE_RECORD_SIZE], &record, sizeof(record));
+            return;
+        }
+    }
+}
+
+
+int main() {
+    const size_t size = CONFIG_STORE_SECTORS * CONFIG_STORE_SECTOR_SIZE;
+
+    {
+        RamFlash flash(size);
+        time_load("EMPTY", flash);
+    }
+    {
+        RamFlash flash(size);
+        save_n(flash, 1);
+        time_load("ONE RECORD", flash);
+    }
+    {
+        RamFlash flash(size);
+        save_n(flash, CONFIG_STORE_MAX_SLOTS);
+        time_load("FULL", flash);
+    }
+    {
+        RamFlash flash(size);
+        save_n(flash, 1000);
+        time_load("WRAPPED (1000 SAVES)", flash);
+    }
+    {
+        RamFlash flash(size);
+        save_n(flash, 10);
+        tear_next_record(flash);
+        time_load("TORN NEWEST RECORD", flash);
+    }
+
+    {
+        RamFlash flash(size);
+        ConfigStore& store = ConfigStore::getInstance();
+        led_strip_config_t config;
+
+        save_n(flash, 10);
+        flash.tear_next_program(100);
+        fill_config(&config, 10);
+        bool saved = store.save(&config);
+        printf("BENCH SAVE WITH TORN PROGRAM: SAVED %s, %lu WRITE FAILURES, SEQUENCE %lu\n",
+               saved ? "YES" : "NO", (unsigned long)store.get_stats()->write_failures,
+               (unsigned long)store.get_stats()->sequence);
+    }
+
+    {
+        RamFlash flash(size);
+        uint32_t min_erases = UINT32_MAX;
+        uint32_t max_erases = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        save_n(flash, WEAR_SAVES);
+        auto end = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(end - start).count();
+
+        for(int sector = 0; sector < flash.get_sector_count(); sector++) {
+            uint32_t erases = flash.get_sector_erases(sector);
+            min_erases = erases < min_erases ? erases : min_erases;
+            max_erases = erases > max_erases ? erases : max_erases;
+        }
+        printf("BENCH WEAR %d SAVES OVER %d SECTORS: %lu-%lu ERASES PER SECTOR, %.0f ns/SAVE (RAM FLASH)\n",
+               WEAR_SAVES, flash.get_sector_count(), (unsigned long)min_erases, (unsigned long)max_erases,
+               seconds * 1e9 / WEAR_SAVES);
+    }
+
+    return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * event_loop_bench.cpp
+ *
+ * Host bench for EventLoop alone, on a virtual clock and without a
+ * scheduler. It measures the loop, not the services. Two hand-written
+ * models shaped like the ones the loop runs on the device share it: a
+ * link supervisor with WifiConnection's states (join, poll the link, back
+ * off) and a time client with NetworkTime's multi-server rounds, which waits
+ * on EVENT_WIFI_JOINED. The access point comes and goes on a random schedule
+ * of outages, from half a second to twenty.
+ *
+ * Each schedule is run twice: once with the "netif callback" clearing the
+ * condition and posting to the supervisor the moment the link drops, the way
+ * WifiConnection's does, and once with the supervisor's poll left to notice
+ * on its own. For both it reports how long outages took to detect and to
+ * rejoin from, how many time rounds went out while the link was down, and
+ * how often the loop woke up. It also checks that timers and waiter timeouts
+ * fire exactly when they're due, and times a dispatch on this machine.
+ *
+ * The services here are models, and nothing it reports says the real ones
+ * behave. WifiConnection itself is tested by the host application
+ * (host/host_monitor.cpp, registered with ctest), which drops and restores
+ * sim_net's access point and fails unless each drop is detected by event,
+ * rejoined, and the EVENT_WIFI_JOINED waiters resumed.
+ *
+ *   EVENT_BENCH_HOURS       simulated hours per run (24)
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "event_loop.h"
+
+
+#define JOIN_MS             150
+#define JOIN_TIMEOUT_MS     2000
+#define JOIN_POLL_MS        10
+#define LINK_POLL_MS        1000
+#define BACKOFF_MIN_MS      250
+#define BACKOFF_MAX_MS      8000
+#define CYW43_INIT_MS       300
+#define ROUND_COLLECT_MS    1000
+#define ROUND_INTERVAL_MS   16000
+#define NEVER_CONDITION     0x80000000
+
+
+static EventLoop& loop = EventLoop::getInstance();
+static uint64_t virtual_us;
+static bool ap_present;
+static uint64_t ap_lost_us;
+static bool failed;
+
+
+static uint64_t virtual_now() {
+    return virtual_us;
+}
+
+
+static uint32_t env_u32(const char *name, uint32_t fallback) {
+    const char *value = getenv(name);
+    return value ? (uint32_t)strtoul(value, NULL, 0) : fallback;
+}
+
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+
+static void check(bool ok, const char *what) {
+    printf("CHECK %-52s %s\n", what, ok ? "OK" : "FAILED");
+    if(!ok) {
+        failed = true;
+    }
+}
+
+
+typedef struct {
+    uint64_t start_us;
+    uint64_t length_us;
+} outage_t;
+
+
+/**
+ * WifiConnection's state machine, with the radio replaced by ap_present: a
+ * join takes JOIN_MS if the access point is there and times out if it isn't,
+ * and the link is looked at every LINK_POLL_MS once joined.
+ */
+class Supervisor {
+    public:
+        enum { JOINING, UP, BACKOFF, STOPPED } state;
+        event_timer_t timer;
+        uint32_t backoff_ms;
+        uint64_t join_start_us;
+        uint64_t detect_us;
+        bool down;
+
+        uint32_t outages;
+        uint64_t detect_total_us;
+        uint64_t detect_max_us;
+        uint64_t rejoin_total_us;
+        uint64_t rejoin_max_us;
+
+        void start() {
+            memset(this, 0, sizeof(*this));
+            timer = EVENT_TIMER_NONE;
+            begin_join();
+        }
+
+        void stop() {
+            state = STOPPED;
+            loop.cancel(&timer);
+        }
+
+        void begin_join() {
+            state = JOINING;
+            join_start_us = virtual_us;
+            timer = loop.schedule(JOIN_POLL_MS, poll, this);
+        }
+
+        static void poll(void *arg) {
+            Supervisor *s = (Supervisor *)arg;
+
+            s->timer = EVENT_TIMER_NONE;
+            switch(s->state) {
+                case JOINING:
+                    if(ap_present && virtual_us - s->join_start_us >= (uint64_t)JOIN_MS * 1000) {
+                        s->joined();
+                    }
+                    else if(virtual_us - s->join_start_us >= (uint64_t)JOIN_TIMEOUT_MS * 1000) {
+                        s->backoff();
+                    }
+                    else {
+                        s->timer = loop.schedule(JOIN_POLL_MS, poll, s);
+                    }
+                    break;
+                case UP:
+                    if(ap_present) {
+                        s->timer = loop.schedule(LINK_POLL_MS, poll, s);
+                    }
+                    else {
+                        s->lost();
+                        s->begin_join();
+                    }
+                    break;
+                case BACKOFF:
+                    s->begin_join();
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // What WifiConnection::link_event() does with a posted netif event
+        static void link_event(void *arg) {
+            Supervisor *s = (Supervisor *)arg;
+
+            if(s->state == BACKOFF || s->state == STOPPED) {
+                return;
+            }
+            loop.cancel(&s->timer);
+            poll(s);
+        }
+
+        void joined() {
+            if(down) {
+                uint64_t rejoin_us = virtual_us - detect_us;
+                rejoin_total_us += rejoin_us;
+                rejoin_max_us = rejoin_us > rejoin_max_us ? rejoin_us : rejoin_max_us;
+                down = false;
+            }
+            backoff_ms = 0;
+            state = UP;
+            loop.set_conditions(EVENT_WIFI_JOINED);
+            timer = loop.schedule(LINK_POLL_MS, poll, this);
+        }
+
+        void lost() {
+            uint64_t detect = virtual_us - ap_lost_us;
+
+            loop.clear_conditions(EVENT_WIFI_JOINED);
+            if(down) {
+                return;
+            }
+            down = true;
+            outages++;
+            detect_us = virtual_us;
+            detect_total_us += detect;
+            detect_max_us = detect > detect_max_us ? detect : detect_max_us;
+        }
+
+        void backoff() {
+            backoff_ms = backoff_ms == 0 ? BACKOFF_MIN_MS : backoff_ms * 2;
+            backoff_ms = backoff_ms > BACKOFF_MAX_MS ? BACKOFF_MAX_MS : backoff_ms;
+            state = BACKOFF;
+            timer = loop.schedule(backoff_ms, poll, this);
+        }
+};
+
+
+/**
+ * NetworkTime's multi-server rounds: wait for the link, send, collect for
+ * ROUND_COLLECT_MS, sleep out the rest of the interval.
+ */
+class TimeClient {
+    public:
+        event_timer_t timer;
+        bool stopped;
+        uint32_t rounds;
+        uint32_t rounds_while_down;
+
+        void start() {
+            timer = EVENT_TIMER_NONE;
+            stopped = false;
+            rounds = 0;
+            rounds_while_down = 0;
+            loop.when(EVENT_WIFI_JOINED, resumed, this);
+        }
+
+        void stop() {
+            stopped = true;
+            loop.cancel(&timer);
+        }
+
+        static void resumed(void *arg, bool met) {
+            start_round(arg);
+        }
+
+        static void start_round(void *arg) {
+            TimeClient *t = (TimeClient *)arg;
+
+            t->timer = EVENT_TIMER_NONE;
+            if(t->stopped) {
+                return;
+            }
+            if(!(loop.get_conditions() & EVENT_WIFI_JOINED)) {
+                loop.when(EVENT_WIFI_JOINED, resumed, t);
+                return;
+            }
+            t->rounds++;
+            if(!ap_present) {
+                t->rounds_while_down++;
+            }
+            t->timer = loop.schedule(ROUND_COLLECT_MS, finish_round, t);
+        }
+
+        static void finish_round(void *arg) {
+            TimeClient *t = (TimeClient *)arg;
+
+            t->timer = loop.schedule(ROUND_INTERVAL_MS - ROUND_COLLECT_MS, start_round, t);
+        }
+};
+
+
+static Supervisor supervisor;
+static TimeClient time_client;
+
+
+static void link_dropped(bool events) {
+    ap_present = false;
+    ap_lost_us = virtual_us;
+    if(events && supervisor.state == Supervisor::UP) {
+        supervisor.lost();
+        loop.post(Supervisor::link_event, &supervisor);
+    }
+}
+
+
+static uint64_t cyw43_ready_us;
+static uint64_t never_timed_out_us;
+
+static void cyw43_ready(void *arg) {
+    loop.set_conditions(EVENT_CYW43_READY);
+}
+
+static void saw_cyw43(void *arg, bool met) {
+    cyw43_ready_us = met ? virtual_us : 0;
+}
+
+static void saw_never(void *arg, bool met) {
+    never_timed_out_us = met ? 0 : virtual_us;
+}
+
+
+/***
+ * One run over the outage schedule, advancing the virtual clock to whichever
+ * comes first: what the loop asked to sleep for, or the next edge of an
+ * outage.
+ */
+static void run(const std::vector<outage_t>& outages, uint64_t run_us, bool events) {
+    uint64_t base_us = virtual_us;
+    uint64_t end_us = base_us + run_us;
+    event_loop_stats_t before = *loop.get_stats();
+    size_t next = 0;
+    bool in_outage = false;
+    uint64_t timed_dispatches = 0;
+    double dispatch_ns = 0;
+
+    loop.clear_conditions(~0u);
+    ap_present = true;
+    cyw43_ready_us = 0;
+    never_timed_out_us = 0;
+    loop.schedule(CYW43_INIT_MS, cyw43_ready, NULL);
+    loop.when(EVENT_CYW43_READY, saw_cyw43, NULL, 1000);
+    loop.when(NEVER_CONDITION, saw_never, NULL, 5000);
+    supervisor.start();
+    time_client.start();
+
+    while(virtual_us < end_us) {
+        auto t0 = std::chrono::steady_clock::now();
+        uint32_t wait_us = loop.dispatch();
+        dispatch_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        timed_dispatches++;
+
+        uint64_t wake_us = virtual_us + wait_us;
+        uint64_t edge_us = UINT64_MAX;
+        if(next < outages.size()) {
+            edge_us = base_us + outages[next].start_us + (in_outage ? outages[next].length_us : 0);
+        }
+
+        if(edge_us <= wake_us) {
+            virtual_us = edge_us;
+            if(in_outage) {
+                ap_present = true;
+                in_outage = false;
+                next++;
+            }
+            else {
+                link_dropped(events);
+                in_outage = true;
+            }
+        }
+        else {
+            virtual_us = wake_us;
+        }
+    }
+
+    supervisor.stop();
+    time_client.stop();
+    while(loop.dispatch() == 0) {
+    }
+
+    const event_loop_stats_t *after = loop.get_stats();
+    double hours = run_us / 3600e6;
+    uint32_t n = supervisor.outages ? supervisor.outages : 1;
+
+    printf("%-12s %3lu OUTAGES, DETECT AVG %6.1f ms MAX %6.1f ms, REJOIN AVG %6.1f ms MAX %7.1f ms\n",
+           events ? "EVENTS" : "POLL ONLY", (unsigned long)supervisor.outages,
+           supervisor.detect_total_us / 1000.0 / n, supervisor.detect_max_us / 1000.0,
+           supervisor.rejoin_total_us / 1000.0 / n, supervisor.rejoin_max_us / 1000.0);
+    printf("%-12s %5lu TIME ROUNDS, %lu SENT WITH THE LINK DOWN; %.0f WAKEUPS AND %.0f CALLBACKS PER HOUR, "
+           "%.0f ns PER DISPATCH\n", "",
+           (unsigned long)time_client.rounds, (unsigned long)time_client.rounds_while_down,
+           (after->dispatches - before.dispatches) / hours, (after->callbacks - before.callbacks) / hours,
+           dispatch_ns / timed_dispatches);
+
+    check(cyw43_ready_us == base_us + CYW43_INIT_MS * 1000, "WAITER MET WHEN ITS CONDITION WAS SET");
+    check(never_timed_out_us == base_us + 5000 * 1000, "WAITER TIMED OUT AT ITS DEADLINE");
+    if(events) {
+        check(supervisor.outages == outages.size(), "EVERY OUTAGE DETECTED");
+        check(time_client.rounds_while_down == 0, "NO TIME ROUNDS WHILE THE LINK IS DOWN");
+    }
+    else {
+        printf("%-12s %lu OUTAGES CAME AND WENT BETWEEN POLLS\n", "",
+               (unsigned long)(outages.size() - supervisor.outages));
+    }
+}
+
+
+int main() {
+    uint32_t hours = env_u32("EVENT_BENCH_HOURS", 24);
+    uint64_t run_us = (uint64_t)hours * 3600 * 1000000;
+    std::vector<outage_t> outages;
+    uint64_t t = 0;
+
+    loop.set_time_source(virtual_now);
+
+    // An outage every 10 to 30 minutes, from half a second to 20 seconds
+    for(;;) {
+        t += (uint64_t)(600 + rng() % 1200) * 1000000;
+        if(t + 60000000 >= run_us) {
+            break;
+        }
+        outages.push_back({ t, (uint64_t)(500 + rng() % 19500) * 1000 });
+    }
+
+    printf("EVENT LOOP: %lu HOURS, %lu OUTAGES, %d TIMERS, %d WAITERS, %d POSTED EVENTS\n",
+           (unsigned long)hours, (unsigned long)outages.size(), EVENT_LOOP_MAX_TIMERS, EVENT_LOOP_MAX_WAITERS,
+           EVENT_LOOP_MAX_POSTED);
+
+    run(outages, run_us, true);
+    run(outages, run_us, false);
+
+    const event_loop_stats_t *stats = loop.get_stats();
+    check(stats->late_max_us == 0, "NO TIMER RAN LATE");
+    check(stats->timer_overflows == 0 && stats->post_overflows == 0, "NO TIMER OR POST OVERFLOWS");
+
+    return failed ? 1 : 0;
+}
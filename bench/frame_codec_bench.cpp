@@ -0,0 +1,380 @@
+/*
+ * frame_codec_bench.cpp
+ *
+ * Host encoder, check and benchmark for the compressed DDP frame types. A
+ * sender would do what encode_frame() does here: split each frame into DDP
+ * packets of frame_codec streams, as a keyframe every KEYFRAME_INTERVAL
+ * frames and as deltas against the previous frame in between, leaving out
+ * ranges that didn't change. When a keyframe would be smaller than the
+ * delta, which it is when most of the frame changed, it sends that instead.
+ *
+ * For a few kinds of animation, generated the way effects engines draw
+ * them, it encodes a few seconds of frames, decodes every packet into a
+ * frame the way the receiver does, and checks the result matches the
+ * original. Then it reports:
+ *   - bytes sent per frame, DDP and UDP/IP headers included, raw against
+ *     keyframes only against keyframes and deltas, and the ratio;
+ *   - packets per frame, which matters as much as bytes for airtime;
+ *   - decode time per frame, average and worst packet.
+ * Last, it feeds the decoder random streams with guard bytes round the
+ * frame to check nothing decodes outside it, and times the most expensive
+ * packets there can be, which is the decoder's worst case.
+ *
+ *   FRAME_RECORDING_FILE      raw RGB frames to use as well, one after another
+ *   FRAME_RECORDING_PIXELS    pixels in each of those frames (300)
+ *   CODEC_BENCH_FRAMES        frames of each animation (600)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include "frame_codec.h"
+#include "strip_config.h"
+
+
+#define DDP_HEADER_LEN          10
+#define UDP_IP_HEADER_LEN       28
+#define DDP_MAX_DATA_LEN        1440
+#define KEYFRAME_INTERVAL       60
+#define BENCH_PIXELS            300
+#define GUARD                   16
+
+typedef std::vector<uint8_t> frame_t;
+
+typedef struct {
+    uint32_t offset;
+    std::vector<uint8_t> data;
+} packet_t;
+
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void hue(uint8_t *pixel, uint32_t h, uint8_t value) {
+    uint32_t sector = (h % 768) / 256, x = h % 256;
+    uint8_t c[3];
+
+    c[sector] = (uint8_t)(255 - x);
+    c[(sector + 1) % 3] = (uint8_t)x;
+    c[(sector + 2) % 3] = 0;
+    for(int k = 0; k < 3; k++) {
+        pixel[k] = (uint8_t)(c[k] * value / 255);
+    }
+}
+
+
+/***
+ * One frame of each animation. frame is the previous one on the way in,
+ * for the ones that fade.
+ */
+static void draw(int animation, frame_t &frame, uint32_t pixels, uint32_t t) {
+    switch(animation) {
+        case 0:     // one colour, slowly changing
+            for(uint32_t i = 0; i < pixels; i++) {
+                hue(&frame[i * 3], t, 200);
+            }
+            break;
+        case 1:     // a moving rainbow
+            for(uint32_t i = 0; i < pixels; i++) {
+                hue(&frame[i * 3], i * 768 / pixels + t * 4, 255);
+            }
+            break;
+        case 2:     // a comet with a fading tail, on black
+            for(uint32_t i = 0; i < pixels * 3; i++) {
+                frame[i] = (uint8_t)(frame[i] * 3 / 4);
+            }
+            hue(&frame[(t % pixels) * 3], t * 2, 255);
+            break;
+        case 3:     // twinkles fading out on black
+            for(uint32_t i = 0; i < pixels * 3; i++) {
+                frame[i] = (uint8_t)(frame[i] * 7 / 8);
+            }
+            for(uint32_t k = 0; k < pixels / 100 + 1; k++) {
+                hue(&frame[(rand() % pixels) * 3], rand(), 255);
+            }
+            break;
+        case 4:     // blocks of colour wiping across, like a chase
+            for(uint32_t i = 0; i < pixels; i++) {
+                hue(&frame[i * 3], ((i + t) / 20) * 97, 255);
+            }
+            break;
+        default:    // noise, the worst there is
+            for(uint32_t i = 0; i < pixels * 3; i++) {
+                frame[i] = (uint8_t)rand();
+            }
+            break;
+    }
+}
+
+static const char *animation_names[] = { "SOLID FADE", "RAINBOW", "COMET", "TWINKLE", "CHASE", "NOISE" };
+#define ANIMATIONS              6
+
+
+/***
+ * The host encoder: a frame as DDP packets of one stream each, against
+ * previous if it isn't NULL. Unchanged bytes at the start of a packet are
+ * skipped, not coded, so a range that didn't change costs nothing. The last
+ * packet is the one that'd carry PUSH, and is always sent, even empty.
+ */
+static void encode_frame(std::vector<packet_t> &packets, const frame_t &frame, const frame_t *previous,
+                         uint32_t len) {
+    uint32_t offset = 0;
+
+    packets.clear();
+    while(offset < len) {
+        packet_t packet;
+        uint32_t encoded, consumed;
+
+        if(previous != NULL) {
+            while(offset < len && frame[offset] == (*previous)[offset]) {
+                offset++;
+            }
+            if(offset == len) {
+                break;
+            }
+        }
+
+        packet.offset = offset;
+        packet.data.resize(DDP_MAX_DATA_LEN);
+        consumed = frame_codec_encode(packet.data.data(), DDP_MAX_DATA_LEN, &encoded, &frame[offset],
+                                      previous != NULL ? &(*previous)[offset] : NULL, len - offset);
+        packet.data.resize(encoded);
+        packets.push_back(packet);
+        offset += consumed;
+    }
+
+    if(packets.empty()) {
+        packet_t push;
+        push.offset = 0;
+        packets.push_back(push);
+    }
+}
+
+
+typedef struct {
+    uint64_t raw_bytes;
+    uint64_t key_bytes;
+    uint64_t delta_bytes;
+    uint64_t raw_packets;
+    uint64_t key_packets;
+    uint64_t delta_packets;
+    uint64_t decode_ns;
+    uint64_t worst_packet_ns;
+    uint32_t frames;
+    uint32_t failures;
+} result_t;
+
+
+static uint64_t wire_bytes(const std::vector<packet_t> &packets) {
+    uint64_t bytes = 0;
+
+    for(const packet_t &packet : packets) {
+        bytes += packet.data.size() + DDP_HEADER_LEN + UDP_IP_HEADER_LEN;
+    }
+    return bytes;
+}
+
+
+/***
+ * Encodes and decodes each frame in turn, with keyframes and deltas, and
+ * keyframes only for comparison.
+ */
+static void run(result_t *result, const std::vector<frame_t> &frames, uint32_t pixels) {
+    uint32_t len = pixels * STRIP_BYTES_PER_PIXEL;
+    frame_t reference(len, 0);
+    std::vector<packet_t> packets, delta_packets;
+
+    memset(result, 0, sizeof(result_t));
+    for(size_t f = 0; f < frames.size(); f++) {
+        bool key = f % KEYFRAME_INTERVAL == 0;
+
+        result->raw_bytes += len + ((len + DDP_MAX_DATA_LEN - 1) / DDP_MAX_DATA_LEN) * (DDP_HEADER_LEN + UDP_IP_HEADER_LEN);
+        result->raw_packets += (len + DDP_MAX_DATA_LEN - 1) / DDP_MAX_DATA_LEN;
+
+        encode_frame(packets, frames[f], NULL, len);
+        result->key_bytes += wire_bytes(packets);
+        result->key_packets += packets.size();
+
+        if(!key) {
+            encode_frame(delta_packets, frames[f], &frames[f - 1], len);
+            if(wire_bytes(delta_packets) < wire_bytes(packets)) {
+                packets.swap(delta_packets);
+            }
+            else {
+                key = true;
+            }
+        }
+        result->delta_bytes += wire_bytes(packets);
+        result->delta_packets += packets.size();
+
+        for(const packet_t &packet : packets) {
+            uint64_t start = now_ns(), ns;
+
+            if(frame_codec_decode(reference.data(), len, packet.offset, packet.data.data(),
+                                  (uint32_t)packet.data.size(), !key) < 0) {
+                result->failures++;
+            }
+            ns = now_ns() - start;
+            result->decode_ns += ns;
+            if(ns > result->worst_packet_ns) {
+                result->worst_packet_ns = ns;
+            }
+        }
+
+        if(memcmp(reference.data(), frames[f].data(), len) != 0) {
+            result->failures++;
+        }
+        result->frames++;
+    }
+}
+
+
+static void print(const char *name, uint32_t pixels, const result_t *r) {
+    printf("%-12s %5u %9.0f %9.0f %9.0f %7.2fx %7.2fx %5.1f/%3.1f/%3.1f %9.2f %9.2f%s\n", name, pixels,
+           (double)r->raw_bytes / r->frames, (double)r->key_bytes / r->frames, (double)r->delta_bytes / r->frames,
+           (double)r->raw_bytes / r->key_bytes, (double)r->raw_bytes / r->delta_bytes,
+           (double)r->raw_packets / r->frames, (double)r->key_packets / r->frames,
+           (double)r->delta_packets / r->frames, (double)r->decode_ns / r->frames / 1000.0,
+           r->worst_packet_ns / 1000.0, r->failures ? "  MISMATCH" : "");
+}
+
+
+/***
+ * Random streams, keyframe and delta, at random offsets. The decoder has to
+ * turn every one of them down or decode it inside the frame. Returns the
+ * number of times it wrote outside.
+ */
+static uint32_t fuzz(uint32_t pixels, uint32_t rounds) {
+    uint32_t len = pixels * STRIP_BYTES_PER_PIXEL;
+    std::vector<uint8_t> buffer(len + 2 * GUARD, 0xa5);
+    uint8_t stream[64];
+    uint32_t failures = 0, rejected = 0;
+
+    for(uint32_t round = 0; round < rounds; round++) {
+        uint32_t stream_len = rand() % sizeof(stream);
+        uint32_t offset = rand() % (len + 8);
+
+        for(uint32_t i = 0; i < stream_len; i++) {
+            stream[i] = (uint8_t)rand();
+        }
+        if(frame_codec_decode(&buffer[GUARD], len, offset, stream, stream_len, round & 1) < 0) {
+            rejected++;
+        }
+        for(int i = 0; i < GUARD; i++) {
+            if(buffer[i] != 0xa5 || buffer[GUARD + len + i] != 0xa5) {
+                failures++;
+                buffer[i] = buffer[GUARD + len + i] = 0xa5;
+            }
+        }
+    }
+
+    printf("FUZZED %u STREAMS (%u REJECTED), %u WROTE OUTSIDE THE FRAME\n", rounds, rejected, failures);
+    return failures;
+}
+
+
+/***
+ * The most a single packet can cost: a full packet of delta literals, which
+ * XORs every byte, and pixel runs that fill the whole frame from a few
+ * bytes.
+ */
+static void worst_case(uint32_t pixels) {
+    uint32_t len = pixels * STRIP_BYTES_PER_PIXEL;
+    frame_t frame(len, 0);
+    std::vector<uint8_t> literals, runs;
+    uint32_t iterations = 20000;
+    uint64_t start, ns[2];
+
+    for(uint32_t i = 0; literals.size() + 1 + FRAME_CODEC_LITERAL_MAX <= DDP_MAX_DATA_LEN; i++) {
+        literals.push_back(FRAME_CODEC_LITERAL | (FRAME_CODEC_LITERAL_MAX - 1));
+        for(int k = 0; k < FRAME_CODEC_LITERAL_MAX; k++) {
+            literals.push_back((uint8_t)rand());
+        }
+    }
+    runs.push_back((uint8_t)(FRAME_CODEC_PIXEL_RUN | ((pixels - 1) >> 8)));
+    runs.push_back((uint8_t)(pixels - 1));
+    runs.push_back(1);
+    runs.push_back(2);
+    runs.push_back(3);
+
+    start = now_ns();
+    for(uint32_t i = 0; i < iterations; i++) {
+        frame_codec_decode(frame.data(), len, 0, literals.data(), (uint32_t)literals.size(), true);
+    }
+    ns[0] = now_ns() - start;
+
+    start = now_ns();
+    for(uint32_t i = 0; i < iterations; i++) {
+        frame_codec_decode(frame.data(), len, 0, runs.data(), (uint32_t)runs.size(), true);
+    }
+    ns[1] = now_ns() - start;
+
+    printf("WORST CASE PACKETS, %u PIXELS: %zu BYTES OF DELTA LITERALS %.2f us, FULL-FRAME PIXEL RUN %.2f us\n",
+           pixels, literals.size(), (double)ns[0] / iterations / 1000.0, (double)ns[1] / iterations / 1000.0);
+}
+
+
+int main(int argc, char **argv) {
+    static const uint32_t lengths[] = { 300, STRIP_MAX_LENGTH };
+    const char *frames_env = getenv("CODEC_BENCH_FRAMES");
+    const char *recording = getenv("FRAME_RECORDING_FILE");
+    const char *recording_pixels_env = getenv("FRAME_RECORDING_PIXELS");
+    uint32_t frame_count = frames_env ? (uint32_t)atoi(frames_env) : 600;
+    uint32_t failures = 0;
+    result_t result;
+
+    srand(1);
+    printf("BYTES AND PACKETS PER FRAME ON THE WIRE, KEYFRAME EVERY %d FRAMES\n", KEYFRAME_INTERVAL);
+    printf("%-12s %5s %9s %9s %9s %8s %8s %13s %9s %9s\n", "ANIMATION", "PX", "RAW", "KEY ONLY", "KEY+DELTA",
+           "KEY", "DELTA", "PACKETS", "DECODE us", "WORST us");
+
+    for(uint32_t pixels : lengths) {
+        for(int animation = 0; animation < ANIMATIONS; animation++) {
+            std::vector<frame_t> frames;
+            frame_t frame(pixels * STRIP_BYTES_PER_PIXEL, 0);
+
+            for(uint32_t t = 0; t < frame_count; t++) {
+                draw(animation, frame, pixels, t);
+                frames.push_back(frame);
+            }
+            run(&result, frames, pixels);
+            print(animation_names[animation], pixels, &result);
+            failures += result.failures;
+        }
+    }
+
+    if(recording != NULL) {
+        uint32_t pixels = recording_pixels_env ? (uint32_t)atoi(recording_pixels_env) : BENCH_PIXELS;
+        FILE *file = fopen(recording, "rb");
+        std::vector<frame_t> frames;
+        frame_t frame(pixels * STRIP_BYTES_PER_PIXEL);
+
+        if(file == NULL) {
+            printf("COULDN'T OPEN %s\n", recording);
+            return 1;
+        }
+        while(fread(frame.data(), 1, frame.size(), file) == frame.size()) {
+            frames.push_back(frame);
+        }
+        fclose(file);
+        if(!frames.empty()) {
+            run(&result, frames, pixels);
+            print("RECORDING", pixels, &result);
+            failures += result.failures;
+        }
+    }
+
+    printf("\n");
+    failures += fuzz(BENCH_PIXELS, 1000000);
+    for(uint32_t pixels : lengths) {
+        worst_case(pixels);
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+/*
+ * frame_handoff_bench.cpp
+ *
+ * Host benchmark for the handoff between the network side of FrameScheduler
+ * and its release side. A producer thread stands in for the tcpip thread: it
+ * fills a buffer and submits it untimed at a steady rate. A consumer thread
+ * stands in for the scheduler task and polls for frames. Load threads spin
+ * alongside, standing in for the rest of the network stack. Everything runs
+ * twice: once with every thread on one CPU, the way a single-core build
+ * shares core 0, and once with the consumer on a CPU of its own, the way the
+ * dual-core build gives it the pixel core. For each it reports how long a
+ * frame took from submit to release, and how many were dropped because no
+ * buffer was free. The numbers come from the host's scheduler rather than
+ * FreeRTOS's, so only the difference between the two runs means anything.
+ *
+ *   HANDOFF_BENCH_FRAMES   frames per run (20000)
+ *   HANDOFF_BENCH_LOAD     load threads (2)
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include "frame_scheduler.h"
+#include "strip_config.h"
+
+
+#define FRAME_INTERVAL_US   500
+#define STRIP_LENGTH        300
+
+
+static volatile bool running;
+static volatile bool producing;
+
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void pin(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+
+typedef struct {
+    int cpu;
+    uint32_t frames;
+} thread_args_t;
+
+
+static void *producer(void *params) {
+    thread_args_t *args = (thread_args_t *)params;
+    FrameScheduler& scheduler = FrameScheduler::getInstance();
+    uint64_t next_us = now_us();
+    uint8_t *buffer;
+
+    pin(args->cpu);
+    for(uint32_t frame = 0; frame < args->frames; frame++) {
+        while(now_us() < next_us) {
+        }
+        next_us += FRAME_INTERVAL_US;
+
+        buffer = scheduler.get_fill_buffer();
+        if(buffer != NULL) {
+            memset(buffer, (uint8_t)frame, STRIP_LENGTH * STRIP_BYTES_PER_PIXEL);
+        }
+        scheduler.submit_untimed();
+    }
+    producing = false;
+    return NULL;
+}
+
+
+static void *consumer(void *params) {
+    thread_args_t *args = (thread_args_t *)params;
+    FrameScheduler& scheduler = FrameScheduler::getInstance();
+
+    pin(args->cpu);
+    while(producing || scheduler.poll() != FRAME_SCHEDULER_IDLE) {
+        scheduler.poll();
+    }
+    return NULL;
+}
+
+
+static void *load(void *params) {
+    thread_args_t *args = (thread_args_t *)params;
+    volatile uint32_t work = 0;
+
+    pin(args->cpu);
+    while(running) {
+        work++;
+    }
+    return NULL;
+}
+
+
+static void run(const char *name, int consumer_cpu, uint32_t frames, int loads) {
+    FrameScheduler& scheduler = FrameScheduler::getInstance();
+    led_strip_config_t config;
+    thread_args_t network = { 0, frames };
+    thread_args_t pixel = { consumer_cpu, frames };
+    pthread_t producer_thread, consumer_thread;
+    pthread_t load_threads[16];
+
+    memset(&config, 0, sizeof(config));
+    config.strip_length = STRIP_LENGTH;
+    scheduler.configure(&config);
+    scheduler.set_output(NULL);
+    scheduler.set_clock(NULL);
+    scheduler.set_time_source(now_us);
+    scheduler.set_playout_delay_us(0);
+    scheduler.reset_stats();
+
+    running = true;
+    producing = true;
+    for(int i = 0; i < loads; i++) {
+        pthread_create(&load_threads[i], NULL, load, &network);
+    }
+    pthread_create(&consumer_thread, NULL, consumer, &pixel);
+    pthread_create(&producer_thread, NULL, producer, &network);
+
+    pthread_join(producer_thread, NULL);
+    pthread_join(consumer_thread, NULL);
+    running = false;
+    for(int i = 0; i < loads; i++) {
+        pthread_join(load_threads[i], NULL);
+    }
+
+    const frame_scheduler_stats_t *stats = scheduler.get_stats();
+    printf("BENCH HANDOFF %-12s: %6lu SUBMITTED, %6lu PRESENTED, %5lu SUPERSEDED, %5lu OVERFLOWS, "
+           "LATENCY AVG %8.1f us MAX %8lu us\n",
+           name, (unsigned long)stats->submitted, (unsigned long)stats->presented, (unsigned long)stats->late,
+           (unsigned long)stats->overflows,
+           stats->latency_count ? (double)stats->latency_total_us / stats->latency_count : 0.0,
+           (unsigned long)stats->latency_max_us);
+}
+
+
+int main() {
+    const char *env = getenv("HANDOFF_BENCH_FRAMES");
+    uint32_t frames = env != NULL ? (uint32_t)strtoul(env, NULL, 0) : 20000;
+    int loads = (env = getenv("HANDOFF_BENCH_LOAD")) != NULL ? atoi(env) : 2;
+
+    if(loads < 0 || loads > 16) {
+        loads = 2;
+    }
+
+    run("ONE CORE", 0, frames, loads);
+    if(sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        printf("BENCH HANDOFF: ONLY ONE CPU HERE, NO TWO CORE RUN\n");
+        return 0;
+    }
+    run("TWO CORES", 1, frames, loads);
+
+    return 0;
+}
@@ -0,0 +1,291 @@
+/*
+ * frame_scheduler_bench.cpp
+ *
+ * Host benchmark for FrameScheduler. A sender puts out frames at a steady
+ * rate, each timestamped to be shown a fixed playout delay after it was sent,
+ * and two strips receive them over links with their own jitter: arrival
+ * traces are generated, or replayed from a file. Each strip is run twice on
+ * a virtual clock, once presenting every frame the moment it arrives (what
+ * happened before the scheduler) and once through the scheduler. For both,
+ * it reports how far apart the two strips started each frame they both
+ * showed, and how many frames each showed; for the scheduled runs, the
+ * scheduler's own view: late and dropped frames, buffer depth, release error
+ * and the least lead any frame arrived with.
+ *
+ *   FRAME_TRACE_FILE   one arrival delay per line, in microseconds, for frame
+ *                      N sent at N frame periods. Strip B replays the same
+ *                      trace from halfway through.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "strip_output.h"
+#include "frame_scheduler.h"
+#include "disciplined_clock.h"
+#include "mock_strip_backend.h"
+
+
+#define FRAMES_PER_RUN      3000
+#define FPS                 40
+#define STRIP_LENGTH        300
+#define PLAYOUT_DELAY_US    80000
+#define EPOCH_US            1760000000000000LL
+#define NOT_SHOWN           UINT64_MAX
+
+
+static uint32_t rng_state = 1;
+
+static uint32_t next_random() {
+    rng_state = rng_state * 1664525 + 1013904223;
+    return rng_state >> 8;
+}
+
+
+/**
+ * Remembers when each frame started shifting out, by the frame number written
+ * into its first pixels.
+ */
+class RecordingBackend : public MockStripBackend {
+    public:
+        std::vector<uint64_t> *starts;
+
+        void start(const uint8_t *pixels, size_t len, strip_done_callback_t done, void *context) override {
+            uint32_t frame;
+            memcpy(&frame, pixels, sizeof(frame));
+            if(frame < starts->size() && (*starts)[frame] == NOT_SHOWN) {
+                (*starts)[frame] = now();
+            }
+            MockStripBackend::start(pixels, len, done, context);
+        }
+};
+
+
+typedef enum {
+    TRACE_UNIFORM,
+    TRACE_STALLS,
+    TRACE_POWER_SAVE
+} trace_type_t;
+
+
+typedef struct {
+    const char *name;
+    trace_type_t type;
+    uint32_t base_us;
+    uint32_t jitter_us;
+    uint32_t extra_us;          // stall length, or the power save wake interval
+} scenario_t;
+
+
+/***
+ * Arrival time of every frame at one strip. Packets don't overtake each
+ * other, so neither do frames.
+ */
+static void make_trace(const scenario_t *s, uint32_t seed, const std::vector<uint32_t> *file,
+                       std::vector<uint64_t> *arrivals) {
+    uint64_t period_us = 1000000 / FPS;
+    uint64_t last = 0;
+    uint64_t stall_until = 0;
+
+    rng_state = seed;
+    arrivals->resize(FRAMES_PER_RUN);
+
+    for(int frame = 0; frame < FRAMES_PER_RUN; frame++) {
+        uint64_t sent = (uint64_t)frame * period_us;
+        uint64_t at;
+
+        if(file != NULL) {
+            at = sent + (*file)[(frame + (seed == 1 ? 0 : file->size() / 2)) % file->size()];
+        }
+        else {
+            at = sent + s->base_us + (s->jitter_us ? next_random() % (2 * s->jitter_us + 1) : 0);
+            if(s->type == TRACE_STALLS) {
+                // Every couple of seconds the link stops for a while, and
+                // everything queued behind it arrives at once
+                if(at >= stall_until && next_random() % (2 * FPS) == 0) {
+                    stall_until = at + s->extra_us;
+                }
+                if(at < stall_until) {
+                    at = stall_until;
+                }
+            }
+            else if(s->type == TRACE_POWER_SAVE) {
+                // Frames wait at the access point for the strip to wake up
+                uint64_t phase = seed * 7919 % s->extra_us;
+                at = (at + s->extra_us - phase - 1) / s->extra_us * s->extra_us + phase;
+            }
+        }
+
+        last = at > last ? at : last;
+        (*arrivals)[frame] = last;
+    }
+}
+
+
+static void write_frame(uint8_t *buffer, uint32_t frame) {
+    if(buffer != NULL) {
+        memset(buffer, 0, STRIP_LENGTH * STRIP_BYTES_PER_PIXEL);
+        memcpy(buffer, &frame, sizeof(frame));
+    }
+}
+
+
+/***
+ * One strip, one trace. Returns the scheduler's stats for the scheduled run.
+ */
+static frame_scheduler_stats_t run_strip(const std::vector<uint64_t> *arrivals, bool scheduled,
+                                         std::vector<uint64_t> *starts) {
+    StripOutput& output = StripOutput::getInstance();
+    FrameScheduler& scheduler = FrameScheduler::getInstance();
+    RecordingBackend backend;
+    DisciplinedClock clock;
+    led_strip_config_t config;
+    uint64_t period_us = 1000000 / FPS;
+    uint8_t *buffer;
+    uint32_t wait_us;
+
+    starts->assign(FRAMES_PER_RUN, NOT_SHOWN);
+    backend.starts = starts;
+
+    memset(&config, 0, sizeof(config));
+    config.strip_length = STRIP_LENGTH;
+    MockStripBackend::reset_clock();
+    output.configure(&config);
+    output.set_buffer_count(3);
+    output.set_backend(&backend);
+    output.set_time_source(MockStripBackend::now);
+    output.reset_stats();
+
+    clock.step(0, EPOCH_US);
+    scheduler.configure(&config);
+    scheduler.set_output(&output);
+    scheduler.set_clock(&clock);
+    scheduler.set_time_source(MockStripBackend::now);
+    scheduler.reset_stats();
+
+    buffer = scheduled ? scheduler.get_fill_buffer() : output.get_back_buffer();
+
+    for(int frame = 0; frame <= FRAMES_PER_RUN; frame++) {
+        uint64_t at = frame < FRAMES_PER_RUN ? (*arrivals)[frame] : UINT64_MAX;
+
+        // Release everything that falls due before the frame arrives
+        while(scheduled && (wait_us = scheduler.poll()) != FRAME_SCHEDULER_IDLE &&
+              MockStripBackend::now() + wait_us <= at) {
+            backend.advance_to(MockStripBackend::now() + wait_us);
+        }
+        backend.advance_to(at);
+
+        if(frame == FRAMES_PER_RUN) {
+            break;
+        }
+
+        write_frame(buffer, (uint32_t)frame);
+        if(scheduled) {
+            scheduler.submit(EPOCH_US + (int64_t)(frame * period_us) + PLAYOUT_DELAY_US);
+            buffer = scheduler.get_fill_buffer();
+        }
+        else {
+            output.present();
+            buffer = output.get_back_buffer();
+        }
+    }
+
+    return *scheduler.get_stats();
+}
+
+
+static void compare(const char *name, const char *mode, const std::vector<uint64_t> *a,
+                    const std::vector<uint64_t> *b) {
+    double squares = 0.0;
+    uint64_t worst = 0;
+    uint32_t both = 0, shown_a = 0, shown_b = 0;
+
+    for(int frame = 0; frame < FRAMES_PER_RUN; frame++) {
+        shown_a += (*a)[frame] != NOT_SHOWN;
+        shown_b += (*b)[frame] != NOT_SHOWN;
+        if((*a)[frame] == NOT_SHOWN || (*b)[frame] == NOT_SHOWN) {
+            continue;
+        }
+        uint64_t d = (*a)[frame] > (*b)[frame] ? (*a)[frame] - (*b)[frame] : (*b)[frame] - (*a)[frame];
+        squares += (double)d * d;
+        worst = d > worst ? d : worst;
+        both++;
+    }
+
+    printf("BENCH SCHEDULER %-22s %-9s: A TO B RMS %7.0f us MAX %7llu us; SHOWN %4lu/%4lu, %4lu BY BOTH\n",
+           name, mode, both ? std::sqrt(squares / both) : 0.0, (unsigned long long)worst,
+           (unsigned long)shown_a, (unsigned long)shown_b, (unsigned long)both);
+}
+
+
+static void print_stats(const char *strip, const frame_scheduler_stats_t *s) {
+    printf("    STRIP %s: %4lu PRESENTED, %4lu LATE, %lu TOO EARLY, %lu OVERFLOWS, DEPTH MAX %lu, "
+           "ERROR %ld..%ld us AVG %.1f us, LEAD MIN %ld us\n",
+           strip, (unsigned long)s->presented, (unsigned long)s->late, (unsigned long)s->too_early,
+           (unsigned long)s->overflows, (unsigned long)s->depth_max,
+           (long)s->error_min_us, (long)s->error_max_us,
+           s->presented ? (double)s->error_total_us / s->presented : 0.0, (long)s->lead_min_us);
+}
+
+
+static void run(const scenario_t *s, const std::vector<uint32_t> *file) {
+    std::vector<uint64_t> arrivals_a, arrivals_b;
+    std::vector<uint64_t> direct_a, direct_b, scheduled_a, scheduled_b;
+    frame_scheduler_stats_t stats_a, stats_b;
+
+    make_trace(s, 1, file, &arrivals_a);
+    make_trace(s, 2, file, &arrivals_b);
+
+    run_strip(&arrivals_a, false, &direct_a);
+    run_strip(&arrivals_b, false, &direct_b);
+    stats_a = run_strip(&arrivals_a, true, &scheduled_a);
+    stats_b = run_strip(&arrivals_b, true, &scheduled_b);
+
+    compare(s->name, "DIRECT", &direct_a, &direct_b);
+    compare(s->name, "SCHEDULED", &scheduled_a, &scheduled_b);
+    print_stats("A", &stats_a);
+    print_stats("B", &stats_b);
+}
+
+
+int main() {
+    static const scenario_t scenarios[] = {
+        { "WIFI 4+/-3 ms",         TRACE_UNIFORM,     1000,  3000,      0 },
+        { "WIFI 10+/-8 ms",        TRACE_UNIFORM,     2000,  8000,      0 },
+        { "60 ms STALLS",          TRACE_STALLS,      1000,  3000,  60000 },
+        { "150 ms STALLS",         TRACE_STALLS,      1000,  3000, 150000 },
+        { "POWER SAVE 30 ms WAKE", TRACE_POWER_SAVE,  1000,  1000,  30000 },
+    };
+    const char *trace_file = getenv("FRAME_TRACE_FILE");
+
+    if(trace_file != NULL) {
+        std::vector<uint32_t> delays;
+        FILE *f = fopen(trace_file, "r");
+        unsigned long delay;
+
+        if(f == NULL) {
+            perror("FRAME_TRACE_FILE");
+            return 1;
+        }
+        while(fscanf(f, "%lu", &delay) == 1) {
+            delays.push_back((uint32_t)delay);
+        }
+        fclose(f);
+
+        if(delays.empty()) {
+            printf("NO DELAYS IN %s\n", trace_file);
+            return 1;
+        }
+        scenario_t replay = { trace_file, TRACE_UNIFORM, 0, 0, 0 };
+        run(&replay, &delays);
+        return 0;
+    }
+
+    for(size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        run(&scenarios[i], NULL);
+    }
+
+    return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * lan_time_bench.cpp
+ *
+ * Host benchmark for the LAN time protocol. One master and a handful of
+ * followers run in this process, each with its own UDP socket on loopback and
+ * its own local timer: the host's monotonic clock, off by a few tens of ppm
+ * and a random amount of time, as if every node had its own crystal and had
+ * booted at a different moment. Packets really go through the kernel, and
+ * every "broadcast" is sent to each of the other nodes in turn, which is what
+ * a busy access point does to it anyway.
+ *
+ * Things run ten times faster than on the strips (a sync every 100ms), so a
+ * minute here is ten there. Every 10ms each follower's clock is compared with
+ * the master's at the same instant, and over the second half of the run it
+ * reports the RMS and worst error of each, and what each measured about
+ * itself: offset, round trip and jitter.
+ *
+ *   LAN_BENCH_NODES         nodes including the master (8)
+ *   LAN_BENCH_SECONDS       how long to run (60)
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "disciplined_clock.h"
+#include "lan_time.h"
+
+
+#define SYNC_INTERVAL_MS    100
+#define MEASURE_US          10000
+
+
+static uint32_t env_u32(const char *name, uint32_t fallback) {
+    const char *value = getenv(name);
+    return value ? (uint32_t)strtoul(value, NULL, 0) : fallback;
+}
+
+
+static uint64_t host_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+class LoopbackNode : public LanTimeTransport {
+    public:
+        double drift_ppm;
+        uint64_t boot_us;
+        int fd;
+        uint16_t port;
+        std::vector<uint16_t> *ports;
+        DisciplinedClock clock;
+        LanTimeNode node;
+        double error_sum;
+        int64_t error_max;
+        uint32_t error_count;
+
+        uint64_t local_us(uint64_t host) {
+            return (uint64_t)((double)(host - boot_us) * (1.0 + drift_ppm / 1e6));
+        }
+
+        uint64_t send(const uint8_t *msg, size_t len) {
+            struct sockaddr_in to;
+
+            memset(&to, 0, sizeof(to));
+            to.sin_family = AF_INET;
+            to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            for(size_t i = 0; i < ports->size(); i++) {
+                if((*ports)[i] != port) {
+                    to.sin_port = htons((*ports)[i]);
+                    sendto(fd, msg, len, 0, (struct sockaddr *)&to, sizeof(to));
+                }
+            }
+            return local_us(host_us());
+        }
+};
+
+
+int main() {
+    uint32_t count = env_u32("LAN_BENCH_NODES", 8);
+    uint32_t seconds = env_u32("LAN_BENCH_SECONDS", 60);
+    std::vector<LoopbackNode> nodes(count < 2 ? 2 : count);
+    std::vector<uint16_t> ports;
+    std::vector<struct pollfd> fds;
+    uint64_t start_us = host_us();
+    uint64_t end_us = start_us + (uint64_t)seconds * 1000000;
+    uint64_t next_measure_us = start_us;
+
+    srand(1);
+
+    for(size_t i = 0; i < nodes.size(); i++) {
+        LoopbackNode *n = &nodes[i];
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+
+        n->drift_ppm = i == 0 ? 0.0 : (double)(rand() % 61) - 30.0;
+        n->boot_us = start_us - (uint64_t)(rand() % 5000000);
+        n->fd = socket(AF_INET, SOCK_DGRAM, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(n->fd < 0 || bind(n->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+           getsockname(n->fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+            perror("BENCH LAN SOCKET");
+            return 1;
+        }
+        n->port = ntohs(addr.sin_port);
+        n->ports = &ports;
+        ports.push_back(n->port);
+        fds.push_back({ n->fd, POLLIN, 0 });
+
+        // Ten times the sync rate needs a tenth of the span before the
+        // frequency fit is trusted
+        n->clock.set_min_fit_span_us(CLOCK_MIN_FIT_SPAN_US / 10);
+        n->node.reset(i == 0 ? LAN_TIME_MASTER : LAN_TIME_FOLLOWER, 0x1000 + (uint32_t)i);
+        n->node.set_clock(&n->clock);
+        n->node.set_transport(n);
+        n->node.set_sync_interval_ms(SYNC_INTERVAL_MS);
+        n->error_sum = 0.0;
+        n->error_max = 0;
+        n->error_count = 0;
+    }
+
+    // The master's clock is its own timer, as if it had never heard of NTP
+    nodes[0].clock.step(0, 0);
+
+    while(host_us() < end_us) {
+        uint32_t wait_ms = SYNC_INTERVAL_MS;
+
+        for(size_t i = 0; i < nodes.size(); i++) {
+            uint32_t ms = nodes[i].node.poll(nodes[i].local_us(host_us()));
+            wait_ms = ms < wait_ms ? ms : wait_ms;
+        }
+        wait_ms = wait_ms > MEASURE_US / 1000 ? MEASURE_US / 1000 : wait_ms;
+
+        if(poll(fds.data(), fds.size(), (int)wait_ms) > 0) {
+            for(size_t i = 0; i < nodes.size(); i++) {
+                uint8_t msg[64];
+                ssize_t len;
+
+                if(!(fds[i].revents & POLLIN)) {
+                    continue;
+                }
+                while((len = recv(nodes[i].fd, msg, sizeof(msg), MSG_DONTWAIT)) > 0) {
+                    nodes[i].node.handle(msg, (size_t)len, nodes[i].local_us(host_us()));
+                }
+            }
+        }
+
+        uint64_t now = host_us();
+        if(now >= next_measure_us) {
+            next_measure_us += MEASURE_US;
+            if(now - start_us >= (end_us - start_us) / 2) {
+                int64_t master_us = nodes[0].clock.to_utc_us(nodes[0].local_us(now));
+                for(size_t i = 1; i < nodes.size(); i++) {
+                    int64_t error = nodes[i].clock.to_utc_us(nodes[i].local_us(now)) - master_us;
+                    nodes[i].error_sum += (double)error * error;
+                    nodes[i].error_max = std::llabs(error) > nodes[i].error_max ? std::llabs(error) : nodes[i].error_max;
+                    nodes[i].error_count++;
+                }
+            }
+        }
+    }
+
+    double total_sum = 0.0;
+    uint32_t total_count = 0;
+    int64_t total_max = 0;
+
+    for(size_t i = 1; i < nodes.size(); i++) {
+        LoopbackNode *n = &nodes[i];
+        const lan_time_stats_t *stats = n->node.get_stats();
+        const clock_stats_t *clock = n->clock.get_stats();
+
+        printf("    FOLLOWER %2u (%+3.0f ppm): RMS %5.1f us MAX %4lld us; %4lu EXCHANGES, %lu LOST, %3lu UPDATES, "
+               "OFFSET %+5ld us, DELAY %4lu us, JITTER %3lu us, FREQ %+8.3f ppm, %lu STEPS\n",
+               (unsigned)i, n->drift_ppm, n->error_count ? std::sqrt(n->error_sum / n->error_count) : 0.0,
+               (long long)n->error_max, (unsigned long)stats->exchanges, (unsigned long)stats->lost,
+               (unsigned long)stats->updates, (long)stats->offset_us, (unsigned long)stats->delay_us,
+               (unsigned long)stats->jitter_us, -clock->freq_ppb / 1000.0, (unsigned long)clock->steps);
+
+        total_sum += n->error_sum;
+        total_count += n->error_count;
+        total_max = n->error_max > total_max ? n->error_max : total_max;
+        close(n->fd);
+    }
+    close(nodes[0].fd);
+
+    printf("BENCH LAN TIME: %u NODES, %u s, SYNC EVERY %u ms: FOLLOWERS WITHIN RMS %.1f us, MAX %lld us OF THE MASTER; "
+           "MASTER SENT %lu SYNCS, ANSWERED %lu DELAY REQUESTS\n",
+           (unsigned)nodes.size(), (unsigned)seconds, SYNC_INTERVAL_MS,
+           total_count ? std::sqrt(total_sum / total_count) : 0.0, (long long)total_max,
+           (unsigned long)nodes[0].node.get_stats()->syncs, (unsigned long)nodes[0].node.get_stats()->delay_requests);
+
+    return 0;
+}
@@ -0,0 +1,342 @@
+/*
+ * latency_probe.cpp
+ *
+ * The host end of a round-trip latency measurement against LatencyResponder:
+ * a board running the latency_responder firmware, or latency_responder_host
+ * on this machine (whose ports are bridged to 127.0.0.1). It sends a paced
+ * stream of probes, and optionally a stream of background load to the
+ * responder's sink port alongside, and reports the round trip, the time the
+ * probe spent inside the device and the rest (the network, both ways)
+ * as p50/p90/p99/p99.9 and a log2 histogram.
+ *
+ * Every probe carries its sequence number and send time, and the responder
+ * echoes both, so replies that come back late, twice, or not at all are
+ * counted rather than mistaken for each other. Probes go out on an absolute
+ * schedule, so a slow reply doesn't delay the next probe and hide itself
+ * (coordinated omission). With LATENCY_POISSON the gaps between probes are
+ * random, at the same mean rate, so the probes can't fall into step with
+ * something periodic on the device and always miss it or always hit it.
+ *
+ *   LATENCY_TARGET        address of the responder (127.0.0.1)
+ *   LATENCY_RATE          probes per second (100)
+ *   LATENCY_COUNT         probes to send (6000)
+ *   LATENCY_SIZE          bytes in each probe datagram (64)
+ *   LATENCY_POISSON       1 for random gaps between probes (0)
+ *   LATENCY_WARMUP        probes left out at the start, while ARP and the
+ *                         radio's power save settle (50)
+ *   LATENCY_TIMEOUT_MS    how long to wait for stragglers at the end (1000)
+ *   LATENCY_LOAD_RATE     background datagrams per second (0)
+ *   LATENCY_LOAD_SIZE     bytes in each of them (1024)
+ *   LATENCY_LOAD_PORT     where they go (LATENCY_SINK_PORT)
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "latency_protocol.h"
+
+
+#define MAX_DATAGRAM        1472
+#define HISTOGRAM_BUCKETS   20      // 2^4 us to 2^23 us and over
+#define HISTOGRAM_FIRST     4
+#define HISTOGRAM_BAR       50
+
+
+typedef struct {
+    uint64_t rtt_ns;
+    uint64_t residence_ns;
+    bool replied;
+} probe_result_t;
+
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void sleep_until_ns(uint64_t t) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(t / 1000000000ULL);
+    ts.tv_nsec = (long)(t % 1000000000ULL);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+
+static uint32_t env_u32(const char *name, uint32_t default_value) {
+    const char *value = getenv(name);
+    return value != NULL && *value != '\0' ? (uint32_t)strtoul(value, NULL, 0) : default_value;
+}
+
+
+static uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+static uint64_t get_be64(const uint8_t *p) {
+    return ((uint64_t)get_be32(p) << 32) | get_be32(&p[4]);
+}
+
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+
+static void put_be64(uint8_t *p, uint64_t v) {
+    put_be32(p, (uint32_t)(v >> 32));
+    put_be32(&p[4], (uint32_t)v);
+}
+
+
+static int open_socket(const char *target, uint16_t port) {
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(fd < 0 || inet_pton(AF_INET, target, &addr.sin_addr) != 1 ||
+       connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "CAN'T REACH %s:%u\n", target, port);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+
+/***
+ * Nearest rank: the smallest sample that at least p percent of the samples
+ * are no bigger than.
+ */
+static double percentile_us(const std::vector<uint64_t>& sorted, double p) {
+    size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+    return (double)sorted[rank > 0 ? rank - 1 : 0] / 1000.0;
+}
+
+
+static void print_percentiles(const char *name, std::vector<uint64_t>& samples) {
+    double sum = 0;
+
+    if(samples.empty()) {
+        printf("%-12s %s\n", name, "NO SAMPLES");
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    for(uint64_t sample : samples) {
+        sum += (double)sample;
+    }
+    printf("%-12s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+           (double)samples.front() / 1000.0, percentile_us(samples, 50), percentile_us(samples, 90),
+           percentile_us(samples, 99), percentile_us(samples, 99.9), (double)samples.back() / 1000.0,
+           sum / samples.size() / 1000.0);
+}
+
+
+static void print_histogram(const std::vector<uint64_t>& samples) {
+    uint32_t buckets[HISTOGRAM_BUCKETS] = { 0 };
+    uint32_t most = 0;
+    uint32_t cumulative = 0;
+
+    for(uint64_t sample : samples) {
+        uint64_t us = sample / 1000;
+        int bucket = 0;
+        while(bucket < HISTOGRAM_BUCKETS - 1 && us >= (1ULL << (HISTOGRAM_FIRST + bucket))) {
+            bucket++;
+        }
+        buckets[bucket]++;
+    }
+    for(uint32_t count : buckets) {
+        most = std::max(most, count);
+    }
+
+    printf("\nROUND TRIP HISTOGRAM\n");
+    printf("%-20s %8s %8s %8s\n", "us", "COUNT", "%", "CUM %");
+    for(int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        char range[32];
+        int bar = most ? (int)((uint64_t)buckets[i] * HISTOGRAM_BAR / most) : 0;
+
+        if(buckets[i] == 0 && cumulative == 0) {
+            continue;
+        }
+        cumulative += buckets[i];
+        if(i == 0) {
+            snprintf(range, sizeof(range), "< %llu", 1ULL << HISTOGRAM_FIRST);
+        }
+        else if(i == HISTOGRAM_BUCKETS - 1) {
+            snprintf(range, sizeof(range), ">= %llu", 1ULL << (HISTOGRAM_FIRST + i - 1));
+        }
+        else {
+            snprintf(range, sizeof(range), "%llu - %llu", 1ULL << (HISTOGRAM_FIRST + i - 1),
+                     (1ULL << (HISTOGRAM_FIRST + i)) - 1);
+        }
+        printf("%-20s %8u %8.3f %8.3f %.*s\n", range, buckets[i], 100.0 * buckets[i] / samples.size(),
+               100.0 * cumulative / samples.size(), bar,
+               "##################################################");
+        if(cumulative == samples.size()) {
+            break;
+        }
+    }
+}
+
+
+int main(int argc, char **argv) {
+    const char *target = getenv("LATENCY_TARGET") ? getenv("LATENCY_TARGET") : "127.0.0.1";
+    uint32_t rate = std::max(env_u32("LATENCY_RATE", 100), 1u);
+    uint32_t count = std::max(env_u32("LATENCY_COUNT", 6000), 1u);
+    uint32_t size = std::min(std::max(env_u32("LATENCY_SIZE", 64), (uint32_t)LATENCY_PROBE_MIN_LEN),
+                             (uint32_t)MAX_DATAGRAM);
+    bool poisson = env_u32("LATENCY_POISSON", 0) != 0;
+    uint32_t warmup = std::min(env_u32("LATENCY_WARMUP", 50), count - 1);
+    uint32_t timeout_ms = env_u32("LATENCY_TIMEOUT_MS", 1000);
+    uint32_t load_rate = env_u32("LATENCY_LOAD_RATE", 0);
+    uint32_t load_size = std::min(std::max(env_u32("LATENCY_LOAD_SIZE", 1024), 1u), (uint32_t)MAX_DATAGRAM);
+    uint16_t load_port = (uint16_t)env_u32("LATENCY_LOAD_PORT", LATENCY_SINK_PORT);
+
+    std::vector<std::atomic<uint64_t>> sent_ns(count);
+    std::vector<probe_result_t> results(count);
+    std::atomic<bool> sending(true), receiving(true);
+    std::atomic<uint32_t> load_sent(0);
+    uint32_t duplicates = 0, corrupt = 0, strays = 0;
+    uint32_t device_sink_packets = 0, device_send_errors = 0;
+    int fd = open_socket(target, LATENCY_PORT);
+    struct timeval tv = { 0, 100000 };
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    printf("PROBING %s:%u, %u PROBES OF %u BYTES AT %u/s (%s), LOAD %u/s OF %u BYTES TO PORT %u\n",
+           target, LATENCY_PORT, count, size, rate, poisson ? "POISSON" : "EVEN", load_rate, load_size,
+           load_port);
+
+    std::thread receiver([&]() {
+        uint8_t reply[MAX_DATAGRAM];
+
+        while(receiving) {
+            ssize_t len = recv(fd, reply, sizeof(reply), 0);
+            uint64_t rx = now_ns();
+            uint32_t sequence;
+
+            if(len < 0) {
+                continue;
+            }
+            if(len < LATENCY_PROBE_MIN_LEN || get_be32(&reply[LATENCY_OFFSET_MAGIC]) != LATENCY_REPLY_MAGIC ||
+               (sequence = get_be32(&reply[LATENCY_OFFSET_SEQUENCE])) >= count) {
+                strays++;
+                continue;
+            }
+            if(get_be64(&reply[LATENCY_OFFSET_HOST_TX]) != sent_ns[sequence].load() || (uint32_t)len != size) {
+                corrupt++;
+                continue;
+            }
+            if(results[sequence].replied) {
+                duplicates++;
+                continue;
+            }
+            results[sequence].replied = true;
+            results[sequence].rtt_ns = rx - sent_ns[sequence].load();
+            results[sequence].residence_ns = (get_be64(&reply[LATENCY_OFFSET_DEVICE_TX]) -
+                                              get_be64(&reply[LATENCY_OFFSET_DEVICE_RX])) * 1000;
+            device_sink_packets = get_be32(&reply[LATENCY_OFFSET_SINK_PACKETS]);
+            device_send_errors = get_be32(&reply[LATENCY_OFFSET_SEND_ERRORS]);
+        }
+    });
+
+    std::thread load;
+    if(load_rate > 0) {
+        load = std::thread([&]() {
+            int load_fd = open_socket(target, load_port);
+            std::vector<uint8_t> datagram(load_size, 0x55);
+            uint64_t start = now_ns();
+
+            for(uint64_t i = 0; sending; i++) {
+                uint64_t due = start + i * 1000000000ULL / load_rate;
+                if(now_ns() < due) {
+                    sleep_until_ns(due);
+                }
+                if(send(load_fd, datagram.data(), datagram.size(), 0) >= 0) {
+                    load_sent++;
+                }
+            }
+            close(load_fd);
+        });
+    }
+
+    std::mt19937_64 random(1);
+    std::exponential_distribution<double> gaps((double)rate);
+    uint8_t probe[MAX_DATAGRAM];
+    uint64_t due = now_ns();
+    uint32_t send_errors = 0;
+
+    memset(probe, 0, sizeof(probe));
+    put_be32(&probe[LATENCY_OFFSET_MAGIC], LATENCY_PROBE_MAGIC);
+    for(uint32_t sequence = 0; sequence < count; sequence++) {
+        uint64_t tx;
+
+        sleep_until_ns(due);
+        due += poisson ? (uint64_t)(gaps(random) * 1e9) : 1000000000ULL / rate;
+
+        tx = now_ns();
+        sent_ns[sequence] = tx;
+        put_be32(&probe[LATENCY_OFFSET_SEQUENCE], sequence);
+        put_be64(&probe[LATENCY_OFFSET_HOST_TX], tx);
+        if(send(fd, probe, size, 0) < 0) {
+            send_errors++;
+        }
+    }
+
+    sending = false;
+    if(load.joinable()) {
+        load.join();
+    }
+    usleep(timeout_ms * 1000);
+    receiving = false;
+    receiver.join();
+    close(fd);
+
+    std::vector<uint64_t> rtt, residence, network;
+    uint32_t received = 0;
+    for(uint32_t i = warmup; i < count; i++) {
+        if(results[i].replied) {
+            received++;
+            rtt.push_back(results[i].rtt_ns);
+            residence.push_back(results[i].residence_ns);
+            network.push_back(results[i].rtt_ns > results[i].residence_ns ?
+                              results[i].rtt_ns - results[i].residence_ns : 0);
+        }
+    }
+
+    printf("SENT %u (%u SEND ERRORS), COUNTED %u AFTER %u WARMUP, RECEIVED %u, LOST %u (%.3f%%)\n",
+           count, send_errors, count - warmup, warmup, received, count - warmup - received,
+           100.0 * (count - warmup - received) / (count - warmup));
+    printf("DUPLICATES %u, CORRUPT %u, STRAYS %u, DEVICE SEND ERRORS %u\n", duplicates, corrupt, strays,
+           device_send_errors);
+    if(load_rate > 0) {
+        printf("LOAD: SENT %u, DEVICE TOOK IN %u\n", load_sent.load(), device_sink_packets);
+    }
+
+    printf("\n%-12s %9s %9s %9s %9s %9s %9s %9s  (us)\n", "", "MIN", "P50", "P90", "P99", "P99.9", "MAX", "MEAN");
+    print_percentiles("ROUND TRIP", rtt);
+    print_percentiles("DEVICE", residence);
+    print_percentiles("NETWORK", network);
+    if(!rtt.empty()) {
+        print_histogram(rtt);
+    }
+
+    return received > 0 && corrupt == 0 ? 0 : 1;
+}
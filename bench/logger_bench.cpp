@@ -0,0 +1,139 @@
+/*
+ * logger_bench.cpp
+ *
+ * Host benchmark for Logger. Times a log call against printf for the same
+ * format and arguments, with printf writing to /dev/null (a stand-in for USB
+ * stdio that never makes it wait, so the comparison flatters printf), and
+ * against snprintf into a buffer, which is the formatting alone. Then times
+ * the drain, which is where the formatting went, and checks that every line
+ * it produced matches what snprintf makes of the same call. Reading the timer
+ * is a register load on the Pico but a system call here, so its cost is shown
+ * on its own.
+ *
+ *   LOG_BENCH_CALLS   log calls per case (1000000)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include "logger.h"
+
+
+#define BATCH               64
+
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+// Collects drained lines for checking, minus the time and level prefix
+typedef struct {
+    char lines[BATCH][LOG_MAX_LINE_LEN];
+    uint32_t count;
+} capture_t;
+
+static void capture_sink(const char *line, size_t len, void *context) {
+    capture_t *capture = (capture_t *)context;
+    const char *message = strchr(strchr(line, ' ') + 1, ' ') + 1;
+
+    if(capture->count < BATCH) {
+        snprintf(capture->lines[capture->count], LOG_MAX_LINE_LEN, "%.*s",
+                 (int)(len - (message - line) - 1), message);
+    }
+    capture->count++;
+}
+
+
+static void discard_sink(const char *line, size_t len, void *context) {
+}
+
+
+/***
+ * Runs one case: the same call through the logger, printf and snprintf.
+ * Logging goes in batches small enough for the ring, which is drained
+ * between them, off the clock; the drain is timed separately.
+ */
+#define RUN_CASE(name, ...) do { \
+    uint64_t log_ns = 0, drain_ns = 0, printf_ns, snprintf_ns, start; \
+    uint32_t mismatches = 0; \
+    char expected[LOG_MAX_LINE_LEN]; \
+    logger.set_sink(discard_sink, NULL); \
+    for(uint32_t done = 0; done < calls; done += BATCH) { \
+        start = now_ns(); \
+        for(int i = 0; i < BATCH; i++) { \
+            LOG_INFO(__VA_ARGS__); \
+        } \
+        log_ns += now_ns() - start; \
+        start = now_ns(); \
+        logger.drain(); \
+        drain_ns += now_ns() - start; \
+    } \
+    start = now_ns(); \
+    for(uint32_t i = 0; i < calls; i++) { \
+        fprintf(devnull, __VA_ARGS__); \
+    } \
+    printf_ns = now_ns() - start; \
+    start = now_ns(); \
+    for(uint32_t i = 0; i < calls; i++) { \
+        snprintf(expected, sizeof(expected), __VA_ARGS__); \
+        sink_value += expected[0]; \
+    } \
+    snprintf_ns = now_ns() - start; \
+    capture.count = 0; \
+    logger.set_sink(capture_sink, &capture); \
+    LOG_INFO(__VA_ARGS__); \
+    logger.drain(); \
+    snprintf(expected, sizeof(expected), __VA_ARGS__); \
+    if(capture.count != 1 || strcmp(capture.lines[0], expected) != 0) { \
+        mismatches++; \
+        printf("    MISMATCH: '%s' != '%s'\n", capture.lines[0], expected); \
+    } \
+    printf("BENCH LOG %-12s: LOG %6.1f ns, PRINTF %6.1f ns, SNPRINTF %6.1f ns, DRAIN %6.1f ns PER CALL%s\n", \
+           name, (double)log_ns / calls, (double)printf_ns / calls, (double)snprintf_ns / calls, \
+           (double)drain_ns / calls, mismatches ? ", OUTPUT WRONG" : ""); \
+} while(0)
+
+
+int main() {
+    Logger& logger = Logger::getInstance();
+    const char *env = getenv("LOG_BENCH_CALLS");
+    uint32_t calls = env != NULL ? (uint32_t)strtoul(env, NULL, 0) : 1000000;
+    FILE *devnull = fopen("/dev/null", "w");
+    static capture_t capture;
+    volatile uint32_t sink_value = 0;
+    const char *ssid = "promisedlan";
+    int64_t offset_us = -1234;
+    uint32_t delay_us = 5678;
+    double ratio = 0.125;
+
+    if(devnull == NULL) {
+        perror("/dev/null");
+        return 1;
+    }
+    calls = (calls + BATCH - 1) / BATCH * BATCH;
+
+    uint64_t start = now_ns();
+    for(uint32_t i = 0; i < calls; i++) {
+        sink_value += time_us_32();
+    }
+    printf("BENCH LOG TIMER READ : %6.1f ns PER CALL\n", (double)(now_ns() - start) / calls);
+
+    RUN_CASE("NO ARGS", "NTP TASK WAITING FOR WIFI INIT");
+    RUN_CASE("3 INTEGERS", "NTP OFFSET %ld us, DELAY %lu us, FREQ %ld ppb",
+             (long)offset_us, (unsigned long)delay_us, (long)-42);
+    RUN_CASE("64 BITS", "SETTING TIME TO %llu us", (unsigned long long)1760000000123456ULL);
+    RUN_CASE("STRING", "JOINING '%s' ON CHANNEL %u", ssid, 6u);
+    RUN_CASE("HEX, DOUBLE", "MASTER %08lx, RATIO %.3f, %c%%", (unsigned long)0xdeadbeef, ratio, 'x');
+
+    const log_stats_t *stats = logger.get_stats();
+    printf("BENCH LOG STATS: %lu RECORDS, %lu DROPPED, %lu LINES, RING PEAK %lu OF %d WORDS\n",
+           (unsigned long)stats->records, (unsigned long)stats->dropped, (unsigned long)stats->lines,
+           (unsigned long)stats->ring_max_words, LOG_RING_WORDS);
+
+    fclose(devnull);
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * ntp_selection_bench.cpp
+ *
+ * Host benchmark for NtpSelector. Four virtual NTP servers answer every poll
+ * over links with their own delay and jitter, and some of them lie: their
+ * clock is off, or the route to them is slower one way than the other. The
+ * same exchanges drive two DisciplinedClocks, one fed only by the first
+ * server (what lwIP's SNTP client in poll mode does) and one fed through the
+ * selector, and every virtual second both are compared with true time.
+ *
+ * For each scenario it reports the RMS and worst error of each clock over the
+ * second half of the run, and what the selector made of each server.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "disciplined_clock.h"
+#include "ntp_selector.h"
+
+
+#define RUN_SECONDS         (6 * 3600)
+#define DRIFT_PPM           20.0
+
+
+static uint32_t rng_state = 1;
+
+static uint32_t next_random() {
+    rng_state = rng_state * 1664525 + 1013904223;
+    return rng_state >> 8;
+}
+
+
+typedef struct {
+    uint32_t delay_us;          // one-way
+    uint32_t jitter_us;         // +/- on each leg
+    int64_t clock_error_us;     // how far its clock is from true time
+    uint32_t extra_up_us;       // route asymmetry: extra time on the way there
+} sim_server_t;
+
+
+typedef struct {
+    const char *name;
+    sim_server_t servers[NTP_MAX_SERVERS];
+} scenario_t;
+
+
+static uint64_t local_at(int64_t true_us) {
+    return (uint64_t)((double)true_us / (1.0 + DRIFT_PPM / 1e6));
+}
+
+
+static uint32_t leg(const sim_server_t *s) {
+    int64_t d = (int64_t)s->delay_us;
+    if(s->jitter_us) {
+        d += (int64_t)(next_random() % (2 * s->jitter_us + 1)) - (int64_t)s->jitter_us;
+    }
+    return d < 0 ? 0 : (uint32_t)d;
+}
+
+
+/***
+ * One exchange with a server starting at true time true_us, measured against
+ * clock the way NetworkTime's multi-server client does it.
+ */
+static void exchange(const sim_server_t *s, DisciplinedClock &clock, int64_t true_us,
+                     uint64_t *local_us, int64_t *reference_us, uint32_t *delay_us) {
+    uint32_t up = leg(s) + s->extra_up_us;
+    uint32_t down = leg(s);
+    uint64_t t1_local = local_at(true_us);
+    int64_t t2 = true_us + up + s->clock_error_us;
+    int64_t t3 = t2 + 50;
+    uint64_t t4_local = local_at(true_us + up + 50 + down);
+    int64_t t1 = clock.to_utc_us(t1_local);
+    int64_t t4 = clock.to_utc_us(t4_local);
+
+    *local_us = t4_local;
+    *reference_us = t4 + ((t2 - t1) + (t3 - t4)) / 2;
+    *delay_us = (uint32_t)((t4 - t1) - (t3 - t2));
+}
+
+
+static void run(const scenario_t *sc) {
+    DisciplinedClock single;
+    DisciplinedClock multi;
+    NtpSelector selector;
+    int64_t next_single_us = 1000000;
+    int64_t next_multi_us = 1000000;
+    double single_sum = 0.0, multi_sum = 0.0;
+    int64_t single_max = 0, multi_max = 0;
+    uint32_t count = 0;
+
+    rng_state = 1;
+    multi.set_burst_length(1);      // as NetworkTime::set_sync_mode() does
+
+    for(int64_t t = 0; t < (int64_t)RUN_SECONDS * 1000000; t += 1000000) {
+        uint64_t local_us;
+        int64_t reference_us;
+        uint32_t delay_us;
+
+        while(next_single_us <= t) {
+            exchange(&sc->servers[0], single, next_single_us, &local_us, &reference_us, &delay_us);
+            single.update(local_us, reference_us, delay_us);
+            next_single_us += (int64_t)single.get_poll_interval_ms() * 1000;
+        }
+
+        while(next_multi_us <= t) {
+            for(int i = 0; i < NTP_MAX_SERVERS; i++) {
+                exchange(&sc->servers[i], multi, next_multi_us, &local_us, &reference_us, &delay_us);
+                selector.add_sample(i, local_us, reference_us, delay_us);
+            }
+            local_us = local_at(next_multi_us + 1000000);
+            if(selector.select(&multi, local_us, &reference_us, &delay_us)) {
+                multi.update(local_us, reference_us, delay_us);
+            }
+            next_multi_us += (int64_t)multi.get_poll_interval_ms() * 1000;
+        }
+
+        if(t >= (int64_t)RUN_SECONDS * 1000000 / 2) {
+            int64_t single_error = single.to_utc_us(local_at(t)) - t;
+            int64_t multi_error = multi.to_utc_us(local_at(t)) - t;
+            single_sum += (double)single_error * single_error;
+            multi_sum += (double)multi_error * multi_error;
+            single_max = std::llabs(single_error) > single_max ? std::llabs(single_error) : single_max;
+            multi_max = std::llabs(multi_error) > multi_max ? std::llabs(multi_error) : multi_max;
+            count++;
+        }
+    }
+
+    const ntp_selection_stats_t *stats = selector.get_stats();
+    printf("BENCH NTP %-18s: FIRST SERVER RMS %6.0f us MAX %6lld us; SELECTED RMS %6.0f us MAX %6lld us; "
+           "%lu ROUNDS, %lu NO MAJORITY, %lu STALE\n",
+           sc->name, std::sqrt(single_sum / count), (long long)single_max,
+           std::sqrt(multi_sum / count), (long long)multi_max,
+           (unsigned long)stats->rounds, (unsigned long)stats->no_majority, (unsigned long)stats->stale);
+    printf("    SELECTED CLOCK: %lu SAMPLES, %lu STEPS, %lu SPIKES, FREQ %+8.3f ppm (TRUE %+8.3f), POLL %lu s\n",
+           (unsigned long)multi.get_stats()->samples, (unsigned long)multi.get_stats()->steps,
+           (unsigned long)multi.get_stats()->spikes, multi.get_stats()->freq_ppb / 1000.0, DRIFT_PPM,
+           (unsigned long)(multi.get_poll_interval_ms() / 1000));
+
+    for(int i = 0; i < NTP_MAX_SERVERS; i++) {
+        const ntp_server_stats_t *server = selector.get_server_stats(i);
+        printf("    SERVER %d: %5lu SELECTED, %5lu FALSETICKS, OFFSET %+7ld us, DELAY %6lu us, "
+               "JITTER %5lu us, DISTANCE %6lu us\n",
+               i, (unsigned long)server->selected, (unsigned long)server->falseticks, (long)server->offset_us,
+               (unsigned long)server->delay_us, (unsigned long)server->jitter_us,
+               (unsigned long)server->distance_us);
+    }
+}
+
+
+int main() {
+    static const scenario_t scenarios[] = {
+        { "ALL HONEST", {
+            { 20000, 5000, 0, 0 }, { 20000, 5000, 0, 0 }, { 25000, 8000, 0, 0 }, { 15000, 3000, 0, 0 } } },
+        { "FIRST IS 40ms OFF", {
+            { 20000, 5000, 40000, 0 }, { 20000, 5000, 0, 0 }, { 25000, 8000, 0, 0 }, { 15000, 3000, 0, 0 } } },
+        { "FIRST IS ONE-SIDED", {
+            { 20000, 5000, 0, 12000 }, { 20000, 5000, 0, 0 }, { 25000, 8000, 0, 0 }, { 15000, 3000, 0, 0 } } },
+        { "FIRST IS FAR AWAY", {
+            { 80000, 30000, 0, 0 }, { 20000, 5000, 0, 0 }, { 25000, 8000, 0, 0 }, { 15000, 3000, 0, 0 } } },
+        { "LIAR AND FAR AWAY", {
+            { 80000, 30000, 0, 0 }, { 20000, 5000, -60000, 0 }, { 25000, 8000, 0, 0 }, { 15000, 3000, 0, 0 } } },
+    };
+
+    for(size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        run(&scenarios[i]);
+    }
+
+    return 0;
+}
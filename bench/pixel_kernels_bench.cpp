@@ -0,0 +1,182 @@
+/*
+ * pixel_kernels_bench.cpp
+ *
+ * Host check and benchmark for the pixel kernels. It first checks them
+ * against pixel_reference() byte for byte, across:
+ *   - every color order, dithered or not;
+ *   - a few gammas and brightnesses;
+ *   - enough consecutive frames to go round the dithering cycle;
+ *   - strip lengths that do and don't divide into four-pixel blocks;
+ *   - every alignment of the source and destination buffers.
+ * Both the plain word kernels and the SIMD ones are checked. The host has
+ * no DSP instructions, so the SIMD kernels run with C stand-ins for them;
+ * that checks their arithmetic, not their speed.
+ *
+ * Then it times a few typical formats on a full-length strip. The results
+ * are in cycles per pixel from the x86 timestamp counter, and in ns, for
+ * the reference, the word kernels, the SIMD kernels, and memcpy() (what
+ * the frame scheduler did before). The counter ticks at a fixed rate, not
+ * always the core clock, so the cycles are for comparing the kernels with
+ * each other, not with a Cortex-M.
+ *
+ *   PIXEL_BENCH_FRAMES    frames per case (20000)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include "pixel_kernels.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+#define CHECK_MAX_PIXELS    67
+#define BENCH_PIXELS        STRIP_MAX_LENGTH
+
+static const char *order_names[PIXEL_ORDER_COUNT] = { "RGB", "RBG", "GRB", "GBR", "BRG", "BGR", "RGBW", "GRBW" };
+
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static uint64_t now_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return now_ns();
+#endif
+}
+
+
+/***
+ * Every format, length and alignment, one frame at a time so the kernels'
+ * dithering phase and the reference's stay in step. Returns the number of
+ * frames that didn't match, and prints the first few.
+ */
+static uint32_t check(PixelKernels& kernels) {
+    static const uint8_t gammas[] = { 10, 22, 28 };
+    static const uint8_t brightnesses[] = { 255, 128, 1 };
+    static uint8_t src_buffer[CHECK_MAX_PIXELS * STRIP_BYTES_PER_PIXEL + 4] __attribute__((aligned(4)));
+    static uint8_t dst_buffer[CHECK_MAX_PIXELS * STRIP_MAX_OUTPUT_BYTES_PER_PIXEL + 4] __attribute__((aligned(4)));
+    static uint8_t expected[CHECK_MAX_PIXELS * STRIP_MAX_OUTPUT_BYTES_PER_PIXEL];
+    uint32_t frame = 0, frames = 0, failures = 0;
+
+    for(int simd = 0; simd < 2; simd++) {
+        for(int order = 0; order < PIXEL_ORDER_COUNT; order++) {
+            for(int dither = 0; dither < 2; dither++) {
+                for(uint8_t gamma : gammas) {
+                    for(uint8_t brightness : brightnesses) {
+                        pixel_format_t format = { (uint8_t)order, brightness, gamma, dither != 0 };
+                        kernels.set_format(&format);
+                        kernels.set_simd(simd != 0);
+                        int channels = kernels.get_channels();
+
+                        for(uint32_t count = 0; count <= CHECK_MAX_PIXELS; count += (count < 12 ? 1 : 11)) {
+                            for(int offset = 0; offset < 16; offset++) {
+                                uint8_t *src = &src_buffer[offset & 3];
+                                uint8_t *dst = &dst_buffer[offset >> 2];
+
+                                for(uint32_t i = 0; i < count * STRIP_BYTES_PER_PIXEL; i++) {
+                                    int r = rand() & 0xff;
+                                    src[i] = (r & 0xc0) == 0xc0 ? 0xff : (r & 0xc0) == 0x80 ? 0x00 : (uint8_t)rand();
+                                }
+                                pixel_reference(expected, src, count, &format, frame);
+                                kernels.process(dst, src, count);
+                                frame++;
+                                frames++;
+
+                                if(memcmp(dst, expected, count * channels) != 0 && failures++ < 8) {
+                                    printf("MISMATCH: %s %s, ORDER %s, GAMMA %u, BRIGHTNESS %u, %u PIXELS, OFFSETS %d/%d\n",
+                                           simd ? "SIMD" : "WORD", dither ? "DITHERED" : "ROUNDED", order_names[order],
+                                           gamma, brightness, count, offset & 3, offset >> 2);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    printf("CHECKED %u FRAMES, %u FAILED\n", frames, failures);
+    return failures;
+}
+
+
+typedef struct {
+    const char *name;
+    pixel_format_t format;
+} bench_case_t;
+
+static const bench_case_t cases[] = {
+    { "RGB AS IS", { PIXEL_ORDER_RGB, 255, 10, false } },
+    { "GRB GAMMA 2.2", { PIXEL_ORDER_GRB, 200, 22, false } },
+    { "GRB GAMMA 2.2 DITHER", { PIXEL_ORDER_GRB, 200, 22, true } },
+    { "GRBW GAMMA 2.2", { PIXEL_ORDER_GRBW, 200, 22, false } },
+    { "GRBW GAMMA 2.2 DITHER", { PIXEL_ORDER_GRBW, 200, 22, true } },
+};
+
+
+int main(int argc, char **argv) {
+    PixelKernels& kernels = PixelKernels::getInstance();
+    const char *frames_env = getenv("PIXEL_BENCH_FRAMES");
+    uint32_t frames = frames_env ? (uint32_t)atoi(frames_env) : 20000;
+    static uint8_t src[BENCH_PIXELS * STRIP_BYTES_PER_PIXEL] __attribute__((aligned(4)));
+    static uint8_t dst[BENCH_PIXELS * STRIP_MAX_OUTPUT_BYTES_PER_PIXEL] __attribute__((aligned(4)));
+    volatile uint8_t sink = 0;
+    uint32_t failures;
+
+    srand(1);
+    failures = check(kernels);
+
+    for(size_t i = 0; i < sizeof(src); i++) {
+        src[i] = (uint8_t)rand();
+    }
+
+    printf("\n%u PIXELS, CYCLES (NS) PER PIXEL\n", BENCH_PIXELS);
+    printf("%-24s %14s %14s %14s %14s\n", "FORMAT", "REFERENCE", "WORD", "SIMD", "MEMCPY");
+    for(const bench_case_t& c : cases) {
+        uint64_t cycles[4], ns[4];
+        uint32_t runs[4] = { frames / 50 + 1, frames, frames, frames };
+
+        for(int variant = 0; variant < 4; variant++) {
+            uint64_t start_cycles, start_ns;
+
+            kernels.set_format(&c.format);
+            kernels.set_simd(variant == 2);
+            start_cycles = now_cycles();
+            start_ns = now_ns();
+            for(uint32_t f = 0; f < runs[variant]; f++) {
+                if(variant == 0) {
+                    pixel_reference(dst, src, BENCH_PIXELS, &c.format, f);
+                }
+                else if(variant == 3) {
+                    memcpy(dst, src, BENCH_PIXELS * STRIP_BYTES_PER_PIXEL);
+                }
+                else {
+                    kernels.process(dst, src, BENCH_PIXELS);
+                }
+                sink += dst[f % BENCH_PIXELS];
+            }
+            cycles[variant] = now_cycles() - start_cycles;
+            ns[variant] = now_ns() - start_ns;
+        }
+
+        printf("%-24s", c.name);
+        for(int variant = 0; variant < 4; variant++) {
+            double pixels = (double)runs[variant] * BENCH_PIXELS;
+            char cell[32];
+            snprintf(cell, sizeof(cell), "%.2f (%.2f)", cycles[variant] / pixels, ns[variant] / pixels);
+            printf(" %14s", cell);
+        }
+        printf("\n");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+/*
+ * pixel_receiver_bench.cpp
+ *
+ * Host benchmark for the DDP and E1.31 receive paths. Builds one frame's worth
+ * of packets for a few strip lengths, then pushes them through
+ * PixelReceiver::handle_ddp()/handle_e131() as fast as it can and reports
+ * pixel bytes parsed per second. Packets are split into pbuf chains of
+ * SEGMENT_SIZE bytes to exercise the chain walking the CYW43 driver can cause.
+ *
+ * The pbufs are built by hand; handle_ddp() and handle_e131() never free or
+ * allocate, so no lwIP pools are involved.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "pixel_receiver.h"
+
+
+#define SEGMENT_SIZE        512
+#define FRAMES_PER_RUN      20000
+#define DDP_PIXELS_PER_PKT  480
+
+
+typedef struct {
+    std::vector<uint8_t> data;
+    std::vector<struct pbuf> chain;
+} packet_t;
+
+
+static void build_chain(packet_t &packet, size_t segment_size) {
+    size_t segments = (packet.data.size() + segment_size - 1) / segment_size;
+
+    packet.chain.assign(segments, pbuf());
+    for(size_t i = 0; i < segments; i++) {
+        struct pbuf *q = &packet.chain[i];
+        size_t start = i * segment_size;
+        size_t len = packet.data.size() - start < segment_size ? packet.data.size() - start : segment_size;
+
+        q->payload = &packet.data[start];
+        q->len = (u16_t)len;
+        q->tot_len = (u16_t)(packet.data.size() - start);
+        q->next = i + 1 < segments ? &packet.chain[i + 1] : NULL;
+    }
+}
+
+
+static std::vector<packet_t> build_ddp_frame(uint32_t strip_length, size_t segment_size) {
+    std::vector<packet_t> packets;
+    uint32_t frame_len = strip_length * STRIP_BYTES_PER_PIXEL;
+
+    for(uint32_t offset = 0; offset < frame_len; offset += DDP_PIXELS_PER_PKT * STRIP_BYTES_PER_PIXEL) {
+        uint32_t len = frame_len - offset;
+        if(len > DDP_PIXELS_PER_PKT * STRIP_BYTES_PER_PIXEL) {
+            len = DDP_PIXELS_PER_PKT * STRIP_BYTES_PER_PIXEL;
+        }
+
+        packet_t packet;
+        packet.data.resize(10 + len);
+        packet.data[0] = 0x40 | ((offset + len == frame_len) ? 0x01 : 0x00);
+        packet.data[1] = 0;
+        packet.data[2] = 0x0b;
+        packet.data[3] = 1;
+        packet.data[4] = (uint8_t)(offset >> 24);
+        packet.data[5] = (uint8_t)(offset >> 16);
+        packet.data[6] = (uint8_t)(offset >> 8);
+        packet.data[7] = (uint8_t)offset;
+        packet.data[8] = (uint8_t)(len >> 8);
+        packet.data[9] = (uint8_t)len;
+        for(uint32_t i = 0; i < len; i++) {
+            packet.data[10 + i] = (uint8_t)(offset + i);
+        }
+        packets.push_back(packet);
+    }
+
+    for(auto &packet : packets) {
+        build_chain(packet, segment_size);
+    }
+    return packets;
+}
+
+
+static std::vector<packet_t> build_e131_frame(uint32_t strip_length, size_t segment_size) {
+    static const uint8_t acn_id[12] = { 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0 };
+    std::vector<packet_t> packets;
+    uint32_t frame_len = strip_length * STRIP_BYTES_PER_PIXEL;
+    uint16_t universe = 1;
+
+    for(uint32_t offset = 0; offset < frame_len; offset += E131_CHANNELS_PER_UNIVERSE, universe++) {
+        uint32_t len = frame_len - offset;
+        if(len > E131_CHANNELS_PER_UNIVERSE) {
+            len = E131_CHANNELS_PER_UNIVERSE;
+        }
+
+        packet_t packet;
+        packet.data.assign(126 + len, 0);
+        uint8_t *h = packet.data.data();
+        h[1] = 0x10;
+        memcpy(&h[4], acn_id, sizeof(acn_id));
+        h[21] = 0x04;
+        h[43] = 0x02;
+        h[108] = 100;
+        h[113] = (uint8_t)(universe >> 8);
+        h[114] = (uint8_t)universe;
+        h[117] = 0x02;
+        h[118] = 0xa1;
+        h[122] = 1;
+        h[123] = (uint8_t)((len + 1) >> 8);
+        h[124] = (uint8_t)(len + 1);
+        for(uint32_t i = 0; i < len; i++) {
+            h[126 + i] = (uint8_t)(offset + i);
+        }
+        packets.push_back(packet);
+    }
+
+    for(auto &packet : packets) {
+        build_chain(packet, segment_size);
+    }
+    return packets;
+}
+
+
+static void run(const char *name, bool ddp, uint32_t strip_length, bool right_to_left, size_t segment_size) {
+    static uint8_t frame_buffer[STRIP_MAX_LENGTH * STRIP_BYTES_PER_PIXEL];
+    PixelReceiver& receiver = PixelReceiver::getInstance();
+    led_strip_config_t config;
+    std::vector<packet_t> packets = ddp ? build_ddp_frame(strip_length, segment_size)
+                                        : build_e131_frame(strip_length, segment_size);
+
+    memset(&config, 0, sizeof(config));
+    config.strip_length = strip_length;
+    config.right_to_left = right_to_left;
+    receiver.configure(&config);
+    receiver.set_frame_buffer(frame_buffer);
+
+    uint32_t bytes_before = receiver.get_stats()->bytes;
+    uint32_t frames_before = receiver.get_stats()->frames;
+    auto start = std::chrono::steady_clock::now();
+
+    for(int frame = 0; frame < FRAMES_PER_RUN; frame++) {
+        for(auto &packet : packets) {
+            // E1.31 sequence numbers have to move forward or the receiver
+            // (correctly) drops the packets as duplicates
+            if(!ddp) {
+                packet.data[111] = (uint8_t)frame;
+            }
+            if(ddp) {
+                receiver.handle_ddp(&packet.chain[0]);
+            }
+            else {
+                receiver.handle_e131(&packet.chain[0]);
+            }
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    uint32_t bytes = receiver.get_stats()->bytes - bytes_before;
+    uint32_t frames = receiver.get_stats()->frames - frames_before;
+
+    printf("BENCH %-6s %4lu PX %-13s SEG %4lu: %8.1f MB/s, %9.0f FRAMES/s, %6.1f ns/PX (%lu FRAMES)\n",
+           name, (unsigned long)strip_length, right_to_left ? "RIGHT_TO_LEFT" : "LEFT_TO_RIGHT",
+           (unsigned long)segment_size,
+           bytes / seconds / 1e6, frames / seconds,
+           seconds * 1e9 / ((double)FRAMES_PER_RUN * strip_length),
+           (unsigned long)frames);
+}
+
+
+int main() {
+    static const uint32_t lengths[] = { 300, 600, 1000 };
+
+    for(uint32_t length : lengths) {
+        run("DDP", true, length, false, 1500);
+        run("DDP", true, length, false, SEGMENT_SIZE);
+        run("DDP", true, length, true, 1500);
+        run("E1.31", false, length, false, 1500);
+        run("E1.31", false, length, true, SEGMENT_SIZE);
+    }
+
+    return 0;
+}
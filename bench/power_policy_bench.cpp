@@ -0,0 +1,408 @@
+/*
+ * power_policy_bench.cpp
+ *
+ * Host simulation of PowerPolicy against traffic traces. Packets arrive at
+ * the access point at the trace's times and reach the node when a model of
+ * the CYW43's power management lets them through: straight away in low
+ * latency; in performance, straight away while the radio is still awake from
+ * the last packet (20ms) and otherwise at the next beacon; in power save, at
+ * the next DTIM beacon. The policy samples what got through every
+ * POWER_SAMPLE_MS, as it does on the board from the packet filter's count,
+ * and the mode it picks applies from then on.
+ *
+ * Each trace is run with the radio pinned in each mode (performance is what
+ * the firmware used to do) and with the policy at two latency budgets. For
+ * each it reports the radio's average current, from the rough model below,
+ * the latency the power management added to pixel packets and to the rest,
+ * the time spent in each mode and how often it switched. It checks that the
+ * policy never held a packet up for longer than its budget.
+ *
+ * The current figures are ballpark ones for the radio alone, not
+ * measurements; what matters is how the runs compare.
+ *
+ *   POWER_TRACE_FILE   a recorded trace to run as well: one packet per line,
+ *                      the arrival time first, in seconds with a decimal
+ *                      point (as `tcpdump -tt` prints) or whole
+ *                      microseconds. Everything in it counts as pixel data.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "power_policy.h"
+
+
+#define BEACON_US           102400
+#define DTIM_PERIOD         3
+#define SLEEP_RETURN_US     20000
+#define PS_POLL_US          2000
+#define BEACON_WAKE_US      2000
+
+// Radio current, in mA: receiving, and asleep between beacons
+#define AWAKE_MA            40.0
+#define ASLEEP_MA           1.0
+
+#define PINNED              (-1)
+
+
+typedef struct {
+    uint64_t us;
+    bool pixel;                 // pixel data, as opposed to background
+} packet_t;
+
+
+typedef struct {
+    const char *name;
+    std::vector<packet_t> packets;
+    uint64_t length_us;
+} trace_t;
+
+
+typedef struct {
+    const char *name;
+    int pinned_mode;            // a power_mode_t, or PINNED for the policy
+    uint32_t budget_ms;
+} run_t;
+
+
+static uint32_t rng_state = 1;
+
+static uint32_t next_random() {
+    rng_state = rng_state * 1664525 + 1013904223;
+    return rng_state >> 8;
+}
+
+
+static double uniform() {
+    return (next_random() & 0xffffff) / (double)0x1000000;
+}
+
+
+static uint64_t exponential_us(double mean_s) {
+    return (uint64_t)(-log(1.0 - uniform()) * mean_s * 1e6);
+}
+
+
+/***
+ * What gets past the packet filter on a quiet network: ARP, which is always
+ * let through, every few seconds, and NTP replies every few minutes.
+ */
+static void add_background(trace_t *trace, uint64_t from_us, uint64_t to_us) {
+    for(uint64_t t = from_us + exponential_us(5); t < to_us; t += exponential_us(5)) {
+        trace->packets.push_back({ t, false });
+    }
+    for(uint64_t t = from_us + 64000000; t < to_us; t += 64000000 + (next_random() % 960) * 1000000ULL) {
+        trace->packets.push_back({ t, false });
+    }
+}
+
+
+/***
+ * A sender at fps frames a second, packets_per_frame DDP packets each, with
+ * a couple of milliseconds of jitter, and songs of a few minutes with a few
+ * seconds between them.
+ */
+static void add_stream(trace_t *trace, uint64_t from_us, uint64_t to_us, uint32_t fps, uint32_t packets_per_frame,
+                       bool songs) {
+    uint64_t period_us = 1000000 / fps;
+    uint64_t song_end_us = songs ? from_us + 180000000 + (next_random() % 120) * 1000000ULL : to_us;
+
+    for(uint64_t t = from_us; t < to_us; t += period_us) {
+        if(t >= song_end_us) {
+            t += 2000000 + (next_random() % 4000) * 1000;
+            song_end_us = t + 180000000 + (next_random() % 120) * 1000000ULL;
+            continue;
+        }
+        uint64_t frame_us = t + next_random() % 2000;
+        for(uint32_t p = 0; p < packets_per_frame; p++) {
+            trace->packets.push_back({ frame_us + p * 200, true });
+        }
+    }
+}
+
+
+static void finish(trace_t *trace, uint64_t length_us) {
+    std::sort(trace->packets.begin(), trace->packets.end(),
+              [](const packet_t& a, const packet_t& b) { return a.us < b.us; });
+    trace->length_us = length_us;
+}
+
+
+static uint64_t hours(double h) {
+    return (uint64_t)(h * 3600e6);
+}
+
+
+static void make_traces(std::vector<trace_t> *traces) {
+    trace_t show = { "EVENING SHOW" };
+    add_background(&show, 0, hours(6));
+    add_stream(&show, hours(0.5), hours(2.5), 40, 2, true);
+    finish(&show, hours(6));
+    traces->push_back(show);
+
+    trace_t idle = { "IDLE DAY" };
+    add_background(&idle, 0, hours(24));
+    finish(&idle, hours(24));
+    traces->push_back(idle);
+
+    // A short animation every five minutes, like a doorbell or a clock chime
+    trace_t chimes = { "CHIMES" };
+    add_background(&chimes, 0, hours(6));
+    for(uint64_t t = 60000000; t < hours(6); t += 300000000) {
+        add_stream(&chimes, t, t + 20000000, 30, 1, false);
+    }
+    finish(&chimes, hours(6));
+    traces->push_back(chimes);
+
+    trace_t slow = { "SLOW STREAM" };
+    add_background(&slow, 0, hours(2));
+    add_stream(&slow, hours(0.25), hours(1.75), 10, 1, true);
+    finish(&slow, hours(2));
+    traces->push_back(slow);
+}
+
+
+static bool load_trace(const char *path, trace_t *trace) {
+    FILE *f = fopen(path, "r");
+    char line[512];
+    uint64_t first_us = 0;
+
+    if(f == NULL) {
+        perror("POWER_TRACE_FILE");
+        return false;
+    }
+    while(fgets(line, sizeof(line), f)) {
+        char *end;
+        double value = strtod(line, &end);
+        uint64_t us;
+
+        if(end == line) {
+            continue;
+        }
+        us = memchr(line, '.', end - line) ? (uint64_t)(value * 1e6) : (uint64_t)value;
+        if(trace->packets.empty()) {
+            first_us = us;
+        }
+        trace->packets.push_back({ us >= first_us ? us - first_us : 0, true });
+    }
+    fclose(f);
+
+    if(trace->packets.empty()) {
+        printf("NO PACKETS IN %s\n", path);
+        return false;
+    }
+    trace->name = path;
+    finish(trace, trace->packets.back().us + 1000000);
+    return true;
+}
+
+
+static uint64_t next_boundary(uint64_t us, uint64_t period_us) {
+    return (us + period_us - 1) / period_us * period_us;
+}
+
+
+typedef struct {
+    double average_ma;
+    uint32_t pixel_p50_us;
+    uint32_t pixel_p99_us;
+    uint32_t pixel_max_us;
+    uint32_t other_p99_us;
+    uint32_t other_max_us;
+    uint64_t time_in_mode_us[POWER_MODE_COUNT];
+    uint32_t switches;
+} result_t;
+
+
+static uint32_t percentile(std::vector<uint32_t> *values, double p) {
+    if(values->empty()) {
+        return 0;
+    }
+    size_t i = (size_t)(p * (values->size() - 1));
+    std::nth_element(values->begin(), values->begin() + i, values->end());
+    return (*values)[i];
+}
+
+
+/***
+ * Steps through the trace one sample period at a time. Packets that arrive
+ * in a period are delivered by the mode the radio was in; any still held at
+ * the access point when the radio switches to low latency come in at once.
+ */
+static void simulate(const trace_t *trace, const run_t *run, result_t *result) {
+    PowerPolicy policy;
+    power_mode_t mode = run->pinned_mode == PINNED ? POWER_MODE_LOW_LATENCY : (power_mode_t)run->pinned_mode;
+    std::vector<uint32_t> pixel_delays;
+    std::vector<uint32_t> other_delays;
+    std::vector<uint64_t> held;         // delivery times not reached yet
+    uint64_t awake_from_us = 0;         // the radio's current or next wakeup in performance
+    uint64_t awake_until_us = 0;
+    uint64_t last_poll_us = UINT64_MAX;
+    double awake_us = 0;
+    size_t next = 0;
+
+    memset(result, 0, sizeof(*result));
+    policy.set_latency_budget_ms(run->budget_ms);
+    policy.reset(0);
+
+    for(uint64_t now = POWER_SAMPLE_MS * 1000ULL; now <= trace->length_us; now += POWER_SAMPLE_MS * 1000ULL) {
+        uint64_t period_start = now - POWER_SAMPLE_MS * 1000ULL;
+
+        for(; next < trace->packets.size() && trace->packets[next].us < now; next++) {
+            const packet_t *p = &trace->packets[next];
+            uint64_t delivered = p->us;
+
+            if(mode == POWER_MODE_PERFORMANCE) {
+                if(p->us < awake_from_us) {
+                    // Held for the beacon the last one was held for
+                    delivered = awake_from_us;
+                }
+                else if(p->us >= awake_until_us) {
+                    delivered = next_boundary(p->us, BEACON_US);
+                    awake_from_us = delivered;
+                }
+                awake_us += delivered + SLEEP_RETURN_US - std::max(delivered, awake_until_us);
+                awake_until_us = delivered + SLEEP_RETURN_US;
+            }
+            else if(mode == POWER_MODE_POWER_SAVE) {
+                delivered = next_boundary(p->us, BEACON_US * DTIM_PERIOD);
+                if(delivered != last_poll_us) {
+                    awake_us += PS_POLL_US;
+                    last_poll_us = delivered;
+                }
+            }
+            (p->pixel ? pixel_delays : other_delays).push_back((uint32_t)(delivered - p->us));
+            held.push_back(delivered);
+        }
+
+        uint32_t packets = 0;
+        for(size_t i = 0; i < held.size();) {
+            if(held[i] <= now) {
+                packets++;
+                held[i] = held.back();
+                held.pop_back();
+            }
+            else {
+                i++;
+            }
+        }
+
+        // The radio's own wakeups for beacons, and its current while it's
+        // always on, over the period just gone
+        if(mode == POWER_MODE_LOW_LATENCY) {
+            awake_us += now - period_start;
+        }
+        else if(mode == POWER_MODE_PERFORMANCE) {
+            awake_us += (double)(now - period_start) * BEACON_WAKE_US / BEACON_US;
+        }
+        else {
+            awake_us += (double)(now - period_start) * BEACON_WAKE_US / (BEACON_US * DTIM_PERIOD);
+        }
+        result->time_in_mode_us[mode] += now - period_start;
+
+        if(run->pinned_mode == PINNED) {
+            power_mode_t wanted = policy.sample(now, packets);
+            if(wanted != mode) {
+                result->switches++;
+                if(wanted == POWER_MODE_LOW_LATENCY) {
+                    // What the access point was holding comes now. Their
+                    // delays were taken at the old times, so if anything
+                    // the figures are unkind to the policy
+                    for(uint64_t& h : held) {
+                        h = now;
+                    }
+                }
+                mode = wanted;
+                awake_from_us = 0;
+                awake_until_us = 0;
+            }
+        }
+    }
+
+    double total_us = (double)trace->length_us;
+    result->average_ma = ASLEEP_MA + (AWAKE_MA - ASLEEP_MA) * std::min(awake_us, total_us) / total_us;
+    result->pixel_p50_us = percentile(&pixel_delays, 0.5);
+    result->pixel_p99_us = percentile(&pixel_delays, 0.99);
+    result->pixel_max_us = pixel_delays.empty() ? 0 : *std::max_element(pixel_delays.begin(), pixel_delays.end());
+    result->other_p99_us = percentile(&other_delays, 0.99);
+    result->other_max_us = other_delays.empty() ? 0 : *std::max_element(other_delays.begin(), other_delays.end());
+}
+
+
+static bool check(const char *what, bool ok) {
+    printf("CHECK %-60s %s\n", what, ok ? "OK" : "FAILED");
+    return ok;
+}
+
+
+static bool run_trace(const trace_t *trace) {
+    static const run_t runs[] = {
+        { "LOW LATENCY", POWER_MODE_LOW_LATENCY, 0 },
+        { "PERFORMANCE", POWER_MODE_PERFORMANCE, 0 },
+        { "POWER SAVE", POWER_MODE_POWER_SAVE, 0 },
+        { "POLICY 500ms", PINNED, 500 },
+        { "POLICY 150ms", PINNED, 150 },
+    };
+    size_t pixels = 0;
+    bool ok = true;
+
+    for(const packet_t& p : trace->packets) {
+        pixels += p.pixel;
+    }
+    printf("\n%s: %.1f HOURS, %zu PIXEL PACKETS, %zu OTHERS\n", trace->name, trace->length_us / 3600e6, pixels,
+           trace->packets.size() - pixels);
+    printf("%-14s %8s %24s %18s %22s %8s\n", "", "CURRENT", "PIXEL ADDED p50/p99/MAX", "OTHER p99/MAX",
+           "LOW LAT/PERF/SAVE", "SWITCHES");
+
+    for(const run_t& run : runs) {
+        result_t r;
+        double total = (double)trace->length_us;
+
+        simulate(trace, &run, &r);
+        printf("%-14s %6.2fmA %7.1f/%6.1f/%6.1f ms %7.1f/%6.1f ms %6.1f%%/%5.1f%%/%5.1f%% %8lu\n", run.name,
+               r.average_ma, r.pixel_p50_us / 1000.0, r.pixel_p99_us / 1000.0, r.pixel_max_us / 1000.0,
+               r.other_p99_us / 1000.0, r.other_max_us / 1000.0,
+               100.0 * r.time_in_mode_us[POWER_MODE_LOW_LATENCY] / total,
+               100.0 * r.time_in_mode_us[POWER_MODE_PERFORMANCE] / total,
+               100.0 * r.time_in_mode_us[POWER_MODE_POWER_SAVE] / total, (unsigned long)r.switches);
+
+        if(run.pinned_mode == PINNED) {
+            char what[96];
+            snprintf(what, sizeof(what), "%s: %s ADDS NO MORE THAN ITS BUDGET", trace->name, run.name);
+            ok &= check(what, r.pixel_max_us <= run.budget_ms * 1000 && r.other_max_us <= run.budget_ms * 1000);
+        }
+    }
+
+    return ok;
+}
+
+
+int main() {
+    std::vector<trace_t> traces;
+    const char *trace_file = getenv("POWER_TRACE_FILE");
+    bool ok = true;
+
+    printf("POWER POLICY: SAMPLES EVERY %d ms, STREAMING AT %d PACKETS A SECOND OVER %d SAMPLES, "
+           "%d ms BEFORE EACH STEP DOWN\n", POWER_SAMPLE_MS, POWER_STREAMING_PPS, POWER_WINDOW_SAMPLES, POWER_HOLD_MS);
+    printf("RADIO MODEL: BEACONS EVERY %.1f ms, DTIM EVERY %d, %.0f mA AWAKE, %.0f mA ASLEEP\n", BEACON_US / 1000.0,
+           DTIM_PERIOD, AWAKE_MA, ASLEEP_MA);
+
+    make_traces(&traces);
+    if(trace_file != NULL) {
+        trace_t recorded = {};
+        if(!load_trace(trace_file, &recorded)) {
+            return 1;
+        }
+        traces.push_back(recorded);
+    }
+
+    for(const trace_t& trace : traces) {
+        ok &= run_trace(&trace);
+    }
+
+    printf("\n%s\n", ok ? "ALL CHECKS OK" : "SOME CHECKS FAILED");
+    return ok ? 0 : 1;
+}
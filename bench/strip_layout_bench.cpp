@@ -0,0 +1,230 @@
+/*
+ * strip_layout_bench.cpp
+ *
+ * Host check and benchmark for physical layouts. Each strip length is tried
+ * with two layouts:
+ *   - a serpentine matrix, 20 pixels to a row;
+ *   - two panels, the second wired backwards, with a few dark pixels between.
+ *
+ * First it checks the remap table against a naive mapping that walks the
+ * segments for every pixel. Then it checks the gather kernels against
+ * pixel_reference() through the same table, for a few formats, word and
+ * SIMD, at every alignment of the output.
+ *
+ * Then it times, in ns per pixel:
+ *   - the naive mapping, copying each pixel as it finds it;
+ *   - the naive mapping into a scratch frame, then the kernels over that;
+ *   - the table, gathered by the kernels in the same pass as converting;
+ *   - the kernels with no layout at all, for comparison.
+ * The last three convert to GRB with gamma, which is what a strip gets.
+ *
+ *   LAYOUT_BENCH_FRAMES   frames per case (5000)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include "strip_layout.h"
+#include "pixel_kernels.h"
+
+
+#define MAX_PIXELS          2000
+#define MAX_PHYSICAL        (MAX_PIXELS + 16)
+#define MATRIX_WIDTH        20
+#define PANEL_GAP           8
+
+static const uint32_t lengths[] = { 300, 600, 1000, 1500, 2000 };
+static const char *layout_names[] = { "MATRIX", "PANELS" };
+
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void make_layout(strip_layout_t *layout, int kind, uint32_t length) {
+    memset(layout, 0, sizeof(strip_layout_t));
+
+    if(kind == 0) {
+        layout->segment_count = 1;
+        layout->segments[0].source = 0;
+        layout->segments[0].length = MATRIX_WIDTH;
+        layout->segments[0].runs = (uint16_t)(length / MATRIX_WIDTH);
+        layout->segments[0].pixel_step = 1;
+        layout->segments[0].run_step = MATRIX_WIDTH;
+        layout->segments[0].flags = STRIP_SEGMENT_SERPENTINE;
+    }
+    else {
+        layout->segment_count = 3;
+        layout->segments[0].source = 0;
+        layout->segments[0].length = (uint16_t)(length / 2);
+        layout->segments[1].length = PANEL_GAP;
+        layout->segments[1].flags = STRIP_SEGMENT_DARK;
+        layout->segments[2].source = (uint16_t)(length - 1);
+        layout->segments[2].length = (uint16_t)(length - length / 2);
+        layout->segments[2].pixel_step = -1;
+    }
+}
+
+
+/***
+ * Which frame pixel the i-th pixel on the wire shows, found the obvious way:
+ * by walking the segments to the one it's in. -1 for black.
+ */
+static int32_t naive_map(const strip_layout_t *layout, uint32_t i, uint32_t frame_length) {
+    for(int s = 0; s < layout->segment_count; s++) {
+        const strip_segment_t *segment = &layout->segments[s];
+        uint32_t runs = segment->runs != 0 ? segment->runs : 1;
+        uint32_t total = runs * segment->length;
+
+        if(i < total) {
+            uint32_t run = i / segment->length;
+            uint32_t k = i % segment->length;
+            int32_t pixel;
+
+            if(segment->flags & STRIP_SEGMENT_DARK) {
+                return -1;
+            }
+            if((segment->flags & STRIP_SEGMENT_SERPENTINE) && (run & 1)) {
+                k = segment->length - 1 - k;
+            }
+            pixel = (int32_t)segment->source + (int32_t)run * segment->run_step +
+                    (int32_t)k * (segment->pixel_step != 0 ? segment->pixel_step : 1);
+            return pixel >= 0 && pixel < (int32_t)frame_length ? pixel : -1;
+        }
+        i -= total;
+    }
+    return -1;
+}
+
+
+static void naive_copy(uint8_t *dst, const uint8_t *src, uint32_t count, const strip_layout_t *layout,
+                       uint32_t frame_length) {
+    for(uint32_t i = 0; i < count; i++) {
+        int32_t pixel = naive_map(layout, i, frame_length);
+
+        if(pixel < 0) {
+            dst[0] = dst[1] = dst[2] = 0;
+        }
+        else {
+            memcpy(dst, &src[pixel * STRIP_BYTES_PER_PIXEL], STRIP_BYTES_PER_PIXEL);
+        }
+        dst += STRIP_BYTES_PER_PIXEL;
+    }
+}
+
+
+int main(int argc, char **argv) {
+    PixelKernels& kernels = PixelKernels::getInstance();
+    const char *frames_env = getenv("LAYOUT_BENCH_FRAMES");
+    uint32_t frames = frames_env ? (uint32_t)atoi(frames_env) : 5000;
+    static const pixel_format_t check_formats[] = {
+        { PIXEL_ORDER_RGB, 255, 10, false },
+        { PIXEL_ORDER_GRB, 200, 22, true },
+        { PIXEL_ORDER_GRBW, 128, 28, false },
+    };
+    static const pixel_format_t strip_format = { PIXEL_ORDER_GRB, 255, 22, false };
+    static uint8_t src[MAX_PIXELS * STRIP_BYTES_PER_PIXEL + 4] __attribute__((aligned(4)));
+    static uint8_t scratch[MAX_PHYSICAL * STRIP_BYTES_PER_PIXEL] __attribute__((aligned(4)));
+    static uint8_t dst[MAX_PHYSICAL * STRIP_MAX_OUTPUT_BYTES_PER_PIXEL + 4] __attribute__((aligned(4)));
+    static uint8_t expected[MAX_PHYSICAL * STRIP_MAX_OUTPUT_BYTES_PER_PIXEL];
+    static uint16_t remap[MAX_PHYSICAL];
+    volatile uint8_t sink = 0;
+    uint32_t frame = 0, cases = 0, failures = 0;
+
+    srand(1);
+
+    for(uint32_t length : lengths) {
+        for(int kind = 0; kind < 2; kind++) {
+            strip_layout_t layout;
+            bool truncated;
+            uint32_t count;
+
+            make_layout(&layout, kind, length);
+            memset(src, 0, sizeof(src));
+            for(uint32_t i = 0; i < length * STRIP_BYTES_PER_PIXEL; i++) {
+                src[i] = (uint8_t)rand();
+            }
+            count = strip_layout_compile(remap, MAX_PHYSICAL, &layout, length,
+                                         (uint16_t)(length * STRIP_BYTES_PER_PIXEL), &truncated);
+
+            for(uint32_t i = 0; i < count; i++) {
+                int32_t pixel = naive_map(&layout, i, length);
+                uint16_t offset = pixel < 0 ? (uint16_t)(length * STRIP_BYTES_PER_PIXEL) :
+                                              (uint16_t)(pixel * STRIP_BYTES_PER_PIXEL);
+                cases++;
+                if(remap[i] != offset && failures++ < 8) {
+                    printf("REMAP MISMATCH: %s, %u PIXELS, PIXEL %u: %u != %u\n",
+                           layout_names[kind], length, i, remap[i], offset);
+                }
+            }
+
+            for(const pixel_format_t& format : check_formats) {
+                for(int simd = 0; simd < 2; simd++) {
+                    kernels.set_format(&format);
+                    kernels.set_simd(simd != 0);
+                    for(int offset = 0; offset < 4; offset++) {
+                        pixel_reference(expected, src, count, &format, frame, remap);
+                        kernels.process(&dst[offset], src, count, remap);
+                        frame++;
+                        cases++;
+                        if(memcmp(&dst[offset], expected, count * kernels.get_channels()) != 0 && failures++ < 8) {
+                            printf("GATHER MISMATCH: %s, %u PIXELS, ORDER %u, %s, OFFSET %d\n",
+                                   layout_names[kind], length, format.order, simd ? "SIMD" : "WORD", offset);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    printf("CHECKED %u CASES, %u FAILED\n", cases, failures);
+
+    kernels.set_format(&strip_format);
+    kernels.set_simd(false);
+    printf("\nNS PER PIXEL\n");
+    printf("%-8s %6s %9s %12s %16s %14s %12s\n", "LAYOUT", "PIXELS", "PHYSICAL", "NAIVE COPY", "NAIVE+CONVERT",
+           "FUSED GATHER", "NO LAYOUT");
+    for(uint32_t length : lengths) {
+        for(int kind = 0; kind < 2; kind++) {
+            strip_layout_t layout;
+            bool truncated;
+            uint32_t count;
+            uint64_t ns[4];
+
+            make_layout(&layout, kind, length);
+            count = strip_layout_compile(remap, MAX_PHYSICAL, &layout, length,
+                                         (uint16_t)(length * STRIP_BYTES_PER_PIXEL), &truncated);
+
+            for(int variant = 0; variant < 4; variant++) {
+                uint64_t start = now_ns();
+
+                for(uint32_t f = 0; f < frames; f++) {
+                    if(variant == 0) {
+                        naive_copy(dst, src, count, &layout, length);
+                    }
+                    else if(variant == 1) {
+                        naive_copy(scratch, src, count, &layout, length);
+                        kernels.process(dst, scratch, count);
+                    }
+                    else if(variant == 2) {
+                        kernels.process(dst, src, count, remap);
+                    }
+                    else {
+                        kernels.process(dst, src, length);
+                    }
+                    sink += dst[f % count];
+                }
+                ns[variant] = now_ns() - start;
+            }
+
+            printf("%-8s %6u %9u %12.2f %16.2f %14.2f %12.2f\n", layout_names[kind], length, count,
+                   (double)ns[0] / frames / count, (double)ns[1] / frames / count,
+                   (double)ns[2] / frames / count, (double)ns[3] / frames / length);
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+/*
+ * strip_output_bench.cpp
+ *
+ * Host benchmark for the strip output pipeline. Frames arrive at a nominal
+ * rate with some random jitter and are presented to StripOutput, which drives
+ * MockStripBackend on a virtual clock that advances exactly as a real 800kHz
+ * strip would. For each strip length, frame rate, jitter and buffer count it
+ * reports how many frames made it to the strip, how many were dropped (replaced
+ * before they were shown) or starved (no buffer to write into), and the
+ * achieved frame time and present-to-start latency.
+ *
+ * Virtual time makes the pipeline numbers repeatable from run to run; the last
+ * section measures the real CPU cost of a present()/frame_done() pair.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "strip_output.h"
+#include "mock_strip_backend.h"
+
+
+#define FRAMES_PER_RUN      2000
+#define OVERHEAD_FRAMES     1000000
+
+
+static uint32_t rng_state = 1;
+
+static uint32_t next_random() {
+    rng_state = rng_state * 1664525 + 1013904223;
+    return rng_state >> 8;
+}
+
+
+static void run(uint32_t strip_length, uint32_t fps, uint32_t jitter_us, int buffers) {
+    StripOutput& output = StripOutput::getInstance();
+    MockStripBackend backend;
+    led_strip_config_t config;
+    uint64_t period_us = 1000000 / fps;
+    uint64_t arrival_us = 0;
+
+    memset(&config, 0, sizeof(config));
+    config.strip_length = strip_length;
+    output.configure(&config);
+    output.set_buffer_count(buffers);
+    output.set_backend(&backend);
+    output.set_time_source(MockStripBackend::now);
+    output.reset_stats();
+    MockStripBackend::reset_clock();
+    rng_state = 1;
+
+    for(int frame = 0; frame < FRAMES_PER_RUN; frame++) {
+        uint64_t due_us = (uint64_t)frame * period_us;
+        if(jitter_us > 0) {
+            due_us += next_random() % (2 * jitter_us + 1);
+        }
+
+        // Packets can't overtake each other, so neither can frames
+        if(due_us > arrival_us) {
+            arrival_us = due_us;
+        }
+        backend.advance_to(arrival_us);
+
+        uint8_t *buffer = output.get_back_buffer();
+        if(buffer) {
+            memset(buffer, frame, output.get_frame_size());
+        }
+        output.present();
+    }
+    backend.advance_to(UINT64_MAX);
+
+    const strip_output_stats_t *stats = output.get_stats();
+    uint32_t intervals = stats->started > 1 ? stats->started - 1 : 1;
+    uint32_t started = stats->started > 0 ? stats->started : 1;
+
+    printf("BENCH %4lu PX %2lu FPS JITTER %4lu us %d BUFFERS: "
+           "DISPLAYED %4lu DROPPED %4lu STARVED %4lu, "
+           "FRAME TIME AVG %6.0f MAX %6lu us, LATENCY AVG %6.0f MAX %6lu us\n",
+           (unsigned long)strip_length, (unsigned long)fps, (unsigned long)jitter_us, buffers,
+           (unsigned long)stats->displayed, (unsigned long)stats->dropped, (unsigned long)stats->starved,
+           (double)stats->frame_time_total_us / intervals, (unsigned long)stats->frame_time_max_us,
+           (double)stats->latency_total_us / started, (unsigned long)stats->latency_max_us);
+}
+
+
+static void run_overhead(int buffers) {
+    StripOutput& output = StripOutput::getInstance();
+    MockStripBackend backend;
+    led_strip_config_t config;
+
+    memset(&config, 0, sizeof(config));
+    config.strip_length = STRIP_DEFAULT_LENGTH;
+    output.configure(&config);
+    output.set_buffer_count(buffers);
+    output.set_backend(&backend);
+    output.set_time_source(MockStripBackend::now);
+    output.reset_stats();
+    MockStripBackend::reset_clock();
+
+    auto start = std::chrono::steady_clock::now();
+
+    for(uint64_t frame = 0; frame < OVERHEAD_FRAMES; frame++) {
+        output.present();
+        backend.advance_to(frame * 20000);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    printf("BENCH OVERHEAD %d BUFFERS: %6.1f ns PER PRESENT/FRAME_DONE (%lu FRAMES DISPLAYED)\n",
+           buffers, seconds * 1e9 / OVERHEAD_FRAMES, (unsigned long)output.get_stats()->displayed);
+}
+
+
+int main() {
+    static const uint32_t lengths[] = { 300, 600, 1000 };
+    static const uint32_t rates[] = { 30, 60 };
+    static const uint32_t jitters[] = { 0, 8000 };
+
+    for(uint32_t length : lengths) {
+        for(uint32_t fps : rates) {
+            for(uint32_t jitter : jitters) {
+                run(length, fps, jitter, 2);
+                run(length, fps, jitter, 3);
+            }
+        }
+    }
+
+    run_overhead(2);
+    run_overhead(3);
+
+    return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * config_flash_host.cpp
+ *
+ * The host build's PicoFlash: a RamFlash, optionally backed by the file named
+ * in HOST_FLASH_FILE so the stored configuration survives from one run to the
+ * next the way it would survive a power cycle.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "config_flash.h"
+#include "ram_flash.h"
+
+
+static RamFlash& host_flash() {
+    static RamFlash flash(CONFIG_FLASH_SIZE);
+    static bool loaded = false;
+
+    if(!loaded) {
+        const char *path = getenv("HOST_FLASH_FILE");
+        FILE *f = path ? fopen(path, "rb") : NULL;
+
+        loaded = true;
+        if(f) {
+            if(fread(flash.get_memory(), 1, CONFIG_FLASH_SIZE, f) != CONFIG_FLASH_SIZE) {
+                printf("HOST FLASH FILE %s IS SHORT, IGNORING THE REST\n", path);
+            }
+            fclose(f);
+        }
+    }
+
+    return flash;
+}
+
+
+static void host_flash_sync() {
+    const char *path = getenv("HOST_FLASH_FILE");
+    FILE *f = path ? fopen(path, "wb") : NULL;
+
+    if(f) {
+        fwrite(host_flash().get_memory(), 1, CONFIG_FLASH_SIZE, f);
+        fclose(f);
+    }
+}
+
+
+bool PicoFlash::read(uint32_t offset, void *buffer, size_t len) {
+    return host_flash().read(offset, buffer, len);
+}
+
+
+bool PicoFlash::erase(uint32_t offset, size_t len) {
+    bool ok = host_flash().erase(offset, len);
+    host_flash_sync();
+    return ok;
+}
+
+
+bool PicoFlash::program(uint32_t offset, const void *data, size_t len) {
+    bool ok = host_flash().program(offset, data, len);
+    host_flash_sync();
+    return ok;
+}
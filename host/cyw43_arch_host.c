@@ -0,0 +1,270 @@
+/*
+ * cyw43_arch_host.c
+ *
+ * The host build's CYW43. Association is a timer that fires after
+ * sim_net_config.join_delay_ms and succeeds if the simulated access point is
+ * there; everything after that (DHCP, DNS, SNTP) is real lwIP talking to the
+ * simulated servers in sim_net.c.
+ *
+ * The connect loop mirrors cyw43_arch_wifi_connect_until() in the Pico SDK so
+ * the timing of WifiConnection::join() is representative.
+ */
+
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "timers.h"
+#include "pico/cyw43_arch.h"
+#include "sim_net.h"
+
+
+// Values for cyw43_state.wifi_join_state
+#define SIM_JOIN_IDLE       0
+#define SIM_JOIN_JOINING    1
+#define SIM_JOIN_ACTIVE     2
+#define SIM_JOIN_NONET      3
+
+cyw43_t cyw43_state;
+
+static TimerHandle_t join_timer;
+static bool join_bssid_matches;
+
+
+static void tcpip_init_done(void *arg) {
+    xSemaphoreGive((SemaphoreHandle_t)arg);
+}
+
+
+static void join_timer_callback(TimerHandle_t timer) {
+    struct netif *n = &cyw43_state.netif[CYW43_ITF_STA];
+
+    if(cyw43_state.wifi_join_state != SIM_JOIN_JOINING) {
+        return;
+    }
+
+    if(sim_net_ap_present() && join_bssid_matches) {
+        cyw43_state.wifi_join_state = SIM_JOIN_ACTIVE;
+        LOCK_TCPIP_CORE();
+        netif_set_link_up(n);
+        UNLOCK_TCPIP_CORE();
+    }
+    else {
+        cyw43_state.wifi_join_state = SIM_JOIN_NONET;
+    }
+}
+
+
+int cyw43_arch_init(void) {
+    static const uint8_t mac[6] = { 0x28, 0xcd, 0xc1, 0x00, 0x00, 0x01 };
+    SemaphoreHandle_t done = xSemaphoreCreateBinary();
+
+    tcpip_init(tcpip_init_done, done);
+    xSemaphoreTake(done, portMAX_DELAY);
+    vSemaphoreDelete(done);
+
+    memcpy(cyw43_state.mac, mac, sizeof(mac));
+    cyw43_state.wifi_join_state = SIM_JOIN_IDLE;
+    cyw43_state.pm = CYW43_DEFAULT_PM;
+
+    sim_net_init();
+
+    join_timer = xTimerCreate("Sim Join", 1, pdFALSE, NULL, join_timer_callback);
+
+    return 0;
+}
+
+
+void cyw43_arch_deinit(void) {
+}
+
+
+void cyw43_arch_enable_sta_mode(void) {
+    struct netif *n = &cyw43_state.netif[CYW43_ITF_STA];
+
+    if(cyw43_state.itf_state & (1 << CYW43_ITF_STA)) {
+        return;
+    }
+
+    LOCK_TCPIP_CORE();
+    netif_add(n, IP4_ADDR_ANY4, IP4_ADDR_ANY4, IP4_ADDR_ANY4, NULL, sim_net_netif_init, tcpip_input);
+    netif_set_hostname(n, "PicoW");
+    netif_set_default(n);
+    netif_set_up(n);
+    dhcp_start(n);
+    UNLOCK_TCPIP_CORE();
+
+    cyw43_state.itf_state |= (1 << CYW43_ITF_STA);
+}
+
+
+void cyw43_arch_lwip_begin(void) {
+    LOCK_TCPIP_CORE();
+}
+
+
+void cyw43_arch_lwip_end(void) {
+    UNLOCK_TCPIP_CORE();
+}
+
+
+int cyw43_wifi_join(cyw43_t *self, size_t ssid_len, const uint8_t *ssid, size_t key_len, const uint8_t *key,
+                    uint32_t auth_type, const uint8_t *bssid, uint32_t channel) {
+    uint32_t delay_ms = sim_net_config.join_delay_ms;
+
+    // Without a channel the radio has to go looking for the network first
+    if(channel == CYW43_CHANNEL_NONE) {
+        delay_ms += sim_net_config.scan_delay_ms;
+    }
+
+    join_bssid_matches = ((bssid == NULL) || (memcmp(bssid, sim_net_ap_bssid, 6) == 0)) &&
+                         (channel == CYW43_CHANNEL_NONE || channel == sim_net_ap_channel);
+    self->wifi_join_state = SIM_JOIN_JOINING;
+    xTimerChangePeriod(join_timer, pdMS_TO_TICKS(delay_ms) ? pdMS_TO_TICKS(delay_ms) : 1, portMAX_DELAY);
+
+    return 0;
+}
+
+
+int cyw43_wifi_leave(cyw43_t *self, int itf) {
+    self->wifi_join_state = SIM_JOIN_IDLE;
+    LOCK_TCPIP_CORE();
+    netif_set_link_down(&self->netif[itf]);
+    UNLOCK_TCPIP_CORE();
+    return 0;
+}
+
+
+void cyw43_host_ap_lost(void) {
+    if(cyw43_state.wifi_join_state == SIM_JOIN_ACTIVE) {
+        cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+    }
+}
+
+
+int cyw43_wifi_link_status(cyw43_t *self, int itf) {
+    switch(self->wifi_join_state) {
+        case SIM_JOIN_ACTIVE:
+            return CYW43_LINK_JOIN;
+        case SIM_JOIN_NONET:
+            return CYW43_LINK_NONET;
+        default:
+            return CYW43_LINK_DOWN;
+    }
+}
+
+
+int cyw43_tcpip_link_status(cyw43_t *self, int itf) {
+    int status = cyw43_wifi_link_status(self, itf);
+    struct netif *n = &self->netif[itf];
+
+    if(status != CYW43_LINK_JOIN) {
+        return status;
+    }
+
+    if(netif_is_up(n) && !ip4_addr_isany_val(*netif_ip4_addr(n))) {
+        return CYW43_LINK_UP;
+    }
+
+    return CYW43_LINK_NOIP;
+}
+
+
+int cyw43_wifi_pm(cyw43_t *self, uint32_t pm) {
+    self->pm = pm;
+    return 0;
+}
+
+
+int cyw43_wifi_get_pm(cyw43_t *self, uint32_t *pm) {
+    *pm = self->pm;
+    return 0;
+}
+
+
+int cyw43_wifi_get_bssid(cyw43_t *self, uint8_t bssid[6]) {
+    if(self->wifi_join_state != SIM_JOIN_ACTIVE) {
+        return -1;
+    }
+    memcpy(bssid, sim_net_ap_bssid, 6);
+    return 0;
+}
+
+
+/***
+ * Only the channel query is implemented. Like WLC_GET_CHANNEL, the reply is a
+ * channel_info_t whose first word is the channel the radio is on.
+ */
+int cyw43_ioctl(cyw43_t *self, uint32_t cmd, size_t len, uint8_t *buf, uint32_t iface) {
+    if(cmd == CYW43_IOCTL_GET_CHANNEL && len >= 4 && self->wifi_join_state == SIM_JOIN_ACTIVE) {
+        memcpy(buf, &sim_net_ap_channel, 4);
+        return 0;
+    }
+    return -1;
+}
+
+
+static int connect_bssid_async(const char *ssid, const uint8_t *bssid, const char *pw, uint32_t auth) {
+    if(!pw) {
+        auth = CYW43_AUTH_OPEN;
+    }
+    return cyw43_wifi_join(&cyw43_state, strlen(ssid), (const uint8_t *)ssid, pw ? strlen(pw) : 0,
+                           (const uint8_t *)pw, auth, bssid, CYW43_CHANNEL_NONE);
+}
+
+
+int cyw43_arch_wifi_connect_async(const char *ssid, const char *pw, uint32_t auth) {
+    return connect_bssid_async(ssid, NULL, pw, auth);
+}
+
+
+static int connect_until(const char *ssid, const uint8_t *bssid, const char *pw, uint32_t auth, uint32_t timeout) {
+    TickType_t until = xTaskGetTickCount() + pdMS_TO_TICKS(timeout);
+    int status = CYW43_LINK_UP + 1;
+    int err;
+
+    cyw43_arch_enable_sta_mode();
+
+    err = connect_bssid_async(ssid, bssid, pw, auth);
+    if(err) {
+        return err;
+    }
+
+    while(status >= 0 && status != CYW43_LINK_UP) {
+        int new_status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+
+        // If there was no network, keep trying
+        if(new_status == CYW43_LINK_NONET) {
+            new_status = CYW43_LINK_JOIN;
+            err = connect_bssid_async(ssid, bssid, pw, auth);
+            if(err) {
+                return err;
+            }
+        }
+        status = new_status;
+
+        if((int32_t)(xTaskGetTickCount() - until) >= 0) {
+            return PICO_ERROR_TIMEOUT;
+        }
+        vTaskDelay(1);
+    }
+
+    if(status == CYW43_LINK_UP) {
+        return PICO_OK;
+    }
+    else if(status == CYW43_LINK_BADAUTH) {
+        return PICO_ERROR_BADAUTH;
+    }
+    return PICO_ERROR_CONNECT_FAILED;
+}
+
+
+int cyw43_arch_wifi_connect_timeout_ms(const char *ssid, const char *pw, uint32_t auth, uint32_t timeout) {
+    return connect_until(ssid, NULL, pw, auth, timeout);
+}
+
+
+int cyw43_arch_wifi_connect_bssid_timeout_ms(const char *ssid, const uint8_t *bssid, const char *pw, uint32_t auth,
+                                             uint32_t timeout) {
+    return connect_until(ssid, bssid, pw, auth, timeout);
+}
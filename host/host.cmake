@@ -0,0 +1,356 @@
+# Host (Linux) build of the networking code.
+#
+# This builds src/wifi.cpp, src/network_time.cpp and main.cpp against the
+# FreeRTOS POSIX port and lwIP straight out of the Pico SDK submodule, with the
+# CYW43 driver replaced by a simulated access point (see host/sim_net.c). It's
+# included from the top-level CMakeLists.txt when PICO_BOARD is "host":
+#
+#   cmake -S . -B build-host -DPICO_BOARD=host
+#   cmake --build build-host
+#   ./build-host/pico_lwip_example_host
+#
+
+set(HOST_DIR ${CMAKE_CURRENT_LIST_DIR})
+get_filename_component(LWIP_DIR ${PICO_SDK_PATH}/lib/lwip ABSOLUTE)
+
+find_package(Threads REQUIRED)
+
+# The FreeRTOS kernel's own CMake wants a freertos_config target that carries the
+# include path for FreeRTOSConfig.h. host/include comes first so that the host
+# overrides in there win over the firmware's include/ directory.
+add_library(freertos_config INTERFACE)
+target_include_directories(freertos_config SYSTEM INTERFACE
+    ${HOST_DIR}/include
+    ${CMAKE_CURRENT_SOURCE_DIR}/include)
+
+set(FREERTOS_PORT GCC_POSIX CACHE STRING "" FORCE)
+set(FREERTOS_HEAP "4" CACHE STRING "" FORCE)
+add_subdirectory(${FREERTOS_KERNEL_PATH} FreeRTOS-Kernel)
+
+# lwIP, built the same way pico_lwip does it, but with the contrib FreeRTOS
+# sys_arch and the host arch/cc.h instead of the Pico one.
+include(${LWIP_DIR}/src/Filelists.cmake)
+
+add_library(lwip_host STATIC
+    ${lwipcore_SRCS}
+    ${lwipcore4_SRCS}
+    ${lwipapi_SRCS}
+    ${LWIP_DIR}/src/netif/ethernet.c
+    ${LWIP_DIR}/src/apps/sntp/sntp.c
+    ${LWIP_DIR}/contrib/ports/freertos/sys_arch.c
+    src/ip_checksum.c
+)
+
+target_include_directories(lwip_host PUBLIC
+    ${HOST_DIR}/include
+    ${CMAKE_CURRENT_SOURCE_DIR}/include
+    ${LWIP_DIR}/src/include
+    ${LWIP_DIR}/contrib/ports/freertos/include
+)
+
+target_link_libraries(lwip_host PUBLIC
+    freertos_kernel
+    Threads::Threads)
+
+# Stand-ins for the bits of the Pico SDK the application touches
+add_library(pico_host STATIC
+    ${HOST_DIR}/pico_host.c
+    ${HOST_DIR}/cyw43_arch_host.c
+    ${HOST_DIR}/sim_net.c
+    src/block_pool.c
+)
+
+target_include_directories(pico_host PUBLIC src/)
+
+target_link_libraries(pico_host PUBLIC lwip_host)
+
+set(HOST_OUTPUT_NAME ${OUTPUT_NAME}_host)
+
+add_executable(${HOST_OUTPUT_NAME}
+    src/main.cpp
+    src/wifi.cpp
+    src/event_loop.cpp
+    src/power_policy.cpp
+    src/packet_filter.cpp
+    src/network_time.cpp
+    src/disciplined_clock.cpp
+    src/ntp_selector.cpp
+    src/lan_time.cpp
+    src/lan_time_sync.cpp
+    src/pixel_receiver.cpp
+    src/frame_codec.cpp
+    src/strip_output.cpp
+    src/frame_scheduler.cpp
+    src/pixel_kernels.cpp
+    src/strip_layout.cpp
+    src/system_metrics.cpp
+    src/logger.cpp
+    src/udp_log_sink.cpp
+    src/tx_pbufs.cpp
+    ${HOST_DIR}/strip_pio_host.cpp
+    src/config_store.cpp
+    ${HOST_DIR}/config_flash_host.cpp
+    ${HOST_DIR}/ram_flash.cpp
+    ${HOST_DIR}/host_monitor.cpp
+)
+
+target_include_directories(${HOST_OUTPUT_NAME} PUBLIC
+    src/
+)
+
+target_link_libraries(${HOST_OUTPUT_NAME} pico_host)
+
+# The host application doubles as the test of the real WifiConnection:
+# host_monitor.cpp fails the run unless every access point drop is detected
+# by the link event, rejoined, and EVENT_WIFI_JOINED's waiters resumed.
+#
+#   ctest --test-dir build-host
+#
+enable_testing()
+add_test(NAME wifi_reconnect COMMAND ${HOST_OUTPUT_NAME})
+set_tests_properties(wifi_reconnect PROPERTIES TIMEOUT 300)
+
+# The latency responder firmware, with its ports bridged out of the simulated
+# network to 127.0.0.1 so latency_probe can reach it
+add_executable(latency_responder_host
+    src/latency_main.cpp
+    src/latency_responder.cpp
+    src/wifi.cpp
+    src/event_loop.cpp
+    src/power_policy.cpp
+    src/packet_filter.cpp
+    src/logger.cpp
+    src/config_store.cpp
+    ${HOST_DIR}/config_flash_host.cpp
+    ${HOST_DIR}/ram_flash.cpp
+    ${HOST_DIR}/latency_host.cpp
+)
+
+target_include_directories(latency_responder_host PUBLIC
+    src/
+)
+
+target_link_libraries(latency_responder_host pico_host)
+
+# The throughput servers, with an iperf client in the same process sending to
+# the node's own address over a simulated link; prints one THROUGHPUT RESULT
+# line and exits
+add_executable(throughput_server_host
+    src/throughput_main.cpp
+    src/throughput_server.cpp
+    src/wifi.cpp
+    src/event_loop.cpp
+    src/power_policy.cpp
+    src/packet_filter.cpp
+    src/logger.cpp
+    src/config_store.cpp
+    ${HOST_DIR}/config_flash_host.cpp
+    ${HOST_DIR}/ram_flash.cpp
+    ${HOST_DIR}/throughput_host.cpp
+    ${LWIP_DIR}/src/apps/lwiperf/lwiperf.c
+)
+
+target_include_directories(throughput_server_host PUBLIC
+    src/
+)
+
+target_link_libraries(throughput_server_host pico_host)
+
+# Host-side benchmarks. These link against the same lwIP and FreeRTOS as the
+# host application but run as plain programs, without starting the scheduler.
+add_executable(pixel_receiver_bench
+    bench/pixel_receiver_bench.cpp
+    src/pixel_receiver.cpp
+    src/frame_codec.cpp
+    src/wifi.cpp
+    src/event_loop.cpp
+    src/power_policy.cpp
+    src/packet_filter.cpp
+    src/logger.cpp
+)
+
+target_include_directories(pixel_receiver_bench PUBLIC
+    src/
+)
+
+target_link_libraries(pixel_receiver_bench pico_host)
+
+add_executable(strip_output_bench
+    bench/strip_output_bench.cpp
+    src/strip_output.cpp
+    src/pixel_kernels.cpp
+    ${HOST_DIR}/mock_strip_backend.cpp
+)
+
+target_include_directories(strip_output_bench PUBLIC
+    src/
+    ${HOST_DIR}
+)
+
+target_link_libraries(strip_output_bench pico_host)
+
+add_executable(config_store_bench
+    bench/config_store_bench.cpp
+    src/config_store.cpp
+    src/logger.cpp
+    ${HOST_DIR}/ram_flash.cpp
+)
+
+target_include_directories(config_store_bench PUBLIC
+    src/
+    ${HOST_DIR}
+)
+
+target_link_libraries(config_store_bench pico_host)
+
+add_executable(clock_discipline_bench
+    bench/clock_discipline_bench.cpp
+    src/disciplined_clock.cpp
+)
+
+target_include_directories(clock_discipline_bench PUBLIC
+    src/
+)
+
+add_executable(ntp_selection_bench
+    bench/ntp_selection_bench.cpp
+    src/ntp_selector.cpp
+    src/disciplined_clock.cpp
+)
+
+target_include_directories(ntp_selection_bench PUBLIC
+    src/
+)
+
+add_executable(lan_time_bench
+    bench/lan_time_bench.cpp
+    src/lan_time.cpp
+    src/disciplined_clock.cpp
+)
+
+target_include_directories(lan_time_bench PUBLIC
+    src/
+)
+
+add_executable(frame_scheduler_bench
+    bench/frame_scheduler_bench.cpp
+    src/frame_scheduler.cpp
+    src/pixel_kernels.cpp
+    src/strip_output.cpp
+    src/disciplined_clock.cpp
+    ${HOST_DIR}/mock_strip_backend.cpp
+)
+
+target_include_directories(frame_scheduler_bench PUBLIC
+    src/
+    ${HOST_DIR}
+)
+
+target_link_libraries(frame_scheduler_bench pico_host)
+
+add_executable(frame_handoff_bench
+    bench/frame_handoff_bench.cpp
+    src/frame_scheduler.cpp
+    src/pixel_kernels.cpp
+    src/strip_output.cpp
+    src/disciplined_clock.cpp
+)
+
+target_include_directories(frame_handoff_bench PUBLIC
+    src/
+)
+
+target_link_libraries(frame_handoff_bench pico_host)
+
+add_executable(block_pool_bench
+    bench/block_pool_bench.cpp
+)
+
+target_include_directories(block_pool_bench PUBLIC
+    src/
+)
+
+target_link_libraries(block_pool_bench pico_host)
+
+add_executable(ip_checksum_bench
+    bench/ip_checksum_bench.cpp
+    src/ip_checksum.c
+)
+
+target_include_directories(ip_checksum_bench PUBLIC
+    src/
+)
+
+add_executable(pixel_kernels_bench
+    bench/pixel_kernels_bench.cpp
+    src/pixel_kernels.cpp
+)
+
+target_include_directories(pixel_kernels_bench PUBLIC
+    src/
+)
+
+add_executable(strip_layout_bench
+    bench/strip_layout_bench.cpp
+    src/strip_layout.cpp
+    src/pixel_kernels.cpp
+    src/logger.cpp
+)
+
+target_include_directories(strip_layout_bench PUBLIC
+    src/
+)
+
+target_link_libraries(strip_layout_bench pico_host)
+
+add_executable(frame_codec_bench
+    bench/frame_codec_bench.cpp
+    src/frame_codec.cpp
+)
+
+target_include_directories(frame_codec_bench PUBLIC
+    src/
+)
+
+# Plain POSIX sockets; it talks to a board as happily as to the host responder
+add_executable(latency_probe
+    bench/latency_probe.cpp
+)
+
+target_include_directories(latency_probe PUBLIC
+    src/
+)
+
+target_link_libraries(latency_probe Threads::Threads)
+
+add_executable(logger_bench
+    bench/logger_bench.cpp
+    src/logger.cpp
+)
+
+target_include_directories(logger_bench PUBLIC
+    src/
+)
+
+target_link_libraries(logger_bench pico_host)
+
+add_executable(event_loop_bench
+    bench/event_loop_bench.cpp
+    src/event_loop.cpp
+    src/logger.cpp
+)
+
+target_include_directories(event_loop_bench PUBLIC
+    src/
+)
+
+target_link_libraries(event_loop_bench pico_host)
+
+add_executable(power_policy_bench
+    bench/power_policy_bench.cpp
+    src/power_policy.cpp
+)
+
+target_include_directories(power_policy_bench PUBLIC
+    src/
+)
@@ -0,0 +1,294 @@
+/*
+ * host_monitor.cpp
+ *
+ * Watches the unmodified application boot on the host build and prints the
+ * numbers we'd otherwise need a board on the bench for: time from scheduler
+ * start to CYW43 init, to joined, and to the first SNTP sync, and how far the
+ * disciplined clock is from the simulated NTP server's; the outage seen
+ * by consumers when the access point disappears and comes back, split into
+ * how long the connection took to notice and how long it took to rejoin,
+ * and when a subscribed task heard about each;
+ * what the event loop running both of those did; how long the radio spent
+ * in each power-management mode;
+ * FreeRTOS heap and block pool usage; what the packet filter let through and
+ * turned away; and the last SystemMetrics sample, with what taking it
+ * cost. Exits the process when it's done, so it can be run in a loop.
+ *
+ * It's also the host build's test of the real WifiConnection (ctest runs it).
+ * Every cycle has to see the drop detected by the link event rather than a
+ * poll, a rejoin, and a waiter on EVENT_WIFI_JOINED, put on the event loop
+ * while the link was down, resumed; if any of that doesn't happen it says
+ * which and exits with EXIT_FAILURE.
+ *
+ *   HOST_RECONNECT_CYCLES   number of access point drop/restore cycles (3)
+ *   HOST_OUTAGE_MS          how long the access point stays away (1000)
+ *   HOST_CLOCK_SECONDS      how long to keep watching the clock afterwards (0)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include "event_loop.h"
+#include "wifi.h"
+#include "network_time.h"
+#include "system_metrics.h"
+#include "block_pool.h"
+#include "packet_filter.h"
+
+extern "C" {
+    #include "FreeRTOS.h"
+    #include "task.h"
+    #include "sim_net.h"
+}
+
+
+#define HOST_REJOIN_TIMEOUT_MS      60000
+
+
+/***
+ * How far NetworkTime's clock is from the simulated NTP server's, which is
+ * the truth as far as the application is concerned.
+ */
+static void print_clock_error(NetworkTime& network_time) {
+    int64_t error_us = (int64_t)(network_time.now_us() - sim_net_ntp_time_us());
+    const clock_stats_t *stats = network_time.get_clock_stats();
+
+    printf("HOST CLOCK: %+lld us FROM SERVER, %lu SAMPLES, %lu STEPS, %lu SPIKES, FREQ %ld ppb, JITTER %lu us\n",
+           (long long)error_us, (unsigned long)stats->samples, (unsigned long)stats->steps,
+           (unsigned long)stats->spikes, (long)stats->freq_ppb, (unsigned long)stats->jitter_us);
+
+    const ntp_selection_stats_t *selection = network_time.get_selection_stats();
+    if(selection->rounds) {
+        printf("HOST NTP SELECTION: %lu ROUNDS, %lu SELECTIONS, %lu NO MAJORITY, %lu STALE, %lu SURVIVORS\n",
+               (unsigned long)selection->rounds, (unsigned long)selection->selections,
+               (unsigned long)selection->no_majority, (unsigned long)selection->stale,
+               (unsigned long)selection->survivors);
+    }
+}
+
+
+// A waiter on EVENT_WIFI_JOINED, the way the services wait for the network
+typedef struct {
+    volatile bool armed;            // when() took it while the link was down
+    volatile bool done;
+    volatile bool met;
+    volatile uint64_t resumed_us;
+} joined_waiter_t;
+
+
+static void joined_waiter_resumed(void *arg, bool met) {
+    joined_waiter_t *waiter = (joined_waiter_t *)arg;
+
+    waiter->resumed_us = time_us_64();
+    waiter->met = met;
+    waiter->done = true;
+}
+
+
+// Posted, since when() is only for the loop's own callbacks
+static void arm_joined_waiter(void *arg) {
+    joined_waiter_t *waiter = (joined_waiter_t *)arg;
+    EventLoop& loop = EventLoop::getInstance();
+
+    if(loop.get_conditions() & EVENT_WIFI_JOINED) {
+        waiter->done = true;
+        return;
+    }
+    waiter->armed = loop.when(EVENT_WIFI_JOINED, joined_waiter_resumed, waiter, HOST_REJOIN_TIMEOUT_MS);
+    if(!waiter->armed) {
+        waiter->done = true;
+    }
+}
+
+
+static void reconnect_failed(uint32_t cycle, const char *what) {
+    printf("HOST RECONNECT %lu: FAILED, %s\n", (unsigned long)cycle, what);
+    exit(EXIT_FAILURE);
+}
+
+
+/***
+ * Takes the monitor task's wifi events until one of the ones asked for
+ * comes, and returns when it did, or 0 if timeout_ms went by first.
+ */
+static uint64_t wait_for_event(uint32_t events, uint32_t timeout_ms) {
+    TickType_t end = xTaskGetTickCount() + pdMS_TO_TICKS(timeout_ms);
+    TickType_t now;
+
+    while((int32_t)(end - (now = xTaskGetTickCount())) > 0) {
+        if(WifiConnection::take_events(end - now) & events) {
+            return time_us_64();
+        }
+    }
+    return 0;
+}
+
+
+static void print_metrics() {
+    const metrics_snapshot_t *metrics = SystemMetrics::getInstance().get_snapshot();
+
+    printf("HOST METRICS: SAMPLE %lu, COLLECTED IN %lu us (MAX %lu us) OVER A %lu us WINDOW, %u OF %u TASKS\n",
+           (unsigned long)metrics->sequence, (unsigned long)metrics->collect_us,
+           (unsigned long)metrics->collect_max_us, (unsigned long)metrics->window_us,
+           metrics->task_count, metrics->tasks_total);
+    for(int i = 0; i < metrics->task_count; i++) {
+        const metrics_task_t *task = &metrics->tasks[i];
+        printf("    TASK %-16s CPU %3u.%u%%, PRIORITY %u, STACK FREE %lu BYTES\n",
+               task->name, task->cpu_permille / 10, task->cpu_permille % 10, task->priority,
+               (unsigned long)task->stack_free_bytes);
+    }
+    printf("    LWIP HEAP: %u USED, %u MAX, %u ERRORS\n",
+           metrics->mem.used, metrics->mem.max, metrics->mem.err);
+    for(int i = 0; i < METRICS_POOL_COUNT; i++) {
+        const metrics_pool_t *pool = &metrics->pools[i];
+        printf("    POOL %-12s %u/%u USED, %u MAX, %u ERRORS\n", SystemMetrics::get_pool_name(i),
+               pool->used, pool->avail, pool->max, pool->err);
+    }
+    printf("    LINK: %lu SENT, %lu RECEIVED, %lu DROPPED, %lu OUT OF MEMORY\n",
+           (unsigned long)metrics->link_xmit, (unsigned long)metrics->link_recv,
+           (unsigned long)metrics->link_drop, (unsigned long)metrics->link_memerr);
+}
+
+
+static void host_monitor_task(void *params) {
+    WifiConnection& wifi = WifiConnection::getInstance();
+    NetworkTime& network_time = NetworkTime::getInstance();
+    uint32_t cycles = sim_net_env_u32("HOST_RECONNECT_CYCLES", 3);
+    uint32_t outage_ms = sim_net_env_u32("HOST_OUTAGE_MS", 1000);
+    uint32_t clock_seconds = sim_net_env_u32("HOST_CLOCK_SECONDS", 0);
+    uint64_t start_us = time_us_64();
+
+    wifi.wait_for_cyw43_init();
+    uint64_t cyw43_us = time_us_64();
+
+    wifi.wait_for_wifi_init();
+    uint64_t joined_us = time_us_64();
+
+    while(!network_time.is_synchronized()) {
+        vTaskDelay(1);
+    }
+    uint64_t synced_us = time_us_64();
+
+    printf("HOST BOOT: CYW43 INIT %llu us, JOINED %llu us, FIRST SNTP SYNC %llu us\n",
+           (unsigned long long)(cyw43_us - start_us),
+           (unsigned long long)(joined_us - start_us),
+           (unsigned long long)(synced_us - start_us));
+    print_clock_error(network_time);
+
+    wifi.subscribe_task(WIFI_EVENT_LINK_LOST | WIFI_EVENT_IP_BOUND, xTaskGetCurrentTaskHandle());
+    for(uint32_t i = 0; i < cycles; i++) {
+        const wifi_link_stats_t *link = wifi.get_link_stats();
+        uint32_t event_detections = link->event_detections;
+        uint32_t polled_detections = link->polled_detections;
+        uint32_t rejoins = link->rejoins;
+        joined_waiter_t waiter = { false, false, false, 0 };
+
+        WifiConnection::take_events(0);
+
+        uint64_t drop_us = time_us_64();
+        sim_net_set_ap_present(false);
+        uint64_t lost_us = wait_for_event(WIFI_EVENT_LINK_LOST, outage_ms);
+        if(lost_us == 0) {
+            reconnect_failed(i, "LINK LOSS NOT HEARD WHILE THE AP WAS GONE");
+        }
+        if(link->event_detections != event_detections + 1 || link->polled_detections != polled_detections) {
+            reconnect_failed(i, "DROP NOT DETECTED BY THE LINK EVENT");
+        }
+        if(!EventLoop::getInstance().post(arm_joined_waiter, &waiter)) {
+            reconnect_failed(i, "EVENT LOOP QUEUE FULL");
+        }
+
+        uint64_t elapsed_ms = (time_us_64() - drop_us) / 1000;
+        if(elapsed_ms < outage_ms) {
+            vTaskDelay(pdMS_TO_TICKS(outage_ms - elapsed_ms));
+        }
+        sim_net_set_ap_present(true);
+
+        uint64_t bound_us = wait_for_event(WIFI_EVENT_IP_BOUND, HOST_REJOIN_TIMEOUT_MS);
+        if(bound_us == 0) {
+            printf("HOST RECONNECT %lu: NOT REJOINED AFTER %u ms\n", (unsigned long)i, HOST_REJOIN_TIMEOUT_MS);
+            exit(EXIT_FAILURE);
+        }
+        if(link->rejoins != rejoins + 1) {
+            reconnect_failed(i, "IP BOUND WITHOUT A REJOIN");
+        }
+
+        TickType_t end = xTaskGetTickCount() + pdMS_TO_TICKS(HOST_REJOIN_TIMEOUT_MS);
+        while(!waiter.done && (int32_t)(end - xTaskGetTickCount()) > 0) {
+            vTaskDelay(1);
+        }
+        if(!waiter.armed) {
+            reconnect_failed(i, "NO EVENT_WIFI_JOINED WAITER WHILE THE LINK WAS DOWN");
+        }
+        if(!waiter.met) {
+            reconnect_failed(i, "EVENT_WIFI_JOINED WAITER NOT RESUMED");
+        }
+
+        printf("HOST RECONNECT %lu: AP GONE %lu ms, LINK DROP TO DETECTED %llu us, "
+               "DETECTED TO REJOINED %lu us, LINK DROP TO REJOINED %llu us; "
+               "LINK LOST HEARD %llu us, IP BOUND HEARD %llu us, JOINED WAITER RESUMED %llu us AFTER THE DROP\n",
+               (unsigned long)i, (unsigned long)outage_ms,
+               (unsigned long long)(link->last_detect_us - drop_us),
+               (unsigned long)link->detect_to_rejoin_last_us,
+               (unsigned long long)(link->last_rejoin_us - drop_us),
+               (unsigned long long)(lost_us - drop_us),
+               (unsigned long long)(bound_us - drop_us),
+               (unsigned long long)(waiter.resumed_us - drop_us));
+    }
+
+    for(uint32_t s = 0; s < clock_seconds; s += 10) {
+        vTaskDelay(pdMS_TO_TICKS(10000));
+        print_clock_error(network_time);
+    }
+
+    const wifi_link_stats_t *link = wifi.get_link_stats();
+    printf("HOST LINK: %lu DOWN (%lu EVENT, %lu POLLED), %lu REJOINED, %lu JOIN FAILURES, "
+           "DETECT MAX %lu us, REJOIN MAX %lu us\n",
+           (unsigned long)link->link_downs, (unsigned long)link->event_detections,
+           (unsigned long)link->polled_detections, (unsigned long)link->rejoins,
+           (unsigned long)link->join_failures, (unsigned long)link->down_to_detect_max_us,
+           (unsigned long)link->detect_to_rejoin_max_us);
+    printf("HOST JOINS: %lu FAST, %lu FAST FAILED, %lu FULL\n",
+           (unsigned long)link->fast_joins, (unsigned long)link->fast_join_failures,
+           (unsigned long)link->full_joins);
+
+    const power_policy_stats_t *power = wifi.get_power_stats();
+    printf("HOST POWER: NOW %s, %lu UP AND %lu DOWN SWITCHES; LOW LATENCY %llu ms, PERFORMANCE %llu ms, "
+           "POWER SAVE %llu ms\n",
+           PowerPolicy::get_mode_name(wifi.get_power_mode()), (unsigned long)power->switches_up,
+           (unsigned long)power->switches_down,
+           (unsigned long long)(power->time_in_mode_us[POWER_MODE_LOW_LATENCY] / 1000),
+           (unsigned long long)(power->time_in_mode_us[POWER_MODE_PERFORMANCE] / 1000),
+           (unsigned long long)(power->time_in_mode_us[POWER_MODE_POWER_SAVE] / 1000));
+
+    const event_loop_stats_t *loop = EventLoop::getInstance().get_stats();
+    printf("HOST EVENT LOOP: %lu WAKEUPS, %lu CALLBACKS (%lu TIMERS, %lu POSTED, %lu WAITS, %lu TIMED OUT), "
+           "LONGEST CALLBACK %lu us, MOST LATE %lu us\n",
+           (unsigned long)loop->dispatches, (unsigned long)loop->callbacks, (unsigned long)loop->timers_fired,
+           (unsigned long)loop->posted, (unsigned long)loop->waits_met, (unsigned long)loop->waits_timed_out,
+           (unsigned long)loop->callback_max_us, (unsigned long)loop->late_max_us);
+
+    printf("HOST HEAP: FREE %lu, MIN EVER FREE %lu OF %lu BYTES\n",
+           (unsigned long)xPortGetFreeHeapSize(),
+           (unsigned long)xPortGetMinimumEverFreeHeapSize(),
+           (unsigned long)configTOTAL_HEAP_SIZE);
+    for(const block_pool_t *pool = block_pool_first(); pool != NULL; pool = pool->next) {
+        printf("HOST BLOCK POOL %-10s %lu/%lu USED, %lu MAX, %lu ALLOCATIONS, %lu FAILED, %lu BYTES EACH\n",
+               pool->name, (unsigned long)pool->used, (unsigned long)pool->block_count,
+               (unsigned long)pool->max_used, (unsigned long)pool->allocs, (unsigned long)pool->failed,
+               (unsigned long)pool->block_size);
+    }
+    const packet_filter_stats_t *filter = PacketFilter::getInstance().get_stats();
+    printf("HOST PACKET FILTER: %lu ACCEPTED, DROPPED %lu PORT, %lu GROUP, %lu UNIVERSE, %lu PROTOCOL, "
+           "%lu MAILBOX OVERFLOWS\n",
+           (unsigned long)filter->accepted, (unsigned long)filter->dropped_port,
+           (unsigned long)filter->dropped_group, (unsigned long)filter->dropped_universe,
+           (unsigned long)filter->dropped_protocol, (unsigned long)filter->mailbox_overflows);
+    print_metrics();
+
+    exit(EXIT_SUCCESS);
+}
+
+
+extern "C" void vApplicationDaemonTaskStartupHook(void) {
+    xTaskCreate(host_monitor_task, "Host Monitor", configMINIMAL_STACK_SIZE, NULL, 1, NULL);
+}
@@ -0,0 +1,57 @@
+/*
+ * Host build overrides for FreeRTOSConfig.h
+ *
+ * Pulls in the firmware's configuration and then changes only what the POSIX
+ * port needs to be different. Every FreeRTOS task is backed by a pthread on
+ * the host, and pthreads need a lot more stack than a Cortex-M0+ does, so the
+ * stack sizes and the heap they come out of get bigger here. Heap numbers from
+ * the host build are therefore only useful relative to each other.
+ */
+#ifndef HOST_FREERTOS_CONFIG_H
+#define HOST_FREERTOS_CONFIG_H
+
+// The POSIX port only runs one core
+#define configNUMBER_OF_CORES                   1
+
+#include "../../include/FreeRTOSConfig.h"
+
+#define HOST_TASK_STACK_SIZE                    4096
+
+#undef configSTACK_DEPTH_TYPE
+#define configSTACK_DEPTH_TYPE                  uint32_t
+
+#undef configMINIMAL_STACK_SIZE
+#define configMINIMAL_STACK_SIZE                HOST_TASK_STACK_SIZE
+
+#undef configTIMER_TASK_STACK_DEPTH
+#define configTIMER_TASK_STACK_DEPTH            HOST_TASK_STACK_SIZE
+
+#undef configTOTAL_HEAP_SIZE
+#define configTOTAL_HEAP_SIZE                   ((size_t)1024*1024)
+
+// The host monitor task is started from the timer daemon startup hook so that
+// main.cpp doesn't have to know it's running on a Linux box
+#undef configUSE_DAEMON_TASK_STARTUP_HOOK
+#define configUSE_DAEMON_TASK_STARTUP_HOOK      1
+
+#define EVENT_LOOP_TASK_STACK_SIZE              HOST_TASK_STACK_SIZE
+#define FRAME_SCHEDULER_TASK_STACK_SIZE         HOST_TASK_STACK_SIZE
+#define METRICS_TASK_STACK_SIZE                 HOST_TASK_STACK_SIZE
+#define LOG_TASK_STACK_SIZE                     HOST_TASK_STACK_SIZE
+
+// Every heap allocation and free can be recorded to HOST_ALLOC_TRACE_FILE,
+// for bench/block_pool_bench to replay; see host/pico_host.c
+#ifndef __ASSEMBLER__
+#ifdef __cplusplus
+extern "C" {
+#endif
+void host_trace_malloc(void *pointer, unsigned long size);
+void host_trace_free(void *pointer);
+#ifdef __cplusplus
+}
+#endif
+#endif
+#define traceMALLOC(pointer, size)              host_trace_malloc(pointer, (unsigned long)(size))
+#define traceFREE(pointer, size)                host_trace_free(pointer)
+
+#endif /* HOST_FREERTOS_CONFIG_H */
@@ -0,0 +1,23 @@
+/*
+ * lwIP compiler/platform glue for the host build. The Pico SDK carries its own
+ * arch/cc.h in pico_lwip; this is the Linux equivalent.
+ */
+#ifndef __HOST_ARCH_CC_H__
+#define __HOST_ARCH_CC_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define LWIP_ERRNO_STDINCLUDE 1
+
+#define LWIP_PLATFORM_DIAG(x) do { printf x; } while(0)
+#define LWIP_PLATFORM_ASSERT(x) do { \
+    printf("ASSERTION \"%s\" FAILED AT LINE %d IN %s\n", x, __LINE__, __FILE__); \
+    fflush(NULL); \
+    abort(); \
+} while(0)
+
+#define LWIP_RAND() ((u32_t)rand())
+
+#endif
@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for hardware/pio.h: just enough for strip_pio.h to compile.
+ * There's no PIO on the host; host/strip_pio_host.cpp times frames instead.
+ */
+#ifndef __HOST_HARDWARE_PIO_H__
+#define __HOST_HARDWARE_PIO_H__
+
+#include "pico/stdlib.h"
+
+typedef struct pio_hw pio_hw_t;
+typedef pio_hw_t *PIO;
+
+#define pio0 ((PIO)NULL)
+
+#endif
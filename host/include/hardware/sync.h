@@ -0,0 +1,28 @@
+/*
+ * Host stand-in for hardware/sync.h: turning interrupts off and on, and spin
+ * locks. See host/pico_host.c for what that means on the POSIX port.
+ */
+#ifndef __HOST_HARDWARE_SYNC_H__
+#define __HOST_HARDWARE_SYNC_H__
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+
+typedef volatile uint32_t spin_lock_t;
+
+int spin_lock_claim_unused(bool required);
+spin_lock_t *spin_lock_instance(unsigned int lock_num);
+uint32_t spin_lock_blocking(spin_lock_t *lock);
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
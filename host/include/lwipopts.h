@@ -0,0 +1,36 @@
+/*
+ * Host build overrides for lwipopts.h
+ *
+ * The firmware's lwipopts.h is the single source of truth for pool and window
+ * sizes; this only adjusts what has to differ when lwIP runs on the FreeRTOS
+ * POSIX port against the simulated network in host/sim_net.c.
+ */
+#ifndef _HOST_LWIPOPTS_H
+#define _HOST_LWIPOPTS_H
+
+#include "../../include/lwipopts.h"
+#include "FreeRTOSConfig.h"
+
+#undef TCPIP_THREAD_STACKSIZE
+#define TCPIP_THREAD_STACKSIZE      HOST_TASK_STACK_SIZE
+#undef DEFAULT_THREAD_STACKSIZE
+#define DEFAULT_THREAD_STACKSIZE    HOST_TASK_STACK_SIZE
+
+// There's no DNS server on the simulated network, so the pool names NetworkTime
+// registers resolve to the fake NTP server through the local host list
+#define SIM_NET_SERVER_ADDR         IPADDR4_INIT_BYTES(10, 0, 0, 1)
+#define DNS_LOCAL_HOSTLIST          1
+#define DNS_LOCAL_HOSTLIST_INIT { \
+    DNS_LOCAL_HOSTLIST_ELEM("0.us.pool.ntp.org", SIM_NET_SERVER_ADDR), \
+    DNS_LOCAL_HOSTLIST_ELEM("1.us.pool.ntp.org", SIM_NET_SERVER_ADDR), \
+    DNS_LOCAL_HOSTLIST_ELEM("2.us.pool.ntp.org", SIM_NET_SERVER_ADDR), \
+    DNS_LOCAL_HOSTLIST_ELEM("3.us.pool.ntp.org", SIM_NET_SERVER_ADDR)  \
+}
+
+// CYW43 debug switches mean nothing without the CYW43
+#undef CYW43_VERBOSE_DEBUG
+#undef CYW43_DEBUG
+#undef CYW43_INFO
+#undef PICO_CYW43_ARCH_DEBUG_ENABLED
+
+#endif
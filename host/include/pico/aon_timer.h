@@ -0,0 +1,25 @@
+/*
+ * Host stand-in for pico/aon_timer.h. The "always on" timer is modelled as an
+ * offset on top of the host's monotonic clock.
+ */
+#ifndef __HOST_PICO_AON_TIMER_H__
+#define __HOST_PICO_AON_TIMER_H__
+
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool aon_timer_start(const struct timespec *ts);
+bool aon_timer_set_time(const struct timespec *ts);
+bool aon_timer_get_time(struct timespec *ts);
+void aon_timer_stop(void);
+bool aon_timer_is_running(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Host stand-in for pico/cyw43_arch.h and the slice of the CYW43 driver API the
+ * application uses. There's no radio: "joining" associates with the simulated
+ * access point in host/sim_net.c, and the STA netif hands its IP packets to
+ * that simulation instead of an SPI bus.
+ *
+ * Names, signatures and constants follow the Pico SDK 2.1 / cyw43-driver ones,
+ * so code that builds here builds against the real thing.
+ */
+#ifndef __HOST_PICO_CYW43_ARCH_H__
+#define __HOST_PICO_CYW43_ARCH_H__
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lwip/netif.h"
+#include "lwip/dhcp.h"
+#include "lwip/tcpip.h"
+
+#define CYW43_ITF_STA               0
+#define CYW43_ITF_AP                1
+
+#define CYW43_LINK_DOWN             (0)
+#define CYW43_LINK_JOIN             (1)
+#define CYW43_LINK_NOIP             (2)
+#define CYW43_LINK_UP               (3)
+#define CYW43_LINK_FAIL             (-1)
+#define CYW43_LINK_NONET            (-2)
+#define CYW43_LINK_BADAUTH          (-3)
+
+#define CYW43_AUTH_OPEN             (0)
+#define CYW43_AUTH_WPA_TKIP_PSK     (0x00200002)
+#define CYW43_AUTH_WPA2_AES_PSK     (0x00400004)
+#define CYW43_AUTH_WPA2_MIXED_PSK   (0x00400006)
+
+#define CYW43_CHANNEL_NONE          (0xffffffff)
+
+#define CYW43_IOCTL_GET_CHANNEL     (0x3a)
+
+#define CYW43_NO_POWERSAVE_MODE     (0)
+#define CYW43_PM1_POWERSAVE_MODE    (1)
+#define CYW43_PM2_POWERSAVE_MODE    (2)
+
+#define cyw43_pm_value(pm_mode, pm2_sleep_ret_ms, li_beacon_period, li_dtim_period, li_assoc) \
+    ((li_assoc) << 20 | (li_dtim_period) << 16 | (li_beacon_period) << 12 | ((pm2_sleep_ret_ms) / 10) << 4 | (pm_mode))
+
+#define CYW43_DEFAULT_PM            cyw43_pm_value(CYW43_PM2_POWERSAVE_MODE, 200, 1, 1, 10)
+#define CYW43_NONE_PM               cyw43_pm_value(CYW43_NO_POWERSAVE_MODE, 10, 0, 0, 0)
+#define CYW43_AGGRESSIVE_PM         cyw43_pm_value(CYW43_PM1_POWERSAVE_MODE, 10, 0, 0, 0)
+#define CYW43_PERFORMANCE_PM        cyw43_pm_value(CYW43_PM2_POWERSAVE_MODE, 20, 1, 1, 1)
+
+typedef struct _cyw43_t {
+    int itf_state;
+    int wifi_join_state;
+    uint32_t pm;
+    uint8_t mac[6];
+    struct netif netif[2];
+} cyw43_t;
+
+extern cyw43_t cyw43_state;
+
+int cyw43_arch_init(void);
+void cyw43_arch_deinit(void);
+void cyw43_arch_enable_sta_mode(void);
+int cyw43_arch_wifi_connect_timeout_ms(const char *ssid, const char *pw, uint32_t auth, uint32_t timeout);
+int cyw43_arch_wifi_connect_bssid_timeout_ms(const char *ssid, const uint8_t *bssid, const char *pw, uint32_t auth, uint32_t timeout);
+int cyw43_arch_wifi_connect_async(const char *ssid, const char *pw, uint32_t auth);
+void cyw43_arch_lwip_begin(void);
+void cyw43_arch_lwip_end(void);
+
+int cyw43_wifi_pm(cyw43_t *self, uint32_t pm);
+int cyw43_wifi_get_pm(cyw43_t *self, uint32_t *pm);
+int cyw43_wifi_link_status(cyw43_t *self, int itf);
+int cyw43_tcpip_link_status(cyw43_t *self, int itf);
+int cyw43_wifi_join(cyw43_t *self, size_t ssid_len, const uint8_t *ssid, size_t key_len, const uint8_t *key,
+                    uint32_t auth_type, const uint8_t *bssid, uint32_t channel);
+int cyw43_wifi_leave(cyw43_t *self, int itf);
+int cyw43_wifi_get_bssid(cyw43_t *self, uint8_t bssid[6]);
+int cyw43_ioctl(cyw43_t *self, uint32_t cmd, size_t len, uint8_t *buf, uint32_t iface);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
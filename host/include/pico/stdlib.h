@@ -0,0 +1,47 @@
+/*
+ * Host stand-in for the parts of pico/stdlib.h the application uses. The real
+ * header drags in stdio, string and friends transitively, and the application
+ * code leans on that, so this does too.
+ */
+#ifndef __HOST_PICO_STDLIB_H__
+#define __HOST_PICO_STDLIB_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum pico_error_codes {
+    PICO_OK = 0,
+    PICO_ERROR_NONE = 0,
+    PICO_ERROR_GENERIC = -1,
+    PICO_ERROR_TIMEOUT = -2,
+    PICO_ERROR_NO_DATA = -3,
+    PICO_ERROR_NOT_PERMITTED = -4,
+    PICO_ERROR_INVALID_ARG = -5,
+    PICO_ERROR_IO = -6,
+    PICO_ERROR_BADAUTH = -7,
+    PICO_ERROR_CONNECT_FAILED = -8,
+    PICO_ERROR_INSUFFICIENT_RESOURCES = -9,
+};
+
+bool stdio_init_all(void);
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+
+// Microseconds since the process started, standing in for the RP2040 timer
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
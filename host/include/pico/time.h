@@ -0,0 +1,33 @@
+/*
+ * Host stand-in for the alarm part of pico/time.h. Alarms are one-shot FreeRTOS
+ * software timers, so callbacks run in the timer task (not an interrupt) and
+ * resolve to the tick rather than the microsecond; re-arming by returning a
+ * non-zero value from the callback isn't supported.
+ */
+#ifndef __HOST_PICO_TIME_H__
+#define __HOST_PICO_TIME_H__
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int32_t alarm_id_t;
+typedef int64_t (*alarm_callback_t)(alarm_id_t id, void *user_data);
+
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback, void *user_data, bool fire_if_past);
+
+// There's only the one pool here; a pool "created" for another core is it
+typedef struct host_alarm_pool alarm_pool_t;
+
+alarm_pool_t *alarm_pool_get_default(void);
+alarm_pool_t *alarm_pool_create_with_unused_hardware_alarm(unsigned int max_timers);
+alarm_id_t alarm_pool_add_alarm_in_us(alarm_pool_t *pool, uint64_t us, alarm_callback_t callback, void *user_data,
+                                      bool fire_if_past);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
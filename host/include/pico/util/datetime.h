@@ -0,0 +1,36 @@
+/*
+ * Host stand-in for pico/util/datetime.h
+ */
+#ifndef __HOST_PICO_UTIL_DATETIME_H__
+#define __HOST_PICO_UTIL_DATETIME_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline void ms_to_timespec(uint64_t ms, struct timespec *ts) {
+    ts->tv_sec = (time_t)(ms / 1000);
+    ts->tv_nsec = (long)((ms % 1000) * 1000000);
+}
+
+static inline uint64_t timespec_to_ms(const struct timespec *ts) {
+    return ((uint64_t)ts->tv_sec * 1000) + (uint64_t)(ts->tv_nsec / 1000000);
+}
+
+static inline void us_to_timespec(uint64_t us, struct timespec *ts) {
+    ts->tv_sec = (time_t)(us / 1000000);
+    ts->tv_nsec = (long)((us % 1000000) * 1000);
+}
+
+static inline uint64_t timespec_to_us(const struct timespec *ts) {
+    return ((uint64_t)ts->tv_sec * 1000000) + (uint64_t)(ts->tv_nsec / 1000);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,3 @@
+// The simulated access point in the host build doesn't check credentials
+#define WIFI_SSID "hostsim"
+#define WIFI_PASSWORD "hostsim"
@@ -0,0 +1,68 @@
+/*
+ * latency_host.cpp
+ *
+ * The host build's stand-in for a board running the latency_responder
+ * firmware. Bridges the responder's ports out to 127.0.0.1 (unless
+ * SIM_UDP_BRIDGE_PORTS already says otherwise), so bench/latency_probe.cpp
+ * can be pointed at it exactly as it would be at a board, and prints the
+ * responder's counters every few seconds.
+ *
+ *   LATENCY_HOST_REPORT_SECONDS   how often to print the counters (5)
+ *   LATENCY_HOST_SECONDS          exit after this long; 0 runs forever (0)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include "latency_responder.h"
+#include "packet_filter.h"
+
+extern "C" {
+    #include "FreeRTOS.h"
+    #include "task.h"
+    #include "sim_net.h"
+}
+
+
+// Runs before main(), so the ports are in the environment by the time
+// cyw43_arch_init() starts the simulation
+__attribute__((constructor)) static void bridge_latency_ports() {
+    char ports[16];
+
+    snprintf(ports, sizeof(ports), "%d,%d", LATENCY_PORT, LATENCY_SINK_PORT);
+    setenv("SIM_UDP_BRIDGE_PORTS", ports, 0);
+}
+
+
+static void latency_host_task(void *params) {
+    uint32_t report_seconds = sim_net_env_u32("LATENCY_HOST_REPORT_SECONDS", 5);
+    uint32_t run_seconds = sim_net_env_u32("LATENCY_HOST_SECONDS", 0);
+    TickType_t start = xTaskGetTickCount();
+
+    if(report_seconds == 0) {
+        report_seconds = 5;
+    }
+
+    for(;;) {
+        vTaskDelay(pdMS_TO_TICKS(report_seconds * 1000));
+
+        const latency_responder_stats_t *stats = LatencyResponder::getInstance().get_stats();
+        printf("HOST LATENCY RESPONDER: %lu PROBES, %lu REPLIES, %lu SEND ERRORS, %lu MALFORMED, "
+               "%lu LOAD PACKETS (%lu BYTES), MAX RESIDENCE %lu us\n",
+               (unsigned long)stats->probes, (unsigned long)stats->replies, (unsigned long)stats->send_errors,
+               (unsigned long)stats->malformed, (unsigned long)stats->sink_packets,
+               (unsigned long)stats->sink_bytes, (unsigned long)stats->residence_max_us);
+
+        const packet_filter_stats_t *filter = PacketFilter::getInstance().get_stats();
+        printf("HOST PACKET FILTER: %lu ACCEPTED, %lu MAILBOX OVERFLOWS\n",
+               (unsigned long)filter->accepted, (unsigned long)filter->mailbox_overflows);
+
+        if(run_seconds && xTaskGetTickCount() - start >= pdMS_TO_TICKS(run_seconds * 1000)) {
+            exit(EXIT_SUCCESS);
+        }
+    }
+}
+
+
+extern "C" void vApplicationDaemonTaskStartupHook(void) {
+    xTaskCreate(latency_host_task, "Latency Host", configMINIMAL_STACK_SIZE, NULL, 1, NULL);
+}
@@ -0,0 +1,38 @@
+/*
+ * mock_strip_backend.cpp
+ */
+
+#include "mock_strip_backend.h"
+
+
+uint64_t MockStripBackend::clock_us = 0;
+
+
+void MockStripBackend::start(const uint8_t *pixels, size_t len, strip_done_callback_t done, void *context) {
+    this->done = done;
+    this->done_context = context;
+    busy = true;
+    done_at_us = clock_us + (uint64_t)len * MOCK_STRIP_US_PER_BYTE + MOCK_STRIP_LATCH_US;
+    frames++;
+    bytes += len;
+    last_pixels = pixels;
+}
+
+
+/***
+ * Moves the virtual clock forward to t, completing the frame in flight (and
+ * any frame its completion starts) at exactly the time it would have latched.
+ */
+void MockStripBackend::advance_to(uint64_t t) {
+    while(busy && done_at_us <= t) {
+        clock_us = done_at_us;
+        busy = false;
+        if(done) {
+            done(done_context);
+        }
+    }
+
+    if(t > clock_us) {
+        clock_us = t;
+    }
+}
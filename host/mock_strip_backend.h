@@ -0,0 +1,55 @@
+/*
+ * mock_strip_backend.h
+ *
+ * A StripBackend for the host build that "shifts out" frames against a
+ * virtual clock instead of a PIO state machine. A frame takes the same time it
+ * would on a real WS2812 strip (10us per byte at 800kHz, plus the FIFO drain
+ * and latch time), and completes when the test driving it advances the clock
+ * past that point. StripOutput can use now() as its time source so that all of
+ * its frame-time statistics are in virtual time and completely repeatable.
+ */
+#ifndef __MOCK_STRIP_BACKEND_H__
+#define __MOCK_STRIP_BACKEND_H__
+
+#include "strip_output.h"
+
+#define MOCK_STRIP_US_PER_BYTE  10
+#define MOCK_STRIP_LATCH_US     370
+
+
+class MockStripBackend : public StripBackend {
+    public:
+        MockStripBackend() {
+            busy = false;
+            done_at_us = 0;
+            done = NULL;
+            done_context = NULL;
+            frames = 0;
+            bytes = 0;
+            last_pixels = NULL;
+        };
+
+        void start(const uint8_t *pixels, size_t len, strip_done_callback_t done, void *context) override;
+        void advance_to(uint64_t t);
+
+        bool is_busy() { return busy; };
+        uint32_t get_frames() { return frames; };
+        uint64_t get_bytes() { return bytes; };
+        const uint8_t *get_last_pixels() { return last_pixels; };
+
+        static uint64_t now() { return clock_us; };
+        static void reset_clock() { clock_us = 0; };
+
+    private:
+        static uint64_t clock_us;
+
+        bool busy;
+        uint64_t done_at_us;
+        strip_done_callback_t done;
+        void *done_context;
+        uint32_t frames;
+        uint64_t bytes;
+        const uint8_t *last_pixels;
+};
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ * pico_host.c
+ *
+ * Linux implementations of the Pico SDK odds and ends declared in
+ * host/include/pico and host/include/hardware: the microsecond timer, sleeps,
+ * alarms, the AON timer, turning interrupts off and spin locks; and the heap
+ * trace recorder.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+#include "pico/time.h"
+#include "pico/aon_timer.h"
+#include "pico/util/datetime.h"
+#include "hardware/sync.h"
+#include "block_pool.h"
+#include "FreeRTOS.h"
+#include "timers.h"
+
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_to_us(&ts);
+}
+
+
+static uint64_t boot_us;
+
+__attribute__((constructor))
+static void pico_host_boot(void) {
+    boot_us = monotonic_us();
+}
+
+
+bool stdio_init_all(void) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    return true;
+}
+
+
+void sleep_ms(uint32_t ms) {
+    usleep(ms * 1000);
+}
+
+
+void sleep_us(uint64_t us) {
+    usleep(us);
+}
+
+
+uint64_t time_us_64(void) {
+    return monotonic_us() - boot_us;
+}
+
+
+uint32_t time_us_32(void) {
+    return (uint32_t)time_us_64();
+}
+
+
+typedef struct {
+    alarm_callback_t callback;
+    void *user_data;
+    alarm_id_t id;
+} host_alarm_t;
+
+static alarm_id_t next_alarm_id = 1;
+
+// The SDK's default alarm pool has room for 16 alarms at once, and so does
+// this one
+#define HOST_ALARM_COUNT    16
+
+BLOCK_POOL_STORAGE(alarm_storage, sizeof(host_alarm_t), HOST_ALARM_COUNT);
+static block_pool_t alarm_pool;
+static bool alarm_pool_ready = false;
+
+
+static void host_alarm_fired(TimerHandle_t timer) {
+    host_alarm_t *alarm = (host_alarm_t *)pvTimerGetTimerID(timer);
+
+    alarm->callback(alarm->id, alarm->user_data);
+    block_pool_free(&alarm_pool, alarm);
+    xTimerDelete(timer, 0);
+}
+
+
+/***
+ * Rounds up to whole ticks, with a minimum of one so the callback never runs
+ * before add_alarm_in_us() has returned, which the SDK doesn't promise either.
+ */
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback, void *user_data, bool fire_if_past) {
+    TickType_t ticks = (TickType_t)((us + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000));
+    host_alarm_t *alarm;
+    TimerHandle_t timer;
+    alarm_id_t id;
+
+    if(ticks == 0) {
+        ticks = 1;
+    }
+
+    if(!alarm_pool_ready) {
+        block_pool_init(&alarm_pool, "ALARMS", alarm_storage, sizeof(host_alarm_t), HOST_ALARM_COUNT);
+        alarm_pool_ready = true;
+    }
+    alarm = (host_alarm_t *)block_pool_alloc(&alarm_pool, sizeof(host_alarm_t));
+    if(alarm == NULL) {
+        return PICO_ERROR_INSUFFICIENT_RESOURCES;
+    }
+    alarm->callback = callback;
+    alarm->user_data = user_data;
+    alarm->id = id = next_alarm_id++;
+
+    timer = xTimerCreate("Alarm", ticks, pdFALSE, alarm, host_alarm_fired);
+    if(timer == NULL) {
+        block_pool_free(&alarm_pool, alarm);
+        return PICO_ERROR_INSUFFICIENT_RESOURCES;
+    }
+
+    // The alarm may fire (and free itself) before we get back here
+    if(xTimerStart(timer, 0) != pdPASS) {
+        xTimerDelete(timer, 0);
+        block_pool_free(&alarm_pool, alarm);
+        return PICO_ERROR_INSUFFICIENT_RESOURCES;
+    }
+
+    return id;
+}
+
+
+struct host_alarm_pool {
+    int unused;
+};
+
+static alarm_pool_t default_alarm_pool;
+
+
+alarm_pool_t *alarm_pool_get_default(void) {
+    return &default_alarm_pool;
+}
+
+
+alarm_pool_t *alarm_pool_create_with_unused_hardware_alarm(unsigned int max_timers) {
+    return &default_alarm_pool;
+}
+
+
+alarm_id_t alarm_pool_add_alarm_in_us(alarm_pool_t *pool, uint64_t us, alarm_callback_t callback, void *user_data,
+                                      bool fire_if_past) {
+    return add_alarm_in_us(us, callback, user_data, fire_if_past);
+}
+
+
+/***
+ * The POSIX port only runs one task's thread at a time, and preempts it from
+ * a signal, so blocking signals on the calling thread is what turning the
+ * core's interrupts off amounts to. These don't nest.
+ */
+uint32_t save_and_disable_interrupts(void) {
+    portDISABLE_INTERRUPTS();
+    return 0;
+}
+
+
+void restore_interrupts(uint32_t status) {
+    portENABLE_INTERRUPTS();
+}
+
+
+/***
+ * There's only the one core, so a spin lock is just interrupts off, like the
+ * SDK's on a single-core build.
+ */
+#define HOST_SPIN_LOCKS     32
+
+static spin_lock_t spin_locks[HOST_SPIN_LOCKS];
+static int spin_locks_claimed = 0;
+
+int spin_lock_claim_unused(bool required) {
+    return spin_locks_claimed < HOST_SPIN_LOCKS ? spin_locks_claimed++ : -1;
+}
+
+
+spin_lock_t *spin_lock_instance(unsigned int lock_num) {
+    return &spin_locks[lock_num % HOST_SPIN_LOCKS];
+}
+
+
+uint32_t spin_lock_blocking(spin_lock_t *lock) {
+    return save_and_disable_interrupts();
+}
+
+
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq) {
+    restore_interrupts(saved_irq);
+}
+
+
+/***
+ * The AON timer is "set" by remembering the difference between the requested
+ * wall-clock time and the microsecond timer.
+ */
+static bool aon_running = false;
+static int64_t aon_offset_us;
+
+bool aon_timer_start(const struct timespec *ts) {
+    aon_offset_us = (int64_t)timespec_to_us(ts) - (int64_t)time_us_64();
+    aon_running = true;
+    return true;
+}
+
+
+bool aon_timer_set_time(const struct timespec *ts) {
+    aon_offset_us = (int64_t)timespec_to_us(ts) - (int64_t)time_us_64();
+    return true;
+}
+
+
+bool aon_timer_get_time(struct timespec *ts) {
+    if(!aon_running) {
+        return false;
+    }
+    us_to_timespec((uint64_t)((int64_t)time_us_64() + aon_offset_us), ts);
+    return true;
+}
+
+
+void aon_timer_stop(void) {
+    aon_running = false;
+}
+
+
+bool aon_timer_is_running(void) {
+    return aon_running;
+}
+
+
+/***
+ * heap4 calls these with the scheduler suspended. If HOST_ALLOC_TRACE_FILE is
+ * set, each allocation is written as "+ address size" and each free as
+ * "- address"; the sizes are what heap4 carved out, its header included.
+ */
+static FILE *alloc_trace = NULL;
+static bool alloc_trace_checked = false;
+
+static FILE *get_alloc_trace(void) {
+    const char *path;
+
+    if(!alloc_trace_checked) {
+        alloc_trace_checked = true;
+        path = getenv("HOST_ALLOC_TRACE_FILE");
+        if(path != NULL) {
+            alloc_trace = fopen(path, "w");
+        }
+    }
+    return alloc_trace;
+}
+
+
+void host_trace_malloc(void *pointer, unsigned long size) {
+    FILE *trace = get_alloc_trace();
+
+    if(trace != NULL && pointer != NULL) {
+        fprintf(trace, "+ %p %lu\n", pointer, size);
+    }
+}
+
+
+void host_trace_free(void *pointer) {
+    FILE *trace = get_alloc_trace();
+
+    if(trace != NULL && pointer != NULL) {
+        fprintf(trace, "- %p\n", pointer);
+    }
+}
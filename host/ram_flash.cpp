@@ -0,0 +1,52 @@
+/*
+ * ram_flash.cpp
+ */
+
+#include <string.h>
+#include "ram_flash.h"
+
+
+RamFlash::RamFlash(size_t size) : memory(size, 0xff), sector_erases(size / CONFIG_STORE_SECTOR_SIZE, 0) {
+    tear_bytes = -1;
+    bytes_read = 0;
+}
+
+
+bool RamFlash::read(uint32_t offset, void *buffer, size_t len) {
+    if(offset + len > memory.size()) {
+        return false;
+    }
+    memcpy(buffer, &memory[offset], len);
+    bytes_read += len;
+    return true;
+}
+
+
+bool RamFlash::erase(uint32_t offset, size_t len) {
+    if(offset % CONFIG_STORE_SECTOR_SIZE || len % CONFIG_STORE_SECTOR_SIZE || offset + len > memory.size()) {
+        return false;
+    }
+    memset(&memory[offset], 0xff, len);
+    for(size_t sector = offset / CONFIG_STORE_SECTOR_SIZE; sector < (offset + len) / CONFIG_STORE_SECTOR_SIZE; sector++) {
+        sector_erases[sector]++;
+    }
+    return true;
+}
+
+
+bool RamFlash::program(uint32_t offset, const void *data, size_t len) {
+    const uint8_t *src = (const uint8_t *)data;
+
+    if(offset % CONFIG_STORE_RECORD_SIZE || offset + len > memory.size()) {
+        return false;
+    }
+    if(tear_bytes >= 0 && (size_t)tear_bytes < len) {
+        len = (size_t)tear_bytes;
+    }
+    tear_bytes = -1;
+
+    for(size_t i = 0; i < len; i++) {
+        memory[offset + i] &= src[i];
+    }
+    return true;
+}
@@ -0,0 +1,40 @@
+/*
+ * ram_flash.h
+ *
+ * A FlashDevice in RAM that behaves like NOR flash: erase sets whole sectors to
+ * 0xff and program can only clear bits. It counts erases per sector, so wear
+ * can be checked, and can be told to cut the next program short to simulate
+ * losing power in the middle of a write.
+ */
+#ifndef __RAM_FLASH_H__
+#define __RAM_FLASH_H__
+
+#include <vector>
+#include "config_store.h"
+
+
+class RamFlash : public FlashDevice {
+    public:
+        RamFlash(size_t size);
+
+        size_t get_size() override { return memory.size(); };
+        bool read(uint32_t offset, void *buffer, size_t len) override;
+        bool erase(uint32_t offset, size_t len) override;
+        bool program(uint32_t offset, const void *data, size_t len) override;
+
+        // The next program() writes only this many bytes
+        void tear_next_program(size_t bytes) { tear_bytes = (long)bytes; };
+
+        uint8_t *get_memory() { return memory.data(); };
+        uint32_t get_sector_erases(int sector) { return sector_erases[sector]; };
+        int get_sector_count() { return (int)sector_erases.size(); };
+        uint64_t get_bytes_read() { return bytes_read; };
+
+    private:
+        std::vector<uint8_t> memory;
+        std::vector<uint32_t> sector_erases;
+        long tear_bytes;
+        uint64_t bytes_read;
+};
+
+#endif
@@ -0,0 +1,609 @@
+/*
+ * sim_net.c
+ *
+ * The simulated access point, DHCP server and NTP server behind the host
+ * build's STA netif. See sim_net.h for the big picture.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcpip.h"
+#include "lwip/prot/iana.h"
+#include "lwip/prot/dhcp.h"
+#include "sim_net.h"
+
+
+#define SIM_NET_QUEUE_LENGTH    64
+#define SIM_NET_TASK_PRIORITY   3
+#define SIM_BRIDGE_MAX_PORTS    4
+
+#define IP_HEADER_LEN           20
+#define UDP_HEADER_LEN          8
+#define BOOTP_OPTIONS_OFFSET    240
+#define NTP_PACKET_LEN          48
+#define NTP_UNIX_EPOCH_OFFSET   2208988800ULL
+
+
+sim_net_config_t sim_net_config = {
+    .join_delay_ms = 300,
+    .scan_delay_ms = 1500,
+    .dhcp_delay_ms = 5,
+    .ntp_delay_ms = 20,
+    .ntp_jitter_ms = 5,
+    .ntp_offset_ms = 0,
+    .ntp_drift_ppm = 0,
+    .lease_seconds = 3600,
+    .link_kbps = 20000,
+    .link_delay_ms = 2,
+    .link_loss_permille = 0,
+};
+
+const uint8_t sim_net_server_ip[4] = { 10, 0, 0, 1 };
+const uint8_t sim_net_client_ip[4] = { 10, 0, 0, 100 };
+const uint8_t sim_net_netmask[4] = { 255, 255, 255, 0 };
+const uint8_t sim_net_ap_bssid[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+const uint32_t sim_net_ap_channel = 6;
+static const uint8_t broadcast_ip[4] = { 255, 255, 255, 255 };
+
+// A packet on its way to the STA netif. It's only copied into a pbuf on
+// delivery, as the CYW43 driver does, so packets in the air don't take up
+// lwIP's pool.
+typedef struct {
+    uint8_t *data;
+    uint16_t len;
+    TickType_t due;
+} sim_packet_t;
+
+// A UDP port bridged to a real loopback socket: what arrives on the socket
+// goes into lwIP as if from the server, from the sender's port, and what the
+// application sends from the port goes back to the last sender
+typedef struct {
+    uint16_t port;
+    int fd;
+    struct sockaddr_in peer;
+    bool have_peer;
+} sim_bridge_t;
+
+static QueueHandle_t delivery_queue;
+static sim_bridge_t bridges[SIM_BRIDGE_MAX_PORTS];
+static int bridge_count;
+static volatile bool ap_present = true;
+static uint16_t ip_id;
+static uint64_t link_free_us;
+
+
+uint32_t sim_net_env_u32(const char *name, uint32_t default_value) {
+    const char *value = getenv(name);
+    if(value == NULL || *value == '\0') {
+        return default_value;
+    }
+    return (uint32_t)strtoul(value, NULL, 0);
+}
+
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+
+static uint16_t get16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+
+/***
+ * Plain ones-complement sum over big-endian 16-bit words. Deliberately not
+ * lwIP's inet_chksum(), so the simulation doesn't share bugs with the stack
+ * it's feeding.
+ */
+static uint32_t sum16(uint32_t sum, const uint8_t *data, size_t len) {
+    while(len > 1) {
+        sum += get16(data);
+        data += 2;
+        len -= 2;
+    }
+    if(len) {
+        sum += (uint32_t)data[0] << 8;
+    }
+    return sum;
+}
+
+
+static uint16_t fold16(uint32_t sum) {
+    while(sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+
+/***
+ * Wraps a UDP payload in UDP and IPv4 headers (checksums and all) and queues it
+ * for delivery to the STA netif delay_ms from now.
+ */
+static void send_udp(const uint8_t *src_ip, uint16_t src_port,
+                     const uint8_t *dst_ip, uint16_t dst_port,
+                     const uint8_t *payload, size_t len, uint32_t delay_ms) {
+    uint8_t packet[SIM_NET_MTU];
+    uint8_t pseudo[12];
+    uint16_t udp_len = (uint16_t)(UDP_HEADER_LEN + len);
+    uint16_t total_len = (uint16_t)(IP_HEADER_LEN + udp_len);
+    uint8_t *ip = packet;
+    uint8_t *udp = packet + IP_HEADER_LEN;
+    uint16_t chksum;
+
+    if(total_len > sizeof(packet)) {
+        return;
+    }
+
+    memset(packet, 0, IP_HEADER_LEN + UDP_HEADER_LEN);
+    ip[0] = 0x45;
+    put16(&ip[2], total_len);
+    put16(&ip[4], ip_id++);
+    ip[8] = 64;
+    ip[9] = 17;
+    memcpy(&ip[12], src_ip, 4);
+    memcpy(&ip[16], dst_ip, 4);
+    put16(&ip[10], fold16(sum16(0, ip, IP_HEADER_LEN)));
+
+    put16(&udp[0], src_port);
+    put16(&udp[2], dst_port);
+    put16(&udp[4], udp_len);
+    memcpy(&udp[UDP_HEADER_LEN], payload, len);
+
+    memcpy(&pseudo[0], src_ip, 4);
+    memcpy(&pseudo[4], dst_ip, 4);
+    pseudo[8] = 0;
+    pseudo[9] = 17;
+    put16(&pseudo[10], udp_len);
+    chksum = fold16(sum16(sum16(0, pseudo, sizeof(pseudo)), udp, udp_len));
+    put16(&udp[6], chksum ? chksum : 0xffff);
+
+    sim_net_inject(packet, total_len, delay_ms);
+}
+
+
+static uint64_t sim_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)(ts.tv_nsec / 1000);
+}
+
+
+static void queue_packet(const uint8_t *packet, size_t len, TickType_t due) {
+    sim_packet_t item;
+
+    item.data = (uint8_t *)malloc(len);
+    if(item.data == NULL) {
+        return;
+    }
+    memcpy(item.data, packet, len);
+    item.len = (uint16_t)len;
+    item.due = due;
+
+    if(xQueueSend(delivery_queue, &item, 0) != pdTRUE) {
+        free(item.data);
+    }
+}
+
+
+/***
+ * Queues a raw IPv4 packet for delivery to the STA netif. Delivery is FIFO, so
+ * a packet never overtakes one queued before it even if its delay is shorter.
+ */
+void sim_net_inject(const uint8_t *packet, size_t len, uint32_t delay_ms) {
+    queue_packet(packet, len, xTaskGetTickCount() + pdMS_TO_TICKS(delay_ms));
+}
+
+
+/***
+ * Sends a packet the STA addressed to itself back to it over the simulated
+ * link: it waits for the packets ahead of it to be serialized at link_kbps,
+ * then takes link_delay_ms to arrive, unless it's one of the link_loss_permille
+ * that never do, or the queue is full (a router's tail drop). This is what
+ * gives the host build a bandwidth-delay product for TCP to fill.
+ */
+static void link_output(const uint8_t *packet, size_t len) {
+    uint64_t now_us = sim_now_us();
+    uint64_t arrive_us;
+
+    if(sim_net_config.link_loss_permille && (uint32_t)(rand() % 1000) < sim_net_config.link_loss_permille) {
+        return;
+    }
+
+    if(link_free_us < now_us) {
+        link_free_us = now_us;
+    }
+    if(sim_net_config.link_kbps) {
+        link_free_us += (uint64_t)len * 8 * 1000 / sim_net_config.link_kbps;
+    }
+    arrive_us = link_free_us + (uint64_t)sim_net_config.link_delay_ms * 1000;
+
+    queue_packet(packet, len, xTaskGetTickCount() + pdMS_TO_TICKS((arrive_us - now_us + 999) / 1000));
+}
+
+
+static void sim_net_task(void *params) {
+    sim_packet_t item;
+    struct netif *netif = &cyw43_state.netif[CYW43_ITF_STA];
+
+    for(;;) {
+        struct pbuf *p;
+
+        xQueueReceive(delivery_queue, &item, portMAX_DELAY);
+
+        TickType_t now = xTaskGetTickCount();
+        if((int32_t)(item.due - now) > 0) {
+            vTaskDelay(item.due - now);
+        }
+
+        // Through netif->input, like the CYW43 driver, so the packet filter
+        // sees it; a full pool drops it, the same as in the driver
+        p = ap_present && netif_is_link_up(netif) ? pbuf_alloc(PBUF_RAW, item.len, PBUF_POOL) : NULL;
+        if(p != NULL) {
+            pbuf_take(p, item.data, item.len);
+            if(netif->input(p, netif) != ERR_OK) {
+                pbuf_free(p);
+            }
+        }
+        free(item.data);
+    }
+}
+
+
+static void dhcp_server(const uint8_t *msg, size_t len) {
+    uint8_t reply[BOOTP_OPTIONS_OFFSET + 32];
+    uint8_t *opt = &reply[BOOTP_OPTIONS_OFFSET];
+    const uint8_t *requested = NULL;
+    uint8_t type = 0;
+    uint8_t reply_type;
+    size_t i;
+
+    if(len < BOOTP_OPTIONS_OFFSET || msg[0] != DHCP_BOOTREQUEST) {
+        return;
+    }
+
+    for(i = BOOTP_OPTIONS_OFFSET; i < len && msg[i] != DHCP_OPTION_END;) {
+        if(msg[i] == DHCP_OPTION_PAD) {
+            i++;
+            continue;
+        }
+        if(i + 2 > len || i + 2 + msg[i + 1] > len) {
+            break;
+        }
+        if(msg[i] == DHCP_OPTION_MESSAGE_TYPE) {
+            type = msg[i + 2];
+        }
+        else if(msg[i] == DHCP_OPTION_REQUESTED_IP && msg[i + 1] == 4) {
+            requested = &msg[i + 2];
+        }
+        i += 2 + msg[i + 1];
+    }
+
+    // There's exactly one client on this network, so it always gets the same
+    // lease. A REQUEST for anything else (a stale INIT-REBOOT, say) gets NAKed.
+    switch(type) {
+        case DHCP_DISCOVER:
+            reply_type = DHCP_OFFER;
+            break;
+        case DHCP_REQUEST:
+            if(requested == NULL) {
+                requested = &msg[12];
+            }
+            reply_type = memcmp(requested, sim_net_client_ip, 4) == 0 ? DHCP_ACK : DHCP_NAK;
+            break;
+        default:
+            return;
+    }
+
+    memset(reply, 0, sizeof(reply));
+    reply[0] = DHCP_BOOTREPLY;
+    reply[1] = msg[1];
+    reply[2] = msg[2];
+    memcpy(&reply[4], &msg[4], 4);
+    memcpy(&reply[10], &msg[10], 2);
+    if(reply_type != DHCP_NAK) {
+        memcpy(&reply[16], sim_net_client_ip, 4);
+    }
+    memcpy(&reply[20], sim_net_server_ip, 4);
+    memcpy(&reply[28], &msg[28], DHCP_CHADDR_LEN);
+    put32(&reply[236], DHCP_MAGIC_COOKIE);
+
+    *opt++ = DHCP_OPTION_MESSAGE_TYPE; *opt++ = 1; *opt++ = reply_type;
+    *opt++ = DHCP_OPTION_SERVER_ID; *opt++ = 4; memcpy(opt, sim_net_server_ip, 4); opt += 4;
+    if(reply_type != DHCP_NAK) {
+        *opt++ = DHCP_OPTION_LEASE_TIME; *opt++ = 4; put32(opt, sim_net_config.lease_seconds); opt += 4;
+        *opt++ = DHCP_OPTION_SUBNET_MASK; *opt++ = 4; memcpy(opt, sim_net_netmask, 4); opt += 4;
+        *opt++ = DHCP_OPTION_ROUTER; *opt++ = 4; memcpy(opt, sim_net_server_ip, 4); opt += 4;
+    }
+    *opt++ = DHCP_OPTION_END;
+
+    send_udp(sim_net_server_ip, LWIP_IANA_PORT_DHCP_SERVER,
+             broadcast_ip, LWIP_IANA_PORT_DHCP_CLIENT,
+             reply, (size_t)(opt - reply), sim_net_config.dhcp_delay_ms);
+}
+
+
+static uint32_t jittered(uint32_t delay_ms, uint32_t jitter_ms) {
+    int32_t d = (int32_t)delay_ms;
+    if(jitter_ms) {
+        d += (rand() % (int32_t)(2 * jitter_ms + 1)) - (int32_t)jitter_ms;
+    }
+    return d < 0 ? 0 : (uint32_t)d;
+}
+
+
+static void put_ntp_timestamp(uint8_t *p, uint64_t unix_us) {
+    put32(&p[0], (uint32_t)(unix_us / 1000000 + NTP_UNIX_EPOCH_OFFSET));
+    put32(&p[4], (uint32_t)(((unix_us % 1000000) << 32) / 1000000));
+}
+
+
+uint64_t sim_net_ntp_time_us(void) {
+    static uint64_t start_us = 0;
+    struct timespec ts;
+    uint64_t now_us;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    now_us = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)(ts.tv_nsec / 1000);
+    if(start_us == 0) {
+        start_us = now_us;
+    }
+    return now_us + (int64_t)sim_net_config.ntp_offset_ms * 1000
+           + (int64_t)(now_us - start_us) * sim_net_config.ntp_drift_ppm / 1000000;
+}
+
+
+/***
+ * A stratum 1 server whose clock is host real time plus ntp_offset_ms, running
+ * ntp_drift_ppm fast. The
+ * request leg and the reply leg each get their own jittered delay, and the
+ * receive/transmit timestamps are stamped as if the request had actually
+ * spent that long in the air.
+ */
+static void ntp_server(const uint8_t *src_ip, uint16_t src_port, const uint8_t *msg, size_t len) {
+    uint8_t reply[NTP_PACKET_LEN];
+    uint32_t up_ms = jittered(sim_net_config.ntp_delay_ms, sim_net_config.ntp_jitter_ms);
+    uint32_t down_ms = jittered(sim_net_config.ntp_delay_ms, sim_net_config.ntp_jitter_ms);
+    uint64_t now_us = sim_net_ntp_time_us();
+    uint64_t rx_us = now_us + (uint64_t)up_ms * 1000;
+
+    // Only answer client-mode requests
+    if(len < NTP_PACKET_LEN || (msg[0] & 0x07) != 3) {
+        return;
+    }
+
+    memset(reply, 0, sizeof(reply));
+    reply[0] = (uint8_t)((msg[0] & 0x38) | 4);
+    reply[1] = 1;
+    reply[2] = msg[2];
+    reply[3] = 0xec;
+    memcpy(&reply[12], "SIM", 4);
+    put_ntp_timestamp(&reply[16], now_us);
+    memcpy(&reply[24], &msg[40], 8);
+    put_ntp_timestamp(&reply[32], rx_us);
+    put_ntp_timestamp(&reply[40], rx_us + 50);
+
+    send_udp(sim_net_server_ip, LWIP_IANA_PORT_SNTP,
+             src_ip, src_port,
+             reply, sizeof(reply), up_ms + down_ms);
+}
+
+
+/***
+ * Sends a datagram from one of the bridged ports out of its socket, to the
+ * last real sender's address at whatever port the application sent it to.
+ * Runs in the tcpip thread; the socket never blocks.
+ */
+static void bridge_output(uint16_t src_port, uint16_t dst_port, const uint8_t *payload, size_t len) {
+    for(int i = 0; i < bridge_count; i++) {
+        sim_bridge_t *bridge = &bridges[i];
+        if(bridge->port == src_port && bridge->have_peer) {
+            struct sockaddr_in to = bridge->peer;
+            to.sin_port = htons(dst_port);
+            sendto(bridge->fd, payload, len, MSG_DONTWAIT, (struct sockaddr *)&to, sizeof(to));
+            return;
+        }
+    }
+}
+
+
+/***
+ * Polls the bridged sockets and feeds whatever has arrived into the netif.
+ * A blocking read would stall the POSIX port's scheduler along with this
+ * task, so it polls every tick instead, which puts up to a tick on every
+ * datagram in. That's fine for checking the code that's measuring; it's not
+ * a latency worth measuring.
+ */
+static void sim_bridge_task(void *params) {
+    uint8_t payload[SIM_NET_MTU - IP_HEADER_LEN - UDP_HEADER_LEN];
+
+    for(;;) {
+        bool idle = true;
+
+        for(int i = 0; i < bridge_count; i++) {
+            sim_bridge_t *bridge = &bridges[i];
+            struct sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t len = recvfrom(bridge->fd, payload, sizeof(payload), MSG_DONTWAIT,
+                                   (struct sockaddr *)&from, &from_len);
+            if(len < 0) {
+                continue;
+            }
+            bridge->peer = from;
+            bridge->have_peer = true;
+            send_udp(sim_net_server_ip, ntohs(from.sin_port), sim_net_client_ip, bridge->port,
+                     payload, (size_t)len, 0);
+            idle = false;
+        }
+
+        if(idle) {
+            vTaskDelay(1);
+        }
+    }
+}
+
+
+/***
+ * Opens a loopback socket for each port in SIM_UDP_BRIDGE_PORTS, a comma
+ * separated list, so a program outside the simulation can talk to
+ * whatever the application has listening on those ports.
+ */
+static void sim_bridge_init(void) {
+    const char *ports = getenv("SIM_UDP_BRIDGE_PORTS");
+
+    while(ports != NULL && *ports != '\0' && bridge_count < SIM_BRIDGE_MAX_PORTS) {
+        char *end;
+        unsigned long port = strtoul(ports, &end, 0);
+        struct sockaddr_in addr;
+        int fd;
+
+        if(end == ports) {
+            break;
+        }
+        ports = *end == ',' ? end + 1 : end;
+
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons((uint16_t)port);
+        if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            printf("SIM NET: CAN'T BRIDGE UDP %lu\n", port);
+            if(fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+        bridges[bridge_count].port = (uint16_t)port;
+        bridges[bridge_count].fd = fd;
+        bridges[bridge_count].have_peer = false;
+        bridge_count++;
+        printf("SIM NET: UDP %lu BRIDGED TO 127.0.0.1:%lu\n", port, port);
+    }
+
+    if(bridge_count > 0) {
+        xTaskCreate(sim_bridge_task, "Sim Bridge Task", configMINIMAL_STACK_SIZE, NULL, SIM_NET_TASK_PRIORITY, NULL);
+    }
+}
+
+
+/***
+ * netif->output for the STA interface. Runs in the tcpip thread. Packets to
+ * the STA's own address go round the simulated link. Anything else that isn't
+ * UDP to one of the simulated servers, or from a bridged port, falls on the
+ * floor, just as it would on a network with nobody listening.
+ */
+static err_t sim_net_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr) {
+    uint8_t packet[SIM_NET_MTU];
+    u16_t len = pbuf_copy_partial(p, packet, sizeof(packet), 0);
+    size_t ihl;
+    const uint8_t *udp;
+    size_t udp_len;
+
+    if(!ap_present || !netif_is_link_up(netif)) {
+        return ERR_OK;
+    }
+
+    if(len >= IP_HEADER_LEN && memcmp(&packet[16], sim_net_client_ip, 4) == 0) {
+        link_output(packet, len);
+        return ERR_OK;
+    }
+
+    if(len < IP_HEADER_LEN || (packet[0] >> 4) != 4 || packet[9] != 17) {
+        return ERR_OK;
+    }
+
+    ihl = (size_t)(packet[0] & 0x0f) * 4;
+    if(len < ihl + UDP_HEADER_LEN) {
+        return ERR_OK;
+    }
+
+    udp = &packet[ihl];
+    udp_len = get16(&udp[4]);
+    if(udp_len < UDP_HEADER_LEN || ihl + udp_len > len) {
+        return ERR_OK;
+    }
+
+    switch(get16(&udp[2])) {
+        case LWIP_IANA_PORT_DHCP_SERVER:
+            dhcp_server(&udp[UDP_HEADER_LEN], udp_len - UDP_HEADER_LEN);
+            break;
+        case LWIP_IANA_PORT_SNTP:
+            if(memcmp(&packet[16], sim_net_server_ip, 4) == 0) {
+                ntp_server(&packet[12], get16(&udp[0]), &udp[UDP_HEADER_LEN], udp_len - UDP_HEADER_LEN);
+            }
+            break;
+        default:
+            bridge_output(get16(&udp[0]), get16(&udp[2]), &udp[UDP_HEADER_LEN], udp_len - UDP_HEADER_LEN);
+            break;
+    }
+
+    return ERR_OK;
+}
+
+
+err_t sim_net_netif_init(struct netif *netif) {
+    netif->name[0] = 'w';
+    netif->name[1] = '0';
+    netif->output = sim_net_output;
+    netif->mtu = SIM_NET_MTU;
+    netif->hwaddr_len = 6;
+    memcpy(netif->hwaddr, cyw43_state.mac, 6);
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_IGMP;
+    return ERR_OK;
+}
+
+
+void sim_net_set_ap_present(bool present) {
+    ap_present = present;
+    if(!present) {
+        cyw43_host_ap_lost();
+    }
+}
+
+
+bool sim_net_ap_present(void) {
+    return ap_present;
+}
+
+
+void sim_net_init(void) {
+    sim_net_config.join_delay_ms = sim_net_env_u32("SIM_JOIN_DELAY_MS", sim_net_config.join_delay_ms);
+    sim_net_config.scan_delay_ms = sim_net_env_u32("SIM_SCAN_DELAY_MS", sim_net_config.scan_delay_ms);
+    sim_net_config.dhcp_delay_ms = sim_net_env_u32("SIM_DHCP_DELAY_MS", sim_net_config.dhcp_delay_ms);
+    sim_net_config.ntp_delay_ms = sim_net_env_u32("SIM_NTP_DELAY_MS", sim_net_config.ntp_delay_ms);
+    sim_net_config.ntp_jitter_ms = sim_net_env_u32("SIM_NTP_JITTER_MS", sim_net_config.ntp_jitter_ms);
+    sim_net_config.ntp_offset_ms = (int32_t)sim_net_env_u32("SIM_NTP_OFFSET_MS", (uint32_t)sim_net_config.ntp_offset_ms);
+    sim_net_config.ntp_drift_ppm = (int32_t)sim_net_env_u32("SIM_NTP_DRIFT_PPM", (uint32_t)sim_net_config.ntp_drift_ppm);
+    sim_net_config.lease_seconds = sim_net_env_u32("SIM_LEASE_SECONDS", sim_net_config.lease_seconds);
+    sim_net_config.link_kbps = sim_net_env_u32("SIM_LINK_KBPS", sim_net_config.link_kbps);
+    sim_net_config.link_delay_ms = sim_net_env_u32("SIM_LINK_DELAY_MS", sim_net_config.link_delay_ms);
+    sim_net_config.link_loss_permille = sim_net_env_u32("SIM_LINK_LOSS_PERMILLE",
+                                                        sim_net_config.link_loss_permille);
+
+    delivery_queue = xQueueCreate(SIM_NET_QUEUE_LENGTH, sizeof(sim_packet_t));
+    xTaskCreate(sim_net_task, "Sim Net Task", configMINIMAL_STACK_SIZE, NULL, SIM_NET_TASK_PRIORITY, NULL);
+    sim_bridge_init();
+}
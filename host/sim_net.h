@@ -0,0 +1,86 @@
+/*
+ * sim_net.h
+ *
+ * A simulated Wi-Fi network for the host build: one access point, a DHCP server
+ * and an NTP server, all living at SIM_NET_SERVER_ADDR. The STA netif's output
+ * function hands IP packets to the simulation, and replies come back into lwIP
+ * through tcpip_input() after a configurable delay, the same way the CYW43
+ * driver delivers received frames.
+ *
+ * The knobs in sim_net_config_t can be set from the environment at startup, so
+ * experiments don't need a rebuild:
+ *
+ *   SIM_JOIN_DELAY_MS    time to associate with the access point
+ *   SIM_SCAN_DELAY_MS    extra time a join takes when it has to scan for the
+ *                        access point, i.e. isn't told the channel
+ *   SIM_DHCP_DELAY_MS    one-way latency to the DHCP server
+ *   SIM_NTP_DELAY_MS     one-way latency to the NTP server
+ *   SIM_NTP_JITTER_MS    +/- uniform jitter added to each NTP leg
+ *   SIM_NTP_OFFSET_MS    how far the NTP server's clock is from host real time
+ *   SIM_NTP_DRIFT_PPM    how much faster than host real time it runs
+ *   SIM_LEASE_SECONDS    DHCP lease time handed out
+ *   SIM_LINK_KBPS        rate of the link that packets the STA sends to its
+ *                        own address go round, 0 for no limit
+ *   SIM_LINK_DELAY_MS    one-way latency of that link
+ *   SIM_LINK_LOSS_PERMILLE  packets in a thousand it loses
+ *
+ * SIM_UDP_BRIDGE_PORTS, a comma-separated list of UDP ports, opens a socket
+ * on 127.0.0.1 for each one. Datagrams sent to it arrive at the STA netif on
+ * the same port, from the server's address, and replies the application
+ * sends from that port go back to whoever sent the last one. That's how a
+ * real program, like bench/latency_probe.cpp, talks to the simulation.
+ */
+#ifndef __SIM_NET_H__
+#define __SIM_NET_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "lwip/netif.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_NET_MTU     1500
+
+typedef struct {
+    uint32_t join_delay_ms;
+    uint32_t scan_delay_ms;
+    uint32_t dhcp_delay_ms;
+    uint32_t ntp_delay_ms;
+    uint32_t ntp_jitter_ms;
+    int32_t ntp_offset_ms;
+    int32_t ntp_drift_ppm;
+    uint32_t lease_seconds;
+    uint32_t link_kbps;
+    uint32_t link_delay_ms;
+    uint32_t link_loss_permille;
+} sim_net_config_t;
+
+extern sim_net_config_t sim_net_config;
+
+extern const uint8_t sim_net_server_ip[4];
+extern const uint8_t sim_net_client_ip[4];
+extern const uint8_t sim_net_netmask[4];
+extern const uint8_t sim_net_ap_bssid[6];
+extern const uint32_t sim_net_ap_channel;
+
+void sim_net_init(void);
+err_t sim_net_netif_init(struct netif *netif);
+void sim_net_inject(const uint8_t *packet, size_t len, uint32_t delay_ms);
+
+uint64_t sim_net_ntp_time_us(void);
+
+void sim_net_set_ap_present(bool present);
+bool sim_net_ap_present(void);
+
+uint32_t sim_net_env_u32(const char *name, uint32_t default_value);
+
+// Implemented by the CYW43 stand-in; called when the access point goes away
+void cyw43_host_ap_lost(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
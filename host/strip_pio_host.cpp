@@ -0,0 +1,40 @@
+/*
+ * strip_pio_host.cpp
+ *
+ * The host build's PioStripBackend. There's no strip to drive, so a frame
+ * simply takes as long as it would on the wire (10us per byte at 800kHz) plus
+ * the FIFO drain and latch time, and then reports itself done through the same
+ * alarm path the firmware uses. That keeps StripOutput's timing and statistics
+ * meaningful when the whole application runs on the host.
+ */
+
+#include "strip_pio.h"
+
+
+bool PioStripBackend::init(uint pin) {
+    printf("STRIP OUTPUT ON GPIO %u (SIMULATED)\n", pin);
+    return true;
+}
+
+
+void PioStripBackend::start(const uint8_t *pixels, size_t len, strip_done_callback_t done, void *context) {
+    uint64_t shift_us = (uint64_t)len * 8 * 1000000 / STRIP_BIT_RATE_HZ;
+
+    this->done = done;
+    this->done_context = context;
+    if(add_alarm_in_us(shift_us + STRIP_FIFO_DRAIN_US + STRIP_RESET_US, latch_alarm, this, true) < 0) {
+        alarm_failures++;
+        latch_alarm(0, this);
+    }
+}
+
+
+int64_t PioStripBackend::latch_alarm(alarm_id_t id, void *user_data) {
+    PioStripBackend *backend = (PioStripBackend *)user_data;
+
+    if(backend->done) {
+        backend->done(backend->done_context);
+    }
+
+    return 0;
+}
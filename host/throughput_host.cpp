@@ -0,0 +1,255 @@
+/*
+ * throughput_host.cpp
+ *
+ * Drives the throughput_server firmware on the host build, with the client
+ * in the same lwIP: the node sends to its own address, and host/sim_net.c
+ * takes those packets round a simulated link with a rate and a delay
+ * (SIM_LINK_KBPS, SIM_LINK_DELAY_MS), so TCP has a real bandwidth-delay
+ * product to fill and the window and pool sizes have something to show for
+ * themselves. lwiperf's client measures the raw, netconn and socket servers
+ * in turn, ten seconds each, and then a UDP client sends iperf datagrams at
+ * a fixed rate and reads the server report.
+ *
+ * It prints what each server measured, the lwIP pools' sizes and peaks, and
+ * one THROUGHPUT RESULT line for scripts/lwip_sweep.py, then exits. Both
+ * ends of every connection are in the same pools, so the peaks are about
+ * twice what one end needs, and the sizes are a 64-bit host's, which are
+ * bigger than the Pico's; the firmware's RAM comes from its map file.
+ *
+ *   THROUGHPUT_HOST_UDP_KBPS      rate of the UDP test (10000)
+ *   THROUGHPUT_HOST_UDP_SECONDS   how long it runs (5)
+ *   THROUGHPUT_HOST_UDP_LEN       datagram size (1470)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "wifi.h"
+#include "throughput_server.h"
+#include "pico/cyw43_arch.h"
+
+extern "C" {
+    #include "FreeRTOS.h"
+    #include "task.h"
+    #include "lwip/memp.h"
+    #include "lwip/stats.h"
+    #include "lwip/priv/memp_priv.h"
+    #include "sim_net.h"
+}
+
+
+#define CLIENT_TIMEOUT_MS       30000
+#define UDP_FIN_ATTEMPTS        10
+#define UDP_FIN_INTERVAL_MS     250
+#define UDP_MAX_LEN             1472
+
+static TaskHandle_t host_task;
+static uint32_t client_kbps;
+static bool client_done;
+
+static uint8_t udp_datagram[UDP_MAX_LEN];
+static uint8_t udp_report[IPERF_UDP_HEADER_LEN + IPERF_SERVER_REPORT_LEN];
+static volatile bool udp_report_received;
+
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+static inline void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+
+static void client_report(void *arg, enum lwiperf_report_type report_type,
+                          const ip_addr_t *local_addr, u16_t local_port,
+                          const ip_addr_t *remote_addr, u16_t remote_port,
+                          u32_t bytes_transferred, u32_t ms_duration, u32_t bandwidth_kbitpsec) {
+    client_kbps = report_type == LWIPERF_TCP_DONE_CLIENT ? bandwidth_kbitpsec : 0;
+    client_done = true;
+    xTaskNotifyGive(host_task);
+}
+
+
+/***
+ * One lwiperf client run against one of the TCP servers, waiting afterwards
+ * for the server to have recorded its end of it.
+ */
+static void run_tcp(const ip_addr_t *self, throughput_variant_t variant, u16_t port) {
+    ThroughputServer& server = ThroughputServer::getInstance();
+    uint32_t sessions = server.get_stats(variant)->sessions;
+    void *session;
+
+    client_done = false;
+    cyw43_arch_lwip_begin();
+    session = lwiperf_start_tcp_client(self, port, LWIPERF_CLIENT, client_report, NULL);
+    cyw43_arch_lwip_end();
+    if(session == NULL) {
+        printf("THROUGHPUT HOST: CAN'T START CLIENT FOR %s\n", ThroughputServer::get_variant_name(variant));
+        return;
+    }
+
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CLIENT_TIMEOUT_MS));
+    for(int i = 0; i < 20 && server.get_stats(variant)->sessions == sessions; i++) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+
+    const throughput_stats_t *stats = server.get_stats(variant);
+    printf("THROUGHPUT HOST: %-8s CLIENT %lu kbit/s%s, SERVER %lu BYTES IN %lu ms, %lu kbit/s%s\n",
+           ThroughputServer::get_variant_name(variant), (unsigned long)client_kbps,
+           client_done ? "" : " (TIMED OUT)", (unsigned long)stats->last_bytes, (unsigned long)stats->last_ms,
+           (unsigned long)stats->last_kbps, stats->aborted ? ", ABORTED" : "");
+}
+
+
+static void udp_client_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    if(p->tot_len >= sizeof(udp_report)) {
+        pbuf_copy_partial(p, udp_report, sizeof(udp_report), 0);
+        udp_report_received = true;
+    }
+    pbuf_free(p);
+}
+
+
+static void send_datagram(struct udp_pcb *pcb, const ip_addr_t *self, int32_t id, uint32_t len) {
+    uint64_t now_us = time_us_64();
+    struct pbuf *p;
+
+    put_be32(&udp_datagram[0], (uint32_t)id);
+    put_be32(&udp_datagram[4], (uint32_t)(now_us / 1000000));
+    put_be32(&udp_datagram[8], (uint32_t)(now_us % 1000000));
+
+    // The simulated link copies the datagram before udp_sendto() returns,
+    // so one buffer does for all of them, and none come out of lwIP's heap
+    cyw43_arch_lwip_begin();
+    p = pbuf_alloc(PBUF_TRANSPORT, (u16_t)len, PBUF_REF);
+    if(p != NULL) {
+        p->payload = udp_datagram;
+        udp_sendto(pcb, p, self, THROUGHPUT_RAW_PORT);
+        pbuf_free(p);
+    }
+    cyw43_arch_lwip_end();
+}
+
+
+/***
+ * Sends iperf datagrams at a fixed rate, a tick's worth at a time, then the
+ * final datagram until the server's report comes back.
+ */
+static void run_udp(const ip_addr_t *self) {
+    uint32_t kbps = sim_net_env_u32("THROUGHPUT_HOST_UDP_KBPS", 10000);
+    uint32_t seconds = sim_net_env_u32("THROUGHPUT_HOST_UDP_SECONDS", 5);
+    uint32_t len = sim_net_env_u32("THROUGHPUT_HOST_UDP_LEN", 1470);
+    const throughput_stats_t *stats = ThroughputServer::getInstance().get_stats(THROUGHPUT_UDP);
+    struct udp_pcb *pcb;
+    TickType_t wake = xTaskGetTickCount();
+    TickType_t end = wake + pdMS_TO_TICKS(seconds * 1000);
+    uint64_t credit_bits = 0;
+    int32_t id = 0;
+
+    if(len < IPERF_UDP_HEADER_LEN + IPERF_SERVER_REPORT_LEN || len > UDP_MAX_LEN) {
+        len = 1470;
+    }
+
+    cyw43_arch_lwip_begin();
+    pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    udp_bind(pcb, IP_ANY_TYPE, 0);
+    udp_recv(pcb, udp_client_recv, NULL);
+    cyw43_arch_lwip_end();
+
+    while((int32_t)(end - xTaskGetTickCount()) > 0) {
+        vTaskDelayUntil(&wake, 1);
+        credit_bits += (uint64_t)kbps * 1000 / configTICK_RATE_HZ;
+        while(credit_bits >= len * 8) {
+            send_datagram(pcb, self, id++, len);
+            credit_bits -= len * 8;
+        }
+    }
+
+    udp_report_received = false;
+    for(int i = 0; i < UDP_FIN_ATTEMPTS && !udp_report_received; i++) {
+        send_datagram(pcb, self, -id, len);
+        vTaskDelay(pdMS_TO_TICKS(UDP_FIN_INTERVAL_MS));
+    }
+
+    cyw43_arch_lwip_begin();
+    udp_remove(pcb);
+    cyw43_arch_lwip_end();
+
+    if(udp_report_received) {
+        const uint8_t *r = &udp_report[IPERF_UDP_HEADER_LEN];
+        printf("THROUGHPUT HOST: UDP      SENT %ld AT %lu kbit/s; REPORT: %lu BYTES, %lu LOST, %lu OUT OF ORDER, "
+               "JITTER %lu us; SERVER %lu kbit/s\n",
+               (long)id, (unsigned long)kbps, (unsigned long)get_be32(&r[8]), (unsigned long)get_be32(&r[20]),
+               (unsigned long)get_be32(&r[24]), (unsigned long)(get_be32(&r[32]) * 1000000 + get_be32(&r[36])),
+               (unsigned long)stats->last_kbps);
+    }
+    else {
+        printf("THROUGHPUT HOST: UDP      NO SERVER REPORT\n");
+    }
+}
+
+
+/***
+ * What lwIP's heap and pools take with this profile, and the most of each
+ * that was in use at once.
+ */
+static uint32_t print_lwip_ram() {
+    uint32_t total = MEM_SIZE;
+
+    printf("THROUGHPUT HOST: LWIP HEAP %u BYTES, PEAK %lu\n", MEM_SIZE, (unsigned long)lwip_stats.mem.max);
+    for(int i = 0; i < MEMP_MAX; i++) {
+        const struct memp_desc *pool = memp_pools[i];
+        total += (uint32_t)pool->size * pool->num;
+        printf("THROUGHPUT HOST: %-16s %4u x %5u BYTES, PEAK %u, FAILED %lu\n", pool->desc, pool->num,
+               pool->size, pool->stats->max, (unsigned long)pool->stats->err);
+    }
+    printf("THROUGHPUT HOST: LWIP RAM %lu BYTES\n", (unsigned long)total);
+    return total;
+}
+
+
+static void throughput_host_task(void *params) {
+    WifiConnection& wifi = WifiConnection::getInstance();
+    ThroughputServer& server = ThroughputServer::getInstance();
+    uint8_t ip[4];
+    ip_addr_t self;
+    uint32_t ram;
+
+    host_task = xTaskGetCurrentTaskHandle();
+    while(!wifi.wait_for_wifi_init(pdMS_TO_TICKS(CLIENT_TIMEOUT_MS)) || !wifi.get_ip_address(ip)) {
+        printf("THROUGHPUT HOST: STILL WAITING FOR AN ADDRESS\n");
+    }
+    vTaskDelay(pdMS_TO_TICKS(500));
+    IP_ADDR4(&self, ip[0], ip[1], ip[2], ip[3]);
+
+    printf("THROUGHPUT HOST: PROFILE %s, LINK %lu kbit/s, %lu ms EACH WAY, %lu PERMILLE LOSS\n", LWIP_PROFILE_NAME,
+           (unsigned long)sim_net_config.link_kbps, (unsigned long)sim_net_config.link_delay_ms,
+           (unsigned long)sim_net_config.link_loss_permille);
+
+    run_tcp(&self, THROUGHPUT_RAW, THROUGHPUT_RAW_PORT);
+    run_tcp(&self, THROUGHPUT_NETCONN, THROUGHPUT_NETCONN_PORT);
+    run_tcp(&self, THROUGHPUT_SOCKET, THROUGHPUT_SOCKET_PORT);
+    run_udp(&self);
+    ram = print_lwip_ram();
+
+    printf("THROUGHPUT RESULT profile=%s raw_kbps=%lu netconn_kbps=%lu socket_kbps=%lu udp_kbps=%lu "
+           "udp_lost=%lu lwip_ram=%lu mem_peak=%lu pbuf_pool_peak=%u tcp_seg_peak=%u\n",
+           LWIP_PROFILE_NAME, (unsigned long)server.get_stats(THROUGHPUT_RAW)->last_kbps,
+           (unsigned long)server.get_stats(THROUGHPUT_NETCONN)->last_kbps,
+           (unsigned long)server.get_stats(THROUGHPUT_SOCKET)->last_kbps,
+           (unsigned long)server.get_stats(THROUGHPUT_UDP)->last_kbps,
+           (unsigned long)server.get_udp_stats()->lost, (unsigned long)ram, (unsigned long)lwip_stats.mem.max,
+           lwip_stats.memp[MEMP_PBUF_POOL]->max, lwip_stats.memp[MEMP_TCP_SEG]->max);
+
+    exit(EXIT_SUCCESS);
+}
+
+
+extern "C" void vApplicationDaemonTaskStartupHook(void) {
+    xTaskCreate(throughput_host_task, "Throughput Host", configMINIMAL_STACK_SIZE, NULL, 1, NULL);
+}
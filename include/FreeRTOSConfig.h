@@ -30,8 +30,24 @@
 #define configMAX_SYSCALL_INTERRUPT_PRIORITY    16
 #define configENABLE_FPU                        1
 #define configENABLE_TRUSTZONE                  0
+#define configSUPPORT_PICO_SYNC_INTEROP         1           // SDK mutexes and sleeps block the task, not the core
+#define configSUPPORT_PICO_TIME_INTEROP         1
+
+/* One core by default. Build with FREERTOS_CORES=2 and both cores run tasks,
+ * but everything stays on core 0 with the network stack unless it asks for
+ * core 1, which is kept for frame release and pixel output. */
+#ifndef configNUMBER_OF_CORES
 #define configNUMBER_OF_CORES                   1
-#define configSUPPORT_PICO_SYNC_INTEROP         0
+#endif
+#if configNUMBER_OF_CORES > 1
+#define configTICK_CORE                         0
+#define configRUN_MULTIPLE_PRIORITIES           1
+#define configUSE_CORE_AFFINITY                 1
+#define configUSE_PASSIVE_IDLE_HOOK             0
+#define NETWORK_CORE_AFFINITY                   (1 << 0)
+#define PIXEL_CORE_AFFINITY                     (1 << 1)
+#define configTASK_DEFAULT_CORE_AFFINITY        NETWORK_CORE_AFFINITY
+#endif
 
 #define configENABLE_MPU                        0
 #define configUSE_PREEMPTION                    1           // Allow tasks to be pre-empted
@@ -42,7 +58,6 @@
 #define configTICK_RATE_HZ                      1000        // FreeRTOS beats per second
 #define configMAX_PRIORITIES                    5           // Max number of priority values (0-24)
 #define configMINIMAL_STACK_SIZE                128
-#define configTOTAL_HEAP_SIZE                   ((size_t)64*1024)
 #define configMAX_TASK_NAME_LEN                 16
 #define configUSE_16_BIT_TICKS                  0
 #define configIDLE_SHOULD_YIELD                 1
@@ -62,10 +77,22 @@
                                                             // but can be changed if lengths will always be less
                                                             // than the number of bytes in a size_t.
 
-/* Memory allocation related definitions. */
-#define configSUPPORT_STATIC_ALLOCATION         0
-#define configSUPPORT_DYNAMIC_ALLOCATION        1           // Get FreeRTOS to allocate task memory
+/* Memory allocation related definitions. Our own tasks and event groups are
+ * static (see StaticTask) unless the build says otherwise with
+ * STATIC_ALLOCATION=OFF, and so are the idle and timer tasks, which the
+ * kernel provides. What's left on the heap is the SDK's: the tcpip thread,
+ * the CYW43 async context task, and lwIP's mailboxes and semaphores. */
+#ifndef configSUPPORT_STATIC_ALLOCATION
+#define configSUPPORT_STATIC_ALLOCATION         1
+#endif
+#define configSUPPORT_DYNAMIC_ALLOCATION        1           // The SDK still creates its tasks from the heap
+#define configKERNEL_PROVIDED_STATIC_MEMORY     1
 #define configAPPLICATION_ALLOCATED_HEAP        0
+#if configSUPPORT_STATIC_ALLOCATION
+#define configTOTAL_HEAP_SIZE                   ((size_t)24*1024)
+#else
+#define configTOTAL_HEAP_SIZE                   ((size_t)64*1024)
+#endif
 
 /* Hook function related definitions. */
 #define configUSE_IDLE_HOOK                     0
@@ -75,7 +102,8 @@
 #define configUSE_DAEMON_TASK_STARTUP_HOOK      0
 
 /* Run time and task stats gathering related definitions. */
-#define configGENERATE_RUN_TIME_STATS           0
+#define configGENERATE_RUN_TIME_STATS           1           // Counted in microseconds; see SystemMetrics
+#define configRUN_TIME_COUNTER_TYPE             uint64_t    // 32 bits of microseconds wrap in 71 minutes
 #define configUSE_TRACE_FACILITY                1
 #define configUSE_STATS_FORMATTING_FUNCTIONS    1
 
@@ -113,6 +141,14 @@
 #define INCLUDE_xQueueGetMutexHolder            1
 
 
+/* The run time stats counter is the free-running microsecond timer, which
+ * needs no setting up. */
+#ifndef __ASSEMBLER__
+#include "pico/time.h"
+#endif
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
+#define portGET_RUN_TIME_COUNTER_VALUE()        time_us_64()
+
 /* A header file that defines trace macro can be included here. */
 
 #endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,12 @@
+/*
+ * Half the default window and send buffer, and pools cut to match, for a
+ * node that mostly receives small UDP and can give the RAM to frames.
+ */
+#define LWIP_PROFILE_NAME           "lean"
+
+#define TCP_WND                     (4 * TCP_MSS)
+#define TCP_SND_BUF                 (4 * TCP_MSS)
+#define MEMP_NUM_TCP_SEG            16
+#define PBUF_POOL_SIZE              12
+#define MEM_SIZE                    4000
+#define DEFAULT_TCP_RECVMBOX_SIZE   16
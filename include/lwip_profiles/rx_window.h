@@ -0,0 +1,12 @@
+/*
+ * A wide receive window and a small send buffer: the RAM goes where a node
+ * that's streamed to needs it, and sending is left with the minimum.
+ */
+#define LWIP_PROFILE_NAME           "rx_window"
+
+#define TCP_WND                     (12 * TCP_MSS)
+#define TCP_SND_BUF                 (2 * TCP_MSS)
+#define MEMP_NUM_TCP_SEG            16
+#define PBUF_POOL_SIZE              32
+#define MEM_SIZE                    6000
+#define DEFAULT_TCP_RECVMBOX_SIZE   32
@@ -0,0 +1,12 @@
+/*
+ * The biggest window lwIP takes without window scaling, both ways, and the
+ * pools and heap to back it: the upper bound on what more RAM buys.
+ */
+#define LWIP_PROFILE_NAME           "wide"
+
+#define TCP_WND                     (16 * TCP_MSS)
+#define TCP_SND_BUF                 (16 * TCP_MSS)
+#define MEMP_NUM_TCP_SEG            64
+#define PBUF_POOL_SIZE              40
+#define MEM_SIZE                    24000
+#define DEFAULT_TCP_RECVMBOX_SIZE   128
@@ -4,6 +4,16 @@
 
 #include "pico/stdlib.h"
 
+// The window, buffer and pool sizes below are defaults. A profile from
+// include/lwip_profiles/ (the LWIP_PROFILE CMake option) can set any of them
+// first; scripts/lwip_sweep.py builds and measures each profile in turn.
+#ifdef LWIPOPTS_PROFILE
+#include LWIPOPTS_PROFILE
+#endif
+#ifndef LWIP_PROFILE_NAME
+#define LWIP_PROFILE_NAME           "default"
+#endif
+
 #define TCPIP_THREAD_PRIO   2
 #define TCPIP_THREAD_STACKSIZE 2048
 #define DEFAULT_THREAD_STACKSIZE 1024
@@ -16,28 +26,38 @@
 #define MEM_LIBC_MALLOC             0
 
 #define MEM_ALIGNMENT               4
+#ifndef MEM_SIZE
 #define MEM_SIZE                    4000
+#endif
+#ifndef MEMP_NUM_TCP_SEG
 #define MEMP_NUM_TCP_SEG            32
+#endif
 #define MEMP_NUM_ARP_QUEUE          10
+#ifndef PBUF_POOL_SIZE
 #define PBUF_POOL_SIZE              24
+#endif
 #define LWIP_ARP                    1
 #define LWIP_ETHERNET               1
 #define LWIP_ICMP                   1
 #define LWIP_RAW                    1
+#ifndef TCP_WND
 #define TCP_WND                     (8 * TCP_MSS)
+#endif
 #define TCP_MSS                     1460
+#ifndef TCP_SND_BUF
 #define TCP_SND_BUF                 (8 * TCP_MSS)
+#endif
 #define TCP_SND_QUEUELEN            ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) / (TCP_MSS))
 #define LWIP_NETIF_STATUS_CALLBACK  1
 #define LWIP_NETIF_LINK_CALLBACK    1
 #define LWIP_NETIF_HOSTNAME         1
 #define LWIP_NETCONN                1
-#define MEM_STATS                   0
+// SystemMetrics reports the heap, pool and link counters
+#define MEM_STATS                   1
 #define SYS_STATS                   0
-#define MEMP_STATS                  0
-#define LINK_STATS                  0
+#define MEMP_STATS                  1
+#define LINK_STATS                  1
 // #define ETH_PAD_SIZE                2
-#define LWIP_CHKSUM_ALGORITHM       3
 #define LWIP_DHCP                   1
 #define LWIP_IPV4                   1
 #define LWIP_TCP                    1
@@ -45,8 +65,13 @@
 #define LWIP_DNS                    1
 #define LWIP_TCP_KEEPALIVE          1
 #define LWIP_NETIF_TX_SINGLE_PBUF   1
+#define LWIP_SUPPORT_CUSTOM_PBUF    1           // Our outgoing datagrams come from TxPbufs' block pools
 #define DHCP_DOES_ARP_CHECK         1
 #define LWIP_DHCP_DOES_ACD_CHECK    0
+// PixelReceiver joins the E1.31 group of each universe it shows: up to 7 for
+// the longest strip, plus the all-systems group lwIP joins itself
+#define LWIP_IGMP                   1
+#define MEMP_NUM_IGMP_GROUP         8
 
 // #ifndef NDEBUG
 #define LWIP_DEBUG                  1
@@ -96,18 +121,54 @@
 #define SNTP_DEBUG                  LWIP_DBG_OFF
 
 
+#ifndef DEFAULT_TCP_RECVMBOX_SIZE
 #define DEFAULT_TCP_RECVMBOX_SIZE 128
+#endif
 
 
 #define SNTP_SUPPORT      1
 #define SNTP_SERVER_DNS   1
-void sntpSetTimeSec(uint32_t sec);
-#define SNTP_SET_SYSTEM_TIME(sec) sntpSetTimeSec(sec)
+#define SNTP_MAX_SERVERS  4
+
+// DHCP, DNS, SNTP, DDP, E1.31, NetworkTime's multi-server client,
+// LanTimeSync, SystemMetrics and UdpLogSink each hold a UDP pcb
+#define MEMP_NUM_UDP_PCB            9
+
+// NetworkTime keeps its own disciplined clock. The SNTP client reads it to
+// timestamp requests and replies, and hands back the roundtrip-compensated
+// server time with the fraction of a second intact (see network_time.cpp).
+#define SNTP_CHECK_RESPONSE         2
+#define SNTP_COMP_ROUNDTRIP         1
+#ifdef __cplusplus
+extern "C" {
+#endif
+void sntpGetTimeUs(uint32_t *sec, uint32_t *us);
+void sntpSetTimeNtp(int32_t sec, uint32_t frac);
+uint32_t sntpGetUpdateDelayMs(void);
+uint16_t ip_checksum(const void *data, int len);
+uint16_t ip_checksum_copy(void *dst, const void *src, uint16_t len);
+#ifdef __cplusplus
+}
+#endif
+#define SNTP_GET_SYSTEM_TIME(sec, us) sntpGetTimeUs(&(sec), &(us))
+#define SNTP_SET_SYSTEM_TIME_NTP(sec, frac) sntpSetTimeNtp(sec, frac)
+
+// Internet checksums come from ip_checksum.c, which has assembly kernels for
+// the RP2040 and RP2350. With checksum-on-copy lwIP sums outgoing TCP data
+// while tcp_write() copies it in, and udp_sendto_chksum() takes a sum made
+// the same way (see UdpLogSink::send())
+#define LWIP_CHKSUM                 ip_checksum
+#define LWIP_CHECKSUM_ON_COPY       1
+#define LWIP_CHKSUM_COPY            ip_checksum_copy
 //MEMP_NUM_SYS_TIMEOUTS Needs to be one larger than default for SNTP
 #define MEMP_NUM_SYS_TIMEOUT            (LWIP_NUM_SYS_TIMEOUT_INTERNAL + 1)
 
-// SNTP updates automatically using a timer managed internall by the LWIP stack
-#define SNTP_UPDATE_DELAY 60*60*1000
+// SNTP updates automatically using a timer managed internall by the LWIP stack,
+// as often as the clock discipline asks for. That's a function call, so the
+// compile-time check for the RFC's 15 second minimum can't see it; the
+// discipline never asks for less than 16.
+#define SNTP_UPDATE_DELAY sntpGetUpdateDelayMs()
+#define SNTP_SUPPRESS_DELAY_CHECK
 
 // #define CYW43_VDEBUG(...) printf(__VA_ARGS__)
 #define CYW43_VERBOSE_DEBUG 1
@@ -1,11 +1,38 @@
+#ifndef __STRIP_CONFIG_H__
+#define __STRIP_CONFIG_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Pixels are packed RGB, one byte per channel
+#define STRIP_BYTES_PER_PIXEL   3
+
+// On the way out they can gain a white channel (see pixel_kernels.h)
+#define STRIP_MAX_OUTPUT_BYTES_PER_PIXEL    4
+
+// Frame buffers are statically sized for the longest strip we'll drive
+#define STRIP_MAX_LENGTH        1024
+#define STRIP_DEFAULT_LENGTH    300
+
+// pm_latency_budget counts 10ms steps from 1 (10ms) to 254 (2540ms). 0, as in
+// configs from before it existed, is WIFI_POWER_BUDGET_DEFAULT_MS, and 255
+// keeps the radio awake, which is what any budget under 10ms comes to anyway
+#define STRIP_PM_BUDGET_DEFAULT     0
+#define STRIP_PM_BUDGET_AWAKE       255
+#define STRIP_PM_BUDGET_STEP_MS     10
+
 
 typedef struct {
     uint32_t magic;
     char wifi_ssid[32];
     char wifi_password[64];
-    uint8_t unused_1[3];
+    uint8_t lan_time_role;      // a lan_time_role_t; 0 (off) in configs from before it existed
+    uint8_t color_order;        // a pixel_order_t; 0 (RGB, as received) in configs from before it existed
+    uint8_t brightness;         // 1-255, with 0 (from configs before it existed) meaning 255
     bool use_dhcp;
-    uint8_t unused_2[3];
+    uint8_t gamma;              // in tenths, 22 for 2.2; 0 or 10 is linear
+    bool dither;
+    uint8_t pm_latency_budget;  // radio wake-up latency allowed, in 10ms steps; see STRIP_PM_BUDGET_DEFAULT and STRIP_PM_BUDGET_AWAKE
     bool right_to_left;
     uint8_t ip[4];
     uint8_t gateway[4];
@@ -13,3 +40,59 @@ typedef struct {
     uint32_t strip_length;
     uint32_t crc;
 } led_strip_config_t;
+
+
+// The pm_latency_budget for a budget in milliseconds: rounded down to a step,
+// so the radio is never allowed longer than asked, and held to 2540ms at most
+static inline uint8_t strip_pm_budget_from_ms(uint32_t budget_ms) {
+    uint32_t steps = budget_ms / STRIP_PM_BUDGET_STEP_MS;
+
+    if(steps == 0) {
+        return STRIP_PM_BUDGET_AWAKE;
+    }
+    return steps >= STRIP_PM_BUDGET_AWAKE ? STRIP_PM_BUDGET_AWAKE - 1 : (uint8_t)steps;
+}
+
+
+// A physical layout, as runs of pixels along the wire. Each run takes length
+// pixels from the frame, starting at source and stepping pixel_step between
+// neighbours; the segment's runs start run_step apart. A 16x16 matrix wired
+// back and forth in rows is one segment: 16 runs of 16, pixel_step 1,
+// run_step 16, serpentine. Dark segments are pixels on the wire that nothing
+// in the frame lights, such as the gap between two panels.
+#define STRIP_LAYOUT_MAX_SEGMENTS   6
+
+#define STRIP_SEGMENT_SERPENTINE    0x01        // every other run goes the other way
+#define STRIP_SEGMENT_DARK          0x02        // always black
+
+typedef struct {
+    uint16_t source;
+    uint16_t length;
+    uint16_t runs;              // 0 counts as 1
+    int16_t pixel_step;         // 0 counts as 1
+    int16_t run_step;
+    uint8_t flags;
+    uint8_t unused;
+} strip_segment_t;
+
+typedef struct {
+    uint8_t segment_count;      // 0 is a plain strip of strip_length
+    uint8_t unused[3];
+    strip_segment_t segments[STRIP_LAYOUT_MAX_SEGMENTS];
+    uint32_t crc;
+} strip_layout_t;
+
+
+// What the last successful join learned, so the next one can skip the scan
+// and ask the DHCP server for the same address back (INIT-REBOOT)
+typedef struct {
+    bool valid;
+    uint8_t channel;
+    uint8_t bssid[6];
+    uint8_t ip[4];
+    uint8_t netmask[4];
+    uint8_t gateway[4];
+    uint8_t dns[4];
+} wifi_reconnect_cache_t;
+
+#endif
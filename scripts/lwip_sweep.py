@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+#
+# Throughput against RAM for each lwIP profile.
+#
+# Builds the throughput server once per profile in include/lwip_profiles (and
+# once with lwipopts.h's own defaults), measures it, and writes one CSV row
+# per profile, so a window or pool change can be judged by what it buys and
+# what it costs. Two ways to measure:
+#
+#   python3 scripts/lwip_sweep.py host [--out sweep.csv]
+#
+# builds throughput_server_host and runs it; the client is in the same
+# process, over host/sim_net.c's simulated link (SIM_LINK_KBPS and
+# SIM_LINK_DELAY_MS in the environment set its rate and delay). lwip_ram is
+# the host's pools, which are bigger than the Pico's and hold both ends.
+#
+#   python3 scripts/lwip_sweep.py firmware --board pico_w [--target 192.168.1.50]
+#
+# builds the throughput_server firmware and takes its lwIP and total RAM from
+# the map. With --target it also runs iperf 2 against a board, which has to be
+# flashed with each profile's build in turn; the script waits for that.
+#
+
+import argparse
+import csv
+import os
+import re
+import subprocess
+import sys
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, os.path.join(REPO, 'scripts'))
+
+import ram_report
+
+RESULT_RE = re.compile(r'^THROUGHPUT RESULT (.*)$', re.M)
+TCP_PORTS = (('raw_kbps', 5001), ('netconn_kbps', 5002), ('socket_kbps', 5003))
+
+
+def profiles():
+    names = sorted(f[:-2] for f in os.listdir(os.path.join(REPO, 'include', 'lwip_profiles')) if f.endswith('.h'))
+    return ['default'] + names
+
+
+def build(profile, board, target):
+    build_dir = os.path.join(REPO, 'build-sweep', board, profile)
+    args = ['cmake', '-S', REPO, '-B', build_dir, '-DPICO_BOARD=%s' % board,
+            '-DLWIP_PROFILE=%s' % ('' if profile == 'default' else profile)]
+    subprocess.run(args, check=True, stdout=subprocess.DEVNULL)
+    subprocess.run(['cmake', '--build', build_dir, '--target', target, '-j', str(os.cpu_count() or 1)],
+                   check=True, stdout=subprocess.DEVNULL)
+    return build_dir
+
+
+def run_host(profile):
+    build_dir = build(profile, 'host', 'throughput_server_host')
+    out = subprocess.run([os.path.join(build_dir, 'throughput_server_host')], capture_output=True, text=True,
+                         timeout=180).stdout
+    m = RESULT_RE.search(out)
+    if m is None:
+        print(out)
+        raise RuntimeError('no THROUGHPUT RESULT from the %s profile' % profile)
+    return dict(field.split('=', 1) for field in m.group(1).split())
+
+
+def map_ram(map_path):
+    """lwIP's RAM and everything's, from the firmware's map."""
+    regions, entries, symbols = ram_report.parse_map(map_path)
+    lwip = total = 0
+    for section, address, size, obj, output in entries:
+        total += size
+        if ram_report.category(ram_report.variable_name(section, obj), obj) == 'lwIP':
+            lwip += size
+    return lwip, total
+
+
+def iperf_kbps(target, args):
+    """Bits per second from iperf 2's CSV output, in kbit/s; 0 if it failed."""
+    out = subprocess.run(['iperf', '-c', target, '-y', 'C'] + args, capture_output=True, text=True).stdout
+    lines = [l for l in out.splitlines() if l.count(',') >= 8]
+    return int(lines[-1].split(',')[8]) // 1000 if lines else 0
+
+
+def run_firmware(profile, board, target, udp_rate):
+    build_dir = build(profile, board, 'throughput_server')
+    lwip, total = map_ram(os.path.join(build_dir, 'throughput_server.elf.map'))
+    row = {'profile': profile, 'lwip_ram': lwip, 'total_ram': total}
+    if target:
+        input('Flash %s and press enter when it has joined: ' % os.path.join(build_dir, 'throughput_server.uf2'))
+        for name, port in TCP_PORTS:
+            row[name] = iperf_kbps(target, ['-p', str(port)])
+        row['udp_kbps'] = iperf_kbps(target, ['-u', '-b', udp_rate, '-p', '5001'])
+    return row
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Throughput against RAM for each lwIP profile')
+    parser.add_argument('mode', choices=('host', 'firmware'))
+    parser.add_argument('--board', default='pico_w', help='board for firmware mode')
+    parser.add_argument('--target', help='address of a board running the throughput server')
+    parser.add_argument('--udp-rate', default='10M', help='iperf -b for the UDP test')
+    parser.add_argument('--profile', action='append', help='only these profiles')
+    parser.add_argument('--out', default='lwip_sweep.csv')
+    args = parser.parse_args()
+
+    rows = []
+    for profile in args.profile or profiles():
+        print('PROFILE %s' % profile)
+        if args.mode == 'host':
+            row = run_host(profile)
+        else:
+            row = run_firmware(profile, args.board, args.target, args.udp_rate)
+        print('  ' + ' '.join('%s=%s' % kv for kv in row.items()))
+        rows.append(row)
+
+    fields = []
+    for row in rows:
+        fields += [k for k in row if k not in fields]
+    with open(args.out, 'w', newline='') as f:
+        writer = csv.DictWriter(f, fieldnames=fields)
+        writer.writeheader()
+        writer.writerows(rows)
+    print('WROTE %s' % args.out)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
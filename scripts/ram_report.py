@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+#
+# RAM budget report, from the linker map and the config headers.
+#
+# Lists everything the link put in RAM, biggest first and grouped into the
+# FreeRTOS heap, lwIP, our own singletons (which hold the static task stacks
+# and the frame buffers), the kernel and the rest of the SDK; then what's
+# configured to come out of the FreeRTOS heap at run time, and how much RAM is
+# left over between the end of .bss and the top of RAM. Run by the build after
+# every link, or by hand:
+#
+#   python3 scripts/ram_report.py build/pico_lwip_example.elf.map
+#
+# It wants the map from a build with -ffunction-sections -fdata-sections (the
+# SDK's default), so each variable has its own input section; without that
+# objects are listed whole.
+#
+
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+RAM_SECTIONS = ('.data', '.bss', '.heap', '.stack', '.stack_dummy', '.stack1_dummy', '.scratch_x', '.scratch_y',
+                '.ram_vector_table', '.uninitialized_data', '.tdata', '.tbss')
+
+INPUT_RE = re.compile(r'^ (\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+INPUT_NAME_RE = re.compile(r'^ (\S+)$')
+INPUT_REST_RE = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+SYMBOL_RE = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+(\S+)\s*=')
+REGION_RE = re.compile(r'^(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+\S*w')
+DEFINE_RE = re.compile(r'^\s*#define\s+(\w+)\s+(.+?)\s*(//.*|/\*.*)?$')
+
+
+def parse_map(path):
+    """Returns the RAM regions, RAM input sections and linker symbols."""
+    regions = {}
+    entries = []
+    symbols = {}
+    output = None
+    pending = None
+    in_memory_config = False
+
+    with open(path, errors='replace') as f:
+        for line in f:
+            line = line.rstrip('\n')
+
+            if line.startswith('Memory Configuration'):
+                in_memory_config = True
+                continue
+            if line.startswith('Linker script and memory map'):
+                in_memory_config = False
+                continue
+            if in_memory_config:
+                m = REGION_RE.match(line)
+                if m and m.group(1) != '*default*':
+                    regions[m.group(1)] = (int(m.group(2), 16), int(m.group(3), 16))
+                continue
+
+            m = SYMBOL_RE.match(line)
+            if m:
+                symbols[m.group(2)] = int(m.group(1), 16)
+                continue
+
+            if line and not line[0].isspace():
+                output = line.split()[0] if line.startswith('.') else None
+                pending = None
+                continue
+            if output is None or not output.startswith(RAM_SECTIONS):
+                continue
+
+            m = INPUT_RE.match(line)
+            if m:
+                entries.append((m.group(1), int(m.group(2), 16), int(m.group(3), 16), m.group(4), output))
+                pending = None
+                continue
+            m = INPUT_NAME_RE.match(line)
+            if m:
+                pending = m.group(1)
+                continue
+            m = INPUT_REST_RE.match(line)
+            if m and pending is not None:
+                entries.append((pending, int(m.group(1), 16), int(m.group(2), 16), m.group(3), output))
+                pending = None
+
+    return regions, [e for e in entries if e[2] > 0 and e[0] != '*fill*'], symbols
+
+
+def demangle(names):
+    tool = shutil.which('arm-none-eabi-c++filt') or shutil.which('c++filt')
+    if tool is None or not names:
+        return {n: n for n in names}
+    out = subprocess.run([tool], input='\n'.join(names), capture_output=True, text=True).stdout.split('\n')
+    return {n: (out[i] if i < len(out) and out[i] else n) for i, n in enumerate(names)}
+
+
+def variable_name(section, obj):
+    for prefix in ('.bss.', '.data.', '.sbss.', '.sdata.', '.uninitialized_data.', '.scratch_x.', '.scratch_y.'):
+        if section.startswith(prefix):
+            return section[len(prefix):]
+    return '%s (%s)' % (os.path.basename(obj.split('(')[0]), section)
+
+
+def category(name, obj):
+    if name == 'ucHeap':
+        return 'FreeRTOS heap'
+    if 'getInstance()::instance' in name:
+        return 'Our singletons'
+    if '/lwip/' in obj or 'lwip' in os.path.basename(obj) or name.startswith(('memp_', 'ram_heap', 'lwip_')):
+        return 'lwIP'
+    if 'FreeRTOS-Kernel' in obj or 'freertos' in obj.lower():
+        return 'FreeRTOS kernel'
+    if '/src/' in obj and 'pico-sdk' not in obj:
+        return 'Our code'
+    return 'SDK and libraries'
+
+
+def read_defines(*paths):
+    defines = {}
+    for path in paths:
+        try:
+            with open(path) as f:
+                for line in f:
+                    m = DEFINE_RE.match(line)
+                    if m and m.group(1) not in defines:
+                        defines[m.group(1)] = m.group(2)
+        except OSError:
+            pass
+    return defines
+
+
+def evaluate(defines, name, depth=0):
+    """The value of a define made of numbers, casts and other defines."""
+    if name not in defines or depth > 8:
+        return None
+    expr = re.sub(r'\(\s*(size_t|uint32_t|configSTACK_DEPTH_TYPE)\s*\)', '', defines[name])
+    expr = re.sub(r'(\d+)[uUlL]+', r'\1', expr)
+    for word in set(re.findall(r'[A-Za-z_]\w*', expr)):
+        value = evaluate(defines, word, depth + 1)
+        if value is None:
+            return None
+        expr = re.sub(r'\b%s\b' % word, str(value), expr)
+    try:
+        return int(eval(expr, {'__builtins__': {}}))
+    except Exception:
+        return None
+
+
+def kib(n):
+    return '%7.1f KB' % (n / 1024.0)
+
+
+def main():
+    if len(sys.argv) < 2:
+        print('usage: ram_report.py <map file> [top N]')
+        return 1
+    top = int(sys.argv[2]) if len(sys.argv) > 2 else 25
+
+    regions, entries, symbols = parse_map(sys.argv[1])
+    names = demangle(sorted({variable_name(e[0], e[3]) for e in entries}))
+
+    variables = {}
+    for section, address, size, obj, output in entries:
+        name = names[variable_name(section, obj)]
+        key = (name, category(name, obj))
+        variables[key] = variables.get(key, 0) + size
+
+    print('RAM BUDGET')
+    print()
+    print('Biggest consumers:')
+    for (name, cat), size in sorted(variables.items(), key=lambda v: -v[1])[:top]:
+        print('  %s  %-20s %s' % (kib(size), cat, name))
+
+    totals = {}
+    for (name, cat), size in variables.items():
+        totals[cat] = totals.get(cat, 0) + size
+    print()
+    print('By owner:')
+    for cat, size in sorted(totals.items(), key=lambda t: -t[1]):
+        print('  %s  %s' % (kib(size), cat))
+    print('  %s  total' % kib(sum(totals.values())))
+
+    src = os.path.join(REPO, 'src')
+    headers = [os.path.join(REPO, 'include', 'FreeRTOSConfig.h'), os.path.join(REPO, 'include', 'lwipopts.h')]
+    headers += [os.path.join(src, f) for f in sorted(os.listdir(src)) if f.endswith('.h')]
+    defines = read_defines(*headers)
+
+    print()
+    print('Task stacks (static ones are inside the singletons above):')
+    for name in sorted(defines):
+        if name.endswith('_TASK_STACK_SIZE'):
+            words = evaluate(defines, name)
+            if words is not None:
+                print('  %s  %s' % (kib(words * 4), name))
+
+    # The heap as linked, since which size the header gives depends on the build
+    heap = sum(size for (name, cat), size in variables.items() if name == 'ucHeap') or \
+        evaluate(defines, 'configTOTAL_HEAP_SIZE')
+    tcpip = evaluate(defines, 'TCPIP_THREAD_STACKSIZE')
+    if heap is not None:
+        print()
+        print('FreeRTOS heap: %s; expected on it at run time:' % kib(heap).strip())
+        if tcpip is not None:
+            print('  %s  tcpip thread stack (TCPIP_THREAD_STACKSIZE)' % kib(tcpip * 4))
+        print('  %s  CYW43 async context task stack' % kib(configured_async_stack(defines)))
+        minimal = evaluate(defines, 'configMINIMAL_STACK_SIZE')
+        if minimal is not None:
+            print('  %s  "Pixel Core Init" task stack, until it has started the output' % kib(minimal * 2 * 4))
+        print('  The rest is lwIP mailboxes and semaphores and the task control blocks;')
+        print('  the Metrics endpoint reports the least the heap has ever had free.')
+
+    ram = regions.get('RAM')
+    end = symbols.get('__end__') or symbols.get('end')
+    limit = symbols.get('__HeapLimit')
+    if ram is not None:
+        print()
+        print('RAM: %s at 0x%08x' % (kib(ram[1]).strip(), ram[0]))
+        if end is not None and limit is not None:
+            print('Headroom between the end of .bss and the top of RAM: %s' % kib(limit - end).strip())
+        elif end is not None:
+            print('Headroom above the end of .bss: %s' % kib(ram[0] + ram[1] - end).strip())
+    return 0
+
+
+def configured_async_stack(defines):
+    words = evaluate(defines, 'ASYNC_CONTEXT_DEFAULT_FREERTOS_TASK_STACK_SIZE')
+    if words is None:
+        words = evaluate(defines, 'configMINIMAL_STACK_SIZE') or 0
+    return words * 4
+
+
+if __name__ == '__main__':
+    sys.exit(main())
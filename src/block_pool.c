@@ -0,0 +1,114 @@
+#include <string.h>
+#include "block_pool.h"
+#include "hardware/sync.h"
+
+// One hardware spin lock covers every pool; nothing holds it for more than a
+// few instructions
+static spin_lock_t *pool_lock = NULL;
+static block_pool_t *pool_list = NULL;
+
+
+/***
+ * Threads every block onto the free list and adds the pool to the list for
+ * reporting. Pools are set up before the scheduler starts, and never go away.
+ */
+void block_pool_init(block_pool_t *pool, const char *name, void *storage, size_t block_size, uint32_t block_count) {
+    if(pool_lock == NULL) {
+        pool_lock = spin_lock_instance(spin_lock_claim_unused(true));
+    }
+
+    memset(pool, 0, sizeof(*pool));
+    pool->name = name;
+    pool->storage = (uint8_t *)storage;
+    pool->block_size = BLOCK_POOL_BLOCK_SIZE(block_size);
+    pool->block_count = block_count;
+
+    for(uint32_t i = block_count; i > 0; i--) {
+        void **block = (void **)(pool->storage + (i - 1) * pool->block_size);
+        *block = pool->free_list;
+        pool->free_list = block;
+    }
+
+    pool->next = pool_list;
+    pool_list = pool;
+}
+
+
+void *block_pool_alloc(block_pool_t *pool, size_t size) {
+    uint32_t status;
+    void **block;
+
+    status = spin_lock_blocking(pool_lock);
+    block = (void **)pool->free_list;
+    if(block == NULL || size > pool->block_size) {
+        pool->failed++;
+        spin_unlock(pool_lock, status);
+        return NULL;
+    }
+    pool->free_list = *block;
+    pool->allocs++;
+    pool->used++;
+    if(pool->used > pool->max_used) {
+        pool->max_used = pool->used;
+    }
+    spin_unlock(pool_lock, status);
+
+    return block;
+}
+
+
+void block_pool_free(block_pool_t *pool, void *block) {
+    uint32_t status;
+
+    if(block == NULL) {
+        return;
+    }
+    status = spin_lock_blocking(pool_lock);
+    *(void **)block = pool->free_list;
+    pool->free_list = block;
+    pool->used--;
+    spin_unlock(pool_lock, status);
+}
+
+
+bool block_pool_owns(const block_pool_t *pool, const void *block) {
+    const uint8_t *p = (const uint8_t *)block;
+    return p >= pool->storage && p < pool->storage + pool->block_size * pool->block_count;
+}
+
+
+void block_pool_reset_stats(block_pool_t *pool) {
+    pool->max_used = pool->used;
+    pool->allocs = 0;
+    pool->failed = 0;
+}
+
+
+/***
+ * A request that's too big for every pool counts as a failure of the biggest.
+ * One that fits a pool that's empty doesn't spill into the next size up: a
+ * pool running dry should show up in its own counts, not eat another's.
+ */
+void *block_pool_alloc_from(block_pool_t *const *pools, int count, size_t size) {
+    for(int i = 0; i < count; i++) {
+        if(size <= pools[i]->block_size) {
+            return block_pool_alloc(pools[i], size);
+        }
+    }
+    return count > 0 ? block_pool_alloc(pools[count - 1], size) : NULL;
+}
+
+
+void block_pool_free_to(block_pool_t *const *pools, int count, void *block) {
+    for(int i = 0; i < count; i++) {
+        if(block_pool_owns(pools[i], block)) {
+            block_pool_free(pools[i], block);
+            return;
+        }
+    }
+}
+
+
+const block_pool_t *block_pool_first(void) {
+    return pool_list;
+}
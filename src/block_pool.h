@@ -0,0 +1,111 @@
+#ifndef __BLOCK_POOL_H__
+#define __BLOCK_POOL_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Blocks are aligned for anything, doubles and 64-bit counters included
+#define BLOCK_POOL_ALIGN        8
+#define BLOCK_POOL_BLOCK_SIZE(size)  (((size) + BLOCK_POOL_ALIGN - 1) & ~(size_t)(BLOCK_POOL_ALIGN - 1))
+
+
+/**
+ * A pool of equal-sized blocks carved out of storage the caller provides
+ * (usually a static array, so the RAM budget report counts it). Free blocks
+ * are kept on a list threaded through the blocks themselves, so allocating
+ * and freeing are a couple of pointer moves however full or churned the pool
+ * is, and there's no fragmentation to speak of: any free block fits any
+ * request the pool takes. A request that's bigger than a block, or that finds
+ * the pool empty, gets NULL and is counted.
+ *
+ * Every pool is on a list for reporting, from block_pool_first(). Allocating
+ * and freeing are safe from any task or interrupt on either core.
+ */
+typedef struct block_pool {
+    const char *name;
+    uint8_t *storage;
+    size_t block_size;
+    uint32_t block_count;
+    void *free_list;
+    uint32_t used;
+    uint32_t max_used;          // the high water mark
+    uint32_t allocs;
+    uint32_t failed;            // empty, or asked for more than a block
+    struct block_pool *next;
+} block_pool_t;
+
+// Static storage for count blocks of at least size bytes each
+#define BLOCK_POOL_STORAGE(var, size, count) \
+    static uint64_t var[BLOCK_POOL_BLOCK_SIZE(size) / sizeof(uint64_t) * (count)]
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void block_pool_init(block_pool_t *pool, const char *name, void *storage, size_t block_size, uint32_t block_count);
+void *block_pool_alloc(block_pool_t *pool, size_t size);
+void block_pool_free(block_pool_t *pool, void *block);
+bool block_pool_owns(const block_pool_t *pool, const void *block);
+void block_pool_reset_stats(block_pool_t *pool);
+
+// Picks the smallest of a set of pools, in increasing block size, that has a
+// block big enough; the free goes back to whichever pool the block came from
+void *block_pool_alloc_from(block_pool_t *const *pools, int count, size_t size);
+void block_pool_free_to(block_pool_t *const *pools, int count, void *block);
+
+const block_pool_t *block_pool_first(void);
+
+#ifdef __cplusplus
+}
+
+#include <new>
+
+
+/**
+ * For allocator-aware C++ containers that allocate one element at a time
+ * (lists, maps, sets): every allocation is one block of the pool, which
+ * has to be at least sizeof(T). There are no exceptions on the Pico, so an
+ * empty pool returns NULL and the container will fault; size the pool for
+ * the worst case and watch its failed count.
+ */
+template<typename T>
+class PoolAllocator {
+    public:
+        typedef T value_type;
+
+        explicit PoolAllocator(block_pool_t *pool) : pool(pool) {}
+
+        template<typename U>
+        PoolAllocator(const PoolAllocator<U>& other) : pool(other.pool) {}
+
+        T *allocate(size_t n) { return (T *)block_pool_alloc(pool, n * sizeof(T)); }
+        void deallocate(T *p, size_t n) { block_pool_free(pool, p); }
+
+        template<typename U>
+        bool operator==(const PoolAllocator<U>& other) const { return pool == other.pool; }
+        template<typename U>
+        bool operator!=(const PoolAllocator<U>& other) const { return pool != other.pool; }
+
+        block_pool_t *pool;
+};
+
+
+// Constructs a T in a block, or returns NULL if there isn't one
+template<typename T, typename... Args>
+T *block_pool_new(block_pool_t *pool, Args&&... args) {
+    void *block = block_pool_alloc(pool, sizeof(T));
+    return block != NULL ? new(block) T(static_cast<Args&&>(args)...) : NULL;
+}
+
+
+template<typename T>
+void block_pool_delete(block_pool_t *pool, T *object) {
+    if(object != NULL) {
+        object->~T();
+        block_pool_free(pool, object);
+    }
+}
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+#include <string.h>
+#include "config_flash.h"
+#include "hardware/flash.h"
+#include "pico/flash.h"
+
+#define CONFIG_FLASH_OFFSET     (PICO_FLASH_SIZE_BYTES - CONFIG_FLASH_SIZE)
+
+
+typedef struct {
+    uint32_t offset;
+    const void *data;
+    size_t len;
+} flash_op_t;
+
+
+static void do_erase(void *param) {
+    flash_op_t *op = (flash_op_t *)param;
+    flash_range_erase(CONFIG_FLASH_OFFSET + op->offset, op->len);
+}
+
+
+static void do_program(void *param) {
+    flash_op_t *op = (flash_op_t *)param;
+    flash_range_program(CONFIG_FLASH_OFFSET + op->offset, (const uint8_t *)op->data, op->len);
+}
+
+
+bool PicoFlash::read(uint32_t offset, void *buffer, size_t len) {
+    if(offset + len > CONFIG_FLASH_SIZE) {
+        return false;
+    }
+    memcpy(buffer, (const void *)(XIP_BASE + CONFIG_FLASH_OFFSET + offset), len);
+    return true;
+}
+
+
+bool PicoFlash::erase(uint32_t offset, size_t len) {
+    flash_op_t op = { offset, NULL, len };
+
+    if(offset + len > CONFIG_FLASH_SIZE) {
+        return false;
+    }
+    return flash_safe_execute(do_erase, &op, CONFIG_FLASH_TIMEOUT_MS) == PICO_OK;
+}
+
+
+bool PicoFlash::program(uint32_t offset, const void *data, size_t len) {
+    flash_op_t op = { offset, data, len };
+
+    if(offset + len > CONFIG_FLASH_SIZE) {
+        return false;
+    }
+    return flash_safe_execute(do_program, &op, CONFIG_FLASH_TIMEOUT_MS) == PICO_OK;
+}
@@ -0,0 +1,35 @@
+#ifndef __CONFIG_FLASH_H__
+#define __CONFIG_FLASH_H__
+
+#include "pico/stdlib.h"
+#include "config_store.h"
+
+#define CONFIG_FLASH_SIZE           (CONFIG_STORE_SECTORS * CONFIG_STORE_SECTOR_SIZE)
+
+// How long flash_safe_execute() may wait for the other core to get out of the way
+#define CONFIG_FLASH_TIMEOUT_MS     100
+
+
+/**
+ * The last CONFIG_FLASH_SIZE bytes of the board's flash, well clear of the
+ * program image. Reads come straight through XIP; erases and programs run
+ * under flash_safe_execute(), which parks the other core and masks interrupts
+ * while XIP is unavailable.
+ */
+class PicoFlash : public FlashDevice {
+    public:
+        size_t get_size() override { return CONFIG_FLASH_SIZE; };
+        bool read(uint32_t offset, void *buffer, size_t len) override;
+        bool erase(uint32_t offset, size_t len) override;
+        bool program(uint32_t offset, const void *data, size_t len) override;
+
+        static PicoFlash& getInstance() {
+            static PicoFlash instance;
+            return instance;
+        }
+
+    private:
+        PicoFlash() {};
+};
+
+#endif
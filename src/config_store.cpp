@@ -0,0 +1,361 @@
+#include <stddef.h>
+#include <string.h>
+#include "config_store.h"
+#include "logger.h"
+
+#define SLOTS_PER_SECTOR    (CONFIG_STORE_SECTOR_SIZE / CONFIG_STORE_RECORD_SIZE)
+#define RECORD_CRC_LEN      (offsetof(config_record_t, config) + offsetof(led_strip_config_t, crc))
+#define LAYOUT_CRC_LEN      offsetof(strip_layout_t, crc)
+#define BLANK_SEQUENCE      0xffffffff
+
+static_assert(sizeof(config_record_t) <= CONFIG_STORE_RECORD_SIZE, "config record doesn't fit in a flash page");
+
+
+/***
+ * Standard (zlib) CRC-32, a nibble at a time so the table stays tiny. Like
+ * zlib's, passing the previous result as crc continues the calculation.
+ */
+uint32_t ConfigStore::crc32(const void *data, size_t len, uint32_t crc) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+    };
+    const uint8_t *p = (const uint8_t *)data;
+
+    crc = ~crc;
+    while(len--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+    }
+
+    return ~crc;
+}
+
+
+void ConfigStore::set_flash(FlashDevice *flash) {
+    this->flash = flash;
+    slot_count = (int)(flash->get_size() / CONFIG_STORE_RECORD_SIZE);
+    if(slot_count > CONFIG_STORE_MAX_SLOTS) {
+        slot_count = CONFIG_STORE_MAX_SLOTS;
+    }
+    slot_count -= slot_count % SLOTS_PER_SECTOR;
+    newest_slot = -1;
+    sequence = 0;
+    scanned = false;
+}
+
+
+uint32_t ConfigStore::record_crc(const config_record_t *record) {
+    uint32_t crc = crc32(record, RECORD_CRC_LEN);
+    return crc32(&record->reconnect, sizeof(record->reconnect), crc);
+}
+
+
+uint32_t ConfigStore::layout_crc(const strip_layout_t *layout) {
+    return crc32(layout, LAYOUT_CRC_LEN);
+}
+
+
+// Reads a whole record and returns whether it's one we wrote
+bool ConfigStore::read_record(int slot, config_record_t *record) {
+    stats.records_scanned++;
+
+    if(!flash->read(slot * CONFIG_STORE_RECORD_SIZE, record, sizeof(config_record_t))) {
+        return false;
+    }
+    if(record->config.magic != CONFIG_STORE_MAGIC || record->sequence == BLANK_SEQUENCE) {
+        return false;
+    }
+    if(record->config.crc != record_crc(record)) {
+        stats.crc_failures++;
+        return false;
+    }
+
+    return true;
+}
+
+
+bool ConfigStore::is_blank(int slot) {
+    uint32_t words[CONFIG_STORE_RECORD_SIZE / sizeof(uint32_t)];
+
+    if(!flash->read(slot * CONFIG_STORE_RECORD_SIZE, words, sizeof(words))) {
+        return false;
+    }
+    for(size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        if(words[i] != 0xffffffff) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/***
+ * Finds the newest good record. Only the first eight bytes of each slot (the
+ * sequence number and magic) are read up front; full records are read and
+ * CRC-checked newest first, so in the normal case exactly one is.
+ */
+bool ConfigStore::scan(led_strip_config_t *config) {
+    uint32_t sequences[CONFIG_STORE_MAX_SLOTS];
+    bool candidate[CONFIG_STORE_MAX_SLOTS];
+    config_record_t record;
+    uint32_t header[2];
+
+    newest_slot = -1;
+    sequence = 0;
+    scanned = true;
+    stats.sequence = 0;
+
+    for(int slot = 0; slot < slot_count; slot++) {
+        candidate[slot] = false;
+        if(!flash->read(slot * CONFIG_STORE_RECORD_SIZE, header, sizeof(header))) {
+            continue;
+        }
+        if(header[0] != BLANK_SEQUENCE && header[1] == CONFIG_STORE_MAGIC) {
+            sequences[slot] = header[0];
+            candidate[slot] = true;
+
+            // Even a record that turns out to be torn has used up its number
+            if(header[0] > sequence) {
+                sequence = header[0];
+            }
+        }
+    }
+
+    for(;;) {
+        int best = -1;
+        for(int slot = 0; slot < slot_count; slot++) {
+            if(candidate[slot] && (best < 0 || sequences[slot] > sequences[best])) {
+                best = slot;
+            }
+        }
+        if(best < 0) {
+            return false;
+        }
+
+        candidate[best] = false;
+        if(read_record(best, &record)) {
+            newest_slot = best;
+            stats.sequence = record.sequence;
+            memcpy(&current, &record, sizeof(current));
+            if(config) {
+                memcpy(config, &record.config, sizeof(led_strip_config_t));
+            }
+            return true;
+        }
+    }
+}
+
+
+bool ConfigStore::load(led_strip_config_t *config) {
+    if(flash == NULL) {
+        return false;
+    }
+
+    stats.loads++;
+    return scan(config);
+}
+
+
+/***
+ * Appends a new record. It only counts once it's been programmed and reads
+ * back with a good CRC; until then the previous one is still the newest, and
+ * nothing it lives in gets erased.
+ */
+bool ConfigStore::append(const led_strip_config_t *config, const wifi_reconnect_cache_t *reconnect,
+                         const strip_layout_t *layout) {
+    uint32_t page[CONFIG_STORE_RECORD_SIZE / sizeof(uint32_t)];
+    config_record_t *record = (config_record_t *)page;
+    config_record_t check;
+    int slot;
+
+    if(flash == NULL || slot_count == 0) {
+        return false;
+    }
+    if(!scanned) {
+        scan(NULL);
+    }
+
+    slot = newest_slot < 0 ? 0 : (newest_slot + 1) % slot_count;
+    for(int tries = 0; tries < slot_count; tries++, slot = (slot + 1) % slot_count) {
+        if(slot % SLOTS_PER_SECTOR == 0) {
+            bool sector_blank = true;
+            for(int i = slot; i < slot + SLOTS_PER_SECTOR && sector_blank; i++) {
+                sector_blank = is_blank(i);
+            }
+
+            if(!sector_blank) {
+                if(newest_slot >= 0 && newest_slot / SLOTS_PER_SECTOR == slot / SLOTS_PER_SECTOR) {
+                    break;
+                }
+                stats.erases++;
+                if(!flash->erase(slot * CONFIG_STORE_RECORD_SIZE, CONFIG_STORE_SECTOR_SIZE)) {
+                    stats.write_failures++;
+                    continue;
+                }
+            }
+        }
+        else if(!is_blank(slot)) {
+            // Left over from a save that didn't finish
+            continue;
+        }
+
+        memset(page, 0xff, sizeof(page));
+        record->sequence = sequence + 1;
+        memcpy(&record->config, config, sizeof(led_strip_config_t));
+        record->config.magic = CONFIG_STORE_MAGIC;
+        memcpy(&record->reconnect, reconnect, sizeof(wifi_reconnect_cache_t));
+        memcpy(&record->layout, layout, sizeof(strip_layout_t));
+        record->config.crc = record_crc(record);
+
+        if(flash->program(slot * CONFIG_STORE_RECORD_SIZE, page, sizeof(page)) && read_record(slot, &check) &&
+           check.sequence == record->sequence) {
+            memcpy(&current, record, sizeof(current));
+            newest_slot = slot;
+            sequence = record->sequence;
+            stats.saves++;
+            stats.sequence = sequence;
+            return true;
+        }
+
+        stats.write_failures++;
+    }
+
+    LOG_WARN("CONFIG STORE: NO USABLE SLOT");
+    return false;
+}
+
+
+/***
+ * Saves a new configuration, carrying the reconnect cache and the layout over
+ * from the current record. Sets config->magic and config->crc as a side
+ * effect.
+ */
+bool ConfigStore::save(led_strip_config_t *config) {
+    wifi_reconnect_cache_t reconnect;
+    strip_layout_t layout;
+
+    if(flash == NULL) {
+        return false;
+    }
+    if(!scanned) {
+        scan(NULL);
+    }
+
+    if(newest_slot >= 0) {
+        memcpy(&reconnect, &current.reconnect, sizeof(reconnect));
+        memcpy(&layout, &current.layout, sizeof(layout));
+    }
+    else {
+        memset(&reconnect, 0, sizeof(reconnect));
+        memset(&layout, 0xff, sizeof(layout));
+    }
+
+    if(!append(config, &reconnect, &layout)) {
+        return false;
+    }
+    config->magic = current.config.magic;
+    config->crc = current.config.crc;
+    return true;
+}
+
+
+bool ConfigStore::load_reconnect_cache(wifi_reconnect_cache_t *cache) {
+    if(flash == NULL) {
+        return false;
+    }
+    if(!scanned) {
+        scan(NULL);
+    }
+    if(newest_slot < 0 || !current.reconnect.valid) {
+        return false;
+    }
+
+    memcpy(cache, &current.reconnect, sizeof(wifi_reconnect_cache_t));
+    return true;
+}
+
+
+/***
+ * Rewrites the current configuration with a new reconnect cache. There has to
+ * be a configuration to attach it to; the cache on its own isn't worth a
+ * record.
+ */
+bool ConfigStore::save_reconnect_cache(const wifi_reconnect_cache_t *cache) {
+    if(flash == NULL) {
+        return false;
+    }
+    if(!scanned) {
+        scan(NULL);
+    }
+    if(newest_slot < 0) {
+        return false;
+    }
+
+    return append(&current.config, cache, &current.layout);
+}
+
+
+/***
+ * The stored layout, if the current record has one that checks out.
+ */
+bool ConfigStore::load_layout(strip_layout_t *layout) {
+    if(flash == NULL) {
+        return false;
+    }
+    if(!scanned) {
+        scan(NULL);
+    }
+    if(newest_slot < 0 || current.layout.crc != layout_crc(&current.layout)) {
+        return false;
+    }
+
+    memcpy(layout, &current.layout, sizeof(strip_layout_t));
+    return true;
+}
+
+
+/***
+ * Rewrites the current configuration with a new layout. Like the reconnect
+ * cache, it needs a configuration to go with.
+ */
+bool ConfigStore::save_layout(const strip_layout_t *layout) {
+    strip_layout_t stored;
+
+    if(flash == NULL) {
+        return false;
+    }
+    if(!scanned) {
+        scan(NULL);
+    }
+    if(newest_slot < 0) {
+        return false;
+    }
+
+    memcpy(&stored, layout, sizeof(stored));
+    stored.crc = layout_crc(&stored);
+    return append(&current.config, &current.reconnect, &stored);
+}
+
+
+/***
+ * Erases the whole log, after which load() finds nothing.
+ */
+bool ConfigStore::reset() {
+    bool ok = true;
+
+    if(flash == NULL) {
+        return false;
+    }
+
+    for(int slot = 0; slot < slot_count; slot += SLOTS_PER_SECTOR) {
+        stats.erases++;
+        ok = flash->erase(slot * CONFIG_STORE_RECORD_SIZE, CONFIG_STORE_SECTOR_SIZE) && ok;
+    }
+    newest_slot = -1;
+    scanned = true;
+
+    return ok;
+}
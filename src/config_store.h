@@ -0,0 +1,118 @@
+#ifndef __CONFIG_STORE_H__
+#define __CONFIG_STORE_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "strip_config.h"
+
+#define CONFIG_STORE_MAGIC          0x4c454443      // "LEDC"
+
+// Flash geometry: erases are by sector, and each record is programmed as one page
+#define CONFIG_STORE_SECTOR_SIZE    4096
+#define CONFIG_STORE_RECORD_SIZE    256
+
+#ifndef CONFIG_STORE_SECTORS
+#define CONFIG_STORE_SECTORS        4
+#endif
+
+#define CONFIG_STORE_MAX_SLOTS      (CONFIG_STORE_SECTORS * CONFIG_STORE_SECTOR_SIZE / CONFIG_STORE_RECORD_SIZE)
+
+
+/**
+ * The flash region the store lives in, addressed from 0. Erased flash reads as
+ * 0xff and programming can only clear bits, like NOR flash. erase() and
+ * program() are only ever called with sector- and page-aligned arguments.
+ */
+class FlashDevice {
+    public:
+        virtual size_t get_size() = 0;
+        virtual bool read(uint32_t offset, void *buffer, size_t len) = 0;
+        virtual bool erase(uint32_t offset, size_t len) = 0;
+        virtual bool program(uint32_t offset, const void *data, size_t len) = 0;
+};
+
+
+// One slot in the log. config.crc covers the whole record, sequence number and
+// reconnect cache included, except for the layout, which has a CRC of its own
+// so that records from before it existed (where it reads as erased flash)
+// still load.
+typedef struct {
+    uint32_t sequence;
+    led_strip_config_t config;
+    wifi_reconnect_cache_t reconnect;
+    strip_layout_t layout;
+} config_record_t;
+
+
+typedef struct {
+    uint32_t loads;
+    uint32_t saves;
+    uint32_t erases;
+    uint32_t records_scanned;
+    uint32_t crc_failures;
+    uint32_t write_failures;
+    uint32_t sequence;          // of the newest good record
+} config_store_stats_t;
+
+
+/**
+ * Keeps led_strip_config_t in flash as an append-only log of page-sized
+ * records spread over CONFIG_STORE_SECTORS sectors. Each save() goes into the
+ * next blank slot with a higher sequence number, and load() returns the newest
+ * record whose CRC checks out, so a save interrupted by a power cut just leaves
+ * the previous configuration in charge. Sectors are erased in turn as the log
+ * wraps around, which spreads the wear evenly.
+ */
+class ConfigStore {
+    public:
+        void set_flash(FlashDevice *flash);
+
+        bool load(led_strip_config_t *config);
+        bool save(led_strip_config_t *config);
+        bool reset();
+
+        bool load_reconnect_cache(wifi_reconnect_cache_t *cache);
+        bool save_reconnect_cache(const wifi_reconnect_cache_t *cache);
+
+        bool load_layout(strip_layout_t *layout);
+        bool save_layout(const strip_layout_t *layout);
+
+        const config_store_stats_t *get_stats() { return &stats; };
+
+        static uint32_t crc32(const void *data, size_t len, uint32_t crc = 0);
+
+        static ConfigStore& getInstance() {
+            static ConfigStore instance;
+            return instance;
+        }
+
+    private:
+        ConfigStore() {
+            flash = NULL;
+            slot_count = 0;
+            newest_slot = -1;
+            sequence = 0;
+            scanned = false;
+            memset(&current, 0, sizeof(current));
+            memset(&stats, 0, sizeof(stats));
+        };
+
+        bool scan(led_strip_config_t *config);
+        bool append(const led_strip_config_t *config, const wifi_reconnect_cache_t *reconnect,
+                    const strip_layout_t *layout);
+        bool read_record(int slot, config_record_t *record);
+        static uint32_t record_crc(const config_record_t *record);
+        static uint32_t layout_crc(const strip_layout_t *layout);
+        bool is_blank(int slot);
+
+        FlashDevice *flash;
+        int slot_count;
+        int newest_slot;
+        uint32_t sequence;
+        bool scanned;
+        config_record_t current;
+        config_store_stats_t stats;
+};
+
+#endif
@@ -0,0 +1,308 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "disciplined_clock.h"
+
+#define FRACTION_ONE    4294967296.0
+
+
+/***
+ * Forgets everything: the clock goes back to counting from the local timer's
+ * zero, unsynchronized, with no frequency correction.
+ */
+void DisciplinedClock::reset() {
+    memset(mappings, 0, sizeof(mappings));
+    memset(history, 0, sizeof(history));
+    generation = 0;
+    history_count = 0;
+    history_next = 0;
+    burst_count = 0;
+    synchronized = false;
+    spike_count = 0;
+    frequency = 0.0;
+    freq_variance = (CLOCK_MAX_FREQ_PPM / 1e6) * (CLOCK_MAX_FREQ_PPM / 1e6);
+    memset(&stats, 0, sizeof(stats));
+    stats.poll_ms = CLOCK_POLL_MIN_MS;
+}
+
+
+/***
+ * UTC in microseconds at a given reading of the local timer. Safe to call from
+ * any task; it only retries if update() published a new mapping while it was
+ * copying the current one.
+ */
+int64_t DisciplinedClock::to_utc_us(uint64_t local_us) {
+    clock_mapping_t mapping;
+    uint32_t seen;
+
+    do {
+        seen = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+        mapping = mappings[seen & 1];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while(seen != __atomic_load_n(&generation, __ATOMIC_RELAXED));
+
+    return map(&mapping, local_us);
+}
+
+
+/***
+ * Takes one (local time, reference time) sample, where reference_us is what
+ * the reference clock read at the moment the local timer read local_us, and
+ * delay_us is the round trip it took to find out.
+ *
+ * Returns false if the sample was thrown away as a spike.
+ */
+bool DisciplinedClock::update(uint64_t local_us, int64_t reference_us, uint32_t delay_us) {
+    clock_mapping_t mapping;
+    int64_t offset;
+    int64_t raw_offset;
+    int64_t now_utc;
+    int64_t theta;
+    int32_t freq = mappings[generation & 1].freq;
+
+    stats.samples++;
+    stats.last_delay_us = delay_us;
+
+    if(!synchronized) {
+        step(local_us, reference_us);
+        add_sample(local_us, reference_us, delay_us);
+        return true;
+    }
+
+    if(!filter(&local_us, &reference_us, &delay_us)) {
+        return true;
+    }
+
+    offset = reference_us - to_utc_us(local_us);
+    stats.last_offset_us = (int32_t)(offset > INT32_MAX ? INT32_MAX : (offset < INT32_MIN ? INT32_MIN : offset));
+
+    if(offset > CLOCK_STEP_THRESHOLD_US || offset < -CLOCK_STEP_THRESHOLD_US) {
+        if(spike_count < CLOCK_MAX_SPIKES) {
+            spike_count++;
+            stats.spikes++;
+            return false;
+        }
+        // Twice in a row means the reference really did move
+        step(local_us, reference_us);
+        add_sample(local_us, reference_us, delay_us);
+        return true;
+    }
+    spike_count = 0;
+
+    add_sample(local_us, reference_us, delay_us);
+    fit(local_us, &raw_offset, &freq);
+
+    // Carry on from where the clock is now, and slew out the difference to
+    // where the fit says it should be at the full slew rate
+    now_utc = to_utc_us(local_us);
+    theta = (int64_t)local_us + raw_offset - now_utc;
+
+    mapping.anchor_local_us = local_us;
+    mapping.anchor_utc_us = now_utc;
+    mapping.freq = freq;
+    mapping.slew = (int32_t)(CLOCK_MAX_SLEW_PPM * (FRACTION_ONE / 1000000.0));
+    if(theta < 0) {
+        mapping.slew = -mapping.slew;
+    }
+    mapping.slew_end_local_us = local_us + (uint64_t)(theta < 0 ? -theta : theta) * 1000000 / CLOCK_MAX_SLEW_PPM;
+    publish(&mapping);
+
+    stats.freq_ppb = (int32_t)((double)freq * 1e9 / FRACTION_ONE);
+    if(offset < CLOCK_STEADY_US && offset > -CLOCK_STEADY_US && stats.jitter_us < CLOCK_STEADY_US &&
+       history_count == CLOCK_HISTORY) {
+        stats.poll_ms = stats.poll_ms * 2 > CLOCK_POLL_MAX_MS ? CLOCK_POLL_MAX_MS : stats.poll_ms * 2;
+    }
+    else if(offset > 2 * CLOCK_STEADY_US || offset < -2 * CLOCK_STEADY_US) {
+        stats.poll_ms = stats.poll_ms / 2 < CLOCK_POLL_MIN_MS ? CLOCK_POLL_MIN_MS : stats.poll_ms / 2;
+    }
+
+    return true;
+}
+
+
+/***
+ * Sets the clock to reference_us at local_us, right now, without slewing.
+ * The frequency correction learned so far is kept, but the sample history
+ * isn't, since it was measured against a reference that has just moved.
+ */
+void DisciplinedClock::step(uint64_t local_us, int64_t reference_us) {
+    clock_mapping_t mapping;
+
+    mapping.anchor_local_us = local_us;
+    mapping.anchor_utc_us = reference_us;
+    mapping.slew_end_local_us = local_us;
+    mapping.freq = mappings[generation & 1].freq;
+    mapping.slew = 0;
+    publish(&mapping);
+
+    history_count = 0;
+    history_next = 0;
+    burst_count = 0;
+    spike_count = 0;
+    synchronized = true;
+    stats.steps++;
+    stats.poll_ms = CLOCK_POLL_MIN_MS;
+}
+
+
+void DisciplinedClock::set_burst_length(int length) {
+    burst_length = length < 1 ? 1 : (length > CLOCK_BURST_LENGTH ? CLOCK_BURST_LENGTH : length);
+    burst_count = 0;
+}
+
+
+/***
+ * The clock filter. Holds on to the samples of a burst and returns false
+ * until it's complete; then hands back the one with the quickest round trip
+ * in place of the sample just taken. Over a burst the clock hardly drifts,
+ * so age doesn't come into it.
+ */
+bool DisciplinedClock::filter(uint64_t *local_us, int64_t *reference_us, uint32_t *delay_us) {
+    const clock_sample_t *best;
+
+    if(burst_length <= 1) {
+        return true;
+    }
+
+    burst[burst_count].local_us = *local_us;
+    burst[burst_count].raw_offset_us = *reference_us - (int64_t)*local_us;
+    burst[burst_count].delay_us = *delay_us;
+    if(++burst_count < burst_length) {
+        return false;
+    }
+    burst_count = 0;
+
+    best = &burst[0];
+    for(int i = 1; i < burst_length; i++) {
+        if(burst[i].delay_us < best->delay_us) {
+            best = &burst[i];
+        }
+    }
+    stats.filtered += burst_length - 1;
+
+    *local_us = best->local_us;
+    *reference_us = best->raw_offset_us + (int64_t)best->local_us;
+    *delay_us = best->delay_us;
+    return true;
+}
+
+
+int64_t DisciplinedClock::map(const clock_mapping_t *mapping, uint64_t local_us) {
+    int64_t dt = (int64_t)(local_us - mapping->anchor_local_us);
+    int64_t slewed = (int64_t)(mapping->slew_end_local_us - mapping->anchor_local_us);
+    int64_t rate = (int64_t)mapping->freq + mapping->slew;
+
+    // Before the anchor, the line goes back at the plain frequency correction,
+    // so old samples can be compared with the clock as it is now
+    if(dt < 0) {
+        return mapping->anchor_utc_us + dt + ((dt * mapping->freq) >> 32);
+    }
+
+    if(dt <= slewed) {
+        return mapping->anchor_utc_us + dt + ((dt * rate) >> 32);
+    }
+
+    dt -= slewed;
+    return mapping->anchor_utc_us + slewed + ((slewed * rate) >> 32) + dt + ((dt * mapping->freq) >> 32);
+}
+
+
+/***
+ * Writes the new mapping into the slot readers aren't using and then flips
+ * them over to it.
+ */
+void DisciplinedClock::publish(const clock_mapping_t *mapping) {
+    uint32_t next = generation + 1;
+
+    mappings[next & 1] = *mapping;
+    __atomic_store_n(&generation, next, __ATOMIC_RELEASE);
+}
+
+
+void DisciplinedClock::add_sample(uint64_t local_us, int64_t reference_us, uint32_t delay_us) {
+    clock_sample_t *sample = &history[history_next];
+
+    sample->local_us = local_us;
+    sample->raw_offset_us = reference_us - (int64_t)local_us;
+    sample->delay_us = delay_us;
+
+    history_next = (history_next + 1) % CLOCK_HISTORY;
+    if(history_count < CLOCK_HISTORY) {
+        history_count++;
+    }
+}
+
+
+/***
+ * Weighted least-squares line through the raw offsets (reference minus local
+ * timer) in the history. The slope is the local timer's frequency error and
+ * the line at local_us is where the clock ought to be. A sample's weight
+ * falls off with how much longer its round trip was than the quickest one in
+ * the history: the extra time was spent in one direction or the other, and
+ * that asymmetry is exactly the error in its offset. With too little history
+ * to trust a slope, the newest sample is taken as-is and freq is left alone.
+ *
+ * Works relative to the newest sample, so doubles don't lose the microseconds.
+ */
+bool DisciplinedClock::fit(uint64_t local_us, int64_t *raw_offset_us, int32_t *freq) {
+    const clock_sample_t *newest = &history[(history_next + CLOCK_HISTORY - 1) % CLOCK_HISTORY];
+    const clock_sample_t *oldest = &history[(history_next + CLOCK_HISTORY - history_count) % CLOCK_HISTORY];
+    double weight[CLOCK_HISTORY];
+    double sum_w = 0.0, mean_x = 0.0, mean_y = 0.0, sxx = 0.0, sxy = 0.0, residuals = 0.0;
+    double slope, slope_variance, gain, phase = 0.0, max_slope = CLOCK_MAX_FREQ_PPM / 1e6;
+    uint32_t min_delay = UINT32_MAX;
+
+    if(history_count < 2 || newest->local_us - oldest->local_us < min_fit_span_us) {
+        *raw_offset_us = newest->raw_offset_us + (((int64_t)(local_us - newest->local_us) * *freq) >> 32);
+        return false;
+    }
+
+    for(int i = 0; i < history_count; i++) {
+        min_delay = history[i].delay_us < min_delay ? history[i].delay_us : min_delay;
+    }
+
+    for(int i = 0; i < history_count; i++) {
+        double excess = (double)(history[i].delay_us - min_delay) / CLOCK_DELAY_WEIGHT_US;
+        weight[i] = 1.0 / (1.0 + excess * excess);
+        sum_w += weight[i];
+        mean_x += weight[i] * (double)(int64_t)(history[i].local_us - newest->local_us);
+        mean_y += weight[i] * (double)(history[i].raw_offset_us - newest->raw_offset_us);
+    }
+    mean_x /= sum_w;
+    mean_y /= sum_w;
+
+    for(int i = 0; i < history_count; i++) {
+        double x = (double)(int64_t)(history[i].local_us - newest->local_us) - mean_x;
+        double y = (double)(history[i].raw_offset_us - newest->raw_offset_us) - mean_y;
+        sxx += weight[i] * x * x;
+        sxy += weight[i] * x * y;
+    }
+
+    slope = sxy / sxx;
+    for(int i = 0; i < history_count; i++) {
+        double x = (double)(int64_t)(history[i].local_us - newest->local_us) - mean_x;
+        double y = (double)(history[i].raw_offset_us - newest->raw_offset_us) - mean_y;
+        residuals += weight[i] * (y - slope * x) * (y - slope * x);
+    }
+    stats.jitter_us = (uint32_t)sqrt(residuals / sum_w);
+
+    // Over a short span, or with noisy samples, the slope isn't worth much, so
+    // it's blended into the running frequency estimate according to how much
+    // each can be trusted, rather than replacing it
+    slope_variance = residuals / sum_w / sxx + CLOCK_MIN_SLOPE_SIGMA * CLOCK_MIN_SLOPE_SIGMA;
+    gain = freq_variance / (freq_variance + slope_variance);
+    frequency += gain * (slope - frequency);
+    frequency = frequency > max_slope ? max_slope : (frequency < -max_slope ? -max_slope : frequency);
+    freq_variance = (1.0 - gain) * freq_variance + CLOCK_FREQ_WANDER * CLOCK_FREQ_WANDER;
+
+    // Then every sample in the history votes for where the clock is now
+    for(int i = 0; i < history_count; i++) {
+        double x = (double)(int64_t)(local_us - history[i].local_us);
+        phase += weight[i] * ((double)(history[i].raw_offset_us - newest->raw_offset_us) + frequency * x);
+    }
+
+    *raw_offset_us = newest->raw_offset_us + (int64_t)(phase / sum_w);
+    *freq = (int32_t)(frequency * FRACTION_ONE);
+    return true;
+}
@@ -0,0 +1,139 @@
+#ifndef __DISCIPLINED_CLOCK_H__
+#define __DISCIPLINED_CLOCK_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// Offset/frequency samples kept for the frequency fit, one per poll
+#define CLOCK_HISTORY               16
+
+// Each poll is a burst of samples this far apart, and only the one with the
+// quickest round trip goes on to the fit: the extra time in the others went
+// one way or the other, and that's exactly the error in their offsets
+#define CLOCK_BURST_LENGTH          8
+#define CLOCK_BURST_SPACING_MS      2000
+
+// Bigger errors than this are stepped, not slewed (NTP uses the same number).
+// A single sample that far out is treated as a spike and ignored.
+#define CLOCK_STEP_THRESHOLD_US     128000
+#define CLOCK_MAX_SPIKES            1
+
+// How fast the clock is allowed to run fast or slow while it slews out an
+// offset, and the largest frequency error we believe the crystal can have
+#define CLOCK_MAX_SLEW_PPM          500
+#define CLOCK_MAX_FREQ_PPM          500
+
+// A sample whose round trip took this much longer than the quickest one in
+// the history counts half as much in the fit
+#define CLOCK_DELAY_WEIGHT_US       1000
+
+// Samples have to span at least this long before the frequency fit is trusted
+#define CLOCK_MIN_FIT_SPAN_US       30000000
+
+// How well a fitted slope can ever be known, and how far the crystal's
+// frequency is expected to wander between samples (both as fractions)
+#define CLOCK_MIN_SLOPE_SIGMA       0.01e-6
+#define CLOCK_FREQ_WANDER           0.01e-6
+
+// The poll interval we ask for starts short and doubles while the clock stays
+// within CLOCK_STEADY_US of the fit, and the samples do too, up to the
+// maximum; that's a quarter of the millisecond the strips have to agree to,
+// so a noisy link keeps polling often. A step starts it over.
+#define CLOCK_POLL_MIN_MS           16000
+#define CLOCK_POLL_MAX_MS           1024000
+#define CLOCK_STEADY_US             250
+
+
+typedef struct {
+    uint32_t samples;
+    uint32_t filtered;          // passed over for a quicker one in the same burst
+    uint32_t steps;
+    uint32_t spikes;
+    int32_t last_offset_us;     // error we measured at the last sample, before correcting it
+    uint32_t last_delay_us;     // round trip of the last sample
+    int32_t freq_ppb;           // how much faster than the local timer the reference runs
+    uint32_t jitter_us;         // RMS of the samples around the frequency fit
+    uint32_t poll_ms;
+} clock_stats_t;
+
+
+/**
+ * A wall clock built on a free-running local microsecond timer, steered by
+ * (local time, reference time) samples from NTP or a LAN time master. Small
+ * errors are slewed out by running the clock up to CLOCK_MAX_SLEW_PPM fast or
+ * slow, so time never jumps and never runs backwards; the frequency error of
+ * the local timer is estimated with a straight-line fit over the recent
+ * samples, so the clock stays on time between them. Only an error bigger than
+ * CLOCK_STEP_THRESHOLD_US, seen twice in a row, steps the clock.
+ *
+ * Samples are asked for in bursts, through get_poll_interval_ms(), and each
+ * burst's quickest one is all the fit sees. A source that filters its own
+ * samples already can turn that off with set_burst_length(1).
+ *
+ * to_utc_us() can be called from any task while update() runs in another:
+ * the mapping is double-buffered, and update() never waits on a reader.
+ */
+class DisciplinedClock {
+    public:
+        DisciplinedClock() { min_fit_span_us = CLOCK_MIN_FIT_SPAN_US; burst_length = CLOCK_BURST_LENGTH; reset(); };
+
+        void reset();
+        bool update(uint64_t local_us, int64_t reference_us, uint32_t delay_us);
+        void step(uint64_t local_us, int64_t reference_us);
+
+        int64_t to_utc_us(uint64_t local_us);
+        bool is_synchronized() { return synchronized; };
+        uint32_t get_poll_interval_ms() { return burst_count > 0 ? CLOCK_BURST_SPACING_MS : stats.poll_ms; };
+        const clock_stats_t *get_stats() { return &stats; };
+
+        // For references that answer far more often (and more precisely) than
+        // NTP, like a LAN time master
+        void set_min_fit_span_us(uint64_t span_us) { min_fit_span_us = span_us; };
+        void set_burst_length(int length);
+
+    private:
+        // local -> UTC is a straight line from the anchor at 1 + freq + slew
+        // until slew_end_local_us, and at 1 + freq after it. Rates are
+        // fractions scaled by 2^32.
+        typedef struct {
+            uint64_t anchor_local_us;
+            int64_t anchor_utc_us;
+            uint64_t slew_end_local_us;
+            int32_t freq;
+            int32_t slew;
+        } clock_mapping_t;
+
+        typedef struct {
+            uint64_t local_us;
+            int64_t raw_offset_us;      // reference - local; doesn't depend on our corrections
+            uint32_t delay_us;
+        } clock_sample_t;
+
+        static int64_t map(const clock_mapping_t *mapping, uint64_t local_us);
+        void publish(const clock_mapping_t *mapping);
+        bool fit(uint64_t local_us, int64_t *raw_offset_us, int32_t *freq);
+        void add_sample(uint64_t local_us, int64_t reference_us, uint32_t delay_us);
+        bool filter(uint64_t *local_us, int64_t *reference_us, uint32_t *delay_us);
+
+        clock_mapping_t mappings[2];
+        uint32_t generation;
+
+        clock_sample_t history[CLOCK_HISTORY];
+        int history_count;
+        int history_next;
+
+        clock_sample_t burst[CLOCK_BURST_LENGTH];
+        int burst_length;
+        int burst_count;
+
+        uint64_t min_fit_span_us;
+        double frequency;
+        double freq_variance;
+
+        bool synchronized;
+        int spike_count;
+        clock_stats_t stats;
+};
+
+#endif
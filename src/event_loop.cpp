@@ -0,0 +1,270 @@
+#include "event_loop.h"
+#include "logger.h"
+
+
+// A timer handle is its slot and the slot's generation, so cancelling a
+// timer that has already fired can't cancel whatever took the slot since
+#define TIMER_SLOT(handle)          ((handle) & 0xff)
+#define TIMER_GENERATION(handle)    ((uint32_t)(handle) >> 8)
+
+
+/**
+ * Starts the loop's task. Anything posted, scheduled or waited for before
+ * this (or before the scheduler starts) is run on its first pass.
+ */
+void EventLoop::init() {
+    loop_task_handle = loop_task_storage.create(loop_task, "Event Loop", this, 2);
+}
+
+
+/***
+ * Sleeps until the next timer is due or something wakes it: a post, or a
+ * condition changing.
+ */
+void EventLoop::loop_task(void *params) {
+    EventLoop *loop = (EventLoop *)params;
+
+    LOG_INFO("EVENT LOOP RUNNING");
+
+    for(;;) {
+        uint32_t wait_us = loop->dispatch();
+        if(wait_us > 0) {
+            TickType_t ticks = pdMS_TO_TICKS((wait_us + 999) / 1000);
+            ulTaskNotifyTake(pdTRUE, ticks ? ticks : 1);
+        }
+    }
+}
+
+
+/***
+ * Calls back once, delay_ms from now. Returns EVENT_TIMER_NONE if every slot
+ * is taken.
+ */
+event_timer_t EventLoop::schedule(uint32_t delay_ms, event_callback_t callback, void *arg) {
+    for(int i = 0; i < EVENT_LOOP_MAX_TIMERS; i++) {
+        timer_slot_t *timer = &timers[i];
+        if(!timer->active) {
+            timer->callback = callback;
+            timer->arg = arg;
+            timer->due_us = time_source() + (uint64_t)delay_ms * 1000;
+            timer->generation = (timer->generation + 1) & 0x7fffff;
+            timer->active = true;
+            return (event_timer_t)((timer->generation << 8) | i);
+        }
+    }
+
+    stats.timer_overflows++;
+    LOG_WARN("EVENT LOOP OUT OF TIMERS");
+    return EVENT_TIMER_NONE;
+}
+
+
+/***
+ * Stops a timer if it hasn't fired yet, and forgets the handle either way.
+ */
+void EventLoop::cancel(event_timer_t *timer) {
+    if(*timer != EVENT_TIMER_NONE) {
+        timer_slot_t *slot = &timers[TIMER_SLOT(*timer)];
+        if(slot->generation == TIMER_GENERATION(*timer)) {
+            slot->active = false;
+        }
+        *timer = EVENT_TIMER_NONE;
+    }
+}
+
+
+/***
+ * Queues a callback for the loop's next pass, from any task. This is how
+ * lwIP's callbacks hand work to the services without doing it on the tcpip
+ * thread.
+ */
+bool EventLoop::post(event_callback_t callback, void *arg) {
+    taskENTER_CRITICAL();
+    if(posted_count == EVENT_LOOP_MAX_POSTED) {
+        stats.post_overflows++;
+        taskEXIT_CRITICAL();
+        return false;
+    }
+    posted_event_t *event = &posted[(posted_head + posted_count) % EVENT_LOOP_MAX_POSTED];
+    event->callback = callback;
+    event->arg = arg;
+    posted_count++;
+    stats.posted++;
+    taskEXIT_CRITICAL();
+
+    wake();
+    return true;
+}
+
+
+/***
+ * Calls back once every one of the conditions holds, with met true, or with
+ * met false if timeout_ms (0 for never) goes by first. A condition that
+ * already holds is still reported from the loop, never from in here.
+ */
+bool EventLoop::when(uint32_t conditions, event_wait_callback_t callback, void *arg, uint32_t timeout_ms) {
+    for(int i = 0; i < EVENT_LOOP_MAX_WAITERS; i++) {
+        waiter_slot_t *waiter = &waiters[i];
+        if(!waiter->active) {
+            waiter->callback = callback;
+            waiter->arg = arg;
+            waiter->conditions = conditions;
+            waiter->deadline_us = timeout_ms ? time_source() + (uint64_t)timeout_ms * 1000 : 0;
+            waiter->active = true;
+            wake();
+            return true;
+        }
+    }
+
+    LOG_WARN("EVENT LOOP OUT OF WAITERS");
+    return false;
+}
+
+
+void EventLoop::set_conditions(uint32_t bits) {
+    taskENTER_CRITICAL();
+    conditions |= bits;
+    taskEXIT_CRITICAL();
+    wake();
+}
+
+
+void EventLoop::clear_conditions(uint32_t bits) {
+    taskENTER_CRITICAL();
+    conditions &= ~bits;
+    taskEXIT_CRITICAL();
+}
+
+
+void EventLoop::wake() {
+    if(loop_task_handle) {
+        xTaskNotifyGive(loop_task_handle);
+    }
+}
+
+
+/***
+ * One pass: everything posted, then every timer that's due, then every
+ * waiter that's satisfied or out of time. Returns how long the loop can
+ * sleep before the next timer or timeout, up to EVENT_LOOP_IDLE_US, or 0 if
+ * a callback left more work for straight away.
+ */
+uint32_t EventLoop::dispatch() {
+    uint64_t now;
+    uint64_t next;
+
+    stats.dispatches++;
+    run_posted();
+    run_timers(time_source());
+    run_waiters(time_source());
+
+    if(posted_count) {
+        return 0;
+    }
+
+    now = time_source();
+    next = now + EVENT_LOOP_IDLE_US;
+    for(int i = 0; i < EVENT_LOOP_MAX_TIMERS; i++) {
+        if(timers[i].active && timers[i].due_us < next) {
+            next = timers[i].due_us;
+        }
+    }
+    for(int i = 0; i < EVENT_LOOP_MAX_WAITERS; i++) {
+        const waiter_slot_t *waiter = &waiters[i];
+        if(!waiter->active) {
+            continue;
+        }
+        if((conditions & waiter->conditions) == waiter->conditions) {
+            return 0;
+        }
+        if(waiter->deadline_us && waiter->deadline_us < next) {
+            next = waiter->deadline_us;
+        }
+    }
+
+    return next > now ? (uint32_t)(next - now) : 0;
+}
+
+
+void EventLoop::run_posted() {
+    for(;;) {
+        posted_event_t event;
+
+        taskENTER_CRITICAL();
+        if(posted_count == 0) {
+            taskEXIT_CRITICAL();
+            return;
+        }
+        event = posted[posted_head];
+        posted_head = (posted_head + 1) % EVENT_LOOP_MAX_POSTED;
+        posted_count--;
+        taskEXIT_CRITICAL();
+
+        uint64_t start_us = time_source();
+        event.callback(event.arg);
+        timed(start_us);
+    }
+}
+
+
+/***
+ * A slot is freed before its callback runs, so the callback can schedule
+ * itself again.
+ */
+void EventLoop::run_timers(uint64_t now) {
+    for(int i = 0; i < EVENT_LOOP_MAX_TIMERS; i++) {
+        timer_slot_t *timer = &timers[i];
+        if(!timer->active || timer->due_us > now) {
+            continue;
+        }
+
+        uint32_t late_us = (uint32_t)(now - timer->due_us);
+        if(late_us > stats.late_max_us) {
+            stats.late_max_us = late_us;
+        }
+        timer->active = false;
+        stats.timers_fired++;
+
+        uint64_t start_us = time_source();
+        timer->callback(timer->arg);
+        timed(start_us);
+    }
+}
+
+
+void EventLoop::run_waiters(uint64_t now) {
+    for(int i = 0; i < EVENT_LOOP_MAX_WAITERS; i++) {
+        waiter_slot_t *waiter = &waiters[i];
+        bool met;
+
+        if(!waiter->active) {
+            continue;
+        }
+        met = (conditions & waiter->conditions) == waiter->conditions;
+        if(!met && (waiter->deadline_us == 0 || waiter->deadline_us > now)) {
+            continue;
+        }
+
+        waiter->active = false;
+        if(met) {
+            stats.waits_met++;
+        }
+        else {
+            stats.waits_timed_out++;
+        }
+
+        uint64_t start_us = time_source();
+        waiter->callback(waiter->arg, met);
+        timed(start_us);
+    }
+}
+
+
+void EventLoop::timed(uint64_t start_us) {
+    uint32_t took_us = (uint32_t)(time_source() - start_us);
+
+    stats.callbacks++;
+    if(took_us > stats.callback_max_us) {
+        stats.callback_max_us = took_us;
+    }
+}
@@ -0,0 +1,150 @@
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "FreeRTOSConfig.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "static_task.h"
+
+#ifndef EVENT_LOOP_TASK_STACK_SIZE
+#define EVENT_LOOP_TASK_STACK_SIZE  1024
+#endif
+
+#define EVENT_LOOP_MAX_TIMERS       12
+#define EVENT_LOOP_MAX_WAITERS      8
+#define EVENT_LOOP_MAX_POSTED       16
+
+// The longest the loop sleeps with nothing due, so a lost wakeup costs at
+// most this much
+#define EVENT_LOOP_IDLE_US          1000000
+
+// Conditions the services raise and lower for each other, and wait on with
+// when()
+#define EVENT_CYW43_READY           0x1
+#define EVENT_WIFI_JOINED           0x2
+
+#define EVENT_TIMER_NONE            (-1)
+
+
+typedef void (*event_callback_t)(void *arg);
+
+// met is false if the wait timed out instead
+typedef void (*event_wait_callback_t)(void *arg, bool met);
+
+typedef int event_timer_t;
+
+typedef struct {
+    uint32_t dispatches;        // times the loop woke up
+    uint32_t callbacks;         // of every kind
+    uint32_t timers_fired;
+    uint32_t posted;
+    uint32_t post_overflows;    // posts dropped because the queue was full
+    uint32_t timer_overflows;   // timers not scheduled because every slot was taken
+    uint32_t waits_met;
+    uint32_t waits_timed_out;
+    uint32_t late_max_us;       // the most a timer ran after it was due
+    uint32_t callback_max_us;   // the longest any one callback took
+} event_loop_stats_t;
+
+
+/**
+ * One task that runs the network services as state machines, instead of a
+ * task each that spends its life blocked. A service never blocks in here: it
+ * schedules a timer and returns, posts itself work from lwIP's callbacks, or
+ * asks to be called when() a condition like EVENT_WIFI_JOINED holds, with a
+ * timeout if it wants one. Callbacks run one at a time, in the loop's task,
+ * so the services need no locks among themselves.
+ *
+ * schedule(), cancel() and when() are for the loop's own callbacks (and for
+ * setting up before the scheduler starts). post() and the condition setters
+ * can be called from any task, including the tcpip thread, but not from an
+ * interrupt.
+ *
+ * dispatch() is the whole loop, one pass of it, and set_time_source() swaps
+ * the microsecond clock, so a bench can drive it on a virtual clock without
+ * a scheduler.
+ */
+class EventLoop {
+    public:
+        void init();
+        void set_time_source(uint64_t (*now_us)()) { time_source = now_us; };
+        uint64_t now_us() { return time_source(); };
+
+        event_timer_t schedule(uint32_t delay_ms, event_callback_t callback, void *arg);
+        void cancel(event_timer_t *timer);
+        bool post(event_callback_t callback, void *arg);
+        bool when(uint32_t conditions, event_wait_callback_t callback, void *arg, uint32_t timeout_ms = 0);
+
+        void set_conditions(uint32_t bits);
+        void clear_conditions(uint32_t bits);
+        uint32_t get_conditions() { return conditions; };
+
+        uint32_t dispatch();
+        const event_loop_stats_t *get_stats() { return &stats; };
+        TaskHandle_t get_task_handle() { return loop_task_handle; };
+
+        static void loop_task(void *params);
+
+        static EventLoop& getInstance() {
+            static EventLoop instance;
+            return instance;
+        }
+
+    private:
+        EventLoop() {
+            loop_task_handle = (TaskHandle_t)0;
+            time_source = time_us_64;
+            conditions = 0;
+            posted_head = 0;
+            posted_count = 0;
+            memset(timers, 0, sizeof(timers));
+            memset(waiters, 0, sizeof(waiters));
+            memset(posted, 0, sizeof(posted));
+            memset(&stats, 0, sizeof(stats));
+        };
+
+        typedef struct {
+            event_callback_t callback;
+            void *arg;
+            uint64_t due_us;
+            uint32_t generation;
+            bool active;
+        } timer_slot_t;
+
+        typedef struct {
+            event_wait_callback_t callback;
+            void *arg;
+            uint32_t conditions;
+            uint64_t deadline_us;       // 0 waits forever
+            bool active;
+        } waiter_slot_t;
+
+        typedef struct {
+            event_callback_t callback;
+            void *arg;
+        } posted_event_t;
+
+        void wake();
+        void run_posted();
+        void run_timers(uint64_t now);
+        void run_waiters(uint64_t now);
+        void timed(uint64_t start_us);
+
+        TaskHandle_t loop_task_handle;
+        StaticTask<EVENT_LOOP_TASK_STACK_SIZE> loop_task_storage;
+        uint64_t (*time_source)();
+        volatile uint32_t conditions;
+
+        timer_slot_t timers[EVENT_LOOP_MAX_TIMERS];
+        waiter_slot_t waiters[EVENT_LOOP_MAX_WAITERS];
+        posted_event_t posted[EVENT_LOOP_MAX_POSTED];
+        uint32_t posted_head;
+        uint32_t posted_count;
+
+        event_loop_stats_t stats;
+};
+
+#endif
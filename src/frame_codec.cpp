@@ -0,0 +1,177 @@
+#include <string.h>
+#include "frame_codec.h"
+#include "strip_config.h"
+
+// Shorter runs than these are cheaper as part of a literal
+#define MIN_ZERO_RUN                3
+#define MIN_PIXEL_RUN               2
+
+
+int32_t frame_codec_decode(uint8_t *frame, uint32_t frame_len, uint32_t offset, const uint8_t *src, uint32_t len,
+                           bool delta) {
+    const uint8_t *end = src + len;
+    uint32_t start = offset;
+
+    if(offset > frame_len) {
+        return -1;
+    }
+
+    while(src < end) {
+        uint8_t control = *src++;
+        uint32_t count;
+
+        if((control & FRAME_CODEC_OP_MASK) < FRAME_CODEC_ZERO_RUN) {
+            count = (uint32_t)control + 1;
+            if(count > (uint32_t)(end - src) || count > frame_len - offset) {
+                return -1;
+            }
+            if(delta) {
+                for(uint32_t i = 0; i < count; i++) {
+                    frame[offset + i] ^= src[i];
+                }
+            }
+            else {
+                memcpy(&frame[offset], src, count);
+            }
+            src += count;
+            offset += count;
+            continue;
+        }
+
+        if(src == end) {
+            return -1;
+        }
+        count = ((((uint32_t)control & ~FRAME_CODEC_OP_MASK) << 8) | *src++) + 1;
+
+        if((control & FRAME_CODEC_OP_MASK) == FRAME_CODEC_ZERO_RUN) {
+            if(count > frame_len - offset) {
+                return -1;
+            }
+            // XORing zeroes changes nothing
+            if(!delta) {
+                memset(&frame[offset], 0, count);
+            }
+            offset += count;
+        }
+        else {
+            uint8_t pixel[STRIP_BYTES_PER_PIXEL];
+
+            if(end - src < STRIP_BYTES_PER_PIXEL || count * STRIP_BYTES_PER_PIXEL > frame_len - offset) {
+                return -1;
+            }
+            memcpy(pixel, src, STRIP_BYTES_PER_PIXEL);
+            src += STRIP_BYTES_PER_PIXEL;
+
+            uint8_t *dst = &frame[offset];
+            for(uint32_t i = 0; i < count; i++) {
+                if(delta) {
+                    dst[0] ^= pixel[0];
+                    dst[1] ^= pixel[1];
+                    dst[2] ^= pixel[2];
+                }
+                else {
+                    dst[0] = pixel[0];
+                    dst[1] = pixel[1];
+                    dst[2] = pixel[2];
+                }
+                dst += STRIP_BYTES_PER_PIXEL;
+            }
+            offset += count * STRIP_BYTES_PER_PIXEL;
+        }
+    }
+
+    return (int32_t)(offset - start);
+}
+
+
+static inline uint8_t value_at(const uint8_t *frame, const uint8_t *previous, uint32_t i) {
+    return previous != NULL ? frame[i] ^ previous[i] : frame[i];
+}
+
+
+static uint32_t zero_run(const uint8_t *frame, const uint8_t *previous, uint32_t i, uint32_t len) {
+    uint32_t n = 0;
+
+    while(i + n < len && n < FRAME_CODEC_RUN_MAX && value_at(frame, previous, i + n) == 0) {
+        n++;
+    }
+    return n;
+}
+
+
+// In pixels, counting the first
+static uint32_t pixel_run(const uint8_t *frame, const uint8_t *previous, uint32_t i, uint32_t len) {
+    uint32_t n = 1;
+
+    if(i + STRIP_BYTES_PER_PIXEL > len) {
+        return 0;
+    }
+    while(i + (n + 1) * STRIP_BYTES_PER_PIXEL <= len && n < FRAME_CODEC_RUN_MAX &&
+          value_at(frame, previous, i + n * STRIP_BYTES_PER_PIXEL) == value_at(frame, previous, i) &&
+          value_at(frame, previous, i + n * STRIP_BYTES_PER_PIXEL + 1) == value_at(frame, previous, i + 1) &&
+          value_at(frame, previous, i + n * STRIP_BYTES_PER_PIXEL + 2) == value_at(frame, previous, i + 2)) {
+        n++;
+    }
+    return n;
+}
+
+
+/***
+ * Greedy: a zero run or a pixel run wherever one starts that's worth its
+ * header, and a literal up to the next one otherwise. Runs are measured from
+ * wherever the last op ended, so a pixel run doesn't have to start on a
+ * pixel boundary.
+ */
+uint32_t frame_codec_encode(uint8_t *dst, uint32_t dst_max, uint32_t *encoded, const uint8_t *frame,
+                            const uint8_t *previous, uint32_t len) {
+    uint32_t i = 0, out = 0;
+
+    while(i < len) {
+        uint32_t zeroes = zero_run(frame, previous, i, len);
+        uint32_t pixels = zeroes >= MIN_ZERO_RUN ? 0 : pixel_run(frame, previous, i, len);
+
+        if(zeroes >= MIN_ZERO_RUN) {
+            if(out + 2 > dst_max) {
+                break;
+            }
+            dst[out++] = (uint8_t)(FRAME_CODEC_ZERO_RUN | ((zeroes - 1) >> 8));
+            dst[out++] = (uint8_t)(zeroes - 1);
+            i += zeroes;
+        }
+        else if(pixels >= MIN_PIXEL_RUN) {
+            if(out + 2 + STRIP_BYTES_PER_PIXEL > dst_max) {
+                break;
+            }
+            dst[out++] = (uint8_t)(FRAME_CODEC_PIXEL_RUN | ((pixels - 1) >> 8));
+            dst[out++] = (uint8_t)(pixels - 1);
+            for(int k = 0; k < STRIP_BYTES_PER_PIXEL; k++) {
+                dst[out++] = value_at(frame, previous, i + k);
+            }
+            i += pixels * STRIP_BYTES_PER_PIXEL;
+        }
+        else {
+            uint32_t n = 1;
+
+            // Up to the next run worth stopping for, or as much as fits
+            while(i + n < len && n < FRAME_CODEC_LITERAL_MAX &&
+                  zero_run(frame, previous, i + n, len) < MIN_ZERO_RUN &&
+                  pixel_run(frame, previous, i + n, len) < MIN_PIXEL_RUN + 1) {
+                n++;
+            }
+            if(out + 1 + n > dst_max) {
+                if(out + 2 > dst_max) {
+                    break;
+                }
+                n = dst_max - out - 1;
+            }
+            dst[out++] = (uint8_t)(FRAME_CODEC_LITERAL | (n - 1));
+            for(uint32_t k = 0; k < n; k++) {
+                dst[out++] = value_at(frame, previous, i + k);
+            }
+            i += n;
+        }
+    }
+
+    *encoded = out;
+    return i;
+}
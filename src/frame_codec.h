@@ -0,0 +1,53 @@
+#ifndef __FRAME_CODEC_H__
+#define __FRAME_CODEC_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+
+// Control bytes. A literal is followed by its bytes; a zero run by the low
+// byte of its length; a pixel run by the low byte of its length and then the
+// three bytes of the pixel it repeats. Lengths are stored less one.
+#define FRAME_CODEC_LITERAL         0x00        // 0x00-0x7f: 1-128 bytes
+#define FRAME_CODEC_ZERO_RUN        0x80        // 0x80-0xbf: 1-16384 zero bytes
+#define FRAME_CODEC_PIXEL_RUN       0xc0        // 0xc0-0xff: 1-16384 copies of a pixel
+#define FRAME_CODEC_OP_MASK         0xc0
+
+#define FRAME_CODEC_LITERAL_MAX     128
+#define FRAME_CODEC_RUN_MAX         16384
+
+// The most an encoded stream can be per byte of frame, for sizing buffers:
+// one control byte for every 128 literal bytes
+#define FRAME_CODEC_WORST_CASE(len) ((len) + ((len) + FRAME_CODEC_LITERAL_MAX - 1) / FRAME_CODEC_LITERAL_MAX)
+
+
+/**
+ * A byte-oriented run-length code for pixel frames, in the PackBits family.
+ * A keyframe codes the pixels themselves. A delta codes each byte XORed
+ * with the same byte of the previous frame, so everything that didn't
+ * change is a zero run and costs two bytes however long it is, and decoding
+ * it writes nothing at all. Runs of one colour, which animations are full
+ * of, are pixel runs either way.
+ *
+ * Each stream decodes to one contiguous range of the frame and stands
+ * alone, so a sender can split a frame into as many streams (packets) as it
+ * likes, and leave out a range that didn't change.
+ *
+ * frame_codec_decode() never writes outside [offset, frame_len), and its
+ * time is bounded by the bytes it decodes plus the bytes it reads, so a
+ * stream can cost at most one full frame's worth of stores whatever is in
+ * it. It returns the number of bytes decoded, or -1 if the stream was cut
+ * short or ran off the end of the frame; whatever it decoded before finding
+ * that out stays decoded.
+ *
+ * frame_codec_encode() codes len bytes of frame, against previous if it's
+ * not NULL, into at most dst_max bytes of dst. It stops early rather than
+ * split an op, and returns how many bytes of the frame it got through;
+ * *encoded is how many bytes of dst it used. Calling it again from there,
+ * into the next packet, carries on.
+ */
+int32_t frame_codec_decode(uint8_t *frame, uint32_t frame_len, uint32_t offset, const uint8_t *src, uint32_t len,
+                           bool delta);
+uint32_t frame_codec_encode(uint8_t *dst, uint32_t dst_max, uint32_t *encoded, const uint8_t *frame,
+                            const uint8_t *previous, uint32_t len);
+
+#endif
@@ -0,0 +1,369 @@
+#include <string.h>
+#include "frame_scheduler.h"
+#include "logger.h"
+
+// The DDP timecode is the middle 32 bits of an NTP timestamp: 16 bits of
+// seconds and 16 of fraction
+#define NTP_UNIX_EPOCH_OFFSET       2208988800ULL
+
+
+/**
+ * Starts the task that releases frames. It does nothing until a frame is
+ * queued, and between frames it sleeps until the alarm for the next one. With
+ * both cores running it gets the pixel core to itself.
+ */
+void FrameScheduler::init() {
+    if(alarm_pool == NULL) {
+        alarm_pool = alarm_pool_get_default();
+    }
+#if configNUMBER_OF_CORES > 1 && configUSE_CORE_AFFINITY
+    scheduler_task_handle = scheduler_task_storage.create(scheduler_task, "Frame Scheduler Task", this,
+                                                          FRAME_SCHEDULER_TASK_PRIORITY, PIXEL_CORE_AFFINITY);
+#else
+    scheduler_task_handle = scheduler_task_storage.create(scheduler_task, "Frame Scheduler Task", this,
+                                                          FRAME_SCHEDULER_TASK_PRIORITY);
+#endif
+}
+
+
+/***
+ * Like StripOutput, the buffers are sized for the longest strip, and a frame
+ * is only as long as the configured one. Nothing ever writes past the frame,
+ * so clearing the buffers here also sets up the black pixel for good.
+ * Anything queued is forgotten, so neither side can be running.
+ */
+void FrameScheduler::configure(const led_strip_config_t *config) {
+    uint32_t strip_length = config->strip_length;
+    if(strip_length > STRIP_MAX_LENGTH) {
+        strip_length = STRIP_MAX_LENGTH;
+    }
+
+    frame_size = strip_length * STRIP_BYTES_PER_PIXEL;
+    memset(buffers, 0, sizeof(buffers));
+    reset_slots();
+    stats.depth = 0;
+}
+
+
+/***
+ * Every buffer goes back in the free queue, and fill starts out empty.
+ */
+void FrameScheduler::reset_slots() {
+    memset(slots, 0, sizeof(slots));
+    ready.reset();
+    free_slots.reset();
+    for(int i = 0; i <= FRAME_SCHEDULER_DEPTH; i++) {
+        free_slots.push((uint8_t)i);
+    }
+    fill = -1;
+}
+
+
+void FrameScheduler::reset_stats() {
+    memset(&stats, 0, sizeof(stats));
+    stats.lead_min_us = INT32_MAX;
+    stats.error_min_us = INT32_MAX;
+    stats.error_max_us = INT32_MIN;
+}
+
+
+/***
+ * Returns the buffer the receiver should write the next frame into, or NULL
+ * if every buffer has a frame waiting in it. As with StripOutput's back
+ * buffer, it still holds whatever frame last went through it.
+ */
+uint8_t *FrameScheduler::get_fill_buffer() {
+    uint8_t slot;
+
+    if(fill < 0 && free_slots.pop(&slot)) {
+        fill = slot;
+    }
+    return fill >= 0 ? buffers[fill] : NULL;
+}
+
+
+/***
+ * The frame in the fill buffer is complete and should be shown at
+ * present_utc_us by the wall clock. Without a synchronized clock there's no
+ * telling when that is, so it's shown now.
+ */
+void FrameScheduler::submit(int64_t present_utc_us) {
+    if(clock == NULL || !clock->is_synchronized()) {
+        submit_untimed();
+        return;
+    }
+    queue(present_utc_us, true);
+}
+
+
+/***
+ * A DDP timecode is the time of day to within 18 hours, so it's taken to be
+ * the one nearest now.
+ */
+void FrameScheduler::submit_timecode(uint32_t timecode) {
+    int64_t now_utc_us;
+    uint64_t ntp_us;
+    uint32_t now_timecode;
+
+    if(clock == NULL || !clock->is_synchronized()) {
+        submit_untimed();
+        return;
+    }
+
+    now_utc_us = clock->to_utc_us(now_us());
+    ntp_us = (uint64_t)now_utc_us + NTP_UNIX_EPOCH_OFFSET * 1000000;
+    now_timecode = (uint32_t)(((ntp_us / 1000000) << 16) | (((ntp_us % 1000000) << 16) / 1000000));
+
+    queue(now_utc_us + (int64_t)(int32_t)(timecode - now_timecode) * 1000000 / 65536, true);
+}
+
+
+void FrameScheduler::submit_untimed() {
+    int64_t now_utc_us = clock != NULL ? clock->to_utc_us(now_us()) : (int64_t)now_us();
+    queue(now_utc_us + playout_delay_us, false);
+}
+
+
+/***
+ * Hands the fill buffer to the scheduler's side and wakes its task to look at
+ * it. Whether it's too late or too early to keep is decided over there, by
+ * when it was submitted.
+ */
+void FrameScheduler::queue(int64_t present_utc_us, bool timed) {
+    frame_entry_t entry;
+
+    if(fill < 0) {
+        // The receiver had nowhere to put this frame
+        stats.overflows++;
+        return;
+    }
+
+    entry.slot = (uint8_t)fill;
+    entry.timed = timed;
+    entry.present_utc_us = present_utc_us;
+    entry.submitted_local_us = now_us();
+    fill = -1;
+
+    stats.submitted++;
+    if(!timed) {
+        stats.untimed++;
+    }
+
+    // There are more places in the queue than buffers, so this can't fail
+    ready.push(entry);
+
+    if(scheduler_task_handle) {
+        xTaskNotifyGive(scheduler_task_handle);
+    }
+}
+
+
+/***
+ * Takes a frame from the receiver into the schedule, or straight back to the
+ * free queue if it was already too late, or too far ahead, when it was
+ * submitted.
+ */
+void FrameScheduler::admit(const frame_entry_t *entry) {
+    frame_slot_t *slot = &slots[entry->slot];
+    int64_t submitted_utc_us = clock != NULL ? clock->to_utc_us(entry->submitted_local_us) :
+                               (int64_t)entry->submitted_local_us;
+    int64_t lead_us = entry->present_utc_us - submitted_utc_us;
+
+    if(entry->timed && lead_us < -FRAME_SCHEDULER_LATE_US) {
+        stats.late++;
+        free_slots.push(entry->slot);
+        return;
+    }
+    if(entry->timed && lead_us > FRAME_SCHEDULER_MAX_AHEAD_US) {
+        stats.too_early++;
+        free_slots.push(entry->slot);
+        return;
+    }
+
+    if(entry->timed && lead_us < stats.lead_min_us) {
+        stats.lead_min_us = (int32_t)lead_us;
+    }
+    slot->queued = true;
+    slot->timed = entry->timed;
+    slot->present_utc_us = entry->present_utc_us;
+    slot->submitted_local_us = entry->submitted_local_us;
+    slot->due_local_us = lead_us > 0 ? to_local_us(entry->present_utc_us, entry->submitted_local_us) :
+                         entry->submitted_local_us;
+    stats.depth++;
+    if(stats.depth > stats.depth_max) {
+        stats.depth_max = stats.depth;
+    }
+}
+
+
+/***
+ * The local timer reading at which the clock will read utc_us. The clock runs
+ * within a few hundred ppm of the timer, so a second step from the first
+ * guess is good to well under a microsecond.
+ */
+uint64_t FrameScheduler::to_local_us(int64_t utc_us, uint64_t local_us) {
+    if(clock == NULL) {
+        return (uint64_t)utc_us;
+    }
+    local_us += utc_us - clock->to_utc_us(local_us);
+    local_us += utc_us - clock->to_utc_us(local_us);
+    return local_us;
+}
+
+
+/***
+ * Admits whatever the receiver has submitted since the last call, then
+ * releases the frame that's due. If more than one is, only the newest
+ * timestamp goes out and the rest count as late. Returns the microseconds
+ * until the next frame is due, or FRAME_SCHEDULER_IDLE.
+ */
+uint32_t FrameScheduler::poll() {
+    uint64_t next_due_us = UINT64_MAX;
+    uint64_t local_us;
+    frame_entry_t entry;
+    int release = -1;
+    uint8_t *buffer;
+    int64_t error_us;
+
+    while(ready.pop(&entry)) {
+        admit(&entry);
+    }
+
+    local_us = now_us();
+    for(int i = 0; i <= FRAME_SCHEDULER_DEPTH; i++) {
+        if(!slots[i].queued || slots[i].due_local_us > local_us) {
+            continue;
+        }
+        if(release < 0) {
+            release = i;
+            continue;
+        }
+        if(slots[i].present_utc_us > slots[release].present_utc_us) {
+            slots[release].queued = false;
+            free_slots.push((uint8_t)release);
+            release = i;
+        }
+        else {
+            slots[i].queued = false;
+            free_slots.push((uint8_t)i);
+        }
+        stats.late++;
+        stats.depth--;
+    }
+    if(release >= 0) {
+        slots[release].queued = false;
+        stats.depth--;
+    }
+    for(int i = 0; i <= FRAME_SCHEDULER_DEPTH; i++) {
+        if(slots[i].queued && slots[i].due_local_us < next_due_us) {
+            next_due_us = slots[i].due_local_us;
+        }
+    }
+
+    if(release >= 0) {
+        error_us = (clock != NULL ? clock->to_utc_us(local_us) : (int64_t)local_us) - slots[release].present_utc_us;
+
+        if(output != NULL) {
+            buffer = output->get_back_buffer();
+            if(buffer != NULL && kernels != NULL && layout != NULL) {
+                kernels->process(buffer, buffers[release], layout->get_physical_length(), layout->get_remap());
+            }
+            else if(buffer != NULL && kernels != NULL) {
+                kernels->process(buffer, buffers[release], frame_size / STRIP_BYTES_PER_PIXEL);
+            }
+            else if(buffer != NULL) {
+                memcpy(buffer, buffers[release], frame_size);
+            }
+            output->present();
+        }
+
+        stats.presented++;
+        stats.error_total_us += error_us;
+        if(error_us < stats.error_min_us) {
+            stats.error_min_us = (int32_t)error_us;
+        }
+        if(error_us > stats.error_max_us) {
+            stats.error_max_us = (int32_t)error_us;
+        }
+        if(!slots[release].timed) {
+            uint32_t latency_us = (uint32_t)(now_us() - slots[release].submitted_local_us);
+            stats.latency_count++;
+            stats.latency_total_us += latency_us;
+            if(latency_us > stats.latency_max_us) {
+                stats.latency_max_us = latency_us;
+            }
+        }
+
+        free_slots.push((uint8_t)release);
+    }
+
+    if(next_due_us == UINT64_MAX) {
+        return FRAME_SCHEDULER_IDLE;
+    }
+    local_us = now_us();
+    return next_due_us <= local_us ? 0 : (uint32_t)(next_due_us - local_us);
+}
+
+
+/***
+ * Only one alarm is kept in flight; it's replaced only by an earlier one. One
+ * that fires for a frame that's already gone just wakes the task for nothing.
+ * Returns how long the task can block for: until the alarm wakes it, not at
+ * all if the time has already come, or to the next tick that's past it if no
+ * alarm could be had.
+ */
+TickType_t FrameScheduler::arm_alarm(uint32_t delay_us) {
+    uint64_t due_us = now_us() + delay_us;
+    alarm_id_t id;
+
+    if(alarm_armed && alarm_due_local_us <= due_us) {
+        return portMAX_DELAY;
+    }
+    alarm_armed = true;
+    alarm_due_local_us = due_us;
+    id = alarm_pool_add_alarm_in_us(alarm_pool, delay_us, release_alarm, this, false);
+    if(id > 0) {
+        return portMAX_DELAY;
+    }
+
+    alarm_armed = false;
+    if(id == 0) {
+        return 0;
+    }
+    stats.alarm_failures++;
+    LOG_WARN("FRAME SCHEDULER COULDN'T ARM AN ALARM (%d)", (int)id);
+    return pdMS_TO_TICKS((delay_us + 999) / 1000) + 1;
+}
+
+
+int64_t FrameScheduler::release_alarm(alarm_id_t id, void *user_data) {
+    FrameScheduler *scheduler = (FrameScheduler *)user_data;
+    BaseType_t woken = pdFALSE;
+
+    scheduler->alarm_armed = false;
+    vTaskNotifyGiveFromISR(scheduler->scheduler_task_handle, &woken);
+    portYIELD_FROM_ISR(woken);
+
+    return 0;
+}
+
+
+void FrameScheduler::scheduler_task(void *params) {
+    FrameScheduler *scheduler = (FrameScheduler *)params;
+    uint32_t wait_us;
+    TickType_t timeout;
+
+    LOG_INFO("FRAME SCHEDULER RUNNING, %d FRAMES DEEP", FRAME_SCHEDULER_DEPTH);
+
+    for(;;) {
+        wait_us = scheduler->poll();
+        if(wait_us == 0) {
+            continue;
+        }
+        timeout = wait_us == FRAME_SCHEDULER_IDLE ? portMAX_DELAY : scheduler->arm_alarm(wait_us);
+        if(timeout == 0) {
+            continue;
+        }
+        ulTaskNotifyTake(pdTRUE, timeout);
+    }
+}
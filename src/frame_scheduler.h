@@ -0,0 +1,179 @@
+#ifndef __FRAME_SCHEDULER_H__
+#define __FRAME_SCHEDULER_H__
+
+#include <stdlib.h>
+#include "pico/stdlib.h"
+#include "pico/time.h"
+#include "FreeRTOSConfig.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "static_task.h"
+#include "strip_config.h"
+#include "strip_output.h"
+#include "pixel_kernels.h"
+#include "strip_layout.h"
+#include "disciplined_clock.h"
+#include "spsc_queue.h"
+
+// Frames that can be waiting for their time at once, besides the one being
+// received. Each is a full-length frame buffer.
+#define FRAME_SCHEDULER_DEPTH           8
+
+// A frame this far past its time by the time it's complete is dropped as
+// late; one timestamped further ahead than the maximum is taken to be a bad
+// timestamp and dropped too
+#define FRAME_SCHEDULER_LATE_US         2000
+#define FRAME_SCHEDULER_MAX_AHEAD_US    1000000
+
+// poll() has nothing queued
+#define FRAME_SCHEDULER_IDLE            UINT32_MAX
+
+// A full-length frame and the black pixel a StripLayout reads dark pixels
+// from, rounded up to keep every buffer word aligned
+#define FRAME_SCHEDULER_BUFFER_SIZE     (STRIP_LAYOUT_BLACK_OFFSET + 4)
+
+// Big enough for every buffer at once, and a power of two
+#define FRAME_SCHEDULER_QUEUE_SIZE      16
+
+#ifndef FRAME_SCHEDULER_TASK_STACK_SIZE
+#define FRAME_SCHEDULER_TASK_STACK_SIZE 1024
+#endif
+
+#define FRAME_SCHEDULER_TASK_PRIORITY   (configMAX_PRIORITIES - 1)
+
+
+typedef struct {
+    uint32_t submitted;
+    uint32_t untimed;           // no timestamp, or no synchronized clock to read it by
+    uint32_t presented;
+    uint32_t late;              // complete after their time, or overtaken by a newer frame
+    uint32_t too_early;
+    uint32_t overflows;         // frames with no buffer to go into
+    uint32_t alarm_failures;    // waits with no hardware alarm free, which fell back on the tick
+    uint32_t depth;             // waiting right now
+    uint32_t depth_max;
+    int32_t lead_min_us;        // how long before its time the least early frame was complete
+    int32_t error_min_us;       // when frames were released, against their timestamps
+    int32_t error_max_us;
+    int64_t error_total_us;
+    uint32_t latency_count;     // untimed frames, from submit() to present()
+    uint32_t latency_max_us;
+    uint64_t latency_total_us;
+} frame_scheduler_stats_t;
+
+
+/**
+ * A jitter buffer between the pixel receiver and the strip output. Frames
+ * that carry a presentation time (the DDP timecode) are held until that time
+ * by the wall clock and then handed to StripOutput, so strips fed by the same
+ * sender start each frame together however differently wifi delayed it on
+ * the way to each one. Frames without a timestamp go out as soon as they're
+ * complete, after the playout delay if one is set.
+ *
+ * The receiver writes straight into the buffer get_fill_buffer() returns, on
+ * the tcpip thread. Releases happen in poll(), in the scheduler's own task at
+ * the top priority, woken by a hardware alarm at the due time; the frame is
+ * converted into StripOutput's back buffer by the PixelKernels, if it has
+ * any (or just copied, if not), and presented from there. A StripLayout, if
+ * there is one, is applied in the same pass, by the kernels. On a
+ * dual-core build that task is pinned to the pixel core, away from the
+ * network stack, and its alarm should come from a pool on that core too
+ * (set_alarm_pool()); otherwise it's the default pool's, on core 0.
+ *
+ * The two sides share nothing but a pair of SpscQueues: complete frames go
+ * to the scheduler through one, and emptied buffers come back through the
+ * other, so neither side ever waits on the other, whichever core it's on.
+ * get_fill_buffer() and the submit functions are the producer side and must
+ * all be called from one task; poll() is the consumer side.
+ */
+class FrameScheduler {
+    public:
+        void init();
+        void configure(const led_strip_config_t *config);
+        void set_output(StripOutput *output) { this->output = output; };
+        void set_kernels(PixelKernels *kernels) { this->kernels = kernels; };
+        void set_layout(StripLayout *layout) { this->layout = layout; };
+        void set_clock(DisciplinedClock *clock) { this->clock = clock; };
+        void set_time_source(uint64_t (*now_us)(void)) { this->now_us = now_us; };
+        void set_playout_delay_us(uint32_t delay_us) { playout_delay_us = delay_us; };
+        void set_alarm_pool(alarm_pool_t *pool) { alarm_pool = pool; };
+
+        uint8_t *get_fill_buffer();
+        void submit(int64_t present_utc_us);
+        void submit_timecode(uint32_t timecode);
+        void submit_untimed();
+        uint32_t poll();
+
+        const frame_scheduler_stats_t *get_stats() { return &stats; };
+        void reset_stats();
+
+        static void scheduler_task(void *params);
+
+        static FrameScheduler& getInstance() {
+            static FrameScheduler instance;
+            return instance;
+        }
+
+    private:
+        FrameScheduler() {
+            output = NULL;
+            kernels = NULL;
+            layout = NULL;
+            clock = NULL;
+            now_us = time_us_64;
+            frame_size = 0;
+            playout_delay_us = 0;
+            fill = -1;
+            alarm_armed = false;
+            alarm_due_local_us = 0;
+            alarm_pool = NULL;
+            scheduler_task_handle = (TaskHandle_t)0;
+            reset_slots();
+            reset_stats();
+        };
+
+        // A complete frame on its way from the receiver to the scheduler
+        typedef struct {
+            uint8_t slot;
+            bool timed;
+            int64_t present_utc_us;
+            uint64_t submitted_local_us;
+        } frame_entry_t;
+
+        // Only the scheduler's side looks at these
+        typedef struct {
+            bool queued;
+            bool timed;
+            int64_t present_utc_us;
+            uint64_t due_local_us;
+            uint64_t submitted_local_us;
+        } frame_slot_t;
+
+        void reset_slots();
+        void queue(int64_t present_utc_us, bool timed);
+        void admit(const frame_entry_t *entry);
+        uint64_t to_local_us(int64_t utc_us, uint64_t local_us);
+        TickType_t arm_alarm(uint32_t delay_us);
+        static int64_t release_alarm(alarm_id_t id, void *user_data);
+
+        StripOutput *output;
+        PixelKernels *kernels;
+        StripLayout *layout;
+        DisciplinedClock *clock;
+        uint64_t (*now_us)(void);
+        size_t frame_size;
+        uint32_t playout_delay_us;
+        int fill;
+        SpscQueue<frame_entry_t, FRAME_SCHEDULER_QUEUE_SIZE> ready;
+        SpscQueue<uint8_t, FRAME_SCHEDULER_QUEUE_SIZE> free_slots;
+        frame_slot_t slots[FRAME_SCHEDULER_DEPTH + 1];
+        volatile bool alarm_armed;
+        uint64_t alarm_due_local_us;
+        alarm_pool_t *alarm_pool;
+        TaskHandle_t scheduler_task_handle;
+        StaticTask<FRAME_SCHEDULER_TASK_STACK_SIZE> scheduler_task_storage;
+        frame_scheduler_stats_t stats;
+        uint8_t buffers[FRAME_SCHEDULER_DEPTH + 1][FRAME_SCHEDULER_BUFFER_SIZE] __attribute__((aligned(4)));
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include <string.h>
+#include <stdbool.h>
+#include "ip_checksum.h"
+
+
+static inline uint32_t fold16(uint32_t sum) {
+    sum = (sum >> 16) + (sum & 0xffff);
+    return (sum >> 16) + (sum & 0xffff);
+}
+
+
+static inline uint16_t swap16(uint32_t sum) {
+    return (uint16_t)(((sum & 0xff) << 8) | ((sum >> 8) & 0xff));
+}
+
+
+#if !IP_CHECKSUM_ASM
+/***
+ * The portable kernels. A 64-bit accumulator catches the carries, which the
+ * assembly ones feed straight back in with ADCS.
+ */
+uint32_t ip_checksum_words(const uint32_t *words, uint32_t count, uint32_t sum) {
+    uint64_t acc = sum;
+
+    while(count-- > 0) {
+        acc += *words++;
+    }
+    acc = (acc >> 32) + (acc & 0xffffffff);
+    return (uint32_t)((acc >> 32) + (acc & 0xffffffff));
+}
+
+
+uint32_t ip_checksum_copy_words(uint32_t *dst, const uint32_t *src, uint32_t count, uint32_t sum) {
+    uint64_t acc = sum;
+
+    while(count-- > 0) {
+        uint32_t word = *src++;
+        *dst++ = word;
+        acc += word;
+    }
+    acc = (acc >> 32) + (acc & 0xffffffff);
+    return (uint32_t)((acc >> 32) + (acc & 0xffffffff));
+}
+#endif
+
+
+/***
+ * Works the same way as lwIP's algorithm 3. An odd first byte is summed as the
+ * high half of a word, which puts everything after it in the wrong half, so
+ * the result is swapped at the end to make up for it. A halfword then brings
+ * the pointer to a word boundary for the kernel, and whatever's left over
+ * after the last whole word is summed in native order.
+ */
+uint16_t ip_checksum(const void *data, int len) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t sum = 0;
+    uint16_t t = 0;
+    bool odd = ((uintptr_t)p & 1) != 0;
+
+    if(len <= 0) {
+        return 0;
+    }
+    if(odd) {
+        ((uint8_t *)&t)[1] = *p++;
+        sum = t;
+        len--;
+    }
+    if(((uintptr_t)p & 2) != 0 && len >= 2) {
+        sum += *(const uint16_t *)p;
+        p += 2;
+        len -= 2;
+    }
+
+    sum = fold16(ip_checksum_words((const uint32_t *)p, (uint32_t)len >> 2, sum));
+    p += len & ~3;
+
+    if(len & 2) {
+        sum += *(const uint16_t *)p;
+        p += 2;
+    }
+    if(len & 1) {
+        t = 0;
+        ((uint8_t *)&t)[0] = *p;
+        sum += t;
+    }
+
+    sum = fold16(sum);
+    return odd ? swap16(sum) : (uint16_t)sum;
+}
+
+
+/***
+ * For LWIP_CHECKSUM_ON_COPY. The fused pass needs the source and destination
+ * the same distance from a word boundary, which they are whenever both are
+ * pbuf payloads at the same header offset; otherwise it's a plain copy and a
+ * second pass. The sum of a run of bytes doesn't depend on where it sits, so
+ * either way the result is ip_checksum() of the data.
+ */
+uint16_t ip_checksum_copy(void *dst, const void *src, uint16_t len) {
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *d = (uint8_t *)dst;
+    uint32_t sum = 0;
+    uint16_t t = 0;
+    bool odd = ((uintptr_t)s & 1) != 0;
+
+    if((((uintptr_t)s ^ (uintptr_t)d) & 3) != 0) {
+        memcpy(dst, src, len);
+        return ip_checksum(dst, len);
+    }
+    if(len == 0) {
+        return 0;
+    }
+    if(odd) {
+        ((uint8_t *)&t)[1] = *d++ = *s++;
+        sum = t;
+        len--;
+    }
+    if(((uintptr_t)s & 2) != 0 && len >= 2) {
+        uint16_t half = *(const uint16_t *)s;
+        *(uint16_t *)d = half;
+        sum += half;
+        s += 2;
+        d += 2;
+        len -= 2;
+    }
+
+    sum = fold16(ip_checksum_copy_words((uint32_t *)d, (const uint32_t *)s, (uint32_t)len >> 2, sum));
+    s += len & ~3;
+    d += len & ~3;
+
+    if(len & 2) {
+        uint16_t half = *(const uint16_t *)s;
+        *(uint16_t *)d = half;
+        sum += half;
+        s += 2;
+        d += 2;
+    }
+    if(len & 1) {
+        t = 0;
+        ((uint8_t *)&t)[0] = *d = *s;
+        sum += t;
+    }
+
+    sum = fold16(sum);
+    return odd ? swap16(sum) : (uint16_t)sum;
+}
+
+
+/***
+ * RFC 1071 as written: big-endian 16-bit words, a zero pad after an odd last
+ * byte. Converted to lwIP's order at the end.
+ */
+uint16_t ip_checksum_reference(const void *data, int len) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t sum = 0;
+
+    while(len > 1) {
+        sum += (uint32_t)((p[0] << 8) | p[1]);
+        p += 2;
+        len -= 2;
+    }
+    if(len > 0) {
+        sum += (uint32_t)(p[0] << 8);
+    }
+
+    sum = fold16(sum);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return swap16(sum);
+#else
+    return (uint16_t)sum;
+#endif
+}
@@ -0,0 +1,40 @@
+#ifndef __IP_CHECKSUM_H__
+#define __IP_CHECKSUM_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+
+// Set by the build when there's an assembly kernel for the board's core
+// (ip_checksum_m0plus.S on the RP2040, ip_checksum_m33.S on the RP2350)
+#ifndef IP_CHECKSUM_ASM
+#define IP_CHECKSUM_ASM         0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The Internet checksum (RFC 1071) for lwIP, as LWIP_CHKSUM and
+ * LWIP_CHKSUM_COPY. Both return the 16-bit one's complement sum of the data,
+ * not yet inverted, in the byte order that lwIP stores straight into a
+ * header, the same way lwip_standard_chksum() does. The bytes are summed a
+ * word at a time by ip_checksum_words(). ip_checksum_copy() copies the data
+ * and sums it in the same pass.
+ */
+uint16_t ip_checksum(const void *data, int len);
+uint16_t ip_checksum_copy(void *dst, const void *src, uint16_t len);
+
+// Two bytes at a time in network order, for checking the others against
+uint16_t ip_checksum_reference(const void *data, int len);
+
+// The kernels: the end-around-carry sum of count aligned 32-bit words, added
+// to sum and folded to 32 bits, optionally copying the words to dst as well
+uint32_t ip_checksum_words(const uint32_t *words, uint32_t count, uint32_t sum);
+uint32_t ip_checksum_copy_words(uint32_t *dst, const uint32_t *src, uint32_t count, uint32_t sum);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,338 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "lan_time.h"
+
+#define LAN_TIME_MAGIC_0            'L'
+#define LAN_TIME_MAGIC_1            'T'
+#define LAN_TIME_VERSION            1
+
+#define LAN_TIME_SYNC               1
+#define LAN_TIME_FOLLOW_UP          2
+#define LAN_TIME_DELAY_REQUEST      3
+#define LAN_TIME_DELAY_RESPONSE     4
+
+
+static inline uint16_t get_be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+static inline void put_be16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+
+static inline void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+
+static int32_t clamp_us(int64_t us) {
+    return (int32_t)(us > INT32_MAX ? INT32_MAX : (us < INT32_MIN ? INT32_MIN : us));
+}
+
+
+/***
+ * Every packet is the same 24 bytes:
+ *
+ *    0  'L' 'T', version, type
+ *    4  sequence (of the master's sync it belongs to), 2 bytes reserved
+ *    8  source node id
+ *   12  target node id (the master for a delay request, the follower for
+ *       its response, 0 otherwise)
+ *   16  timestamp: microseconds on the master's clock, signed
+ *
+ * all big-endian. Node ids can be anything but 0; the bottom of the MAC
+ * address does nicely.
+ */
+void LanTimeNode::reset(lan_time_role_t role, uint32_t node_id) {
+    this->role = role;
+    this->node_id = node_id;
+    sequence = 0;
+    next_sync_local_us = 0;
+    sent_local_us = 0;
+    master_id = 0;
+    master_seen_local_us = 0;
+    sync_sequence = 0;
+    sync_local_us = 0;
+    sync_sent_us = 0;
+    follow_up_seen = false;
+    request_due_local_us = 0;
+    request_due = false;
+    request_local_us = 0;
+    request_pending = false;
+    window_count = 0;
+    memset(window, 0, sizeof(window));
+    memset(&stats, 0, sizeof(stats));
+}
+
+
+/***
+ * Does whatever is due at local_us: the master's next sync, or a follower's
+ * delay request. Returns how many milliseconds until it needs calling again,
+ * though a packet arriving can make that sooner.
+ */
+uint32_t LanTimeNode::poll(uint64_t local_us) {
+    uint64_t interval_us = (uint64_t)interval_ms * 1000;
+
+    if(role == LAN_TIME_MASTER) {
+        if(local_us >= next_sync_local_us) {
+            send_sync(local_us);
+            next_sync_local_us = local_us - next_sync_local_us < interval_us ?
+                                 next_sync_local_us + interval_us : local_us + interval_us;
+        }
+        return (uint32_t)((next_sync_local_us - local_us + 999) / 1000);
+    }
+
+    if(role == LAN_TIME_FOLLOWER) {
+        if(master_id != 0 && local_us - master_seen_local_us > LAN_TIME_MASTER_TIMEOUT * interval_us) {
+            master_id = 0;
+            stats.master_id = 0;
+            request_due = false;
+            request_pending = false;
+        }
+
+        if(request_due) {
+            if(local_us >= request_due_local_us) {
+                send_delay_request();
+            }
+            else {
+                return (uint32_t)((request_due_local_us - local_us + 999) / 1000);
+            }
+        }
+    }
+
+    return interval_ms;
+}
+
+
+/***
+ * Takes one packet off the LAN. local_us should be read as soon as the
+ * packet arrives, before anything else is done with it: it's half of
+ * every measurement.
+ */
+void LanTimeNode::handle(const uint8_t *msg, size_t len, uint64_t local_us) {
+    uint32_t source, target;
+    uint16_t seq;
+    int64_t timestamp_us;
+
+    if(len < LAN_TIME_PACKET_LEN || msg[0] != LAN_TIME_MAGIC_0 || msg[1] != LAN_TIME_MAGIC_1 ||
+       msg[2] != LAN_TIME_VERSION || clock == NULL) {
+        return;
+    }
+
+    seq = get_be16(&msg[4]);
+    source = get_be32(&msg[8]);
+    target = get_be32(&msg[12]);
+    timestamp_us = (int64_t)(((uint64_t)get_be32(&msg[16]) << 32) | get_be32(&msg[20]));
+
+    // Our own broadcasts come back to us on some stacks
+    if(source == node_id || source == 0) {
+        return;
+    }
+
+    if(role == LAN_TIME_MASTER) {
+        if(msg[3] == LAN_TIME_DELAY_REQUEST && target == node_id) {
+            stats.delay_requests++;
+            send(LAN_TIME_DELAY_RESPONSE, seq, source, clock->to_utc_us(local_us));
+        }
+    }
+    else if(role == LAN_TIME_FOLLOWER) {
+        switch(msg[3]) {
+            case LAN_TIME_SYNC:
+                handle_sync(source, seq, local_us);
+                break;
+            case LAN_TIME_FOLLOW_UP:
+                handle_follow_up(source, seq, timestamp_us, local_us);
+                break;
+            case LAN_TIME_DELAY_RESPONSE:
+                if(target == node_id) {
+                    handle_delay_response(source, seq, timestamp_us);
+                }
+                break;
+        }
+    }
+}
+
+
+void LanTimeNode::send(uint8_t type, uint16_t seq, uint32_t target, int64_t timestamp_us) {
+    uint8_t msg[LAN_TIME_PACKET_LEN];
+
+    msg[0] = LAN_TIME_MAGIC_0;
+    msg[1] = LAN_TIME_MAGIC_1;
+    msg[2] = LAN_TIME_VERSION;
+    msg[3] = type;
+    put_be16(&msg[4], seq);
+    put_be16(&msg[6], 0);
+    put_be32(&msg[8], node_id);
+    put_be32(&msg[12], target);
+    put_be32(&msg[16], (uint32_t)((uint64_t)timestamp_us >> 32));
+    put_be32(&msg[20], (uint32_t)timestamp_us);
+
+    if(transport != NULL) {
+        sent_local_us = transport->send(msg, sizeof(msg));
+    }
+}
+
+
+/***
+ * The sync carries when we meant to send it; the follow-up carries when the
+ * transport says it actually went, which is the one followers use.
+ */
+void LanTimeNode::send_sync(uint64_t local_us) {
+    sequence++;
+    stats.syncs++;
+
+    send(LAN_TIME_SYNC, sequence, 0, clock->to_utc_us(local_us));
+    send(LAN_TIME_FOLLOW_UP, sequence, 0, clock->to_utc_us(sent_local_us));
+}
+
+
+void LanTimeNode::send_delay_request() {
+    request_due = false;
+    request_pending = true;
+    stats.delay_requests++;
+
+    send(LAN_TIME_DELAY_REQUEST, sync_sequence, master_id, 0);
+    request_local_us = sent_local_us;
+}
+
+
+void LanTimeNode::handle_sync(uint32_t source, uint16_t seq, uint64_t local_us) {
+    if(master_id == 0) {
+        master_id = source;
+        stats.master_id = source;
+        stats.master_changes++;
+    }
+    if(source != master_id) {
+        return;
+    }
+
+    if(request_pending) {
+        stats.lost++;
+        request_pending = false;
+    }
+
+    stats.syncs++;
+    master_seen_local_us = local_us;
+    sync_sequence = seq;
+    sync_local_us = local_us;
+    follow_up_seen = false;
+    request_due = false;
+}
+
+
+void LanTimeNode::handle_follow_up(uint32_t source, uint16_t seq, int64_t timestamp_us, uint64_t local_us) {
+    uint64_t slot = node_id % LAN_TIME_STAGGER_SLOTS;
+
+    if(source != master_id || seq != sync_sequence || follow_up_seen) {
+        return;
+    }
+
+    follow_up_seen = true;
+    sync_sent_us = timestamp_us;
+
+    // Spread over the first half of the interval, out of the way of the next sync
+    request_due = true;
+    request_due_local_us = local_us + slot * interval_ms * 1000 / (2 * LAN_TIME_STAGGER_SLOTS);
+}
+
+
+/***
+ * The fourth timestamp is in, so the exchange is complete. Our two readings
+ * are converted with the clock as it is now, so a correction made in between
+ * doesn't show up as an offset. The offset assumes the path took as long
+ * each way; the round trip is how far wrong that could be.
+ */
+void LanTimeNode::handle_delay_response(uint32_t source, uint16_t seq, int64_t timestamp_us) {
+    int64_t t1, t2, t3, t4;
+    int64_t offset, delay;
+
+    if(source != master_id || seq != sync_sequence || !request_pending) {
+        return;
+    }
+    request_pending = false;
+    stats.exchanges++;
+
+    t1 = sync_sent_us;
+    t2 = clock->to_utc_us(sync_local_us);
+    t3 = clock->to_utc_us(request_local_us);
+    t4 = timestamp_us;
+
+    offset = ((t2 - t1) - (t4 - t3)) / 2;
+    delay = (t2 - t1) + (t4 - t3);
+
+    add_sample(sync_local_us, t2 - offset, delay < 0 ? 0 : (uint32_t)(delay > UINT32_MAX ? UINT32_MAX : delay));
+}
+
+
+/***
+ * A follower steers the clock with the quickest of every
+ * LAN_TIME_FILTER_LENGTH exchanges already, so the clock's own burst filter
+ * is turned off; a master leaves the clock to NTP. Call after reset().
+ */
+void LanTimeNode::set_clock(DisciplinedClock *clock) {
+    this->clock = clock;
+    if(role == LAN_TIME_FOLLOWER) {
+        clock->set_burst_length(1);
+    }
+}
+
+
+/***
+ * The first sample sets the clock straight away. After that, every
+ * LAN_TIME_FILTER_LENGTH of them, the one with the quickest round trip goes
+ * to the clock.
+ */
+void LanTimeNode::add_sample(uint64_t local_us, int64_t reference_us, uint32_t delay_us) {
+    const lan_time_sample_t *best;
+    double squares = 0.0;
+    int64_t best_offset;
+
+    if(!clock->is_synchronized()) {
+        clock->update(local_us, reference_us, delay_us);
+        stats.updates++;
+        stats.delay_us = delay_us;
+        window_count = 0;
+        return;
+    }
+
+    window[window_count].local_us = local_us;
+    window[window_count].reference_us = reference_us;
+    window[window_count].delay_us = delay_us;
+    if(++window_count < LAN_TIME_FILTER_LENGTH) {
+        return;
+    }
+    window_count = 0;
+
+    best = &window[0];
+    for(int i = 1; i < LAN_TIME_FILTER_LENGTH; i++) {
+        if(window[i].delay_us < best->delay_us) {
+            best = &window[i];
+        }
+    }
+
+    best_offset = best->reference_us - clock->to_utc_us(best->local_us);
+    for(int i = 0; i < LAN_TIME_FILTER_LENGTH; i++) {
+        double d = (double)(window[i].reference_us - clock->to_utc_us(window[i].local_us) - best_offset);
+        squares += d * d;
+    }
+
+    stats.offset_us = clamp_us(-best_offset);
+    stats.delay_us = best->delay_us;
+    stats.jitter_us = (uint32_t)sqrt(squares / LAN_TIME_FILTER_LENGTH);
+    stats.updates++;
+
+    clock->update(best->local_us, best->reference_us, best->delay_us);
+}
@@ -0,0 +1,141 @@
+#ifndef __LAN_TIME_H__
+#define __LAN_TIME_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "disciplined_clock.h"
+
+#define LAN_TIME_PORT               4049
+#define LAN_TIME_PACKET_LEN         24
+
+// How often the master sends a sync, and how many exchanges a follower
+// measures before it gives its clock the one with the quickest round trip
+#define LAN_TIME_SYNC_INTERVAL_MS   1000
+#define LAN_TIME_FILTER_LENGTH      8
+
+// A follower gives up on a master it hasn't heard from in this many intervals
+// and takes the next one it hears
+#define LAN_TIME_MASTER_TIMEOUT     5
+
+// Followers spread their delay requests over this much of the interval, by
+// node id, so a room full of them doesn't answer the master all at once
+#define LAN_TIME_STAGGER_SLOTS      16
+
+
+typedef enum {
+    LAN_TIME_DISABLED = 0,
+    LAN_TIME_MASTER = 1,
+    LAN_TIME_FOLLOWER = 2
+} lan_time_role_t;
+
+
+typedef struct {
+    uint32_t syncs;             // sent (master) or received (follower)
+    uint32_t delay_requests;    // answered (master) or sent (follower)
+    uint32_t exchanges;         // complete, with all four timestamps
+    uint32_t lost;              // delay requests that never got an answer
+    uint32_t updates;           // filtered samples given to the clock
+    uint32_t master_changes;
+    uint32_t master_id;
+    int32_t offset_us;          // ours from the master's, at the last update, before correcting it
+    uint32_t delay_us;          // round trip of the last update's sample
+    uint32_t jitter_us;         // RMS of the filter window's offsets around it
+} lan_time_stats_t;
+
+
+/**
+ * How a LanTimeNode gets its packets onto the LAN. Every packet goes to every
+ * node. send() returns the local timer reading from as soon after the packet
+ * left as the transport can tell, which is what goes into the follow-up.
+ */
+class LanTimeTransport {
+    public:
+        virtual uint64_t send(const uint8_t *msg, size_t len) = 0;
+};
+
+
+/**
+ * A PTP-style master/follower time protocol for nodes on one LAN, with no
+ * dependence on the network stack: packets come in through handle() with
+ * the local timer reading taken as they arrived, and go out through a
+ * LanTimeTransport.
+ *
+ * The master sends a sync every interval, then a follow-up with the time it
+ * actually left (two-step, like PTP). Each follower notes when the sync
+ * arrived, sends a delay request, and gets back when that arrived at the
+ * master. Those four timestamps give the follower's offset from the master
+ * and the round trip, without assuming anything but a symmetric path. The
+ * exchange with the quickest round trip out of every LAN_TIME_FILTER_LENGTH
+ * is the one the follower's DisciplinedClock slews to, since on wifi the
+ * slow ones are slow in one direction.
+ *
+ * The master's time is whatever its own clock says, NTP-disciplined or not;
+ * what matters for playback is that every node in the room agrees.
+ */
+class LanTimeNode {
+    public:
+        LanTimeNode() {
+            clock = NULL;
+            transport = NULL;
+            interval_ms = LAN_TIME_SYNC_INTERVAL_MS;
+            reset(LAN_TIME_DISABLED, 0);
+        };
+
+        void reset(lan_time_role_t role, uint32_t node_id);
+        void set_clock(DisciplinedClock *clock);
+        void set_transport(LanTimeTransport *transport) { this->transport = transport; };
+        void set_sync_interval_ms(uint32_t interval_ms) { this->interval_ms = interval_ms; };
+
+        uint32_t poll(uint64_t local_us);
+        void handle(const uint8_t *msg, size_t len, uint64_t local_us);
+
+        lan_time_role_t get_role() { return role; };
+        bool has_master() { return master_id != 0; };
+        const lan_time_stats_t *get_stats() { return &stats; };
+
+    private:
+        typedef struct {
+            uint64_t local_us;
+            int64_t reference_us;
+            uint32_t delay_us;
+        } lan_time_sample_t;
+
+        void send(uint8_t type, uint16_t sequence, uint32_t target, int64_t timestamp_us);
+        void send_sync(uint64_t local_us);
+        void send_delay_request();
+        void handle_sync(uint32_t source, uint16_t sequence, uint64_t local_us);
+        void handle_follow_up(uint32_t source, uint16_t sequence, int64_t timestamp_us, uint64_t local_us);
+        void handle_delay_response(uint32_t source, uint16_t sequence, int64_t timestamp_us);
+        void add_sample(uint64_t local_us, int64_t reference_us, uint32_t delay_us);
+
+        lan_time_role_t role;
+        uint32_t node_id;
+        uint32_t interval_ms;
+        DisciplinedClock *clock;
+        LanTimeTransport *transport;
+        uint64_t sent_local_us;         // when the transport says the last packet left
+
+        // Master
+        uint16_t sequence;
+        uint64_t next_sync_local_us;
+
+        // Follower
+        uint32_t master_id;
+        uint64_t master_seen_local_us;
+        uint16_t sync_sequence;
+        uint64_t sync_local_us;         // t2: the sync arrived
+        int64_t sync_sent_us;           // t1: the sync left the master, from the follow-up
+        bool follow_up_seen;
+        uint64_t request_due_local_us;
+        bool request_due;
+        uint64_t request_local_us;      // t3: our delay request left
+        bool request_pending;
+
+        lan_time_sample_t window[LAN_TIME_FILTER_LENGTH];
+        int window_count;
+
+        lan_time_stats_t stats;
+};
+
+#endif
@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lan_time_sync.h"
+#include "logger.h"
+#include "tx_pbufs.h"
+#include "pico/cyw43_arch.h"
+
+
+/**
+ * Starts LAN time on the event loop, unless the configuration has no role
+ * for this node. It can't be called before the event loop has been set with
+ * set_event_loop(). Like the other network services it waits for
+ * EVENT_WIFI_JOINED before it binds anything; after that the node is polled
+ * on a loop timer, as often as it asks to be, for the master's syncs and the
+ * followers' delay requests.
+ */
+void LanTimeSync::init() {
+    if(role == LAN_TIME_DISABLED || clock == NULL) {
+        return;
+    }
+    LOG_INFO("LAN TIME WAITING FOR WIFI");
+    loop->when(EVENT_WIFI_JOINED, wifi_joined, this);
+}
+
+
+void LanTimeSync::configure(const led_strip_config_t *config) {
+    role = config->lan_time_role == LAN_TIME_MASTER || config->lan_time_role == LAN_TIME_FOLLOWER ?
+           (lan_time_role_t)config->lan_time_role : LAN_TIME_DISABLED;
+}
+
+
+/***
+ * LanTimeTransport: broadcasts msg to every node on the LAN. Called from the
+ * event loop with the lwIP lock held, or from the receive callback on the
+ * tcpip thread.
+ */
+uint64_t LanTimeSync::send(const uint8_t *msg, size_t len) {
+    struct pbuf *p = TxPbufs::getInstance().alloc((u16_t)len);
+
+    if(p != NULL) {
+        memcpy(p->payload, msg, len);
+        udp_sendto(pcb, p, IP_ADDR_BROADCAST, LAN_TIME_PORT);
+        pbuf_free(p);
+    }
+
+    return time_us_64();
+}
+
+
+/***
+ * Runs on the tcpip thread. The timer is read before anything else is done
+ * with the packet, then the node is polled from the event loop in case a
+ * delay request has just become due.
+ */
+void LanTimeSync::lan_time_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    uint64_t local_us = time_us_64();
+    LanTimeSync *sync = (LanTimeSync *)arg;
+    uint8_t msg[LAN_TIME_PACKET_LEN];
+
+    if(p->tot_len >= LAN_TIME_PACKET_LEN) {
+        pbuf_copy_partial(p, msg, LAN_TIME_PACKET_LEN, 0);
+        sync->node.handle(msg, LAN_TIME_PACKET_LEN, local_us);
+        sync->loop->post(received, sync);
+    }
+    pbuf_free(p);
+}
+
+
+void LanTimeSync::wifi_joined(void *arg, bool met) {
+    LanTimeSync *sync = (LanTimeSync *)arg;
+    uint8_t mac[6];
+
+    sync->wifi->get_mac_address(mac);
+
+    cyw43_arch_lwip_begin();
+    sync->node.reset(sync->role, ((uint32_t)mac[2] << 24) | ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5]);
+    sync->node.set_clock(sync->clock);
+    sync->node.set_transport(sync);
+
+    sync->pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    ip_set_option(sync->pcb, SOF_BROADCAST);
+    udp_bind(sync->pcb, IP_ANY_TYPE, LAN_TIME_PORT);
+    udp_recv(sync->pcb, lan_time_recv, sync);
+    cyw43_arch_lwip_end();
+
+    LOG_INFO("LAN TIME %s ON UDP %d", sync->role == LAN_TIME_MASTER ? "MASTER" : "FOLLOWER", LAN_TIME_PORT);
+
+    poll(sync);
+}
+
+
+/***
+ * Runs the node and schedules itself again for when the node next wants to
+ * be run. While the link is down the timer stops, and the loop calls back
+ * when it's joined again.
+ */
+void LanTimeSync::poll(void *arg) {
+    LanTimeSync *sync = (LanTimeSync *)arg;
+    uint32_t wait_ms;
+
+    sync->poll_timer = EVENT_TIMER_NONE;
+    if(!(sync->loop->get_conditions() & EVENT_WIFI_JOINED)) {
+        sync->loop->when(EVENT_WIFI_JOINED, resumed, sync);
+        return;
+    }
+
+    cyw43_arch_lwip_begin();
+    wait_ms = sync->node.poll(time_us_64());
+    cyw43_arch_lwip_end();
+
+    const lan_time_stats_t *stats = sync->node.get_stats();
+    if(stats->updates != sync->updates) {
+        sync->updates = stats->updates;
+        LOG_INFO("LAN TIME OFFSET %ld us, DELAY %lu us, JITTER %lu us FROM MASTER %08lx",
+                 (long)stats->offset_us, (unsigned long)stats->delay_us, (unsigned long)stats->jitter_us,
+                 (unsigned long)stats->master_id);
+    }
+
+    sync->poll_timer = sync->loop->schedule(wait_ms ? wait_ms : 1, poll, sync);
+}
+
+
+void LanTimeSync::resumed(void *arg, bool met) {
+    poll(arg);
+}
+
+
+/***
+ * Posted by the receive callback. A poll that's waiting on its timer is
+ * brought forward; one that's waiting for wifi is left to it.
+ */
+void LanTimeSync::received(void *arg) {
+    LanTimeSync *sync = (LanTimeSync *)arg;
+
+    if(sync->poll_timer != EVENT_TIMER_NONE) {
+        sync->loop->cancel(&sync->poll_timer);
+        poll(sync);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef __LAN_TIME_SYNC_H__
+#define __LAN_TIME_SYNC_H__
+
+#include <stdlib.h>
+#include "pico/stdlib.h"
+#include "FreeRTOSConfig.h"
+#include "FreeRTOS.h"
+#include "event_loop.h"
+#include "wifi.h"
+#include "strip_config.h"
+#include "disciplined_clock.h"
+#include "lan_time.h"
+
+extern "C" {
+    #include "lwip/pbuf.h"
+    #include "lwip/udp.h"
+}
+
+
+/**
+ * Runs a LanTimeNode over lwIP, as the time master for the room or as a
+ * follower of whichever master it hears, according to the strip
+ * configuration. Packets are broadcast on LAN_TIME_PORT. Receive timestamps
+ * are taken first thing in the lwIP receive callback, and transmit
+ * timestamps as soon as udp_sendto() has handed the packet to the driver.
+ *
+ * The clock it keeps is NetworkTime's: a master serves whatever NTP has made
+ * of it, and a follower steers it instead of NTP.
+ */
+class LanTimeSync : public LanTimeTransport {
+    public:
+        void init();
+        void configure(const led_strip_config_t *config);
+        void set_role(lan_time_role_t role) { this->role = role; };
+        lan_time_role_t get_role() { return role; };
+        void set_clock(DisciplinedClock *clock) { this->clock = clock; };
+        void set_wifi_connection(WifiConnection *wifi) { this->wifi = wifi; };
+        void set_event_loop(EventLoop *loop) { this->loop = loop; };
+        const lan_time_stats_t *get_stats() { return node.get_stats(); };
+
+        uint64_t send(const uint8_t *msg, size_t len);
+
+        static LanTimeSync& getInstance() {
+            static LanTimeSync instance;
+            return instance;
+        }
+
+    private:
+        LanTimeSync() {
+            role = LAN_TIME_DISABLED;
+            clock = NULL;
+            wifi = NULL;
+            loop = NULL;
+            pcb = NULL;
+            poll_timer = EVENT_TIMER_NONE;
+            updates = 0;
+        };
+
+        static void wifi_joined(void *arg, bool met);
+        static void poll(void *arg);
+        static void resumed(void *arg, bool met);
+        static void received(void *arg);
+        static void lan_time_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+
+        lan_time_role_t role;
+        DisciplinedClock *clock;
+        WifiConnection *wifi;
+        EventLoop *loop;
+        LanTimeNode node;
+        struct udp_pcb *pcb;
+        event_timer_t poll_timer;
+        uint32_t updates;               // the node's update count when it was last logged
+};
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * latency_main.cpp
+ *
+ * Firmware for the latency_responder target: wifi, the packet filter and
+ * the latency responder, and nothing else, so a round trip measured against
+ * it is the radio, the driver and lwIP. It joins the network the stored
+ * configuration names, the same as pico_lwip_example, or the one in
+ * secrets.h if there's no stored configuration; it never saves one.
+ * bench/latency_probe.cpp is the other end.
+ */
+
+#include <cstdio>
+#include "pico/stdlib.h"
+#include "secrets.h"
+#include "event_loop.h"
+#include "wifi.h"
+#include "latency_responder.h"
+#include "logger.h"
+#include "strip_config.h"
+#include "config_store.h"
+#include "config_flash.h"
+#include "packet_filter.h"
+
+extern "C" {
+    #include "FreeRTOSConfig.h"
+    #include "FreeRTOS.h"
+    #include "task.h"
+}
+
+
+EventLoop& event_loop = EventLoop::getInstance();
+WifiConnection& wifi = WifiConnection::getInstance();
+LatencyResponder& latency_responder = LatencyResponder::getInstance();
+ConfigStore& config_store = ConfigStore::getInstance();
+PacketFilter& packet_filter = PacketFilter::getInstance();
+Logger& logger = Logger::getInstance();
+
+led_strip_config_t strip_config;
+
+
+/***
+ * Only the network settings matter here. Unlike main.cpp, the defaults
+ * aren't saved, so flashing this over a configured strip and back again
+ * leaves its configuration as it was.
+ */
+void load_config() {
+    config_store.set_flash(&PicoFlash::getInstance());
+    if(config_store.load(&strip_config)) {
+        LOG_INFO("LOADED CONFIG (SEQUENCE %lu)", (unsigned long)config_store.get_stats()->sequence);
+    }
+    else {
+        LOG_WARN("NO STORED CONFIG, USING DEFAULTS");
+        memset(&strip_config, 0, sizeof(strip_config));
+        strncpy(strip_config.wifi_ssid, WIFI_SSID, sizeof(strip_config.wifi_ssid) - 1);
+        strncpy(strip_config.wifi_password, WIFI_PASSWORD, sizeof(strip_config.wifi_password) - 1);
+        strip_config.use_dhcp = true;
+#ifdef WIFI_STATIC_IP
+        static const uint8_t ip[4] = WIFI_STATIC_IP;
+        static const uint8_t netmask[4] = WIFI_STATIC_NETMASK;
+        static const uint8_t gateway[4] = WIFI_STATIC_GATEWAY;
+        memcpy(strip_config.ip, ip, 4);
+        memcpy(strip_config.netmask, netmask, 4);
+        memcpy(strip_config.gateway, gateway, 4);
+        strip_config.use_dhcp = false;
+#endif
+    }
+
+    strip_config.wifi_ssid[sizeof(strip_config.wifi_ssid) - 1] = '\0';
+    strip_config.wifi_password[sizeof(strip_config.wifi_password) - 1] = '\0';
+}
+
+
+void launch() {
+    logger.init();
+    load_config();
+    wifi.configure(&strip_config);
+    wifi.set_config_store(&config_store);
+
+    // Probes and load are unicast, so this only keeps stray broadcasts out
+    // of the mailbox, the same as in the full firmware
+    packet_filter.allow_port(68);
+    wifi.set_packet_filter(&packet_filter);
+
+    LOG_INFO("STARTING CYW43/WIFI INITIALIZATION");
+    // What's measured is the network, not the power policy
+    wifi.set_power_mode(POWER_MODE_PERFORMANCE);
+    wifi.set_event_loop(&event_loop);
+    wifi.init();
+
+    LOG_INFO("STARTING LATENCY RESPONDER");
+    latency_responder.set_wifi_connection(&wifi);
+    latency_responder.set_event_loop(&event_loop);
+    latency_responder.init();
+
+    event_loop.init();
+    vTaskStartScheduler();
+}
+
+
+int main() {
+    stdio_init_all();
+    sleep_ms(2000);
+    printf("UP\n");
+    sleep_ms(500);
+
+    printf("LAUNCHING LATENCY RESPONDER\n");
+    launch();
+}
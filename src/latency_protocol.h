@@ -0,0 +1,25 @@
+#ifndef __LATENCY_PROTOCOL_H__
+#define __LATENCY_PROTOCOL_H__
+
+// The wire format between LatencyResponder and bench/latency_probe.cpp, on
+// its own so the prober doesn't need lwIP or FreeRTOS to build.
+
+#define LATENCY_PORT                4052
+#define LATENCY_SINK_PORT           4053
+
+// A probe and its reply, big-endian. The prober fills in the first 16 bytes
+// and pads the datagram out to whatever size it's testing; the reply is the
+// same datagram, the same size, with the magic changed and the device's
+// fields filled in.
+#define LATENCY_PROBE_MAGIC         0x4c415450  // "LATP"
+#define LATENCY_REPLY_MAGIC         0x4c415452  // "LATR"
+#define LATENCY_OFFSET_MAGIC        0
+#define LATENCY_OFFSET_SEQUENCE     4           // the prober's, echoed
+#define LATENCY_OFFSET_HOST_TX      8           // the prober's, echoed
+#define LATENCY_OFFSET_DEVICE_RX    16          // time_us_64() when the probe reached the callback
+#define LATENCY_OFFSET_DEVICE_TX    24          // time_us_64() just before udp_sendto()
+#define LATENCY_OFFSET_SINK_PACKETS 32          // background datagrams taken in so far
+#define LATENCY_OFFSET_SEND_ERRORS  36          // replies udp_sendto() refused so far
+#define LATENCY_PROBE_MIN_LEN       40
+
+#endif
@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <string.h>
+#include "latency_responder.h"
+#include "logger.h"
+#include "pico/cyw43_arch.h"
+
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+static inline void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+
+static inline void put_be64(uint8_t *p, uint64_t v) {
+    put_be32(p, (uint32_t)(v >> 32));
+    put_be32(&p[4], (uint32_t)v);
+}
+
+
+/**
+ * Opens both ports once the event loop (set with set_event_loop()) sees
+ * EVENT_WIFI_JOINED. Everything after that happens in the receive callbacks.
+ */
+void LatencyResponder::init() {
+    loop->when(EVENT_WIFI_JOINED, wifi_joined, this);
+}
+
+
+void LatencyResponder::wifi_joined(void *arg, bool met) {
+    LatencyResponder *responder = (LatencyResponder *)arg;
+
+    cyw43_arch_lwip_begin();
+    responder->probe_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    udp_bind(responder->probe_pcb, IP_ANY_TYPE, LATENCY_PORT);
+    udp_recv(responder->probe_pcb, probe_recv, responder);
+
+    responder->sink_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    udp_bind(responder->sink_pcb, IP_ANY_TYPE, LATENCY_SINK_PORT);
+    udp_recv(responder->sink_pcb, sink_recv, responder);
+    cyw43_arch_lwip_end();
+
+    LOG_INFO("LATENCY PROBES ON UDP %d, LOAD ON UDP %d", LATENCY_PORT, LATENCY_SINK_PORT);
+}
+
+
+/***
+ * Runs on the tcpip thread. The receive timestamp is the first thing taken.
+ * The reply goes back in the probe's own pbuf: lwIP took the UDP, IP and
+ * link headers off the front of it on the way in, so there's room to put
+ * them back on the way out, and the device's fields are written in place
+ * (pbuf_take_at() copes with a probe that spans a chain).
+ */
+void LatencyResponder::probe_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    uint64_t rx_us = time_us_64();
+    LatencyResponder *responder = (LatencyResponder *)arg;
+    uint8_t header[4];
+    uint8_t stamps[LATENCY_PROBE_MIN_LEN - LATENCY_OFFSET_DEVICE_RX];
+    uint64_t tx_us;
+    uint32_t residence_us;
+
+    if(p->tot_len < LATENCY_PROBE_MIN_LEN ||
+       pbuf_copy_partial(p, header, sizeof(header), LATENCY_OFFSET_MAGIC) != sizeof(header) ||
+       get_be32(header) != LATENCY_PROBE_MAGIC) {
+        responder->stats.malformed++;
+        pbuf_free(p);
+        return;
+    }
+    responder->stats.probes++;
+
+    put_be32(header, LATENCY_REPLY_MAGIC);
+    pbuf_take_at(p, header, sizeof(header), LATENCY_OFFSET_MAGIC);
+
+    tx_us = time_us_64();
+    put_be64(&stamps[0], rx_us);
+    put_be64(&stamps[LATENCY_OFFSET_DEVICE_TX - LATENCY_OFFSET_DEVICE_RX], tx_us);
+    put_be32(&stamps[LATENCY_OFFSET_SINK_PACKETS - LATENCY_OFFSET_DEVICE_RX], responder->stats.sink_packets);
+    put_be32(&stamps[LATENCY_OFFSET_SEND_ERRORS - LATENCY_OFFSET_DEVICE_RX], responder->stats.send_errors);
+    pbuf_take_at(p, stamps, sizeof(stamps), LATENCY_OFFSET_DEVICE_RX);
+
+    if(udp_sendto(pcb, p, addr, port) == ERR_OK) {
+        responder->stats.replies++;
+    }
+    else {
+        responder->stats.send_errors++;
+    }
+    pbuf_free(p);
+
+    residence_us = (uint32_t)(tx_us - rx_us);
+    if(residence_us > responder->stats.residence_max_us) {
+        responder->stats.residence_max_us = residence_us;
+    }
+}
+
+
+void LatencyResponder::sink_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    LatencyResponder *responder = (LatencyResponder *)arg;
+
+    responder->stats.sink_packets++;
+    responder->stats.sink_bytes += p->tot_len;
+    pbuf_free(p);
+}
@@ -0,0 +1,75 @@
+#ifndef __LATENCY_RESPONDER_H__
+#define __LATENCY_RESPONDER_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "FreeRTOSConfig.h"
+#include "FreeRTOS.h"
+#include "event_loop.h"
+#include "wifi.h"
+#include "latency_protocol.h"
+
+extern "C" {
+    #include "lwip/pbuf.h"
+    #include "lwip/udp.h"
+}
+
+
+typedef struct {
+    uint32_t probes;            // well-formed probes received
+    uint32_t replies;           // and answered
+    uint32_t send_errors;       // udp_sendto() failed
+    uint32_t malformed;         // too short, or not a probe
+    uint32_t sink_packets;      // background load taken in on LATENCY_SINK_PORT
+    uint32_t sink_bytes;
+    uint32_t residence_max_us;  // longest a probe spent between callback and reply
+} latency_responder_stats_t;
+
+
+/**
+ * The device end of a round-trip latency measurement. It answers every
+ * probe on LATENCY_PORT with the probe itself, stamped with when it reached
+ * the lwIP receive callback and when the reply was handed back to lwIP, so
+ * the prober can take the device's own time out of the round trip. Replies
+ * go out from the callback on the tcpip thread, in the pbuf the probe came
+ * in, so nothing is copied or allocated and nothing waits for a task to be
+ * scheduled.
+ *
+ * LATENCY_SINK_PORT takes in background load and throws it away, counting
+ * it, so the load goes through the whole stack without being answered.
+ */
+class LatencyResponder {
+    public:
+        void init();
+        void set_wifi_connection(WifiConnection *wifi) { this->wifi = wifi; };
+        void set_event_loop(EventLoop *loop) { this->loop = loop; };
+        const latency_responder_stats_t *get_stats() { return &stats; };
+        void reset_stats() { memset(&stats, 0, sizeof(stats)); };
+
+        static void wifi_joined(void *arg, bool met);
+        static void probe_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+        static void sink_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+
+        static LatencyResponder& getInstance() {
+            static LatencyResponder instance;
+            return instance;
+        }
+
+    private:
+        LatencyResponder() {
+            wifi = NULL;
+            loop = NULL;
+            probe_pcb = NULL;
+            sink_pcb = NULL;
+            reset_stats();
+        };
+
+        WifiConnection *wifi;
+        EventLoop *loop;
+        struct udp_pcb *probe_pcb;
+        struct udp_pcb *sink_pcb;
+        latency_responder_stats_t stats;
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <string.h>
+#include "logger.h"
+
+static const char level_letters[] = "DIWE";
+
+
+/**
+ * Starts the drain task. Anything logged before then, including before the
+ * scheduler starts, waits in the rings.
+ */
+void Logger::init() {
+    log_task_handle = log_task_storage.create(log_task, "Log Task", this, tskIDLE_PRIORITY);
+}
+
+
+/***
+ * The counts are kept per ring, by the core that owns it; these add them up.
+ */
+const log_stats_t *Logger::get_stats() {
+    stats.records = 0;
+    stats.dropped = 0;
+    stats.ring_max_words = 0;
+    for(int i = 0; i < configNUMBER_OF_CORES; i++) {
+        stats.records += rings[i].records;
+        stats.dropped += rings[i].dropped;
+        if(rings[i].max_words > stats.ring_max_words) {
+            stats.ring_max_words = rings[i].max_words;
+        }
+    }
+    return &stats;
+}
+
+
+void Logger::reset_stats() {
+    for(int i = 0; i < configNUMBER_OF_CORES; i++) {
+        rings[i].records = 0;
+        rings[i].dropped = 0;
+        rings[i].max_words = 0;
+    }
+    memset(&stats, 0, sizeof(stats));
+    reported_drops = 0;
+}
+
+
+/***
+ * Formats and hands to the sink everything that's been logged so far, oldest
+ * first across the cores, and says how much was dropped since the last time
+ * if anything was. Returns the number of lines.
+ */
+uint32_t Logger::drain() {
+    uint32_t record[LOG_MAX_RECORD_WORDS];
+    char line[LOG_MAX_LINE_LEN];
+    uint32_t lines = 0;
+    uint32_t dropped;
+    size_t len;
+
+    for(;;) {
+        log_ring_t *oldest = NULL;
+        uint32_t oldest_time = 0;
+
+        for(int i = 0; i < configNUMBER_OF_CORES; i++) {
+            log_ring_t *ring = &rings[i];
+            if(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail) {
+                continue;
+            }
+            uint32_t time = ring->words[(ring->tail + 1) & MASK];
+            if(oldest == NULL || (int32_t)(time - oldest_time) < 0) {
+                oldest = ring;
+                oldest_time = time;
+            }
+        }
+        if(oldest == NULL) {
+            break;
+        }
+
+        uint32_t words = oldest->words[oldest->tail & MASK] & 0xff;
+        if(words < HEADER_WORDS || words > LOG_MAX_RECORD_WORDS) {
+            // Can't happen, but if it did there'd be no finding the next record
+            __atomic_store_n(&oldest->tail, oldest->head, __ATOMIC_RELEASE);
+            continue;
+        }
+        for(uint32_t i = 0; i < words; i++) {
+            record[i] = oldest->words[(oldest->tail + i) & MASK];
+        }
+        __atomic_store_n(&oldest->tail, oldest->tail + words, __ATOMIC_RELEASE);
+
+        len = format(record, line);
+        sink(line, len, sink_context);
+        lines++;
+    }
+
+    dropped = get_stats()->dropped;
+    if(dropped != reported_drops) {
+        len = snprintf(line, sizeof(line), "LOG DROPPED %lu RECORDS\n", (unsigned long)(dropped - reported_drops));
+        sink(line, len, sink_context);
+        reported_drops = dropped;
+        lines++;
+    }
+
+    stats.lines += lines;
+    return lines;
+}
+
+
+/***
+ * Walks the format string like printf would, and hands each conversion to
+ * snprintf on its own with the argument read back out of the record. The
+ * length modifier says how many words an integer took, the same way the
+ * argument's type did when it was written. The line starts with the time in
+ * seconds and the level, and always ends with a newline.
+ */
+size_t Logger::format(const uint32_t *record, char *line) {
+    uint32_t words = record[0] & 0xff;
+    uint32_t level = record[0] >> 24;
+    uint32_t time = record[1];
+    const char *f;
+    uint32_t arg = HEADER_WORDS;
+    size_t limit = LOG_MAX_LINE_LEN - 2;
+    size_t n;
+    char spec[16];
+    char text[LOG_MAX_STRING_LEN + 1];
+
+    if(POINTER_WORDS == 1) {
+        f = (const char *)(uintptr_t)record[2];
+    }
+    else {
+        f = (const char *)(uintptr_t)(((uint64_t)record[3] << 32) | record[2]);
+    }
+
+    n = snprintf(line, limit, "%lu.%06lu %c ", (unsigned long)(time / 1000000), (unsigned long)(time % 1000000),
+                 level < sizeof(level_letters) - 1 ? level_letters[level] : '?');
+
+    while(*f != '\0' && n < limit) {
+        if(*f != '%') {
+            line[n++] = *f++;
+            continue;
+        }
+        if(f[1] == '%') {
+            line[n++] = '%';
+            f += 2;
+            continue;
+        }
+
+        size_t s = 0;
+        char size = 0;
+        int written = 0;
+        uint64_t value = 0;
+
+        spec[s++] = *f++;
+        while(*f != '\0' && strchr("-+ #0123456789.", *f) != NULL && s < sizeof(spec) - 4) {
+            spec[s++] = *f++;
+        }
+        while(*f != '\0' && strchr("hlqjzt", *f) != NULL && s < sizeof(spec) - 2) {
+            size = (size == 'l' && *f == 'l') ? 'q' : *f;
+            spec[s++] = *f++;
+        }
+        if(*f == '\0') {
+            break;
+        }
+        char conversion = *f++;
+        spec[s++] = conversion;
+        spec[s] = '\0';
+
+        uint32_t arg_size = 4;
+        if(conversion == 's') {
+            arg_size = 0;
+        }
+        else if(strchr("fFeEgGaA", conversion) != NULL || size == 'q' || size == 'j') {
+            arg_size = 8;
+        }
+        else if(conversion == 'p') {
+            arg_size = sizeof(void *);
+        }
+        else if(size == 'l') {
+            arg_size = sizeof(long);
+        }
+        else if(size == 'z') {
+            arg_size = sizeof(size_t);
+        }
+        else if(size == 't') {
+            arg_size = sizeof(ptrdiff_t);
+        }
+
+        if(arg_size == 0) {
+            uint32_t len = arg < words ? record[arg++] : 0;
+            if(len > LOG_MAX_STRING_LEN || arg + (len + 3) / 4 > words) {
+                break;
+            }
+            memcpy(text, &record[arg], len);
+            text[len] = '\0';
+            arg += (len + 3) / 4;
+            written = snprintf(&line[n], limit - n, spec, text);
+        }
+        else {
+            if(arg + (arg_size + 3) / 4 > words) {
+                break;
+            }
+            value = record[arg++];
+            if(arg_size == 8) {
+                value |= (uint64_t)record[arg++] << 32;
+            }
+
+            if(strchr("fFeEgGaA", conversion) != NULL) {
+                double d;
+                memcpy(&d, &value, sizeof(d));
+                written = snprintf(&line[n], limit - n, spec, d);
+            }
+            else if(conversion == 'p') {
+                written = snprintf(&line[n], limit - n, spec, (void *)(uintptr_t)value);
+            }
+            else if(size == 'q' || size == 'j') {
+                written = snprintf(&line[n], limit - n, spec, (unsigned long long)value);
+            }
+            else if(size == 'l') {
+                written = snprintf(&line[n], limit - n, spec, (unsigned long)value);
+            }
+            else if(size == 'z' || size == 't') {
+                written = snprintf(&line[n], limit - n, spec, (size_t)value);
+            }
+            else {
+                written = snprintf(&line[n], limit - n, spec, (unsigned int)value);
+            }
+        }
+
+        if(written > 0) {
+            n += (size_t)written < limit - n ? (size_t)written : limit - n - 1;
+        }
+    }
+
+    if(n > limit) {
+        n = limit;
+    }
+    line[n++] = '\n';
+    line[n] = '\0';
+    return n;
+}
+
+
+void Logger::stdout_sink(const char *line, size_t len, void *context) {
+    fwrite(line, 1, len, stdout);
+}
+
+
+void Logger::log_task(void *params) {
+    Logger *logger = (Logger *)params;
+
+    for(;;) {
+        logger->drain();
+        vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_INTERVAL_MS));
+    }
+}
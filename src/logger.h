@@ -0,0 +1,272 @@
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "FreeRTOSConfig.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "static_task.h"
+
+#define LOG_LEVEL_DEBUG         0
+#define LOG_LEVEL_INFO          1
+#define LOG_LEVEL_WARN          2
+#define LOG_LEVEL_ERROR         3
+#define LOG_LEVEL_NONE          4
+
+// Calls below this level compile to nothing
+#ifndef LOG_LEVEL
+#define LOG_LEVEL               LOG_LEVEL_INFO
+#endif
+
+// Words in each core's ring. A power of two.
+#ifndef LOG_RING_WORDS
+#define LOG_RING_WORDS          1024
+#endif
+
+// A string argument is copied into the record, up to this many characters
+#define LOG_MAX_STRING_LEN      32
+#define LOG_MAX_ARGS            8
+
+// The header, the timestamp, the format string and the arguments
+#define LOG_MAX_RECORD_WORDS    (2 + 2 + LOG_MAX_ARGS * (1 + (LOG_MAX_STRING_LEN + 3) / 4))
+#define LOG_MAX_LINE_LEN        160
+
+#define LOG_DRAIN_INTERVAL_MS   20
+
+#ifndef LOG_TASK_STACK_SIZE
+#define LOG_TASK_STACK_SIZE     1024
+#endif
+
+#if configNUMBER_OF_CORES > 1
+#define LOG_CORE()              portGET_CORE_ID()
+#else
+#define LOG_CORE()              0
+#endif
+
+
+typedef struct {
+    uint32_t records;
+    uint32_t dropped;           // no room in the ring
+    uint32_t lines;             // formatted and handed to the sink
+    uint32_t ring_max_words;    // the fullest any ring has been
+} log_stats_t;
+
+// Gets each formatted line, newline included, on the drain task
+typedef void (*log_sink_t)(const char *line, size_t len, void *context);
+
+
+/**
+ * A logger for code that can't afford to wait for printf. A log call
+ * copies the format string's address, a timestamp and its raw arguments into
+ * a ring belonging to the core it runs on, with that core's interrupts off for
+ * the few stores it takes, and returns; nothing is formatted and nothing
+ * waits for USB. The drain task, at the lowest priority, formats what's there
+ * every LOG_DRAIN_INTERVAL_MS and hands each line to the sink: stdout (USB)
+ * unless set_sink() says otherwise. A record that doesn't fit is dropped and
+ * counted rather than waited for.
+ *
+ * Use the LOG_DEBUG(), LOG_INFO(), LOG_WARN() and LOG_ERROR() macros, with a
+ * string literal for the format, since only its address is kept. Arguments
+ * are checked against the format like printf's. %s arguments are copied, so
+ * they needn't outlive the call; '*' widths aren't supported.
+ */
+class Logger {
+    public:
+        void init();
+        void set_sink(log_sink_t sink, void *context) { this->sink = sink; sink_context = context; };
+        uint32_t drain();
+        const log_stats_t *get_stats();
+        void reset_stats();
+
+        template<typename... Args>
+        void write(uint8_t level, const char *format, Args... args) {
+            static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many arguments to log");
+            log_ring_t *ring = &rings[LOG_CORE()];
+            uint32_t words = HEADER_WORDS + (0 + ... + arg_words(args));
+            uint32_t now = time_us_32();
+            uint32_t status = save_and_disable_interrupts();
+            uint32_t head = ring->head;
+            uint32_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+            if(used + words > LOG_RING_WORDS) {
+                ring->dropped++;
+                restore_interrupts(status);
+                return;
+            }
+            put(ring, head, ((uint32_t)level << 24) | words);
+            put(ring, head, now);
+            put_pointer(ring, head, format);
+            (put_arg(ring, head, args), ...);
+            __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+            ring->records++;
+            if(used + words > ring->max_words) {
+                ring->max_words = used + words;
+            }
+            restore_interrupts(status);
+        }
+
+        static void log_task(void *params);
+
+        static Logger& getInstance() {
+            static Logger instance;
+            return instance;
+        }
+
+    private:
+        Logger() {
+            sink = stdout_sink;
+            sink_context = NULL;
+            log_task_handle = (TaskHandle_t)0;
+            memset(rings, 0, sizeof(rings));
+            memset(&stats, 0, sizeof(stats));
+            reported_drops = 0;
+        };
+
+        // head and the counts are only written by the ring's own core, tail
+        // only by the drain task; head and tail count words forever and wrap
+        // into the ring with the mask
+        typedef struct {
+            uint32_t words[LOG_RING_WORDS];
+            uint32_t head;
+            uint32_t tail;
+            uint32_t records;
+            uint32_t dropped;
+            uint32_t max_words;
+        } log_ring_t;
+
+        static const uint32_t MASK = LOG_RING_WORDS - 1;
+        static const uint32_t POINTER_WORDS = (sizeof(void *) + 3) / 4;
+        static const uint32_t HEADER_WORDS = 2 + POINTER_WORDS;
+
+        static inline uint32_t string_len(const char *s) {
+            uint32_t len = 0;
+            if(s != NULL) {
+                while(len < LOG_MAX_STRING_LEN && s[len] != '\0') {
+                    len++;
+                }
+            }
+            return len;
+        }
+
+        // Integers take one word, or two if they're 64 bits; floats go as
+        // doubles, the way printf gets them; strings are a length word and
+        // their characters
+        template<typename T>
+        static inline uint32_t arg_words(T value) {
+            if constexpr (std::is_same<T, const char *>::value || std::is_same<T, char *>::value) {
+                return 1 + (string_len(value) + 3) / 4;
+            }
+            else if constexpr (std::is_floating_point<T>::value) {
+                return 2;
+            }
+            else {
+                return (sizeof(T) + 3) / 4;
+            }
+        }
+
+        static inline void put(log_ring_t *ring, uint32_t &head, uint32_t word) {
+            ring->words[head++ & MASK] = word;
+        }
+
+        static inline void put_64(log_ring_t *ring, uint32_t &head, uint64_t value) {
+            put(ring, head, (uint32_t)value);
+            put(ring, head, (uint32_t)(value >> 32));
+        }
+
+        static inline void put_pointer(log_ring_t *ring, uint32_t &head, const void *pointer) {
+            if(POINTER_WORDS == 1) {
+                put(ring, head, (uint32_t)(uintptr_t)pointer);
+            }
+            else {
+                put_64(ring, head, (uint64_t)(uintptr_t)pointer);
+            }
+        }
+
+        static inline void put_string(log_ring_t *ring, uint32_t &head, const char *s) {
+            uint32_t len = string_len(s);
+            uint32_t word;
+
+            put(ring, head, len);
+            for(uint32_t i = 0; i < len; i += 4) {
+                word = 0;
+                memcpy(&word, &s[i], len - i < 4 ? len - i : 4);
+                put(ring, head, word);
+            }
+        }
+
+        template<typename T>
+        static inline void put_arg(log_ring_t *ring, uint32_t &head, T value) {
+            if constexpr (std::is_same<T, const char *>::value || std::is_same<T, char *>::value) {
+                put_string(ring, head, value);
+            }
+            else if constexpr (std::is_floating_point<T>::value) {
+                double d = value;
+                uint64_t bits;
+                memcpy(&bits, &d, sizeof(bits));
+                put_64(ring, head, bits);
+            }
+            else if constexpr (std::is_pointer<T>::value) {
+                put_pointer(ring, head, (const void *)value);
+            }
+            else if constexpr (sizeof(T) > 4) {
+                put_64(ring, head, (uint64_t)value);
+            }
+            else {
+                put(ring, head, (uint32_t)value);
+            }
+        }
+
+        size_t format(const uint32_t *record, char *line);
+        static void stdout_sink(const char *line, size_t len, void *context);
+
+        log_ring_t rings[configNUMBER_OF_CORES];
+        log_sink_t sink;
+        void *sink_context;
+        TaskHandle_t log_task_handle;
+        StaticTask<LOG_TASK_STACK_SIZE> log_task_storage;
+        log_stats_t stats;
+        uint32_t reported_drops;
+};
+
+
+// Never called; it's here so the compiler checks log arguments against the
+// format string the way it does printf's
+static inline void log_check_format(const char *format, ...) __attribute__((format(printf, 1, 2)));
+static inline void log_check_format(const char *format, ...) {}
+
+#define LOG_AT(level, ...) do { \
+    if(0) { log_check_format(__VA_ARGS__); } \
+    Logger::getInstance().write(level, __VA_ARGS__); \
+} while(0)
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...)  LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...)  do { } while(0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...)   LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...)   do { } while(0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...)   LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...)   do { } while(0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...)  LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...)  do { } while(0)
+#endif
+
+#endif
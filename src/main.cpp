@@ -1,8 +1,25 @@
 #include <cstdio>
 #include "pico/stdlib.h"
 #include "secrets.h"
+#include "event_loop.h"
 #include "wifi.h"
 #include "network_time.h"
+#include "lan_time_sync.h"
+#include "pixel_receiver.h"
+#include "strip_output.h"
+#include "pixel_kernels.h"
+#include "frame_scheduler.h"
+#include "strip_layout.h"
+#include "system_metrics.h"
+#include "logger.h"
+#include "udp_log_sink.h"
+#include "tx_pbufs.h"
+#include "strip_pio.h"
+#include "strip_config.h"
+#include "config_store.h"
+#include "config_flash.h"
+#include "packet_filter.h"
+#include "lan_time.h"
 
 extern "C" {
     #include "pico_led.h"
@@ -20,23 +37,237 @@ extern "C" {
 }
 
 
+EventLoop& event_loop = EventLoop::getInstance();
 WifiConnection& wifi = WifiConnection::getInstance();
 NetworkTime& network_time = NetworkTime::getInstance();
+LanTimeSync& lan_time_sync = LanTimeSync::getInstance();
+PixelReceiver& pixel_receiver = PixelReceiver::getInstance();
+StripOutput& strip_output = StripOutput::getInstance();
+PixelKernels& pixel_kernels = PixelKernels::getInstance();
+StripLayout& strip_layout = StripLayout::getInstance();
+FrameScheduler& frame_scheduler = FrameScheduler::getInstance();
+SystemMetrics& system_metrics = SystemMetrics::getInstance();
+ConfigStore& config_store = ConfigStore::getInstance();
+PacketFilter& packet_filter = PacketFilter::getInstance();
+Logger& logger = Logger::getInstance();
+
+// The pixel core's alarm pool: the latch alarm, and the frame scheduler's,
+// with room for ones that have been overtaken but haven't fired yet
+#define PIXEL_ALARM_COUNT   8
+
+led_strip_config_t strip_config;
+strip_layout_t strip_physical_layout;
+
+
+/***
+ * Runs on the tcpip thread when the receiver has a complete frame. The frame
+ * goes to the scheduler, to be shown at its timecode (or straight away if it
+ * hasn't one), and the receiver moves on to the next free buffer; if there
+ * isn't one it gets NULL and drops pixel data until the next frame ends and
+ * it asks again.
+ */
+void frame_ready(void *context) {
+    uint32_t timecode;
+
+    if(pixel_receiver.get_frame_timecode(&timecode)) {
+        frame_scheduler.submit_timecode(timecode);
+    }
+    else {
+        frame_scheduler.submit_untimed();
+    }
+    pixel_receiver.set_frame_buffer(frame_scheduler.get_fill_buffer());
+}
+
+
+/***
+ * The configuration lives in flash. The first boot (or one after the store has
+ * been wiped) gets the compiled-in defaults from secrets.h, which are saved so
+ * every boot after that reads the same thing. secrets.h can define
+ * WIFI_STATIC_IP, WIFI_STATIC_NETMASK and WIFI_STATIC_GATEWAY as byte
+ * initializers, e.g. { 192, 168, 1, 50 }, to default to a static address,
+ * LAN_TIME_ROLE as LAN_TIME_MASTER or LAN_TIME_FOLLOWER to take part in
+ * LAN time sync, and STRIP_COLOR_ORDER (a pixel_order_t), STRIP_BRIGHTNESS,
+ * STRIP_GAMMA (in tenths) and STRIP_DITHER for what the pixel kernels do to
+ * frames on their way out. Without those, pixels go out as they came in.
+ * WIFI_POWER_BUDGET_MS sets how long the radio may take to wake up for the
+ * first packet after a quiet spell (see PowerPolicy); under 110 keeps it awake,
+ * 0 included, and anything over 2540 is taken as 2540.
+ * STRIP_LAYOUT, a strip_layout_t initializer, does the same for the physical
+ * layout; without one the strip is a plain strip.
+ */
+void load_config() {
+    config_store.set_flash(&PicoFlash::getInstance());
+    if(config_store.load(&strip_config)) {
+        LOG_INFO("LOADED CONFIG (SEQUENCE %lu)", (unsigned long)config_store.get_stats()->sequence);
+    }
+    else {
+        LOG_WARN("NO STORED CONFIG, USING DEFAULTS");
+        memset(&strip_config, 0, sizeof(strip_config));
+        strncpy(strip_config.wifi_ssid, WIFI_SSID, sizeof(strip_config.wifi_ssid) - 1);
+        strncpy(strip_config.wifi_password, WIFI_PASSWORD, sizeof(strip_config.wifi_password) - 1);
+        strip_config.strip_length = STRIP_DEFAULT_LENGTH;
+        strip_config.right_to_left = false;
+        strip_config.use_dhcp = true;
+#ifdef LAN_TIME_ROLE
+        strip_config.lan_time_role = LAN_TIME_ROLE;
+#endif
+#ifdef STRIP_COLOR_ORDER
+        strip_config.color_order = STRIP_COLOR_ORDER;
+#endif
+#ifdef STRIP_BRIGHTNESS
+        strip_config.brightness = STRIP_BRIGHTNESS;
+#endif
+#ifdef STRIP_GAMMA
+        strip_config.gamma = STRIP_GAMMA;
+#endif
+#ifdef STRIP_DITHER
+        strip_config.dither = STRIP_DITHER;
+#endif
+#ifdef WIFI_POWER_BUDGET_MS
+        strip_config.pm_latency_budget = strip_pm_budget_from_ms(WIFI_POWER_BUDGET_MS);
+#endif
+#ifdef WIFI_STATIC_IP
+        static const uint8_t ip[4] = WIFI_STATIC_IP;
+        static const uint8_t netmask[4] = WIFI_STATIC_NETMASK;
+        static const uint8_t gateway[4] = WIFI_STATIC_GATEWAY;
+        memcpy(strip_config.ip, ip, 4);
+        memcpy(strip_config.netmask, netmask, 4);
+        memcpy(strip_config.gateway, gateway, 4);
+        strip_config.use_dhcp = false;
+#endif
+        config_store.save(&strip_config);
+    }
+
+    strip_config.wifi_ssid[sizeof(strip_config.wifi_ssid) - 1] = '\0';
+    strip_config.wifi_password[sizeof(strip_config.wifi_password) - 1] = '\0';
+
+    if(!config_store.load_layout(&strip_physical_layout)) {
+        memset(&strip_physical_layout, 0, sizeof(strip_physical_layout));
+#ifdef STRIP_LAYOUT
+        static const strip_layout_t layout = STRIP_LAYOUT;
+        memcpy(&strip_physical_layout, &layout, sizeof(strip_physical_layout));
+        config_store.save_layout(&strip_physical_layout);
+#endif
+    }
+}
+
+
+/***
+ * The broadcast and multicast ports anything here listens on: DHCP replies
+ * can be broadcast, DDP senders often broadcast, E1.31 multicasts, and LAN
+ * time sync and metrics queries are broadcast. The receiver adds its E1.31
+ * universes when it's configured.
+ */
+void configure_packet_filter() {
+    static const uint16_t ports[] = { 68, DDP_PORT, E131_PORT, LAN_TIME_PORT, METRICS_PORT };
+
+    for(uint16_t port : ports) {
+        packet_filter.allow_port(port);
+    }
+    wifi.set_packet_filter(&packet_filter);
+    pixel_receiver.set_packet_filter(&packet_filter);
+}
+
+
+/***
+ * Log lines go out over USB, unless secrets.h defines LOG_UDP_HOST as a byte
+ * initializer like WIFI_STATIC_IP, in which case they're sent there over UDP
+ * once wifi is up ({ 255, 255, 255, 255 } broadcasts them).
+ */
+void start_logging() {
+#ifdef LOG_UDP_HOST
+    static const uint8_t log_host[4] = LOG_UDP_HOST;
+    UdpLogSink& udp_log_sink = UdpLogSink::getInstance();
+    udp_log_sink.set_destination(log_host);
+    udp_log_sink.set_wifi_connection(&wifi);
+    logger.set_sink(UdpLogSink::sink, &udp_log_sink);
+#endif
+    logger.init();
+}
+
+
+/***
+ * The strip backend is set up from a task on the pixel core, so the DMA
+ * interrupt that finishes each frame is taken there too, and then the frame
+ * scheduler is started alongside it. Both get their alarms from a pool
+ * created here, whose interrupt is on this core as well, so the latch alarm,
+ * starting the next frame and the scheduler's release alarm all stay off
+ * the network core. With one core it's all done in place, on the default
+ * pool.
+ */
+void start_pixel_output(void *params) {
+#if configNUMBER_OF_CORES > 1 && configUSE_CORE_AFFINITY
+    alarm_pool_t *pool = alarm_pool_create_with_unused_hardware_alarm(PIXEL_ALARM_COUNT);
+
+    PioStripBackend::getInstance().set_alarm_pool(pool);
+    frame_scheduler.set_alarm_pool(pool);
+#endif
+    if(PioStripBackend::getInstance().init()) {
+        strip_output.set_backend(&PioStripBackend::getInstance());
+    }
+    frame_scheduler.init();
+
+#if configNUMBER_OF_CORES > 1 && configUSE_CORE_AFFINITY
+    vTaskDelete(NULL);
+#endif
+}
 
 
 void launch() {
 
-    wifi.set_ssid(WIFI_SSID);
-    wifi.set_password(WIFI_PASSWORD);
+    TxPbufs::getInstance().init();
+    start_logging();
+    load_config();
+    wifi.configure(&strip_config);
+    wifi.set_config_store(&config_store);
+    configure_packet_filter();
 
-    printf("STARTING CYW43/WIFI INITIALIZATION\n");
+    LOG_INFO("STARTING CYW43/WIFI INITIALIZATION");
+    wifi.set_event_loop(&event_loop);
     wifi.init();
 
-    printf("STARTING NTP SYNC\n");
+    LOG_INFO("STARTING NTP SYNC");
     network_time.sntp_set_timezone(-7);
-    network_time.set_wifi_connection(&wifi);
+    network_time.set_event_loop(&event_loop);
+    lan_time_sync.configure(&strip_config);
+    network_time.set_sync_mode(lan_time_sync.get_role() == LAN_TIME_FOLLOWER ? NTP_SYNC_OFF : NTP_SYNC_MULTI_SERVER);
     network_time.init();
 
+    LOG_INFO("STARTING LAN TIME SYNC");
+    lan_time_sync.set_clock(network_time.get_clock());
+    lan_time_sync.set_wifi_connection(&wifi);
+    lan_time_sync.set_event_loop(&event_loop);
+    lan_time_sync.init();
+
+    LOG_INFO("STARTING STRIP OUTPUT AND FRAME SCHEDULER");
+    strip_layout.configure(&strip_config, &strip_physical_layout);
+    strip_output.configure(&strip_config, strip_layout.get_physical_length());
+    pixel_kernels.configure(&strip_config);
+    frame_scheduler.configure(&strip_config);
+    frame_scheduler.set_output(&strip_output);
+    frame_scheduler.set_kernels(&pixel_kernels);
+    frame_scheduler.set_layout(&strip_layout);
+    frame_scheduler.set_clock(network_time.get_clock());
+#if configNUMBER_OF_CORES > 1 && configUSE_CORE_AFFINITY
+    xTaskCreateAffinitySet(start_pixel_output, "Pixel Core Init", configMINIMAL_STACK_SIZE * 2, NULL,
+                           configMAX_PRIORITIES - 1, PIXEL_CORE_AFFINITY, NULL);
+#else
+    start_pixel_output(NULL);
+#endif
+
+    LOG_INFO("STARTING PIXEL RECEIVER");
+    pixel_receiver.configure(&strip_config);
+    pixel_receiver.set_frame_buffer(frame_scheduler.get_fill_buffer());
+    pixel_receiver.set_frame_callback(frame_ready, NULL);
+    pixel_receiver.set_wifi_connection(&wifi);
+    pixel_receiver.set_event_loop(&event_loop);
+    pixel_receiver.init();
+
+    LOG_INFO("STARTING METRICS");
+    system_metrics.set_wifi_connection(&wifi);
+    system_metrics.init();
+
+    event_loop.init();
     vTaskStartScheduler();
 }
 
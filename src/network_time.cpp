@@ -2,42 +2,94 @@
 #include <stdlib.h>
 #include <string.h>
 #include "network_time.h"
+#include "logger.h"
+#include "tx_pbufs.h"
 #include "pico/util/datetime.h"
 #include "pico/aon_timer.h"
+#include "pico/cyw43_arch.h"
 #include "lwip/apps/sntp.h"
+#include "lwip/dns.h"
+#include "lwip/pbuf.h"
 
 
 
 
+// NTP timestamps count from 1900 and wrap in 2036; lwIP hands us the seconds
+// as a signed number so that adding this gets Unix time in either era
+#define NTP_DIFF_SEC_1970_2036  2085978496u
+
+#define NTP_PORT                123
+#define NTP_PACKET_LEN          48
+#define NTP_MODE_CLIENT         3
+#define NTP_MODE_SERVER         4
+#define NTP_VERSION             4
+#define NTP_LI_ALARM            3
+
+
+static uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+
+static int64_t ntp_to_unix_us(uint32_t sec, uint32_t frac) {
+    return (int64_t)(uint32_t)(sec + NTP_DIFF_SEC_1970_2036) * 1000000 + (int64_t)(((uint64_t)frac * 1000000) >> 32);
+}
+
+
 /**
- * This function is declared in $PICO_SDK/lib/lwip/src/apps/sntp/sntp.c, but not
- * implemented anywhere in that library code. It is called from the lwIP stack
- * when the SNTP client gets a result back from an NTP server, and it's our
- * responsibility to do something with that time. The NetworkTime class, (which
- * is involved because it holds time zone offset state, which NTP itself doesn't
- * care about) provides the set_time_in_seconds() method to implement the RTC
- * interface.
+ * These functions are declared in lwipopts.h and are how lwIP's SNTP client
+ * (in $PICO_SDK/lib/lwip/src/apps/sntp/sntp.c) talks to NetworkTime. It reads
+ * our clock to timestamp each request and reply, hands back the server's time
+ * with the round trip compensated for and the fraction of a second intact,
+ * and asks how long to wait before the next request. The NetworkTime class
+ * (which is involved because it owns the clock, and holds time zone offset
+ * state, which NTP itself doesn't care about) does the actual work.
  */
-void sntpSetTimeSec(uint32_t sec) {
-    NetworkTime::getInstance().set_time_in_seconds(sec);
+void sntpGetTimeUs(uint32_t *sec, uint32_t *us) {
+    NetworkTime::getInstance().get_time_us(sec, us);
+}
+
+
+void sntpSetTimeNtp(int32_t sec, uint32_t frac) {
+    NetworkTime::getInstance().set_time_ntp(sec, frac);
+}
+
+
+uint32_t sntpGetUpdateDelayMs(void) {
+    return NetworkTime::getInstance().get_poll_interval_ms();
 }
 
 
 /**
  * Kicks off the SNTP process in the Pico SDK LWIP "apps" library. This function
  * can be called before or after the FreeRTOS scheduler is running, but it can't
- * be called before the WifiConnection has been set with set_wifi_connection().
+ * be called before the event loop has been set with set_event_loop().
  *
- * The function creates a short-lived task that waits for the wifi connection to
- * be established through the syncrhronization mechanism exposed by the
- * WifiConnection class. That task kicks off the periodic SNTP sync process,
- * whose period is determined by SNTP_UPDATE_DELAY defined in lwipopts.h. That
- * task dies as soon as the SNTP process is started, since an internal LWIP task
- * is managing the update timer for us.
+ * Nothing happens until the event loop sees EVENT_WIFI_JOINED. Then lwIP's
+ * SNTP client is started, and from there on its own timer runs the periodic
+ * sync, with whatever period the clock discipline asks for (see
+ * CLOCK_POLL_MIN_MS and CLOCK_POLL_MAX_MS in disciplined_clock.h).
+ *
+ * In NTP_SYNC_MULTI_SERVER mode (see set_sync_mode()) lwIP's SNTP client is
+ * left out, and the rounds run on the event loop instead. In NTP_SYNC_OFF
+ * mode nothing runs at all.
  */
 void NetworkTime::init()
 {
-    xTaskCreate(time_task, "SNTP Task", 1024, this, 1, &time_task_handle);
+    if(sync_mode == NTP_SYNC_OFF) {
+        LOG_INFO("NTP SYNC OFF");
+        return;
+    }
+    LOG_INFO("NTP SYNC WAITING FOR WIFI");
+    loop->when(EVENT_WIFI_JOINED, wifi_joined, this);
 }
 
 
@@ -58,6 +110,9 @@ void NetworkTime::sntp_set_timezone(int offsetHours, int offsetMinutes) {
  * @param server - string name of server. Should remain in scope
  */
 void NetworkTime::sntp_add_server(const char *server){
+    if(sntp_server_count < NTP_MAX_SERVERS) {
+        server_names[sntp_server_count] = server;
+    }
     sntp_setservername(sntp_server_count++, server);
 }
 
@@ -68,22 +123,108 @@ void NetworkTime::sntp_add_server(const char *server){
  * what's going on behind the scenes.
  */
 void NetworkTime::sntp_start_sync() {
+    cyw43_arch_lwip_begin();
     sntp_setoperatingmode(SNTP_OPMODE_POLL);
     sntp_init();
+    cyw43_arch_lwip_end();
 }
 
 
 /**
- * Actually sets the Pico real-time clock (RTC) with a specific time. In the
- * case of this class, that time should be coming from an NTP server. See the
- * sntpSetTimeSec() function (declared in this file but not a part of the
- * NetworkTime class) for how this call is made.
+ * Hard-sets the clock to a whole number of seconds, with no slewing. The
+ * SNTP client doesn't come through here anymore (see set_time_ntp()), but
+ * it's still the way to set the time by hand.
  */
 void NetworkTime::set_time_in_seconds(uint32_t sec) {
+    uint64_t local_us = time_us_64();
+
+    LOG_INFO("SETTING TIME TO %lu", (unsigned long)sec);
+
+    clock.step(local_us, (int64_t)sec * 1000000);
+    set_aon_timer((uint64_t)sec * 1000000);
+}
+
+
+/**
+ * Called by the SNTP client with the server's time at the moment we read our
+ * clock for the reply. The two most recent clock readings were the request
+ * going out and the reply coming in, so they give us the round trip, and
+ * which local timer reading the server's time belongs to. That sample goes to
+ * the clock discipline, which slews the clock onto it.
+ *
+ * Before the first sync lwIP can't compensate for the round trip (our clock
+ * is decades off), so the server's transmit time is moved on by half of it.
+ */
+void NetworkTime::set_time_ntp(int32_t sec, uint32_t frac) {
+    uint32_t delay_us = (uint32_t)(reply_local_us - request_local_us);
+    int64_t reference_us = ntp_to_unix_us((uint32_t)sec, frac);
+
+    if(!clock.is_synchronized()) {
+        reference_us += delay_us / 2;
+    }
+
+    apply_sample(reply_local_us, reference_us, delay_us);
+}
+
+
+/**
+ * Hands one sample, from whichever way we're syncing, to the clock
+ * discipline, and keeps the AON timer in line with the result.
+ */
+void NetworkTime::apply_sample(uint64_t local_us, int64_t reference_us, uint32_t delay_us) {
+    uint32_t steps = clock.get_stats()->steps;
+
+    if(!clock.update(local_us, reference_us, delay_us)) {
+        LOG_WARN("NTP SAMPLE REJECTED, OFFSET %ld us", (long)clock.get_stats()->last_offset_us);
+        return;
+    }
+
+    const clock_stats_t *stats = clock.get_stats();
+    if(stats->steps != steps) {
+        LOG_INFO("SETTING TIME TO %llu us", (unsigned long long)reference_us);
+        set_aon_timer(now_us());
+        return;
+    }
+
+    LOG_INFO("NTP OFFSET %ld us, DELAY %lu us, FREQ %ld ppb, NEXT POLL %lu s",
+             (long)stats->last_offset_us, (unsigned long)stats->last_delay_us, (long)stats->freq_ppb,
+             (unsigned long)(stats->poll_ms / 1000));
+
+    // The AON timer runs off its own crystal and isn't disciplined, so pull it
+    // back into line whenever it's a second out
     struct timespec ts;
-    uint64_t ms = (sec + (60 * sntp_timezone_minutes_offset)) * 1000;
+    int64_t local_ms = (int64_t)(now_us() / 1000) + (int64_t)sntp_timezone_minutes_offset * 60 * 1000;
+    if(aon_timer_get_time(&ts) && llabs((int64_t)timespec_to_ms(&ts) - local_ms) >= 1000) {
+        set_aon_timer(now_us());
+    }
+}
+
 
-    printf("SETTING TIME TO %lu\n", ms);
+/**
+ * Reads our clock for the SNTP client, remembering when, so set_time_ntp()
+ * can tell which readings were the request and the reply.
+ */
+void NetworkTime::get_time_us(uint32_t *sec, uint32_t *us) {
+    uint64_t local_us = time_us_64();
+    int64_t utc_us = clock.to_utc_us(local_us);
+
+    request_local_us = reply_local_us;
+    reply_local_us = local_us;
+
+    *sec = (uint32_t)(utc_us / 1000000);
+    *us = (uint32_t)(utc_us % 1000000);
+}
+
+
+/**
+ * The AON timer (the RTC on the RP2040) keeps local calendar time for
+ * anything that wants it, at whole-second resolution, so it's only set when
+ * the clock steps or it has wandered a second away. now_us() is the time to use for anything that cares about
+ * milliseconds.
+ */
+void NetworkTime::set_aon_timer(uint64_t utc_us) {
+    struct timespec ts;
+    uint64_t ms = utc_us / 1000 + (int64_t)sntp_timezone_minutes_offset * 60 * 1000;
 
     ms_to_timespec(ms, &ts);
 
@@ -97,18 +238,212 @@ void NetworkTime::set_time_in_seconds(uint32_t sec) {
 }
 
 
-void NetworkTime::time_task(void *params) {
-    printf("NTP TASK STARTED\n");
-    NetworkTime *time = (NetworkTime *)params;
-    WifiConnection *wifi = time->wifi;
+void NetworkTime::wifi_joined(void *arg, bool met) {
+    NetworkTime *time = (NetworkTime *)arg;
 
-    printf("NTP TASK WAITING FOR WIFI INIT\n");
-    wifi->wait_for_wifi_init();
-    printf("NTP TASK WIFI INIT COMPLETE\n");
+    if(time->sync_mode == NTP_SYNC_MULTI_SERVER) {
+        time->start_multi_server_sync();
+        return;
+    }
 
     time->sntp_start_sync();
+    LOG_INFO("NTP SYNC RUNNING");
+}
+
+
+/***
+ * The multi-server client. Each round sends a request to every server at
+ * once, gives the replies NTP_COLLECT_MS to come in, and then lets
+ * NtpSelector pick the time out of everything it has heard recently. The
+ * rounds come as often as the clock discipline asks for its samples, and
+ * wait for wifi whenever it's down.
+ */
+void NetworkTime::start_multi_server_sync() {
+    cyw43_arch_lwip_begin();
+    ntp_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    udp_bind(ntp_pcb, IP_ANY_TYPE, 0);
+    udp_recv(ntp_pcb, ntp_recv, this);
+    cyw43_arch_lwip_end();
+
+    LOG_INFO("NTP MULTI-SERVER SYNC RUNNING WITH %d SERVERS",
+             sntp_server_count < NTP_MAX_SERVERS ? sntp_server_count : NTP_MAX_SERVERS);
+
+    start_round(this);
+}
+
+
+void NetworkTime::start_round(void *arg) {
+    NetworkTime *time = (NetworkTime *)arg;
+
+    time->round_timer = EVENT_TIMER_NONE;
+    if(!(time->loop->get_conditions() & EVENT_WIFI_JOINED)) {
+        time->loop->when(EVENT_WIFI_JOINED, resumed, time);
+        return;
+    }
+
+    for(int i = 0; i < NTP_MAX_SERVERS; i++) {
+        time->send_request(i);
+    }
+    time->round_timer = time->loop->schedule(NTP_COLLECT_MS, finish_round, time);
+}
+
+
+void NetworkTime::resumed(void *arg, bool met) {
+    start_round(arg);
+}
+
+
+void NetworkTime::finish_round(void *arg) {
+    NetworkTime *time = (NetworkTime *)arg;
+    uint64_t local_us;
+    int64_t reference_us;
+    uint32_t delay_us;
+    bool selected;
+
+    cyw43_arch_lwip_begin();
+    local_us = time_us_64();
+    selected = time->selector.select(&time->clock, local_us, &reference_us, &delay_us);
+    cyw43_arch_lwip_end();
+
+    if(selected) {
+        const ntp_selection_stats_t *stats = time->selector.get_stats();
+        LOG_INFO("NTP SELECTED %lu OF %d SERVERS", (unsigned long)stats->survivors, time->sntp_server_count);
+        time->apply_sample(local_us, reference_us, delay_us);
+    }
+    else {
+        LOG_INFO("NTP ROUND WITHOUT A SELECTION");
+    }
+
+    time->round_timer = time->loop->schedule(time->clock.get_poll_interval_ms() - NTP_COLLECT_MS, start_round,
+                                             time);
+}
+
+
+/***
+ * Looks the server up, without waiting: lwIP answers from its cache when it
+ * can, and otherwise calls dns_found() on the tcpip thread when the answer
+ * comes, which sends the request from there.
+ */
+void NetworkTime::send_request(int server) {
+    ntp_request_t *request = &requests[server];
+    err_t err;
+
+    if(server_names[server] == NULL) {
+        return;
+    }
+
+    cyw43_arch_lwip_begin();
+    err = dns_gethostbyname(server_names[server], &request->addr, dns_found, request);
+    if(err == ERR_OK) {
+        transmit(server);
+    }
+    cyw43_arch_lwip_end();
+
+    if(err != ERR_OK && err != ERR_INPROGRESS) {
+        LOG_WARN("COULDN'T RESOLVE NTP SERVER %s", server_names[server]);
+    }
+}
+
+
+void NetworkTime::dns_found(const char *name, const ip_addr_t *addr, void *arg) {
+    NetworkTime& time = getInstance();
+    ntp_request_t *request = (ntp_request_t *)arg;
+
+    if(addr == NULL) {
+        LOG_WARN("COULDN'T RESOLVE NTP SERVER %s", name);
+        return;
+    }
+    ip_addr_copy(request->addr, *addr);
+    time.transmit((int)(request - time.requests));
+}
+
+
+/***
+ * Sends a client-mode request, with lwIP already locked. The transmit
+ * timestamp is our clock, with the server's index folded into bits far below
+ * a microsecond, so that replies can be matched even when several names
+ * resolve to the same address.
+ */
+void NetworkTime::transmit(int server) {
+    ntp_request_t *request = &requests[server];
+    uint8_t *msg;
+    struct pbuf *p;
+    int64_t utc_us;
+
+    p = TxPbufs::getInstance().alloc(NTP_PACKET_LEN);
+    if(p == NULL) {
+        return;
+    }
+    msg = (uint8_t *)p->payload;
+    memset(msg, 0, NTP_PACKET_LEN);
+    msg[0] = (NTP_VERSION << 3) | NTP_MODE_CLIENT;
+
+    request->local_us = time_us_64();
+    utc_us = clock.to_utc_us(request->local_us);
+    put_be32(&msg[40], (uint32_t)(utc_us / 1000000) - NTP_DIFF_SEC_1970_2036);
+    put_be32(&msg[44], (uint32_t)(((uint64_t)(utc_us % 1000000) << 32) / 1000000) ^ (uint32_t)server);
+    memcpy(request->transmit, &msg[40], sizeof(request->transmit));
+    request->pending = true;
+
+    udp_sendto(ntp_pcb, p, &request->addr, NTP_PORT);
+    pbuf_free(p);
+}
+
+
+/***
+ * Runs on the tcpip thread. The local timer is read before anything else, so
+ * the receive timestamp is as close to the packet's arrival as lwIP lets us
+ * get without going into the driver.
+ */
+void NetworkTime::ntp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    uint64_t local_us = time_us_64();
+    NetworkTime *time = (NetworkTime *)arg;
+
+    time->handle_reply(p, addr, local_us);
+    pbuf_free(p);
+}
+
+
+/***
+ * Checks the reply is a sane answer to one of our outstanding requests and
+ * turns it into a sample: the usual NTP offset and delay, measured against
+ * our clock as it is right now, for both ends of the exchange.
+ */
+void NetworkTime::handle_reply(struct pbuf *p, const ip_addr_t *addr, uint64_t local_us) {
+    uint8_t msg[NTP_PACKET_LEN];
+    ntp_request_t *request = NULL;
+    int server;
+    int64_t t1, t2, t3, t4;
+    int64_t delay_us;
+
+    if(p->tot_len < NTP_PACKET_LEN) {
+        return;
+    }
+    pbuf_copy_partial(p, msg, NTP_PACKET_LEN, 0);
+
+    // A server that isn't synchronized itself (alarm, or stratum 0, which is a
+    // kiss-o'-death) has nothing to tell us
+    if((msg[0] & 0x07) != NTP_MODE_SERVER || (msg[0] >> 6) == NTP_LI_ALARM || msg[1] == 0 || msg[1] > 15) {
+        return;
+    }
+
+    for(server = 0; server < NTP_MAX_SERVERS; server++) {
+        if(requests[server].pending && memcmp(&msg[24], requests[server].transmit, 8) == 0 &&
+           ip_addr_cmp(addr, &requests[server].addr)) {
+            request = &requests[server];
+            break;
+        }
+    }
+    if(request == NULL) {
+        return;
+    }
+    request->pending = false;
 
-    printf("NTP SYNC RUNNING; EXITING NTP TASK\n");
+    t1 = clock.to_utc_us(request->local_us);
+    t2 = ntp_to_unix_us(get_be32(&msg[32]), get_be32(&msg[36]));
+    t3 = ntp_to_unix_us(get_be32(&msg[40]), get_be32(&msg[44]));
+    t4 = clock.to_utc_us(local_us);
 
-    vTaskDelete(NULL);
+    delay_us = (t4 - t1) - (t3 - t2);
+    selector.add_sample(server, local_us, t4 + ((t2 - t1) + (t3 - t4)) / 2, delay_us < 0 ? 0 : (uint32_t)delay_us);
 }
@@ -6,9 +6,19 @@
 #include "pico/stdlib.h"
 #include "FreeRTOSConfig.h"
 #include "FreeRTOS.h"
-#include "event_groups.h"
-#include "wifi.h"
+#include "event_loop.h"
+#include "disciplined_clock.h"
+#include "ntp_selector.h"
+#include "lwip/udp.h"
 
+// How long a multi-server round waits for replies before it selects
+#define NTP_COLLECT_MS            1000
+
+typedef enum {
+    NTP_SYNC_SNTP,              // lwIP's SNTP client: one server at a time
+    NTP_SYNC_MULTI_SERVER,      // every server each round, through NtpSelector
+    NTP_SYNC_OFF                // the clock is steered by something else (a LAN time master)
+} ntp_sync_mode_t;
 
 class NetworkTime {
     public:
@@ -17,33 +27,83 @@ class NetworkTime {
         void sntp_add_server(const char *server);
         void sntp_start_sync();
         void set_time_in_seconds(uint32_t sec);
-        static void time_task(void *params);
+        void set_time_ntp(int32_t sec, uint32_t frac);
+        void get_time_us(uint32_t *sec, uint32_t *us);
+
+        uint64_t now_us() { return (uint64_t)clock.to_utc_us(time_us_64()); };
+        bool is_synchronized() { return clock.is_synchronized(); };
+        uint32_t get_poll_interval_ms() { return clock.get_poll_interval_ms(); };
+        const clock_stats_t *get_clock_stats() { return clock.get_stats(); };
+        DisciplinedClock *get_clock() { return &clock; };
 
         static NetworkTime& getInstance() {
             static NetworkTime instance;
-            
-            instance.sntp_server_count = 0;
-            instance.sntp_timezone_minutes_offset = 0;
-            instance.time_task_handle = (TaskHandle_t)0;
-            instance.sntp_add_server("0.us.pool.ntp.org");
-            instance.sntp_add_server("1.us.pool.ntp.org");
-            instance.sntp_add_server("2.us.pool.ntp.org");
-            instance.sntp_add_server("3.us.pool.ntp.org");
-            instance.wifi = NULL;
-            instance.aon_is_running = false;
-
             return instance;
         }
 
-        void set_wifi_connection(WifiConnection *wifi) { this->wifi = wifi; };
+        void set_event_loop(EventLoop *loop) { this->loop = loop; };
+        // NtpSelector keeps its own quickest-round-trip filter per server, so
+        // multi-server rounds don't burst: one round per poll is enough traffic
+        void set_sync_mode(ntp_sync_mode_t mode) {
+            sync_mode = mode;
+            clock.set_burst_length(mode == NTP_SYNC_MULTI_SERVER ? 1 : CLOCK_BURST_LENGTH);
+        };
+
+        const ntp_selection_stats_t *get_selection_stats() { return selector.get_stats(); };
+        const ntp_server_stats_t *get_server_stats(int server) { return selector.get_server_stats(server); };
 
     private:
-        NetworkTime() {};
-        TaskHandle_t time_task_handle;
+        NetworkTime() {
+            sntp_server_count = 0;
+            memset(server_names, 0, sizeof(server_names));
+            sntp_timezone_minutes_offset = 0;
+            loop = NULL;
+            sntp_add_server("0.us.pool.ntp.org");
+            sntp_add_server("1.us.pool.ntp.org");
+            sntp_add_server("2.us.pool.ntp.org");
+            sntp_add_server("3.us.pool.ntp.org");
+            aon_is_running = false;
+            request_local_us = 0;
+            reply_local_us = 0;
+            sync_mode = NTP_SYNC_SNTP;
+            ntp_pcb = NULL;
+            round_timer = EVENT_TIMER_NONE;
+            memset(requests, 0, sizeof(requests));
+        };
+
+        typedef struct {
+            ip_addr_t addr;
+            uint64_t local_us;          // local timer when the request went out
+            uint8_t transmit[8];        // its transmit timestamp, which the reply has to echo
+            bool pending;
+        } ntp_request_t;
+
+        void apply_sample(uint64_t local_us, int64_t reference_us, uint32_t delay_us);
+        void set_aon_timer(uint64_t utc_us);
+        void start_multi_server_sync();
+        void send_request(int server);
+        void transmit(int server);
+        void handle_reply(struct pbuf *p, const ip_addr_t *addr, uint64_t local_us);
+        static void wifi_joined(void *arg, bool met);
+        static void start_round(void *arg);
+        static void finish_round(void *arg);
+        static void resumed(void *arg, bool met);
+        static void dns_found(const char *name, const ip_addr_t *addr, void *arg);
+        static void ntp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+
+        EventLoop *loop;
+        event_timer_t round_timer;
+        const char *server_names[NTP_MAX_SERVERS];
         int sntp_server_count;
         int32_t sntp_timezone_minutes_offset;
-        WifiConnection *wifi;
         bool aon_is_running;
+        DisciplinedClock clock;
+        uint64_t request_local_us;
+        uint64_t reply_local_us;
+        ntp_sync_mode_t sync_mode;
+        NtpSelector selector;
+        ntp_request_t requests[NTP_MAX_SERVERS];
+        struct udp_pcb *ntp_pcb;
 };
 
 #endif
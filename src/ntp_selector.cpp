@@ -0,0 +1,201 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ntp_selector.h"
+
+
+static int32_t clamp_us(int64_t us) {
+    return (int32_t)(us > INT32_MAX ? INT32_MAX : (us < INT32_MIN ? INT32_MIN : us));
+}
+
+
+void NtpSelector::reset() {
+    memset(servers, 0, sizeof(servers));
+    memset(&stats, 0, sizeof(stats));
+    last_used_local_us = 0;
+}
+
+
+/***
+ * Records one reply from a server: reference_us is the server's time at the
+ * moment the local timer read local_us, with the round trip compensated.
+ */
+void NtpSelector::add_sample(int server, uint64_t local_us, int64_t reference_us, uint32_t delay_us) {
+    ntp_server_t *s;
+
+    if(server < 0 || server >= NTP_MAX_SERVERS) {
+        return;
+    }
+
+    s = &servers[server];
+    s->samples[s->next].local_us = local_us;
+    s->samples[s->next].reference_us = reference_us;
+    s->samples[s->next].delay_us = delay_us;
+    s->next = (s->next + 1) % NTP_FILTER_LENGTH;
+    if(s->count < NTP_FILTER_LENGTH) {
+        s->count++;
+    }
+    s->stats.samples++;
+}
+
+
+/***
+ * Runs the selection over every server's samples and, if a majority of them
+ * agree, comes back with the time at local_us they agree on, as a sample for
+ * the clock discipline, and the round trip of the quickest survivor.
+ *
+ * Returns false if there's no majority, or if nothing has come in since the
+ * last selection that the clock hasn't already been given.
+ */
+bool NtpSelector::select(DisciplinedClock *clock, uint64_t local_us, int64_t *reference_us, uint32_t *delay_us) {
+    ntp_endpoint_t endpoints[2 * NTP_MAX_SERVERS];
+    const ntp_sample_t *best[NTP_MAX_SERVERS];
+    int64_t offset[NTP_MAX_SERVERS];
+    uint32_t distance[NTP_MAX_SERVERS];
+    bool valid[NTP_MAX_SERVERS];
+    int candidates = 0;
+    int count = 0, most = 0;
+    int64_t low = 0, high = 0;
+    double sum = 0.0, sum_weights = 0.0;
+    uint64_t newest_us = 0;
+    uint32_t min_delay = UINT32_MAX;
+    int survivors = 0;
+
+    stats.rounds++;
+
+    for(int i = 0; i < NTP_MAX_SERVERS; i++) {
+        valid[i] = filter(&servers[i], clock, local_us, &best[i], &offset[i], &distance[i]);
+        if(valid[i]) {
+            endpoints[2 * candidates].value = offset[i] - distance[i];
+            endpoints[2 * candidates].type = -1;
+            endpoints[2 * candidates + 1].value = offset[i] + distance[i];
+            endpoints[2 * candidates + 1].type = 1;
+            candidates++;
+        }
+    }
+
+    if(candidates == 0) {
+        return false;
+    }
+
+    // Sort the interval ends, low ends first where they tie, so intervals that
+    // just touch count as overlapping
+    for(int i = 1; i < 2 * candidates; i++) {
+        ntp_endpoint_t e = endpoints[i];
+        int j = i - 1;
+        while(j >= 0 && (endpoints[j].value > e.value ||
+                         (endpoints[j].value == e.value && endpoints[j].type > e.type))) {
+            endpoints[j + 1] = endpoints[j];
+            j--;
+        }
+        endpoints[j + 1] = e;
+    }
+
+    // Marzullo: sweep along counting open intervals, and keep the stretch
+    // where the most of them are open at once
+    for(int i = 0; i < 2 * candidates; i++) {
+        if(endpoints[i].type < 0) {
+            count++;
+            if(count > most) {
+                most = count;
+                low = endpoints[i].value;
+                high = endpoints[i + 1].value;
+            }
+        }
+        else {
+            count--;
+        }
+    }
+
+    if(most * 2 <= candidates) {
+        stats.no_majority++;
+        return false;
+    }
+
+    for(int i = 0; i < NTP_MAX_SERVERS; i++) {
+        if(!valid[i]) {
+            continue;
+        }
+        if(offset[i] - (int64_t)distance[i] > high || offset[i] + (int64_t)distance[i] < low) {
+            servers[i].stats.falseticks++;
+            continue;
+        }
+
+        servers[i].stats.selected++;
+        survivors++;
+        sum += (double)offset[i] / distance[i];
+        sum_weights += 1.0 / distance[i];
+        newest_us = best[i]->local_us > newest_us ? best[i]->local_us : newest_us;
+        min_delay = best[i]->delay_us < min_delay ? best[i]->delay_us : min_delay;
+    }
+
+    if(newest_us <= last_used_local_us) {
+        stats.stale++;
+        return false;
+    }
+    last_used_local_us = newest_us;
+
+    stats.selections++;
+    stats.survivors = survivors;
+    stats.offset_us = clamp_us((int64_t)(sum / sum_weights));
+
+    *reference_us = clock->to_utc_us(local_us) + (int64_t)(sum / sum_weights);
+    *delay_us = min_delay;
+    return true;
+}
+
+
+/***
+ * The clock filter for one server: of its samples young enough to still
+ * count, the one with the least distance (half the round trip, plus what it
+ * has lost with age), its offset from our clock, and the distance, with the
+ * server's jitter added, that bounds how wrong that offset can be.
+ */
+bool NtpSelector::filter(ntp_server_t *server, DisciplinedClock *clock, uint64_t local_us,
+                         const ntp_sample_t **best, int64_t *offset_us, uint32_t *distance_us) {
+    const ntp_sample_t *chosen = NULL;
+    double squares = 0.0;
+    int fresh = 0;
+    uint64_t distance, best_distance = 0;
+
+    for(int i = 0; i < server->count; i++) {
+        const ntp_sample_t *s = &server->samples[i];
+        uint64_t age = local_us - s->local_us;
+        if(age > NTP_SAMPLE_MAX_AGE_US) {
+            continue;
+        }
+        distance = s->delay_us / 2 + age * NTP_DISPERSION_PPM / 1000000;
+        if(chosen == NULL || distance < best_distance) {
+            chosen = s;
+            best_distance = distance;
+        }
+    }
+
+    if(chosen == NULL) {
+        return false;
+    }
+
+    *offset_us = chosen->reference_us - clock->to_utc_us(chosen->local_us);
+    for(int i = 0; i < server->count; i++) {
+        const ntp_sample_t *s = &server->samples[i];
+        if(local_us - s->local_us > NTP_SAMPLE_MAX_AGE_US) {
+            continue;
+        }
+        double d = (double)(s->reference_us - clock->to_utc_us(s->local_us) - *offset_us);
+        squares += d * d;
+        fresh++;
+    }
+
+    server->stats.jitter_us = (uint32_t)sqrt(squares / fresh);
+    distance = chosen->delay_us / 2 + server->stats.jitter_us
+               + (local_us - chosen->local_us) * NTP_DISPERSION_PPM / 1000000;
+    *distance_us = distance < NTP_MIN_DISTANCE_US ? NTP_MIN_DISTANCE_US :
+                   (distance > UINT32_MAX ? UINT32_MAX : (uint32_t)distance);
+    *best = chosen;
+
+    server->stats.offset_us = clamp_us(*offset_us);
+    server->stats.delay_us = chosen->delay_us;
+    server->stats.distance_us = *distance_us;
+    return true;
+}
@@ -0,0 +1,98 @@
+#ifndef __NTP_SELECTOR_H__
+#define __NTP_SELECTOR_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "disciplined_clock.h"
+
+#define NTP_MAX_SERVERS             4
+
+// Samples kept per server; the one with the quickest round trip, allowing
+// for age, stands for it
+#define NTP_FILTER_LENGTH           8
+
+// Samples older than this are forgotten
+#define NTP_SAMPLE_MAX_AGE_US       (2ULL * 3600 * 1000000)
+
+// Error bounds: how fast we assume a sample's worth decays with age (NTP's
+// PHI), and a floor for servers that look too good to be true
+#define NTP_DISPERSION_PPM          15
+#define NTP_MIN_DISTANCE_US         500
+
+
+typedef struct {
+    uint64_t local_us;          // local timer when the reply came in
+    int64_t reference_us;       // server time at that moment, round trip compensated
+    uint32_t delay_us;
+} ntp_sample_t;
+
+
+typedef struct {
+    uint32_t samples;
+    uint32_t selected;          // rounds it was a truechimer in
+    uint32_t falseticks;        // rounds it was voted out in
+    int32_t offset_us;          // from our clock, at the last selection
+    uint32_t delay_us;
+    uint32_t jitter_us;
+    uint32_t distance_us;       // half the width of its correctness interval
+} ntp_server_stats_t;
+
+
+typedef struct {
+    uint32_t rounds;
+    uint32_t selections;
+    uint32_t no_majority;
+    uint32_t stale;             // rounds with nothing newer than what the clock already has
+    uint32_t survivors;         // in the last selection
+    int32_t offset_us;          // combined, at the last selection
+} ntp_selection_stats_t;
+
+
+/**
+ * Picks the time out of several NTP servers' answers the way ntpd does, in
+ * miniature. Each server's recent samples go through a clock filter that
+ * keeps the one with the quickest round trip (allowing for age), since the
+ * extra time in a slow one went one way or the other and that's exactly the
+ * error in its offset. The filtered offset, give or take a distance built
+ * from the round trip, the server's jitter and the sample's age, is the
+ * server's correctness interval. Marzullo's algorithm finds the range most of the intervals agree
+ * on; servers that don't overlap it are falsetickers and are dropped, and the
+ * rest are averaged, weighted by how tight their intervals are.
+ *
+ * Offsets are measured against the clock being disciplined as it is now, so
+ * samples from different rounds stay comparable while the clock slews.
+ */
+class NtpSelector {
+    public:
+        NtpSelector() { reset(); };
+
+        void reset();
+        void add_sample(int server, uint64_t local_us, int64_t reference_us, uint32_t delay_us);
+        bool select(DisciplinedClock *clock, uint64_t local_us, int64_t *reference_us, uint32_t *delay_us);
+
+        const ntp_selection_stats_t *get_stats() { return &stats; };
+        const ntp_server_stats_t *get_server_stats(int server) { return &servers[server].stats; };
+
+    private:
+        typedef struct {
+            ntp_sample_t samples[NTP_FILTER_LENGTH];
+            int count;
+            int next;
+            ntp_server_stats_t stats;
+        } ntp_server_t;
+
+        typedef struct {
+            int64_t value;
+            int type;                   // -1 for the low end of an interval, +1 for the high end
+        } ntp_endpoint_t;
+
+        bool filter(ntp_server_t *server, DisciplinedClock *clock, uint64_t local_us,
+                    const ntp_sample_t **best, int64_t *offset_us, uint32_t *distance_us);
+
+        ntp_server_t servers[NTP_MAX_SERVERS];
+        uint64_t last_used_local_us;
+        ntp_selection_stats_t stats;
+};
+
+#endif
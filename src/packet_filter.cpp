@@ -0,0 +1,175 @@
+#include "packet_filter.h"
+#include "pixel_receiver.h"
+#include "logger.h"
+
+#define ETH_HEADER_LEN              14
+#define ETH_TYPE_IPV4               0x0800
+#define IPV4_PROTO_IGMP             2
+#define IPV4_PROTO_UDP              17
+#define IPV4_FRAGMENT_OFFSET_MASK   0x1fff
+#define UDP_HEADER_LEN              8
+
+// Where the universe number is in an E1.31 data packet
+#define E131_UNIVERSE_OFFSET        113
+
+// E1.31 multicasts universe N to 239.255.N/256.N%256
+#define E131_GROUP(universe)        (0xefff0000 | (universe))
+
+
+static inline uint16_t get_be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+/***
+ * Swaps the netif's input function for ours, which hands whatever it accepts
+ * on to the one that was there. The CYW43 driver frees a packet the input
+ * function fails on, so ours frees the ones it drops itself and says ERR_OK.
+ */
+void PacketFilter::install(struct netif *netif) {
+    if(netif->input == filter_input) {
+        return;
+    }
+    next_input = netif->input;
+    netif->input = filter_input;
+    LOG_INFO("PACKET FILTER INSTALLED: %d PORTS, %d GROUPS, E1.31 UNIVERSES %u-%u", port_count, group_count,
+             e131_first, e131_first + e131_count - 1);
+}
+
+
+bool PacketFilter::allow_port(uint16_t port) {
+    for(int i = 0; i < port_count; i++) {
+        if(ports[i] == port) {
+            return true;
+        }
+    }
+    if(port_count == PACKET_FILTER_MAX_PORTS) {
+        return false;
+    }
+    ports[port_count++] = port;
+    return true;
+}
+
+
+bool PacketFilter::allow_group(const ip4_addr_t *group) {
+    if(group_count == PACKET_FILTER_MAX_GROUPS) {
+        return false;
+    }
+    groups[group_count++] = lwip_ntohl(ip4_addr_get_u32(group));
+    return true;
+}
+
+
+void PacketFilter::set_e131_universes(uint16_t first, uint16_t count) {
+    e131_first = first;
+    e131_count = count;
+}
+
+
+/***
+ * The rules, without the counting of what passes. Only looks at the headers,
+ * and only in the first pbuf.
+ */
+bool PacketFilter::accept(const struct pbuf *p, const struct netif *netif) {
+    const uint8_t *packet = (const uint8_t *)p->payload;
+    uint32_t len = p->len;
+    uint32_t header_len, destination;
+    uint16_t port;
+    bool multicast;
+    int i;
+
+    // The CYW43 netif takes Ethernet frames; the host build's takes IP
+    if(netif->flags & NETIF_FLAG_ETHARP) {
+        if(len < ETH_HEADER_LEN || get_be16(&packet[12]) != ETH_TYPE_IPV4) {
+            return true;
+        }
+        packet += ETH_HEADER_LEN;
+        len -= ETH_HEADER_LEN;
+    }
+    if(len < 20 || (packet[0] >> 4) != 4) {
+        return true;
+    }
+
+    destination = get_be32(&packet[16]);
+    multicast = (destination & 0xf0000000) == 0xe0000000;
+    if(!multicast && destination != 0xffffffff) {
+        ip4_addr_t address;
+        ip4_addr_set_u32(&address, lwip_htonl(destination));
+        if(!ip4_addr_isbroadcast(&address, netif)) {
+            return true;
+        }
+    }
+
+    if(packet[9] == IPV4_PROTO_IGMP) {
+        return true;
+    }
+    if(packet[9] != IPV4_PROTO_UDP) {
+        stats.dropped_protocol++;
+        return false;
+    }
+
+    // Later fragments have no UDP header to go by
+    header_len = (packet[0] & 0x0f) * 4;
+    if((get_be16(&packet[6]) & IPV4_FRAGMENT_OFFSET_MASK) != 0 || len < header_len + UDP_HEADER_LEN) {
+        return true;
+    }
+
+    port = get_be16(&packet[header_len + 2]);
+    for(i = 0; i < port_count && ports[i] != port; i++);
+    if(i == port_count) {
+        stats.dropped_port++;
+        return false;
+    }
+
+    if(multicast) {
+        bool joined = e131_count > 0 && destination >= E131_GROUP(e131_first) &&
+                      destination < E131_GROUP(e131_first) + e131_count;
+        for(i = 0; !joined && i < group_count; i++) {
+            joined = groups[i] == destination;
+        }
+        if(!joined) {
+            stats.dropped_group++;
+            return false;
+        }
+    }
+
+    if(port == E131_PORT && e131_count > 0 &&
+       len >= header_len + UDP_HEADER_LEN + E131_UNIVERSE_OFFSET + 2) {
+        uint16_t universe = get_be16(&packet[header_len + UDP_HEADER_LEN + E131_UNIVERSE_OFFSET]);
+        if((uint16_t)(universe - e131_first) >= e131_count) {
+            stats.dropped_universe++;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/***
+ * The netif input function. A failure from the one after us is almost always
+ * the tcpip mailbox being full.
+ */
+err_t PacketFilter::filter_input(struct pbuf *p, struct netif *netif) {
+    PacketFilter& filter = getInstance();
+    err_t err;
+
+    if(!filter.accept(p, netif)) {
+        pbuf_free(p);
+        return ERR_OK;
+    }
+
+    err = filter.next_input(p, netif);
+    if(err != ERR_OK) {
+        filter.stats.mailbox_overflows++;
+    }
+    else {
+        filter.stats.accepted++;
+    }
+    return err;
+}
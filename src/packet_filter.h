@@ -0,0 +1,86 @@
+#ifndef __PACKET_FILTER_H__
+#define __PACKET_FILTER_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+extern "C" {
+    #include "lwip/netif.h"
+    #include "lwip/pbuf.h"
+}
+
+// Broadcast and multicast UDP ports let through, and extra multicast groups
+#define PACKET_FILTER_MAX_PORTS     8
+#define PACKET_FILTER_MAX_GROUPS    4
+
+
+typedef struct {
+    uint32_t accepted;          // handed to the tcpip thread
+    uint32_t dropped_port;      // broadcast or multicast to a port nobody listens for
+    uint32_t dropped_group;     // multicast to a group we haven't joined
+    uint32_t dropped_universe;  // E1.31 for a universe this strip doesn't show
+    uint32_t dropped_protocol;  // broadcast or multicast that isn't UDP or IGMP
+    uint32_t mailbox_overflows; // accepted, and then turned away by a full TCPIP_MBOX
+} packet_filter_stats_t;
+
+
+/**
+ * Sits in front of the netif's input function, in the CYW43 driver's
+ * context, and throws away broadcast and multicast traffic this node has no
+ * use for before it takes a place in the tcpip thread's mailbox. Under an
+ * sACN multicast storm the mailbox (TCPIP_MBOX_SIZE) fills with universes
+ * for other controllers, and the ones for us get dropped with the rest.
+ *
+ * Unicast, and anything that isn't IPv4 (ARP, mostly), always goes through;
+ * it's for us, and lwIP needs it. So does IGMP, to answer queries. Broadcast
+ * and multicast UDP goes through only to an allowed port, multicast only to
+ * a group in the list or the E1.31 group of a universe in range, and E1.31
+ * only for a universe in range, wherever it's addressed.
+ *
+ * The filter only reads the first pbuf; a packet whose headers don't fit in
+ * it goes through. Set the rules up before install(): the filter reads them
+ * from the driver's context without a lock.
+ */
+class PacketFilter {
+    public:
+        void install(struct netif *netif);
+        bool allow_port(uint16_t port);
+        bool allow_group(const ip4_addr_t *group);
+        void set_e131_universes(uint16_t first, uint16_t count);
+
+        bool accept(const struct pbuf *p, const struct netif *netif);
+
+        const packet_filter_stats_t *get_stats() { return &stats; };
+        void reset_stats() { memset(&stats, 0, sizeof(stats)); };
+
+        static err_t filter_input(struct pbuf *p, struct netif *netif);
+
+        static PacketFilter& getInstance() {
+            static PacketFilter instance;
+            return instance;
+        }
+
+    private:
+        PacketFilter() {
+            next_input = NULL;
+            port_count = 0;
+            group_count = 0;
+            e131_first = 0;
+            e131_count = 0;
+            memset(ports, 0, sizeof(ports));
+            memset(groups, 0, sizeof(groups));
+            reset_stats();
+        };
+
+        netif_input_fn next_input;
+        uint16_t ports[PACKET_FILTER_MAX_PORTS];
+        int port_count;
+        uint32_t groups[PACKET_FILTER_MAX_GROUPS];
+        int group_count;
+        uint16_t e131_first;
+        uint16_t e131_count;
+        packet_filter_stats_t stats;
+};
+
+#endif
@@ -0,0 +1,444 @@
+#include <string.h>
+#include <math.h>
+#include "pixel_kernels.h"
+
+#if PIXEL_KERNELS_SIMD
+#include <arm_acle.h>
+#endif
+
+// The SIMD kernels are built for the RP2350, and for the host build, where
+// C stand-ins for the instructions let the bench check them
+#if PIXEL_KERNELS_SIMD || !defined(PICO_ON_DEVICE) || !PICO_ON_DEVICE
+#define PIXEL_KERNELS_BUILD_SIMD    1
+#else
+#define PIXEL_KERNELS_BUILD_SIMD    0
+#endif
+
+// Which received channel (0 red, 1 green, 2 blue, 3 white) goes out in each
+// position, for each order
+static constexpr uint8_t order_map[PIXEL_ORDER_COUNT][4] = {
+    { 0, 1, 2, 3 },     // RGB
+    { 0, 2, 1, 3 },     // RBG
+    { 1, 0, 2, 3 },     // GRB
+    { 1, 2, 0, 3 },     // GBR
+    { 2, 0, 1, 3 },     // BRG
+    { 2, 1, 0, 3 },     // BGR
+    { 0, 1, 2, 3 },     // RGBW
+    { 1, 0, 2, 3 },     // GRBW
+};
+
+static constexpr uint8_t order_channels[PIXEL_ORDER_COUNT] = { 3, 3, 3, 3, 3, 3, 4, 4 };
+
+// Added to a level's fraction before it's truncated. They average 128, which
+// is what rounding without dithering adds, and are in bit-reversed order so
+// that neighbouring pixels and consecutive frames are far apart.
+static const uint8_t dither_offsets[PIXEL_DITHER_FRAMES] = { 16, 144, 80, 208, 48, 176, 112, 240 };
+
+#define ROUNDING_OFFSET             128
+
+
+int pixel_order_channels(uint8_t order) {
+    return order < PIXEL_ORDER_COUNT ? order_channels[order] : STRIP_BYTES_PER_PIXEL;
+}
+
+
+/***
+ * The output level for one 8-bit channel value in 8.8 fixed point, so 255.0
+ * is 0xff00 and there's room to add any offset below 256 without carrying out
+ * of the halfword.
+ */
+uint16_t pixel_level(uint8_t value, uint8_t gamma, uint8_t brightness) {
+    float x = value / 255.0f;
+
+    if(brightness == 0) {
+        brightness = 255;
+    }
+    if(gamma != 0 && gamma != 10) {
+        x = powf(x, gamma / 10.0f);
+    }
+    return (uint16_t)(x * brightness * 256.0f + 0.5f);
+}
+
+
+/***
+ * One pixel at a time and one channel at a time, computing every level as it
+ * goes. Slow, and obviously right. With a remap, pixel i is read from byte
+ * remap[i] of src.
+ */
+void pixel_reference(uint8_t *dst, const uint8_t *src, uint32_t count, const pixel_format_t *format,
+                     uint32_t frame, const uint16_t *remap) {
+    uint8_t order = format->order < PIXEL_ORDER_COUNT ? format->order : PIXEL_ORDER_RGB;
+    int channels = order_channels[order];
+
+    for(uint32_t i = 0; i < count; i++) {
+        const uint8_t *p = remap != NULL ? &src[remap[i]] : &src[i * STRIP_BYTES_PER_PIXEL];
+        uint8_t c[4] = { p[0], p[1], p[2], 0 };
+        uint32_t offset = format->dither ? dither_offsets[(frame + i) % PIXEL_DITHER_FRAMES] : ROUNDING_OFFSET;
+
+        if(channels == 4) {
+            uint8_t white = c[0] < c[1] ? c[0] : c[1];
+            white = c[2] < white ? c[2] : white;
+            c[0] -= white;
+            c[1] -= white;
+            c[2] -= white;
+            c[3] = white;
+        }
+        for(int k = 0; k < channels; k++) {
+            dst[k] = (uint8_t)((pixel_level(c[order_map[order][k]], format->gamma, format->brightness) + offset) >> 8);
+        }
+
+        dst += channels;
+    }
+}
+
+
+#if PIXEL_KERNELS_SIMD
+// USUB8 sets the GE flag for each byte where a >= b, and SEL picks b there
+static inline uint32_t simd_min8(uint32_t a, uint32_t b) {
+    __usub8(a, b);
+    return __sel(b, a);
+}
+
+static inline uint32_t simd_sub8(uint32_t a, uint32_t b) {
+    return __usub8(a, b);
+}
+
+// The high byte of each halfword, into the low byte
+static inline uint32_t simd_high8x2(uint32_t a) {
+    return __uxtb16((a >> 8) | (a << 24));
+}
+#else
+static inline uint32_t simd_min8(uint32_t a, uint32_t b) {
+    uint32_t result = 0;
+    for(int shift = 0; shift < 32; shift += 8) {
+        uint32_t x = (a >> shift) & 0xff, y = (b >> shift) & 0xff;
+        result |= (x < y ? x : y) << shift;
+    }
+    return result;
+}
+
+static inline uint32_t simd_sub8(uint32_t a, uint32_t b) {
+    uint32_t result = 0;
+    for(int shift = 0; shift < 32; shift += 8) {
+        result |= (((a >> shift) - (b >> shift)) & 0xff) << shift;
+    }
+    return result;
+}
+
+static inline uint32_t simd_high8x2(uint32_t a) {
+    return (a >> 8) & 0x00ff00ff;
+}
+#endif
+
+
+/***
+ * One pixel, packed as red | green << 8 | blue << 16, to its output bytes
+ * packed the same way, first byte lowest. Everything that depends on ORDER is
+ * settled at compile time.
+ */
+template<int ORDER, bool DITHER, bool SIMD>
+static inline uint32_t convert_pixel(uint32_t pixel, const uint16_t *levels, const uint8_t *levels8,
+                                     uint32_t offset) {
+    constexpr int channels = order_channels[ORDER];
+    uint32_t c[4];
+
+    if(channels == 4) {
+        if(SIMD) {
+            // The white level is the least of the three bytes, taken from
+            // all of them at once
+            uint32_t white = simd_min8(simd_min8(pixel, pixel >> 8), pixel >> 16) & 0xff;
+            pixel = simd_sub8(pixel, white * 0x010101);
+            c[3] = white;
+        }
+        else {
+            uint32_t r = pixel & 0xff, g = (pixel >> 8) & 0xff, b = pixel >> 16;
+            uint32_t white = r < g ? r : g;
+            white = b < white ? b : white;
+            pixel -= white * 0x010101;
+            c[3] = white;
+        }
+    }
+    else {
+        c[3] = 0;
+    }
+    c[0] = pixel & 0xff;
+    c[1] = (pixel >> 8) & 0xff;
+    c[2] = (pixel >> 16) & 0xff;
+
+    uint32_t s0 = c[order_map[ORDER][0]];
+    uint32_t s1 = c[order_map[ORDER][1]];
+    uint32_t s2 = c[order_map[ORDER][2]];
+    uint32_t s3 = c[order_map[ORDER][3]];
+
+    if(!DITHER) {
+        uint32_t out = levels8[s0] | (levels8[s1] << 8) | (levels8[s2] << 16);
+        if(channels == 4) {
+            out |= (uint32_t)levels8[s3] << 24;
+        }
+        return out;
+    }
+    if(SIMD) {
+        // Two levels to a word, first and third bytes in one and second and
+        // fourth in the other, so the high bytes interleave straight into
+        // place. A level plus its offset never carries out of its halfword.
+        uint32_t offsets = offset * 0x00010001;
+        uint32_t even = (levels[s0] | ((uint32_t)levels[s2] << 16)) + offsets;
+        uint32_t odd = (levels[s1] | (channels == 4 ? (uint32_t)levels[s3] << 16 : 0)) + offsets;
+        uint32_t out = simd_high8x2(even) | (simd_high8x2(odd) << 8);
+        return channels == 4 ? out : out & 0xffffff;
+    }
+    uint32_t out = ((levels[s0] + offset) >> 8) | (((levels[s1] + offset) >> 8) << 8) |
+                   (((levels[s2] + offset) >> 8) << 16);
+    if(channels == 4) {
+        out |= ((levels[s3] + offset) >> 8) << 24;
+    }
+    return out;
+}
+
+
+/***
+ * Four pixels at a time while both buffers are word aligned: three word loads
+ * in, and three or four word stores out, instead of a byte each. The rest,
+ * and everything when they aren't aligned, goes a pixel at a time.
+ */
+template<int ORDER, bool DITHER, bool SIMD>
+static void convert(uint8_t *dst, const uint8_t *src, uint32_t count, const uint16_t *levels,
+                    const uint8_t *levels8, uint32_t phase) {
+    constexpr int channels = order_channels[ORDER];
+    uint32_t i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if((((uintptr_t)src | (uintptr_t)dst) & 3) == 0) {
+        const uint32_t *s = (const uint32_t *)src;
+        uint32_t *d = (uint32_t *)dst;
+
+        for(; i + 4 <= count; i += 4) {
+            uint32_t w0 = s[0], w1 = s[1], w2 = s[2];
+            uint32_t o0 = convert_pixel<ORDER, DITHER, SIMD>(w0 & 0xffffff, levels, levels8,
+                                                             dither_offsets[(phase + i) % PIXEL_DITHER_FRAMES]);
+            uint32_t o1 = convert_pixel<ORDER, DITHER, SIMD>((w0 >> 24) | ((w1 & 0xffff) << 8), levels, levels8,
+                                                             dither_offsets[(phase + i + 1) % PIXEL_DITHER_FRAMES]);
+            uint32_t o2 = convert_pixel<ORDER, DITHER, SIMD>((w1 >> 16) | ((w2 & 0xff) << 16), levels, levels8,
+                                                             dither_offsets[(phase + i + 2) % PIXEL_DITHER_FRAMES]);
+            uint32_t o3 = convert_pixel<ORDER, DITHER, SIMD>(w2 >> 8, levels, levels8,
+                                                             dither_offsets[(phase + i + 3) % PIXEL_DITHER_FRAMES]);
+            s += 3;
+
+            if(channels == 4) {
+                d[0] = o0;
+                d[1] = o1;
+                d[2] = o2;
+                d[3] = o3;
+                d += 4;
+            }
+            else {
+                d[0] = o0 | (o1 << 24);
+                d[1] = (o1 >> 8) | (o2 << 16);
+                d[2] = (o2 >> 16) | (o3 << 8);
+                d += 3;
+            }
+        }
+        src += i * STRIP_BYTES_PER_PIXEL;
+        dst += i * channels;
+    }
+#endif
+
+    for(; i < count; i++) {
+        uint32_t pixel = src[0] | (src[1] << 8) | (src[2] << 16);
+        uint32_t out = convert_pixel<ORDER, DITHER, SIMD>(pixel, levels, levels8,
+                                                          dither_offsets[(phase + i) % PIXEL_DITHER_FRAMES]);
+        dst[0] = (uint8_t)out;
+        dst[1] = (uint8_t)(out >> 8);
+        dst[2] = (uint8_t)(out >> 16);
+        if(channels == 4) {
+            dst[3] = (uint8_t)(out >> 24);
+        }
+        src += STRIP_BYTES_PER_PIXEL;
+        dst += channels;
+    }
+}
+
+
+/***
+ * convert() reading its pixels through a remap table: pixel i comes from byte
+ * remap[i] of src, wherever that is, so there's no reading the source a word
+ * at a time. The table has already settled every question about the layout,
+ * so there's nothing to branch on per pixel. The output still goes a word at
+ * a time when it can.
+ */
+template<int ORDER, bool DITHER, bool SIMD>
+static void gather(uint8_t *dst, const uint8_t *src, const uint16_t *remap, uint32_t count,
+                   const uint16_t *levels, const uint8_t *levels8, uint32_t phase) {
+    constexpr int channels = order_channels[ORDER];
+    uint32_t i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if(((uintptr_t)dst & 3) == 0) {
+        uint32_t *d = (uint32_t *)dst;
+
+        for(; i + 4 <= count; i += 4) {
+            uint32_t o[4];
+
+            for(int k = 0; k < 4; k++) {
+                const uint8_t *p = &src[remap[i + k]];
+                o[k] = convert_pixel<ORDER, DITHER, SIMD>(p[0] | (p[1] << 8) | (p[2] << 16), levels, levels8,
+                                                          dither_offsets[(phase + i + k) % PIXEL_DITHER_FRAMES]);
+            }
+
+            if(channels == 4) {
+                d[0] = o[0];
+                d[1] = o[1];
+                d[2] = o[2];
+                d[3] = o[3];
+                d += 4;
+            }
+            else {
+                d[0] = o[0] | (o[1] << 24);
+                d[1] = (o[1] >> 8) | (o[2] << 16);
+                d[2] = (o[2] >> 16) | (o[3] << 8);
+                d += 3;
+            }
+        }
+        dst += i * channels;
+    }
+#endif
+
+    for(; i < count; i++) {
+        const uint8_t *p = &src[remap[i]];
+        uint32_t out = convert_pixel<ORDER, DITHER, SIMD>(p[0] | (p[1] << 8) | (p[2] << 16), levels, levels8,
+                                                          dither_offsets[(phase + i) % PIXEL_DITHER_FRAMES]);
+        dst[0] = (uint8_t)out;
+        dst[1] = (uint8_t)(out >> 8);
+        dst[2] = (uint8_t)(out >> 16);
+        if(channels == 4) {
+            dst[3] = (uint8_t)(out >> 24);
+        }
+        dst += channels;
+    }
+}
+
+
+#define ORDER_KERNELS(ORDER, SIMD)  { convert<ORDER, false, SIMD>, convert<ORDER, true, SIMD> }
+#define ORDER_GATHER_KERNELS(ORDER, SIMD)   { gather<ORDER, false, SIMD>, gather<ORDER, true, SIMD> }
+
+static const pixel_kernel_t word_kernels[PIXEL_ORDER_COUNT][2] = {
+    ORDER_KERNELS(PIXEL_ORDER_RGB, false),
+    ORDER_KERNELS(PIXEL_ORDER_RBG, false),
+    ORDER_KERNELS(PIXEL_ORDER_GRB, false),
+    ORDER_KERNELS(PIXEL_ORDER_GBR, false),
+    ORDER_KERNELS(PIXEL_ORDER_BRG, false),
+    ORDER_KERNELS(PIXEL_ORDER_BGR, false),
+    ORDER_KERNELS(PIXEL_ORDER_RGBW, false),
+    ORDER_KERNELS(PIXEL_ORDER_GRBW, false),
+};
+
+static const pixel_gather_kernel_t word_gather_kernels[PIXEL_ORDER_COUNT][2] = {
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_RGB, false),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_RBG, false),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_GRB, false),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_GBR, false),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_BRG, false),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_BGR, false),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_RGBW, false),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_GRBW, false),
+};
+
+#if PIXEL_KERNELS_BUILD_SIMD
+static const pixel_kernel_t simd_kernels[PIXEL_ORDER_COUNT][2] = {
+    ORDER_KERNELS(PIXEL_ORDER_RGB, true),
+    ORDER_KERNELS(PIXEL_ORDER_RBG, true),
+    ORDER_KERNELS(PIXEL_ORDER_GRB, true),
+    ORDER_KERNELS(PIXEL_ORDER_GBR, true),
+    ORDER_KERNELS(PIXEL_ORDER_BRG, true),
+    ORDER_KERNELS(PIXEL_ORDER_BGR, true),
+    ORDER_KERNELS(PIXEL_ORDER_RGBW, true),
+    ORDER_KERNELS(PIXEL_ORDER_GRBW, true),
+};
+
+static const pixel_gather_kernel_t simd_gather_kernels[PIXEL_ORDER_COUNT][2] = {
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_RGB, true),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_RBG, true),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_GRB, true),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_GBR, true),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_BRG, true),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_BGR, true),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_RGBW, true),
+    ORDER_GATHER_KERNELS(PIXEL_ORDER_GRBW, true),
+};
+#endif
+
+
+void PixelKernels::configure(const led_strip_config_t *config) {
+    pixel_format_t strip_format;
+
+    strip_format.order = config->color_order;
+    strip_format.brightness = config->brightness;
+    strip_format.gamma = config->gamma;
+    strip_format.dither = config->dither;
+    set_format(&strip_format);
+}
+
+
+/***
+ * Builds the level tables; that's 256 powf() calls with gamma on, which the
+ * M0+ does in software, so it isn't something to do per frame. Not safe to
+ * call while a frame is being processed.
+ */
+void PixelKernels::set_format(const pixel_format_t *format) {
+    this->format = *format;
+    if(this->format.order >= PIXEL_ORDER_COUNT) {
+        this->format.order = PIXEL_ORDER_RGB;
+    }
+    if(this->format.brightness == 0) {
+        this->format.brightness = 255;
+    }
+    if(this->format.gamma == 0) {
+        this->format.gamma = 10;
+    }
+
+    for(int value = 0; value < 256; value++) {
+        levels[value] = pixel_level((uint8_t)value, this->format.gamma, this->format.brightness);
+        levels8[value] = (uint8_t)((levels[value] + ROUNDING_OFFSET) >> 8);
+    }
+    select_kernel();
+}
+
+
+/***
+ * For the bench: the SIMD kernels instead of the plain word ones, or back.
+ * Only the RP2350 and the host have them.
+ */
+void PixelKernels::set_simd(bool simd) {
+    this->simd = simd && PIXEL_KERNELS_BUILD_SIMD;
+    select_kernel();
+}
+
+
+void PixelKernels::select_kernel() {
+#if PIXEL_KERNELS_BUILD_SIMD
+    if(simd) {
+        kernel = simd_kernels[format.order][format.dither ? 1 : 0];
+        gather_kernel = simd_gather_kernels[format.order][format.dither ? 1 : 0];
+        return;
+    }
+#endif
+    kernel = word_kernels[format.order][format.dither ? 1 : 0];
+    gather_kernel = word_gather_kernels[format.order][format.dither ? 1 : 0];
+}
+
+
+/***
+ * Converts count received pixels at src into get_channels() bytes each at
+ * dst, and moves the dithering on a frame. With a remap, the pixels are taken
+ * from src in the table's order rather than src's, and count is the table's
+ * length.
+ */
+void PixelKernels::process(uint8_t *dst, const uint8_t *src, uint32_t count, const uint16_t *remap) {
+    if(remap != NULL) {
+        gather_kernel(dst, src, remap, count, levels, levels8, frame);
+    }
+    else {
+        kernel(dst, src, count, levels, levels8, frame);
+    }
+    frame++;
+}
@@ -0,0 +1,113 @@
+#ifndef __PIXEL_KERNELS_H__
+#define __PIXEL_KERNELS_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "strip_config.h"
+
+// The Cortex-M33's DSP extension has byte and halfword SIMD; the M0+ doesn't
+#ifndef PIXEL_KERNELS_SIMD
+#if defined(__ARM_FEATURE_SIMD32) && __ARM_FEATURE_SIMD32
+#define PIXEL_KERNELS_SIMD      1
+#else
+#define PIXEL_KERNELS_SIMD      0
+#endif
+#endif
+
+// Frames in a temporal dithering cycle
+#define PIXEL_DITHER_FRAMES     8
+
+
+// The order the strip wants its channels in. The W orders add a white
+// channel, taken out of whatever the three colours have in common.
+typedef enum {
+    PIXEL_ORDER_RGB = 0,
+    PIXEL_ORDER_RBG,
+    PIXEL_ORDER_GRB,
+    PIXEL_ORDER_GBR,
+    PIXEL_ORDER_BRG,
+    PIXEL_ORDER_BGR,
+    PIXEL_ORDER_RGBW,
+    PIXEL_ORDER_GRBW,
+    PIXEL_ORDER_COUNT
+} pixel_order_t;
+
+typedef struct {
+    uint8_t order;              // a pixel_order_t
+    uint8_t brightness;         // 1-255; 0 is taken as 255
+    uint8_t gamma;              // in tenths; 0 is taken as 10 (linear)
+    bool dither;
+} pixel_format_t;
+
+typedef void (*pixel_kernel_t)(uint8_t *dst, const uint8_t *src, uint32_t count, const uint16_t *levels,
+                               const uint8_t *levels8, uint32_t phase);
+typedef void (*pixel_gather_kernel_t)(uint8_t *dst, const uint8_t *src, const uint16_t *remap, uint32_t count,
+                                      const uint16_t *levels, const uint8_t *levels8, uint32_t phase);
+
+
+int pixel_order_channels(uint8_t order);
+uint16_t pixel_level(uint8_t value, uint8_t gamma, uint8_t brightness);
+void pixel_reference(uint8_t *dst, const uint8_t *src, uint32_t count, const pixel_format_t *format,
+                     uint32_t frame, const uint16_t *remap = NULL);
+
+
+/**
+ * Turns received RGB frames into what the strip is sent: gamma corrected,
+ * scaled to the global brightness, in the strip's channel order, optionally
+ * with a white channel, and optionally dithered from frame to frame.
+ *
+ * Gamma and brightness are folded into one table of 256 levels in 8.8 fixed
+ * point, built when the format is set. Without dithering a level is rounded
+ * to 8 bits, so the table is 256 bytes and each channel costs one load.
+ * With dithering each pixel adds one of eight offsets to the fraction before
+ * truncating, in a different phase for each pixel and a different one each
+ * frame. Over eight frames a channel averages out to its level, fraction
+ * included, which gets back the low end that gamma correction squeezes
+ * together. That only works if frames keep coming, so it's for animations,
+ * not still pictures.
+ *
+ * The kernels are templates, one per channel order, dithered or not, so the
+ * order is resolved at compile time. They work a word at a time, four pixels
+ * per iteration, when both buffers are word aligned. On the RP2350 they use
+ * the DSP extension's byte and halfword SIMD instructions as well. Each has a
+ * gather twin that reads its pixels through a StripLayout remap table
+ * instead of in order, so the layout costs one halfword load per pixel on
+ * top of the conversion rather than a pass of its own.
+ * pixel_reference() is the same sums done byte by byte, the way they're
+ * written down, for checking the kernels against.
+ */
+class PixelKernels {
+    public:
+        void configure(const led_strip_config_t *config);
+        void set_format(const pixel_format_t *format);
+        void set_simd(bool simd);
+        const pixel_format_t *get_format() { return &format; };
+        int get_channels() { return pixel_order_channels(format.order); };
+
+        void process(uint8_t *dst, const uint8_t *src, uint32_t count, const uint16_t *remap = NULL);
+
+        static PixelKernels& getInstance() {
+            static PixelKernels instance;
+            return instance;
+        }
+
+    private:
+        PixelKernels() {
+            pixel_format_t identity = { PIXEL_ORDER_RGB, 255, 10, false };
+            simd = PIXEL_KERNELS_SIMD;
+            frame = 0;
+            set_format(&identity);
+        };
+
+        void select_kernel();
+
+        pixel_format_t format;
+        bool simd;
+        pixel_kernel_t kernel;
+        pixel_gather_kernel_t gather_kernel;
+        uint32_t frame;
+        uint16_t levels[256];
+        uint8_t levels8[256];
+};
+
+#endif
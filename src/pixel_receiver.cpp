@@ -0,0 +1,507 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pixel_receiver.h"
+#include "frame_codec.h"
+#include "logger.h"
+#include "pico/cyw43_arch.h"
+
+extern "C" {
+    #include "lwip/igmp.h"
+}
+
+
+#define DDP_HEADER_LEN              10
+#define DDP_HEADER_LEN_TIMECODE     14
+#define DDP_VERSION_MASK            0xc0
+#define DDP_VERSION_1               0x40
+#define DDP_FLAG_TIMECODE           0x10
+#define DDP_FLAG_REPLY              0x04
+#define DDP_FLAG_QUERY              0x02
+#define DDP_FLAG_PUSH               0x01
+#define DDP_SEQUENCE_MASK           0x0f
+#define DDP_TYPE_KEYFRAME           0x81        // custom: frame_codec keyframe
+#define DDP_TYPE_DELTA              0x82        // custom: frame_codec delta against the last frame
+#define DDP_ID_DISPLAY              1
+#define DDP_ID_ALL                  255
+
+#define E131_HEADER_LEN             126
+#define E131_SYNC_PACKET_LEN        49
+#define E131_PREAMBLE_SIZE          0x0010
+#define E131_ROOT_VECTOR_DATA       0x00000004
+#define E131_ROOT_VECTOR_EXTENDED   0x00000008
+#define E131_FRAMING_VECTOR_DATA    0x00000002
+#define E131_FRAMING_VECTOR_SYNC    0x00000001
+#define E131_DMP_VECTOR_SET_PROP    0x02
+#define E131_DMP_ADDRESS_TYPE       0xa1
+#define E131_OPTION_PREVIEW         0x80
+#define E131_OPTION_TERMINATED      0x40
+
+static const uint8_t e131_acn_id[12] = { 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0 };
+
+
+static inline uint16_t get_be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+/**
+ * Starts the DDP and E1.31 listeners, which can't be done before the event
+ * loop has been set with set_event_loop(). The connection's address events
+ * are subscribed to first, so none that come before the PCBs are bound is
+ * missed. Once the loop sees EVENT_WIFI_JOINED the UDP PCBs are bound; from
+ * there on all the work happens in the lwIP receive callbacks on the tcpip
+ * thread, with no task of its own.
+ */
+void PixelReceiver::init() {
+    wifi_listener = wifi->subscribe(WIFI_EVENT_IP_BOUND | WIFI_EVENT_IP_CHANGED, network_changed, this);
+
+    LOG_INFO("PIXEL RECEIVER WAITING FOR WIFI");
+    loop->when(EVENT_WIFI_JOINED, wifi_joined, this);
+}
+
+
+/***
+ * Takes the strip length and direction from the strip configuration. Pixels
+ * past strip_length in an incoming frame are dropped, and right_to_left
+ * reverses pixel order (but not channel order within a pixel) on the way into
+ * the frame buffer. The packet filter, if there is one, is told which E1.31
+ * universes that makes ours.
+ */
+void PixelReceiver::configure(const led_strip_config_t *config) {
+    strip_length = config->strip_length;
+    if(strip_length > STRIP_MAX_LENGTH) {
+        strip_length = STRIP_MAX_LENGTH;
+    }
+    right_to_left = config->right_to_left;
+    reference_valid = false;
+    frame_compressed = false;
+
+    if(packet_filter) {
+        packet_filter->set_e131_universes(e131_start_universe, (uint16_t)get_universe_count());
+    }
+}
+
+
+uint32_t PixelReceiver::get_universe_count() {
+    return (strip_length * STRIP_BYTES_PER_PIXEL + E131_CHANNELS_PER_UNIVERSE - 1) / E131_CHANNELS_PER_UNIVERSE;
+}
+
+
+/***
+ * Joins the E1.31 multicast group of each universe the strip shows, and no
+ * others, so the access point and the CYW43's own multicast filter keep
+ * everyone else's universes off the air and out of the driver. lwIP reports
+ * the groups again whenever the link comes back. Called with the lwIP core
+ * locked.
+ */
+void PixelReceiver::join_universes() {
+    uint32_t universe_count = get_universe_count();
+
+    for(uint32_t i = 0; i < universe_count; i++) {
+        uint32_t universe = e131_start_universe + i;
+        ip4_addr_t group;
+
+        IP4_ADDR(&group, 239, 255, (universe >> 8) & 0xff, universe & 0xff);
+        if(igmp_joingroup(IP4_ADDR_ANY4, &group) != ERR_OK) {
+            LOG_WARN("COULDN'T JOIN E1.31 UNIVERSE %lu", (unsigned long)universe);
+        }
+    }
+}
+
+
+/***
+ * Forgets what the senders were in the middle of: sequence numbers and the
+ * frame codec's reference. After an outage, or on a new address, they'll
+ * have moved on, and a delta that happens to carry the next sequence number
+ * would otherwise be applied to a frame from before.
+ */
+void PixelReceiver::reset_streams() {
+    memset(e131_sequence, 0xff, sizeof(e131_sequence));
+    e131_sync_address = 0;
+    ddp_sequence = 0;
+    reference_valid = false;
+    frame_compressed = false;
+}
+
+
+/***
+ * On the event loop, when the STA interface is bound again or its address
+ * changes. The PCBs are bound to the any-address and survive both, but our
+ * IGMP reports went out when the link came up, before DHCP had given us an
+ * address, so the switch may not know we're in the universes' groups; they
+ * are reported again from the address we have now. The first time, this
+ * comes before wifi_joined() and there are no groups to report yet.
+ */
+void PixelReceiver::network_changed(void *arg, uint32_t event) {
+    PixelReceiver *receiver = (PixelReceiver *)arg;
+
+    cyw43_arch_lwip_begin();
+    receiver->reset_streams();
+    igmp_report_groups(&cyw43_state.netif[CYW43_ITF_STA]);
+    cyw43_arch_lwip_end();
+
+    LOG_INFO("PIXEL RECEIVER REJOINED UNIVERSES (%s)", event == WIFI_EVENT_IP_CHANGED ? "NEW ADDRESS" : "LINK BACK");
+}
+
+
+/***
+ * The callback fires from the tcpip thread each time a complete frame has been
+ * written into the frame buffer: on a DDP packet with the PUSH flag, on the
+ * last universe of an unsynchronized E1.31 frame, or on an E1.31 universe sync
+ * packet. It's a good place to swap buffers, and a bad place to do anything slow.
+ */
+void PixelReceiver::set_frame_callback(pixel_frame_callback_t callback, void *context) {
+    frame_callback = callback;
+    frame_callback_context = context;
+}
+
+
+/***
+ * Copies len bytes of pixel data, starting offset bytes into the pbuf chain,
+ * to byte position channel of the (logical, left-to-right) frame. Works one
+ * pbuf at a time straight out of the payload, so there's no staging copy no
+ * matter how the driver chained the packet.
+ */
+void PixelReceiver::copy_pixels(const struct pbuf *p, uint16_t offset, uint32_t channel, uint32_t len) {
+    uint32_t frame_len = strip_length * STRIP_BYTES_PER_PIXEL;
+
+    if(pixels == NULL || channel >= frame_len) {
+        return;
+    }
+    if(len > frame_len - channel) {
+        len = frame_len - channel;
+    }
+
+    while(p != NULL && offset >= p->len) {
+        offset -= p->len;
+        p = p->next;
+    }
+
+    while(p != NULL && len > 0) {
+        const uint8_t *src = (const uint8_t *)p->payload + offset;
+        uint32_t n = p->len - offset;
+        if(n > len) {
+            n = len;
+        }
+
+        if(right_to_left) {
+            copy_pixels_reversed(src, channel, n);
+        }
+        else {
+            memcpy(&pixels[channel], src, n);
+        }
+
+        stats.bytes += n;
+        channel += n;
+        len -= n;
+        offset = 0;
+        p = p->next;
+    }
+}
+
+
+void PixelReceiver::copy_pixels_reversed(const uint8_t *src, uint32_t channel, uint32_t len) {
+    uint32_t sub = channel % STRIP_BYTES_PER_PIXEL;
+    uint8_t *dst = &pixels[(strip_length - 1 - channel / STRIP_BYTES_PER_PIXEL) * STRIP_BYTES_PER_PIXEL];
+
+    while(len > 0) {
+        dst[sub] = *src++;
+        len--;
+        if(++sub == STRIP_BYTES_PER_PIXEL && len > 0) {
+            sub = 0;
+            dst -= STRIP_BYTES_PER_PIXEL;
+        }
+    }
+}
+
+
+/***
+ * Decodes a frame_codec stream, len bytes starting offset bytes into the pbuf
+ * chain, into the reference frame at byte position channel. The stream is
+ * read straight from the payload when it's all in the first pbuf, which it
+ * is unless the driver chained the packet, and copied out first otherwise.
+ * The reference frame is the receiver's own, because the frame buffers move
+ * on to the scheduler and come back in any order, so the last frame is never
+ * reliably in the one being filled; frame_complete() copies it over.
+ */
+bool PixelReceiver::decode_pixels(const struct pbuf *p, uint16_t offset, uint32_t channel, uint16_t len,
+                                  bool delta) {
+    uint32_t frame_len = strip_length * STRIP_BYTES_PER_PIXEL;
+    const uint8_t *src;
+    int32_t decoded;
+
+    if(len > DDP_MAX_DATA_LEN) {
+        return false;
+    }
+    if(p->len >= (uint32_t)offset + len) {
+        src = (const uint8_t *)p->payload + offset;
+    }
+    else {
+        pbuf_copy_partial(p, payload, len, offset);
+        src = payload;
+    }
+
+    decoded = frame_codec_decode(reference, frame_len, channel, src, len, delta);
+    if(decoded < 0) {
+        stats.decode_errors++;
+        return false;
+    }
+    stats.decoded_bytes += decoded;
+    frame_compressed = true;
+    return true;
+}
+
+
+void PixelReceiver::frame_complete() {
+    uint32_t frame_len = strip_length * STRIP_BYTES_PER_PIXEL;
+
+    if(frame_compressed && pixels != NULL) {
+        if(right_to_left) {
+            copy_pixels_reversed(reference, 0, frame_len);
+        }
+        else {
+            memcpy(pixels, reference, frame_len);
+        }
+    }
+    frame_compressed = false;
+
+    stats.frames++;
+    if(frame_callback) {
+        frame_callback(frame_callback_context);
+    }
+    frame_has_timecode = false;
+}
+
+
+/***
+ * For the frame callback: the DDP timecode (the middle 32 bits of an NTP
+ * timestamp) of the frame that has just completed, if it had one.
+ */
+bool PixelReceiver::get_frame_timecode(uint32_t *timecode) {
+    if(frame_has_timecode) {
+        *timecode = frame_timecode;
+    }
+    return frame_has_timecode;
+}
+
+
+/***
+ * Distributed Display Protocol. The header says where in the frame the payload
+ * goes (as a byte offset) and whether this packet finishes the frame (PUSH).
+ * Queries and replies are for DDP controllers, not displays, so we ignore them.
+ * A packet with a timecode says when the frame should be shown; the last one
+ * in a frame wins.
+ *
+ * Two custom data types carry frame_codec streams instead of raw pixels, to
+ * save airtime: a keyframe, and a delta against the previous frame. For
+ * those, the offset is where the decoded data goes, and a frame is whatever
+ * the last one was plus the ranges its packets changed, so a sender can
+ * leave out a range that didn't. Deltas need the sender's sequence numbers:
+ * once one goes missing, or a raw frame comes in between, deltas are dropped
+ * until the next keyframe starts at offset 0, since they'd only build on a
+ * frame the sender never sent.
+ */
+bool PixelReceiver::handle_ddp(const struct pbuf *p) {
+    uint8_t header[DDP_HEADER_LEN_TIMECODE];
+    uint16_t header_len;
+    uint32_t offset;
+    uint16_t len;
+
+    if(p->tot_len < DDP_HEADER_LEN) {
+        stats.rejected++;
+        return false;
+    }
+    pbuf_copy_partial(p, header, DDP_HEADER_LEN, 0);
+
+    if((header[0] & DDP_VERSION_MASK) != DDP_VERSION_1 ||
+       (header[0] & (DDP_FLAG_QUERY | DDP_FLAG_REPLY)) ||
+       (header[3] != DDP_ID_DISPLAY && header[3] != DDP_ID_ALL)) {
+        stats.rejected++;
+        return false;
+    }
+
+    header_len = (header[0] & DDP_FLAG_TIMECODE) ? DDP_HEADER_LEN_TIMECODE : DDP_HEADER_LEN;
+    offset = get_be32(&header[4]);
+    len = get_be16(&header[8]);
+
+    if((uint32_t)header_len + len > p->tot_len) {
+        stats.rejected++;
+        return false;
+    }
+
+    if(header[0] & DDP_FLAG_TIMECODE) {
+        pbuf_copy_partial(p, &header[DDP_HEADER_LEN], DDP_HEADER_LEN_TIMECODE - DDP_HEADER_LEN, DDP_HEADER_LEN);
+        frame_timecode = get_be32(&header[DDP_HEADER_LEN]);
+        frame_has_timecode = true;
+    }
+
+    stats.packets++;
+    if(header[2] == DDP_TYPE_KEYFRAME || header[2] == DDP_TYPE_DELTA) {
+        uint8_t sequence = header[1] & DDP_SEQUENCE_MASK;
+
+        stats.compressed++;
+        if(sequence == 0 || (ddp_sequence != 0 && sequence != ddp_sequence % DDP_SEQUENCE_MASK + 1)) {
+            reference_valid = false;
+            frame_compressed = false;
+        }
+        ddp_sequence = sequence;
+
+        if(header[2] == DDP_TYPE_KEYFRAME && offset == 0) {
+            reference_valid = true;
+        }
+        if(!reference_valid) {
+            stats.deltas_dropped++;
+            return false;
+        }
+        if(!decode_pixels(p, header_len, offset, len, header[2] == DDP_TYPE_DELTA)) {
+            reference_valid = false;
+            frame_compressed = false;
+            return false;
+        }
+    }
+    else {
+        reference_valid = false;
+        frame_compressed = false;
+        copy_pixels(p, header_len, offset, len);
+    }
+
+    if(header[0] & DDP_FLAG_PUSH) {
+        frame_complete();
+    }
+
+    return true;
+}
+
+
+/***
+ * E1.31 (streaming ACN). Universe N carries pixels starting at
+ * (N - e131_start_universe) * 170. A frame is complete when the universe with
+ * the end of the strip arrives, unless the sender asked for universe sync, in
+ * which case we hold off until the sync packet.
+ */
+bool PixelReceiver::handle_e131(const struct pbuf *p) {
+    uint8_t header[E131_HEADER_LEN];
+    uint16_t header_len = p->tot_len < E131_HEADER_LEN ? p->tot_len : E131_HEADER_LEN;
+    uint32_t universe_count = get_universe_count();
+    uint32_t index;
+    uint16_t universe;
+    uint16_t sync_address;
+    uint16_t count;
+    int8_t sequence_delta;
+
+    if(header_len < E131_SYNC_PACKET_LEN) {
+        stats.rejected++;
+        return false;
+    }
+    pbuf_copy_partial(p, header, header_len, 0);
+
+    if(get_be16(&header[0]) != E131_PREAMBLE_SIZE || memcmp(&header[4], e131_acn_id, sizeof(e131_acn_id)) != 0) {
+        stats.rejected++;
+        return false;
+    }
+
+    if(get_be32(&header[18]) == E131_ROOT_VECTOR_EXTENDED && get_be32(&header[40]) == E131_FRAMING_VECTOR_SYNC) {
+        if(e131_sync_address != 0 && get_be16(&header[45]) == e131_sync_address) {
+            stats.packets++;
+            e131_sync_address = 0;
+            frame_complete();
+            return true;
+        }
+        stats.rejected++;
+        return false;
+    }
+
+    if(header_len < E131_HEADER_LEN ||
+       get_be32(&header[18]) != E131_ROOT_VECTOR_DATA ||
+       get_be32(&header[40]) != E131_FRAMING_VECTOR_DATA ||
+       header[117] != E131_DMP_VECTOR_SET_PROP ||
+       header[118] != E131_DMP_ADDRESS_TYPE ||
+       header[125] != 0 ||
+       (header[112] & (E131_OPTION_PREVIEW | E131_OPTION_TERMINATED))) {
+        stats.rejected++;
+        return false;
+    }
+
+    universe = get_be16(&header[113]);
+    if(universe < e131_start_universe || (uint32_t)(universe - e131_start_universe) >= universe_count) {
+        stats.rejected++;
+        return false;
+    }
+    index = universe - e131_start_universe;
+
+    // Per E1.31 section 6.7.2, anything up to 20 behind the last sequence number
+    // is out of order and gets thrown away
+    if(e131_sequence[index] >= 0) {
+        sequence_delta = (int8_t)(header[111] - (uint8_t)e131_sequence[index]);
+        if(sequence_delta <= 0 && sequence_delta > -20) {
+            stats.rejected++;
+            return false;
+        }
+    }
+    e131_sequence[index] = header[111];
+
+    // The property value count includes the start code
+    count = get_be16(&header[123]);
+    if(count == 0 || (uint32_t)E131_HEADER_LEN + count - 1 > p->tot_len) {
+        stats.rejected++;
+        return false;
+    }
+    count -= 1;
+    if(count > E131_CHANNELS_PER_UNIVERSE) {
+        count = E131_CHANNELS_PER_UNIVERSE;
+    }
+
+    stats.packets++;
+    reference_valid = false;
+    frame_compressed = false;
+    copy_pixels(p, E131_HEADER_LEN, index * E131_CHANNELS_PER_UNIVERSE, count);
+
+    sync_address = get_be16(&header[109]);
+    if(sync_address != 0) {
+        e131_sync_address = sync_address;
+    }
+    else if(index == universe_count - 1) {
+        frame_complete();
+    }
+
+    return true;
+}
+
+
+void PixelReceiver::ddp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    ((PixelReceiver *)arg)->handle_ddp(p);
+    pbuf_free(p);
+}
+
+
+void PixelReceiver::e131_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    ((PixelReceiver *)arg)->handle_e131(p);
+    pbuf_free(p);
+}
+
+
+/***
+ * On the event loop, the first time the connection is joined. The PCBs are
+ * bound to the any-address, so they're good for every join after this one.
+ */
+void PixelReceiver::wifi_joined(void *arg, bool met) {
+    PixelReceiver *receiver = (PixelReceiver *)arg;
+
+    cyw43_arch_lwip_begin();
+    receiver->ddp_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    udp_bind(receiver->ddp_pcb, IP_ANY_TYPE, DDP_PORT);
+    udp_recv(receiver->ddp_pcb, ddp_recv, receiver);
+
+    receiver->e131_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    udp_bind(receiver->e131_pcb, IP_ANY_TYPE, E131_PORT);
+    udp_recv(receiver->e131_pcb, e131_recv, receiver);
+    receiver->join_universes();
+    cyw43_arch_lwip_end();
+
+    LOG_INFO("PIXEL RECEIVER LISTENING ON UDP %d (DDP) AND %d (E1.31)", DDP_PORT, E131_PORT);
+}
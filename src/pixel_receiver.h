@@ -0,0 +1,126 @@
+#ifndef __PIXEL_RECEIVER_H__
+#define __PIXEL_RECEIVER_H__
+
+#include <stdlib.h>
+#include "pico/stdlib.h"
+#include "FreeRTOSConfig.h"
+#include "FreeRTOS.h"
+#include "event_loop.h"
+#include "wifi.h"
+#include "packet_filter.h"
+#include "strip_config.h"
+
+extern "C" {
+    #include "lwip/pbuf.h"
+    #include "lwip/udp.h"
+}
+
+#define DDP_PORT                    4048
+#define E131_PORT                   5568
+
+// The most data a DDP packet carries
+#define DDP_MAX_DATA_LEN            1440
+
+// E1.31 carries 170 RGB pixels in each 512-slot DMX universe
+#define E131_CHANNELS_PER_UNIVERSE  510
+#define E131_MAX_UNIVERSES          ((STRIP_MAX_LENGTH * STRIP_BYTES_PER_PIXEL + E131_CHANNELS_PER_UNIVERSE - 1) / E131_CHANNELS_PER_UNIVERSE)
+
+
+typedef struct {
+    uint32_t packets;
+    uint32_t bytes;
+    uint32_t frames;
+    uint32_t rejected;
+    uint32_t compressed;        // DDP packets in the frame codec's keyframe or delta types
+    uint32_t decoded_bytes;
+    uint32_t decode_errors;
+    uint32_t deltas_dropped;    // with no good keyframe to apply them to
+} pixel_receiver_stats_t;
+
+typedef void (*pixel_frame_callback_t)(void *context);
+
+
+class PixelReceiver {
+    public:
+        void init();
+        void configure(const led_strip_config_t *config);
+        void set_frame_buffer(uint8_t *pixels) { this->pixels = pixels; };
+        void set_frame_callback(pixel_frame_callback_t callback, void *context);
+        void set_e131_start_universe(uint16_t universe) { e131_start_universe = universe; };
+        void set_wifi_connection(WifiConnection *wifi) { this->wifi = wifi; };
+        void set_event_loop(EventLoop *loop) { this->loop = loop; };
+        void set_packet_filter(PacketFilter *filter) { packet_filter = filter; };
+        const pixel_receiver_stats_t *get_stats() { return &stats; };
+        bool get_frame_timecode(uint32_t *timecode);
+
+        bool handle_ddp(const struct pbuf *p);
+        bool handle_e131(const struct pbuf *p);
+
+        static PixelReceiver& getInstance() {
+            static PixelReceiver instance;
+            return instance;
+        }
+
+    private:
+        PixelReceiver() {
+            pixels = NULL;
+            strip_length = 0;
+            right_to_left = false;
+            frame_callback = NULL;
+            frame_callback_context = NULL;
+            e131_start_universe = 1;
+            e131_sync_address = 0;
+            frame_timecode = 0;
+            frame_has_timecode = false;
+            frame_compressed = false;
+            reference_valid = false;
+            ddp_sequence = 0;
+            wifi = NULL;
+            loop = NULL;
+            packet_filter = NULL;
+            ddp_pcb = NULL;
+            e131_pcb = NULL;
+            wifi_listener = WIFI_LISTENER_NONE;
+            memset(&stats, 0, sizeof(stats));
+            memset(e131_sequence, 0xff, sizeof(e131_sequence));
+            memset(reference, 0, sizeof(reference));
+        };
+
+        void copy_pixels(const struct pbuf *p, uint16_t offset, uint32_t channel, uint32_t len);
+        void copy_pixels_reversed(const uint8_t *src, uint32_t channel, uint32_t len);
+        bool decode_pixels(const struct pbuf *p, uint16_t offset, uint32_t channel, uint16_t len, bool delta);
+        void frame_complete();
+        uint32_t get_universe_count();
+        void join_universes();
+        void reset_streams();
+
+        static void wifi_joined(void *arg, bool met);
+        static void network_changed(void *arg, uint32_t event);
+        static void ddp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+        static void e131_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+
+        uint8_t *pixels;
+        uint32_t strip_length;
+        bool right_to_left;
+        pixel_frame_callback_t frame_callback;
+        void *frame_callback_context;
+        uint16_t e131_start_universe;
+        uint16_t e131_sync_address;
+        int16_t e131_sequence[E131_MAX_UNIVERSES];
+        uint32_t frame_timecode;
+        bool frame_has_timecode;
+        bool frame_compressed;
+        bool reference_valid;
+        uint8_t ddp_sequence;
+        pixel_receiver_stats_t stats;
+        WifiConnection *wifi;
+        EventLoop *loop;
+        PacketFilter *packet_filter;
+        struct udp_pcb *ddp_pcb;
+        struct udp_pcb *e131_pcb;
+        wifi_listener_t wifi_listener;
+        uint8_t reference[STRIP_MAX_LENGTH * STRIP_BYTES_PER_PIXEL];
+        uint8_t payload[DDP_MAX_DATA_LEN];
+};
+
+#endif
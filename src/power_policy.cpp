@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <string.h>
+#include "power_policy.h"
+
+
+static const char *mode_names[POWER_MODE_COUNT] = { "LOW LATENCY", "PERFORMANCE", "POWER SAVE" };
+
+
+/***
+ * Starts over in low latency, which is what a join wants anyway, with the
+ * counters cleared.
+ */
+void PowerPolicy::reset(uint64_t now_us) {
+    mode = POWER_MODE_LOW_LATENCY;
+    streaming = false;
+    memset(window_packets, 0, sizeof(window_packets));
+    memset(window_us, 0, sizeof(window_us));
+    window_next = 0;
+    last_sample_us = now_us;
+    calm_since_us = now_us;
+    memset(&stats, 0, sizeof(stats));
+    stats.last_switch_us = now_us;
+}
+
+
+/***
+ * Takes the number of packets that came in since the last sample, and
+ * returns the mode the radio should be in now. The rate is over the whole
+ * window, so a burst of a few packets isn't a stream, but a fast stream is
+ * seen on its first sample.
+ */
+power_mode_t PowerPolicy::sample(uint64_t now_us, uint32_t packets) {
+    uint64_t elapsed_us = now_us > last_sample_us ? now_us - last_sample_us : 0;
+    uint64_t total_packets = 0;
+    uint64_t total_us = 0;
+    power_mode_t wanted;
+
+    stats.samples++;
+    stats.time_in_mode_us[mode] += elapsed_us;
+    last_sample_us = now_us;
+
+    window_packets[window_next] = packets;
+    window_us[window_next] = elapsed_us ? elapsed_us : (uint64_t)POWER_SAMPLE_MS * 1000;
+    window_next = (window_next + 1) % POWER_WINDOW_SAMPLES;
+    for(int i = 0; i < POWER_WINDOW_SAMPLES; i++) {
+        total_packets += window_packets[i];
+        total_us += window_us[i];
+    }
+    streaming = total_packets * 1000000 >= (uint64_t)POWER_STREAMING_PPS * total_us;
+    wanted = get_wanted_mode(streaming);
+
+    if(wanted <= mode) {
+        if(wanted < mode) {
+            mode = wanted;
+            stats.switches_up++;
+            stats.last_switch_us = now_us;
+        }
+        calm_since_us = now_us;
+    }
+    else if(now_us - calm_since_us >= (uint64_t)hold_ms * 1000) {
+        mode = (power_mode_t)(mode + 1);
+        stats.switches_down++;
+        stats.last_switch_us = now_us;
+        calm_since_us = now_us;
+    }
+
+    return mode;
+}
+
+
+power_mode_t PowerPolicy::get_wanted_mode(bool streaming) {
+    if(!streaming) {
+        for(int m = POWER_MODE_COUNT - 1; m > POWER_MODE_LOW_LATENCY; m--) {
+            if(get_mode_latency_ms((power_mode_t)m) <= latency_budget_ms) {
+                return (power_mode_t)m;
+            }
+        }
+    }
+    return POWER_MODE_LOW_LATENCY;
+}
+
+
+uint32_t PowerPolicy::get_mode_latency_ms(power_mode_t mode) {
+    switch(mode) {
+        case POWER_MODE_PERFORMANCE:
+            return POWER_PERFORMANCE_LATENCY_MS;
+        case POWER_MODE_POWER_SAVE:
+            return POWER_SAVE_LATENCY_MS;
+        default:
+            return 0;
+    }
+}
+
+
+const char *PowerPolicy::get_mode_name(power_mode_t mode) {
+    return mode < POWER_MODE_COUNT ? mode_names[mode] : "UNKNOWN";
+}
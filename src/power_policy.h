@@ -0,0 +1,103 @@
+#ifndef __POWER_POLICY_H__
+#define __POWER_POLICY_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// How often traffic is sampled
+#define POWER_SAMPLE_MS                 250
+
+// Traffic is streaming at this many packets a second or more, over the last
+// POWER_WINDOW_SAMPLES samples: pixel data comes at 10 to 60 frames a second,
+// and what the packet filter lets through otherwise at one every few seconds,
+// with bursts when power save hands over what the access point held
+#define POWER_STREAMING_PPS             8
+#define POWER_WINDOW_SAMPLES            4
+
+// How long the traffic has to want a lower-power mode before the radio takes
+// one step down. Going up never waits.
+#define POWER_HOLD_MS                   10000
+
+// The most each mode adds to a packet's latency when the radio is asleep:
+// performance wakes on every beacon (102.4ms apart), power save only on DTIM
+// beacons, which most access points send every third beacon
+#ifndef POWER_PERFORMANCE_LATENCY_MS
+#define POWER_PERFORMANCE_LATENCY_MS    110
+#endif
+#ifndef POWER_SAVE_LATENCY_MS
+#define POWER_SAVE_LATENCY_MS           320
+#endif
+
+
+// Fastest first; the policy steps down through them one at a time
+typedef enum {
+    POWER_MODE_LOW_LATENCY,     // never sleeps
+    POWER_MODE_PERFORMANCE,     // sleeps 20ms after the last packet, wakes every beacon
+    POWER_MODE_POWER_SAVE,      // sleeps straight away, wakes every DTIM
+    POWER_MODE_COUNT
+} power_mode_t;
+
+
+typedef struct {
+    uint32_t samples;
+    uint32_t switches_up;
+    uint32_t switches_down;
+    uint64_t time_in_mode_us[POWER_MODE_COUNT];
+    uint64_t last_switch_us;
+} power_policy_stats_t;
+
+
+/**
+ * Picks the CYW43's power-management mode from the traffic. Every sample
+ * takes the packets that came in since the last one, and the rate over the
+ * last few says whether the node is streaming or idle:
+ *
+ *   streaming   wants low latency, since every frame would otherwise wait
+ *               for the radio to wake up
+ *   idle        wants the lowest-power mode whose wake-up latency fits in
+ *               the budget, which is what the first packet of the next
+ *               stream, or a stray packet, will be held up by
+ *
+ * A faster mode is taken on the first sample that wants it. A slower one has
+ * to be wanted for POWER_HOLD_MS, and then only one step is taken, so a pause
+ * between songs doesn't put the radio to sleep and an idle node winds down
+ * gradually. A budget of 0, or anything under the performance mode's wake-up
+ * latency, keeps the radio in low latency. (In the stored configuration that's
+ * STRIP_PM_BUDGET_AWAKE, since a 0 there means the default budget.)
+ *
+ * Pure logic on timestamps the caller passes in, so a bench can replay
+ * traffic traces through exactly what runs on the board.
+ */
+class PowerPolicy {
+    public:
+        PowerPolicy() { latency_budget_ms = 0; hold_ms = POWER_HOLD_MS; reset(0); };
+
+        void reset(uint64_t now_us);
+        void set_latency_budget_ms(uint32_t budget_ms) { latency_budget_ms = budget_ms; };
+        uint32_t get_latency_budget_ms() { return latency_budget_ms; };
+        void set_hold_ms(uint32_t hold_ms) { this->hold_ms = hold_ms; };
+
+        power_mode_t sample(uint64_t now_us, uint32_t packets);
+        power_mode_t get_mode() { return mode; };
+        bool is_streaming() { return streaming; };
+        power_mode_t get_wanted_mode(bool streaming);
+        const power_policy_stats_t *get_stats() { return &stats; };
+
+        static uint32_t get_mode_latency_ms(power_mode_t mode);
+        static const char *get_mode_name(power_mode_t mode);
+
+    private:
+        uint32_t latency_budget_ms;
+        uint32_t hold_ms;
+        power_mode_t mode;
+        bool streaming;
+        uint32_t window_packets[POWER_WINDOW_SAMPLES];
+        uint64_t window_us[POWER_WINDOW_SAMPLES];
+        int window_next;
+        uint64_t last_sample_us;
+        uint64_t calm_since_us;         // since the traffic last wanted this mode or a faster one
+        power_policy_stats_t stats;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __SPSC_QUEUE_H__
+#define __SPSC_QUEUE_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+
+
+/**
+ * A fixed-size queue between exactly one producer and exactly one consumer,
+ * which may be on different cores. Neither side ever waits for the other or
+ * takes a lock: the producer only writes head, the consumer only writes tail,
+ * and each publishes its index with a release store after touching the
+ * entries, so the other side's acquire load sees the entries too. Both
+ * indexes count forever and wrap into the ring; SIZE must be a power of two.
+ *
+ * Waking the consumer is up to the caller (a task notification, usually).
+ */
+template<typename T, uint32_t SIZE>
+class SpscQueue {
+    static_assert(SIZE != 0 && (SIZE & (SIZE - 1)) == 0, "SpscQueue size must be a power of two");
+
+    public:
+        SpscQueue() { reset(); };
+
+        // Only while neither side is using it
+        void reset() { head = 0; tail = 0; };
+
+        bool push(const T &item) {
+            uint32_t h = head;
+
+            if(h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) == SIZE) {
+                return false;
+            }
+            items[h & (SIZE - 1)] = item;
+            __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        bool pop(T *item) {
+            uint32_t t = tail;
+
+            if(__atomic_load_n(&head, __ATOMIC_ACQUIRE) == t) {
+                return false;
+            }
+            *item = items[t & (SIZE - 1)];
+            __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        uint32_t count() {
+            return __atomic_load_n(&head, __ATOMIC_ACQUIRE) - __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+        }
+
+    private:
+        T items[SIZE];
+        uint32_t head;
+        uint32_t tail;
+};
+
+#endif
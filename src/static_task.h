@@ -0,0 +1,54 @@
+#ifndef __STATIC_TASK_H__
+#define __STATIC_TASK_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "FreeRTOSConfig.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+/**
+ * A task's control block and stack, for the class that runs the task to keep
+ * as a member. With configSUPPORT_STATIC_ALLOCATION they're right here, so
+ * they're counted in .bss at link time (and in the RAM budget report) rather
+ * than found missing from the heap in the field; without it this is just
+ * xTaskCreate(). STACK_DEPTH is in words, the way xTaskCreate() takes it.
+ *
+ * A task can only be created from its storage once.
+ */
+template<uint32_t STACK_DEPTH>
+class StaticTask {
+    public:
+        TaskHandle_t create(TaskFunction_t function, const char *name, void *params, UBaseType_t priority) {
+            TaskHandle_t handle = NULL;
+#if configSUPPORT_STATIC_ALLOCATION
+            handle = xTaskCreateStatic(function, name, STACK_DEPTH, params, priority, stack, &tcb);
+#else
+            xTaskCreate(function, name, STACK_DEPTH, params, priority, &handle);
+#endif
+            return handle;
+        }
+
+#if configNUMBER_OF_CORES > 1 && configUSE_CORE_AFFINITY
+        TaskHandle_t create(TaskFunction_t function, const char *name, void *params, UBaseType_t priority,
+                            UBaseType_t affinity) {
+            TaskHandle_t handle = NULL;
+#if configSUPPORT_STATIC_ALLOCATION
+            handle = xTaskCreateStaticAffinitySet(function, name, STACK_DEPTH, params, priority, stack, &tcb,
+                                                  affinity);
+#else
+            xTaskCreateAffinitySet(function, name, STACK_DEPTH, params, priority, affinity, &handle);
+#endif
+            return handle;
+        }
+#endif
+
+    private:
+#if configSUPPORT_STATIC_ALLOCATION
+        StaticTask_t tcb;
+        StackType_t stack[STACK_DEPTH];
+#endif
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "strip_layout.h"
+#include "logger.h"
+
+
+/***
+ * Walks the segments in wire order and writes the frame offset of each
+ * physical pixel into remap, up to max_length of them. Returns how many there
+ * are; truncated says whether the layout wanted more than max_length.
+ */
+uint32_t strip_layout_compile(uint16_t *remap, uint32_t max_length, const strip_layout_t *layout,
+                              uint32_t frame_length, uint16_t black_offset, bool *truncated) {
+    uint32_t segment_count = layout->segment_count;
+    uint32_t count = 0;
+
+    *truncated = false;
+    if(segment_count > STRIP_LAYOUT_MAX_SEGMENTS) {
+        segment_count = STRIP_LAYOUT_MAX_SEGMENTS;
+    }
+
+    for(uint32_t s = 0; s < segment_count; s++) {
+        const strip_segment_t *segment = &layout->segments[s];
+        uint32_t runs = segment->runs != 0 ? segment->runs : 1;
+        int32_t pixel_step = segment->pixel_step != 0 ? segment->pixel_step : 1;
+        bool dark = (segment->flags & STRIP_SEGMENT_DARK) != 0;
+        bool serpentine = (segment->flags & STRIP_SEGMENT_SERPENTINE) != 0;
+
+        for(uint32_t run = 0; run < runs; run++) {
+            int32_t start = (int32_t)segment->source + (int32_t)run * segment->run_step;
+            bool reversed = serpentine && (run & 1) != 0;
+
+            for(uint32_t k = 0; k < segment->length; k++) {
+                int32_t pixel = start + (int32_t)(reversed ? segment->length - 1 - k : k) * pixel_step;
+
+                if(count >= max_length) {
+                    *truncated = true;
+                    return count;
+                }
+                if(dark || pixel < 0 || pixel >= (int32_t)frame_length) {
+                    remap[count++] = black_offset;
+                }
+                else {
+                    remap[count++] = (uint16_t)(pixel * STRIP_BYTES_PER_PIXEL);
+                }
+            }
+        }
+    }
+
+    return count;
+}
+
+
+/***
+ * Compiles the layout against the configured strip length, which is the
+ * length of the received frames. The physical length is however many pixels
+ * the layout adds up to; with no segments it's the strip length, in order.
+ * right_to_left has already been applied by the PixelReceiver by the time a
+ * frame gets here, so the layout describes a frame as the sender sees it.
+ */
+void StripLayout::configure(const led_strip_config_t *config, const strip_layout_t *layout) {
+    uint32_t strip_length = config->strip_length;
+    bool truncated = false;
+
+    if(strip_length > STRIP_MAX_LENGTH) {
+        strip_length = STRIP_MAX_LENGTH;
+    }
+
+    if(layout == NULL || layout->segment_count == 0) {
+        physical_length = strip_length;
+        identity = true;
+        return;
+    }
+
+    physical_length = strip_layout_compile(remap, STRIP_MAX_LENGTH, layout, strip_length,
+                                           STRIP_LAYOUT_BLACK_OFFSET, &truncated);
+    if(truncated) {
+        LOG_WARN("STRIP LAYOUT LONGER THAN %d PIXELS, TRUNCATED", STRIP_MAX_LENGTH);
+    }
+
+    identity = physical_length == strip_length;
+    for(uint32_t i = 0; identity && i < physical_length; i++) {
+        identity = remap[i] == i * STRIP_BYTES_PER_PIXEL;
+    }
+    LOG_INFO("STRIP LAYOUT: %lu PIXELS FROM %lu%s", (unsigned long)physical_length, (unsigned long)strip_length,
+             identity ? ", IN ORDER" : "");
+}
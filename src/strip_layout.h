@@ -0,0 +1,55 @@
+#ifndef __STRIP_LAYOUT_H__
+#define __STRIP_LAYOUT_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "strip_config.h"
+
+// Where in every frame buffer the black pixel that dark and out of range
+// pixels are read from lives: just past the longest frame
+#define STRIP_LAYOUT_BLACK_OFFSET   (STRIP_MAX_LENGTH * STRIP_BYTES_PER_PIXEL)
+
+
+uint32_t strip_layout_compile(uint16_t *remap, uint32_t max_length, const strip_layout_t *layout,
+                              uint32_t frame_length, uint16_t black_offset, bool *truncated);
+
+
+/**
+ * Turns a strip_layout_t into a flat remap table once, when the strip is
+ * configured: entry i is the byte offset in the received frame of the pixel
+ * that goes out i-th on the wire. Serpentine runs, strides, gaps and dark
+ * pixels are all worked out here, so the PixelKernels can apply the layout
+ * in the same pass that converts the pixels, with one table load per pixel
+ * and no branches.
+ *
+ * Dark pixels, and any that point outside the frame, read the black pixel at
+ * STRIP_LAYOUT_BLACK_OFFSET, which the FrameScheduler keeps at the end of
+ * each of its buffers. A layout that comes out as the frame in order, which
+ * includes the default one, has no table at all and costs nothing.
+ */
+class StripLayout {
+    public:
+        void configure(const led_strip_config_t *config, const strip_layout_t *layout);
+
+        const uint16_t *get_remap() { return identity ? NULL : remap; };
+        uint32_t get_physical_length() { return physical_length; };
+
+        static StripLayout& getInstance() {
+            static StripLayout instance;
+            return instance;
+        }
+
+    private:
+        StripLayout() {
+            physical_length = 0;
+            identity = true;
+            memset(remap, 0, sizeof(remap));
+        };
+
+        uint32_t physical_length;
+        bool identity;
+        uint16_t remap[STRIP_MAX_LENGTH];
+};
+
+#endif
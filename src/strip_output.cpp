@@ -0,0 +1,199 @@
+#include <string.h>
+#include "strip_output.h"
+#include "pixel_kernels.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+/***
+ * Frames move through the buffers in one direction: the network side fills the
+ * back buffer, present() queues it as pending, and the backend picks up the
+ * pending buffer as the front buffer at the next vsync, i.e. as soon as the
+ * previous frame has finished shifting out and latched. The old front buffer
+ * becomes the next back buffer, so it still holds a frame from a couple of
+ * frames ago; senders that only update part of a frame should know that.
+ *
+ * present() runs on the tcpip thread and frame_done() in the backend's
+ * completion interrupt, so the buffer indices are only touched inside
+ * critical sections.
+ *
+ * A frame is as many bytes per pixel as the strip's color order has
+ * channels: four with a white channel, three otherwise. It's as many pixels
+ * as there are on the wire, which a StripLayout can make different from the
+ * strip length; 0 means the same.
+ */
+void StripOutput::configure(const led_strip_config_t *config, uint32_t physical_length) {
+    uint32_t strip_length = physical_length != 0 ? physical_length : config->strip_length;
+    if(strip_length > STRIP_MAX_LENGTH) {
+        strip_length = STRIP_MAX_LENGTH;
+    }
+    frame_size = strip_length * pixel_order_channels(config->color_order);
+    memset(buffers, 0, sizeof(buffers));
+}
+
+
+/***
+ * Two buffers is classic double buffering: a frame that arrives while the
+ * previous one is still waiting for vsync has nowhere to go and is counted as
+ * starved. Three lets the network side keep working on the next frame while
+ * one is shifting out and another is waiting.
+ */
+void StripOutput::set_buffer_count(int count) {
+    if(count < 2) {
+        count = 2;
+    }
+    if(count > STRIP_OUTPUT_MAX_BUFFERS) {
+        count = STRIP_OUTPUT_MAX_BUFFERS;
+    }
+
+    taskENTER_CRITICAL();
+    buffer_count = count;
+    back = 0;
+    pending = -1;
+    front = -1;
+    taskEXIT_CRITICAL();
+}
+
+
+void StripOutput::reset_stats() {
+    memset(&stats, 0, sizeof(stats));
+    stats.frame_time_min_us = UINT32_MAX;
+    stats.latency_min_us = UINT32_MAX;
+}
+
+
+int StripOutput::find_free_buffer() {
+    for(int i = 0; i < buffer_count; i++) {
+        if(i != back && i != pending && i != front) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/***
+ * Returns the buffer the network side should write the next frame into, or
+ * NULL if every buffer is either queued or on its way out to the strip.
+ */
+uint8_t *StripOutput::get_back_buffer() {
+    uint8_t *buffer = NULL;
+
+    taskENTER_CRITICAL();
+    if(back >= 0) {
+        buffer = buffers[back];
+    }
+    taskEXIT_CRITICAL();
+
+    return buffer;
+}
+
+
+/***
+ * Hands the back buffer over for display. If a frame is already pending it
+ * hasn't been shown yet and never will be: the newer frame replaces it, and
+ * the older buffer goes back to the network side.
+ */
+void StripOutput::present() {
+    int start = -1;
+
+    taskENTER_CRITICAL();
+
+    if(back < 0) {
+        stats.starved++;
+        taskEXIT_CRITICAL();
+        return;
+    }
+
+    stats.presented++;
+    if(pending >= 0) {
+        int replaced = pending;
+        stats.dropped++;
+        pending = back;
+        back = replaced;
+    }
+    else {
+        pending = back;
+        back = find_free_buffer();
+    }
+    pending_since_us = now_us();
+
+    if(front < 0) {
+        start = promote_pending();
+    }
+
+    taskEXIT_CRITICAL();
+
+    if(start >= 0 && backend) {
+        backend->start(buffers[start], frame_size, frame_done, this);
+    }
+}
+
+
+/***
+ * Makes the pending buffer the front buffer and returns its index. Called with
+ * the critical section held; the caller starts the backend once it's released,
+ * since nothing else can touch the front buffer until the frame is done.
+ */
+int StripOutput::promote_pending() {
+    uint64_t now = now_us();
+    uint32_t latency = (uint32_t)(now - pending_since_us);
+
+    front = pending;
+    pending = -1;
+
+    if(latency < stats.latency_min_us) {
+        stats.latency_min_us = latency;
+    }
+    if(latency > stats.latency_max_us) {
+        stats.latency_max_us = latency;
+    }
+    stats.latency_total_us += latency;
+
+    if(stats.started > 0) {
+        uint32_t frame_time = (uint32_t)(now - last_start_us);
+        if(frame_time < stats.frame_time_min_us) {
+            stats.frame_time_min_us = frame_time;
+        }
+        if(frame_time > stats.frame_time_max_us) {
+            stats.frame_time_max_us = frame_time;
+        }
+        stats.frame_time_total_us += frame_time;
+    }
+    stats.started++;
+    last_start_us = now;
+    front_started_us = now;
+
+    return front;
+}
+
+
+/***
+ * The backend's completion callback: the front frame is out and latched, which
+ * is our vsync. The pending frame (if any) starts immediately.
+ */
+void StripOutput::frame_done(void *context) {
+    StripOutput *output = (StripOutput *)context;
+    int start = -1;
+    UBaseType_t interrupt_state = taskENTER_CRITICAL_FROM_ISR();
+
+    if(output->front >= 0) {
+        output->stats.displayed++;
+        output->stats.busy_total_us += output->now_us() - output->front_started_us;
+
+        if(output->back < 0) {
+            output->back = output->front;
+        }
+        output->front = -1;
+    }
+
+    if(output->pending >= 0) {
+        start = output->promote_pending();
+    }
+
+    taskEXIT_CRITICAL_FROM_ISR(interrupt_state);
+
+    if(start >= 0 && output->backend) {
+        output->backend->start(output->buffers[start], output->frame_size, frame_done, output);
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef __STRIP_OUTPUT_H__
+#define __STRIP_OUTPUT_H__
+
+#include <stdlib.h>
+#include "pico/stdlib.h"
+#include "strip_config.h"
+
+#define STRIP_OUTPUT_MAX_BUFFERS    3
+
+
+typedef void (*strip_done_callback_t)(void *context);
+
+/**
+ * Something that can shift a frame out to the strip without the CPU's help.
+ * start() must return immediately and call done(context) once the frame has
+ * been fully clocked out and latched, from whatever context that happens in
+ * (an IRQ on the Pico). Only one frame is ever in flight.
+ */
+class StripBackend {
+    public:
+        virtual void start(const uint8_t *pixels, size_t len, strip_done_callback_t done, void *context) = 0;
+};
+
+
+typedef struct {
+    uint32_t presented;
+    uint32_t started;
+    uint32_t displayed;
+    uint32_t dropped;
+    uint32_t starved;
+    uint32_t frame_time_min_us;
+    uint32_t frame_time_max_us;
+    uint64_t frame_time_total_us;
+    uint32_t latency_min_us;
+    uint32_t latency_max_us;
+    uint64_t latency_total_us;
+    uint64_t busy_total_us;
+} strip_output_stats_t;
+
+
+class StripOutput {
+    public:
+        void configure(const led_strip_config_t *config, uint32_t physical_length = 0);
+        void set_buffer_count(int count);
+        void set_backend(StripBackend *backend) { this->backend = backend; };
+        void set_time_source(uint64_t (*now_us)(void)) { this->now_us = now_us; };
+
+        uint8_t *get_back_buffer();
+        void present();
+        size_t get_frame_size() { return frame_size; };
+        bool is_busy() { return front >= 0; };
+
+        const strip_output_stats_t *get_stats() { return &stats; };
+        void reset_stats();
+
+        static void frame_done(void *context);
+
+        static StripOutput& getInstance() {
+            static StripOutput instance;
+            return instance;
+        }
+
+    private:
+        StripOutput() {
+            backend = NULL;
+            now_us = time_us_64;
+            frame_size = 0;
+            buffer_count = STRIP_OUTPUT_MAX_BUFFERS;
+            back = 0;
+            pending = -1;
+            front = -1;
+            pending_since_us = 0;
+            front_started_us = 0;
+            last_start_us = 0;
+            reset_stats();
+        };
+
+        int find_free_buffer();
+        int promote_pending();
+
+        StripBackend *backend;
+        uint64_t (*now_us)(void);
+        size_t frame_size;
+        int buffer_count;
+        int back;
+        int pending;
+        int front;
+        uint64_t pending_since_us;
+        uint64_t front_started_us;
+        uint64_t last_start_us;
+        strip_output_stats_t stats;
+        uint8_t buffers[STRIP_OUTPUT_MAX_BUFFERS][STRIP_MAX_LENGTH * STRIP_MAX_OUTPUT_BYTES_PER_PIXEL] __attribute__((aligned(4)));
+};
+
+#endif
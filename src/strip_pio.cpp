@@ -0,0 +1,98 @@
+#include "strip_pio.h"
+#include "logger.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "ws2812.pio.h"
+
+
+/***
+ * Loads the WS2812 program into a free state machine and sets up a DMA channel
+ * that copies one byte per transfer from the front buffer into its TX FIFO,
+ * paced by the state machine's DREQ.
+ */
+bool PioStripBackend::init(uint pin) {
+    dma_channel_config c;
+    int claimed_sm;
+    uint offset;
+
+    if(!pio_can_add_program(pio, &ws2812_program)) {
+        LOG_WARN("NO ROOM FOR WS2812 PIO PROGRAM");
+        return false;
+    }
+    offset = pio_add_program(pio, &ws2812_program);
+
+    claimed_sm = pio_claim_unused_sm(pio, false);
+    if(claimed_sm < 0) {
+        LOG_WARN("NO FREE PIO STATE MACHINE FOR STRIP OUTPUT");
+        return false;
+    }
+    sm = (uint)claimed_sm;
+    ws2812_program_init(pio, sm, offset, pin, STRIP_BIT_RATE_HZ);
+
+    dma_channel = dma_claim_unused_channel(false);
+    if(dma_channel < 0) {
+        LOG_WARN("NO FREE DMA CHANNEL FOR STRIP OUTPUT");
+        return false;
+    }
+
+    c = dma_channel_get_default_config(dma_channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, true));
+    dma_channel_configure(dma_channel, &c, &pio->txf[sm], NULL, 0, false);
+
+    if(alarm_pool == NULL) {
+        alarm_pool = alarm_pool_get_default();
+    }
+
+    dma_channel_set_irq0_enabled(dma_channel, true);
+    irq_add_shared_handler(DMA_IRQ_0, dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    LOG_INFO("STRIP OUTPUT ON GPIO %u (PIO SM %u, DMA %d)", pin, sm, dma_channel);
+
+    return true;
+}
+
+
+void PioStripBackend::start(const uint8_t *pixels, size_t len, strip_done_callback_t done, void *context) {
+    this->done = done;
+    this->done_context = context;
+    dma_channel_transfer_from_buffer_now(dma_channel, pixels, len);
+}
+
+
+/***
+ * The DMA finishing doesn't mean the strip has the frame yet: the last few
+ * bytes are still in the FIFO, and the strip only latches after the line has
+ * been low for the reset time. An alarm covers both. If there's no alarm to
+ * be had, the time is waited out right here instead, since a frame that's
+ * never reported done would stop the output for good.
+ */
+void PioStripBackend::dma_irq_handler() {
+    PioStripBackend& backend = getInstance();
+    alarm_id_t id;
+
+    if(backend.dma_channel >= 0 && dma_channel_get_irq0_status(backend.dma_channel)) {
+        dma_channel_acknowledge_irq0(backend.dma_channel);
+        id = alarm_pool_add_alarm_in_us(backend.alarm_pool, STRIP_FIFO_DRAIN_US + STRIP_RESET_US, latch_alarm,
+                                        &backend, true);
+        if(id < 0) {
+            backend.alarm_failures++;
+            busy_wait_us_32(STRIP_FIFO_DRAIN_US + STRIP_RESET_US);
+            latch_alarm(0, &backend);
+        }
+    }
+}
+
+
+int64_t PioStripBackend::latch_alarm(alarm_id_t id, void *user_data) {
+    PioStripBackend *backend = (PioStripBackend *)user_data;
+
+    if(backend->done) {
+        backend->done(backend->done_context);
+    }
+
+    return 0;
+}
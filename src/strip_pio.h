@@ -0,0 +1,66 @@
+#ifndef __STRIP_PIO_H__
+#define __STRIP_PIO_H__
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "pico/time.h"
+#include "strip_output.h"
+
+#ifndef STRIP_DATA_PIN
+#define STRIP_DATA_PIN          2
+#endif
+
+#define STRIP_BIT_RATE_HZ       800000
+
+// The WS2812B datasheet asks for a 280us low to latch; older parts want 50us
+#define STRIP_RESET_US          280
+
+// After the last DMA transfer, the joined 8-entry TX FIFO plus the OSR can still
+// hold nine bytes, at 10us a byte
+#define STRIP_FIFO_DRAIN_US     90
+
+
+/**
+ * Shifts frames out to a WS2812-style strip through a PIO state machine fed by
+ * DMA. The CPU only gets involved twice per frame: once in the DMA completion
+ * IRQ to arm the latch alarm, and once in the alarm to report the frame done.
+ * The DMA IRQ is taken on the core that called init(), and the alarm on the
+ * core whose alarm pool it's given with set_alarm_pool() (the default pool's
+ * is core 0's), which is where the next frame gets started from.
+ */
+class PioStripBackend : public StripBackend {
+    public:
+        bool init(uint pin = STRIP_DATA_PIN);
+        void start(const uint8_t *pixels, size_t len, strip_done_callback_t done, void *context) override;
+        void set_alarm_pool(alarm_pool_t *pool) { alarm_pool = pool; };
+        uint32_t get_alarm_failures() { return alarm_failures; };
+
+        static PioStripBackend& getInstance() {
+            static PioStripBackend instance;
+            return instance;
+        }
+
+    private:
+        PioStripBackend() {
+            pio = pio0;
+            sm = 0;
+            dma_channel = -1;
+            done = NULL;
+            done_context = NULL;
+            alarm_pool = NULL;
+            alarm_failures = 0;
+        };
+
+        static void dma_irq_handler();
+        static int64_t latch_alarm(alarm_id_t id, void *user_data);
+
+        PIO pio;
+        uint sm;
+        int dma_channel;
+        strip_done_callback_t done;
+        void *done_context;
+        alarm_pool_t *alarm_pool;
+        volatile uint32_t alarm_failures;   // frames latched by waiting in the IRQ, for want of an alarm
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <string.h>
+#include "system_metrics.h"
+#include "logger.h"
+#include "pico/cyw43_arch.h"
+
+extern "C" {
+    #include "lwip/memp.h"
+    #include "lwip/stats.h"
+}
+
+
+// The pools that run out first on a Pico: pbufs for received packets and for
+// references to outgoing data, the UDP and TCP control blocks, TCP segments
+// and lwIP's timeouts
+static const memp_t pool_ids[METRICS_POOL_COUNT] = {
+    MEMP_PBUF_POOL,
+    MEMP_PBUF,
+    MEMP_UDP_PCB,
+    MEMP_TCP_PCB,
+    MEMP_TCP_SEG,
+    MEMP_SYS_TIMEOUT
+};
+
+static const char *pool_names[METRICS_POOL_COUNT] = {
+    "PBUF_POOL",
+    "PBUF",
+    "UDP_PCB",
+    "TCP_PCB",
+    "TCP_SEG",
+    "SYS_TIMEOUT"
+};
+
+
+static inline void put_be16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+
+static inline void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+
+/**
+ * Starts the metrics task. It samples from the start, and opens the UDP
+ * endpoint once wifi is up.
+ */
+void SystemMetrics::init() {
+    metrics_task_handle = metrics_task_storage.create(metrics_task, "Metrics Task", this, 1);
+}
+
+
+const char *SystemMetrics::get_pool_name(int pool) {
+    return pool >= 0 && pool < METRICS_POOL_COUNT ? pool_names[pool] : "?";
+}
+
+
+/***
+ * Takes a sample and makes it the snapshot the UDP endpoint hands out. The
+ * cost is measured up to the encoding, which is a few hundred byte stores.
+ */
+void SystemMetrics::sample() {
+    uint64_t start_us = time_us_64();
+
+    sample_tasks();
+    snapshot.heap_free = (uint32_t)xPortGetFreeHeapSize();
+    snapshot.heap_min_free = (uint32_t)xPortGetMinimumEverFreeHeapSize();
+    snapshot.heap_total = (uint32_t)configTOTAL_HEAP_SIZE;
+
+    cyw43_arch_lwip_begin();
+    sample_lwip();
+
+    snapshot.sequence++;
+    snapshot.uptime_ms = (uint32_t)(start_us / 1000);
+    snapshot.collect_us = (uint32_t)(time_us_64() - start_us);
+    if(snapshot.collect_us > snapshot.collect_max_us) {
+        snapshot.collect_max_us = snapshot.collect_us;
+    }
+
+    packet_len = encode(packet);
+    cyw43_arch_lwip_end();
+}
+
+
+/***
+ * CPU share is each task's run time counter against the previous sample's,
+ * matched up by task number, so a task that's new since then is measured from
+ * when it started.
+ */
+void SystemMetrics::sample_tasks() {
+    configRUN_TIME_COUNTER_TYPE total;
+    configRUN_TIME_COUNTER_TYPE window;
+    UBaseType_t numbers[METRICS_MAX_TASKS];
+    configRUN_TIME_COUNTER_TYPE counters[METRICS_MAX_TASKS];
+    UBaseType_t count;
+
+    count = uxTaskGetSystemState(task_status, METRICS_MAX_TASKS, &total);
+    window = total - last_total;
+
+    snapshot.tasks_total = (uint8_t)uxTaskGetNumberOfTasks();
+    snapshot.task_count = (uint8_t)count;
+    snapshot.window_us = (uint32_t)window;
+
+    for(UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t *status = &task_status[i];
+        metrics_task_t *task = &snapshot.tasks[i];
+        configRUN_TIME_COUNTER_TYPE ran = status->ulRunTimeCounter;
+
+        for(int j = 0; j < METRICS_MAX_TASKS; j++) {
+            if(last_numbers[j] == status->xTaskNumber) {
+                ran -= last_counters[j];
+                break;
+            }
+        }
+
+        strncpy(task->name, status->pcTaskName, sizeof(task->name) - 1);
+        task->name[sizeof(task->name) - 1] = '\0';
+        task->cpu_permille = window ? (uint16_t)((uint64_t)ran * 1000 / window) : 0;
+        task->priority = (uint8_t)status->uxCurrentPriority;
+        task->state = (uint8_t)status->eCurrentState;
+        task->stack_free_bytes = (uint32_t)status->usStackHighWaterMark * sizeof(StackType_t);
+
+        numbers[i] = status->xTaskNumber;
+        counters[i] = status->ulRunTimeCounter;
+    }
+
+    memset(last_numbers, 0, sizeof(last_numbers));
+    memcpy(last_numbers, numbers, count * sizeof(numbers[0]));
+    memcpy(last_counters, counters, count * sizeof(counters[0]));
+    last_total = total;
+}
+
+
+/***
+ * lwIP keeps its counters on the tcpip thread; this is called with the lwIP
+ * lock held.
+ */
+void SystemMetrics::sample_lwip() {
+    snapshot.mem.used = (uint16_t)lwip_stats.mem.used;
+    snapshot.mem.max = (uint16_t)lwip_stats.mem.max;
+    snapshot.mem.avail = (uint16_t)lwip_stats.mem.avail;
+    snapshot.mem.err = (uint16_t)lwip_stats.mem.err;
+
+    for(int i = 0; i < METRICS_POOL_COUNT; i++) {
+        const struct stats_mem *pool = lwip_stats.memp[pool_ids[i]];
+        snapshot.pools[i].used = (uint16_t)pool->used;
+        snapshot.pools[i].max = (uint16_t)pool->max;
+        snapshot.pools[i].avail = (uint16_t)pool->avail;
+        snapshot.pools[i].err = (uint16_t)pool->err;
+    }
+
+    snapshot.link_xmit = lwip_stats.link.xmit;
+    snapshot.link_recv = lwip_stats.link.recv;
+    snapshot.link_drop = lwip_stats.link.drop;
+    snapshot.link_memerr = lwip_stats.link.memerr;
+    snapshot.link_err = lwip_stats.link.err;
+}
+
+
+/***
+ * Header: 'M', 'T', version, task count, then the sequence number, uptime,
+ * window, collection cost and its maximum, heap free, least ever free and
+ * total, and the link's transmitted, received, dropped, out of memory and
+ * error counts, 32 bits each. Each pool is used, max, available and failed
+ * allocations, 16 bits each. Each task is its name padded with zeroes to 16
+ * bytes, CPU share in tenths of a percent (16 bits), priority and state (8
+ * bits each) and the least free stack in bytes (32 bits).
+ */
+size_t SystemMetrics::encode(uint8_t *packet) {
+    uint8_t *p = packet;
+    const metrics_pool_t *pool;
+
+    p[0] = 'M';
+    p[1] = 'T';
+    p[2] = METRICS_VERSION;
+    p[3] = snapshot.task_count;
+    put_be32(&p[4], snapshot.sequence);
+    put_be32(&p[8], snapshot.uptime_ms);
+    put_be32(&p[12], snapshot.window_us);
+    put_be32(&p[16], snapshot.collect_us);
+    put_be32(&p[20], snapshot.collect_max_us);
+    put_be32(&p[24], snapshot.heap_free);
+    put_be32(&p[28], snapshot.heap_min_free);
+    put_be32(&p[32], snapshot.heap_total);
+    put_be32(&p[36], snapshot.link_xmit);
+    put_be32(&p[40], snapshot.link_recv);
+    put_be32(&p[44], snapshot.link_drop);
+    put_be32(&p[48], snapshot.link_memerr);
+    put_be32(&p[52], snapshot.link_err);
+    p += METRICS_HEADER_LEN;
+
+    for(int i = -1; i < METRICS_POOL_COUNT; i++) {
+        pool = i < 0 ? &snapshot.mem : &snapshot.pools[i];
+        put_be16(&p[0], pool->used);
+        put_be16(&p[2], pool->max);
+        put_be16(&p[4], pool->avail);
+        put_be16(&p[6], pool->err);
+        p += METRICS_POOL_LEN;
+    }
+
+    for(int i = 0; i < snapshot.task_count; i++) {
+        const metrics_task_t *task = &snapshot.tasks[i];
+        memset(p, 0, 16);
+        memcpy(p, task->name, strnlen(task->name, 16));
+        put_be16(&p[16], task->cpu_permille);
+        p[18] = task->priority;
+        p[19] = task->state;
+        put_be32(&p[20], task->stack_free_bytes);
+        p += METRICS_TASK_LEN;
+    }
+
+    return p - packet;
+}
+
+
+/***
+ * Runs on the tcpip thread. Whatever arrives, the answer is the latest
+ * snapshot. The pbuf refers to it rather than copying it out of lwIP's small
+ * heap, which is safe because the snapshot only changes under the lwIP lock
+ * and the driver has copied the frame by the time udp_sendto() returns.
+ */
+void SystemMetrics::metrics_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    SystemMetrics *metrics = (SystemMetrics *)arg;
+    struct pbuf *reply;
+
+    pbuf_free(p);
+
+    if(metrics->packet_len == 0) {
+        return;
+    }
+    reply = pbuf_alloc(PBUF_TRANSPORT, (u16_t)metrics->packet_len, PBUF_REF);
+    if(reply != NULL) {
+        reply->payload = metrics->packet;
+        udp_sendto(pcb, reply, addr, port);
+        pbuf_free(reply);
+    }
+}
+
+
+void SystemMetrics::metrics_task(void *params) {
+    SystemMetrics *metrics = (SystemMetrics *)params;
+    TickType_t wake = xTaskGetTickCount();
+
+    LOG_INFO("METRICS SAMPLING EVERY %d ms", METRICS_SAMPLE_INTERVAL_MS);
+
+    for(;;) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(METRICS_SAMPLE_INTERVAL_MS));
+        metrics->sample();
+
+        if(metrics->pcb == NULL && metrics->wifi != NULL && metrics->wifi->is_joined()) {
+            cyw43_arch_lwip_begin();
+            metrics->pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+            udp_bind(metrics->pcb, IP_ANY_TYPE, METRICS_PORT);
+            udp_recv(metrics->pcb, metrics_recv, metrics);
+            cyw43_arch_lwip_end();
+            LOG_INFO("METRICS ON UDP %d", METRICS_PORT);
+        }
+    }
+}
@@ -0,0 +1,138 @@
+#ifndef __SYSTEM_METRICS_H__
+#define __SYSTEM_METRICS_H__
+
+#include <stdlib.h>
+#include "pico/stdlib.h"
+#include "FreeRTOSConfig.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "static_task.h"
+#include "wifi.h"
+
+extern "C" {
+    #include "lwip/pbuf.h"
+    #include "lwip/udp.h"
+}
+
+#ifndef METRICS_TASK_STACK_SIZE
+#define METRICS_TASK_STACK_SIZE     1024
+#endif
+
+#define METRICS_PORT                4050
+#define METRICS_SAMPLE_INTERVAL_MS  1000
+
+// Room for this many tasks in a sample. FreeRTOS won't report any of them if
+// there are more, so tasks_total says when it needs to grow.
+#define METRICS_MAX_TASKS           16
+
+// The lwIP pools in a snapshot, after lwIP's heap; see pool_ids in
+// system_metrics.cpp
+#define METRICS_POOL_COUNT          6
+
+// The snapshot on the wire: a header, the lwIP heap and pools, then the tasks.
+// Everything is big-endian.
+#define METRICS_VERSION             1
+#define METRICS_HEADER_LEN          56
+#define METRICS_POOL_LEN            8
+#define METRICS_TASK_LEN            24
+#define METRICS_PACKET_MAX_LEN      (METRICS_HEADER_LEN + (METRICS_POOL_COUNT + 1) * METRICS_POOL_LEN + \
+                                     METRICS_MAX_TASKS * METRICS_TASK_LEN)
+
+
+typedef struct {
+    char name[configMAX_TASK_NAME_LEN];
+    uint16_t cpu_permille;      // share of the sample window spent running
+    uint8_t priority;
+    uint8_t state;              // eTaskState
+    uint32_t stack_free_bytes;  // the least there has ever been
+} metrics_task_t;
+
+typedef struct {
+    uint16_t used;
+    uint16_t max;
+    uint16_t avail;
+    uint16_t err;               // allocations that failed
+} metrics_pool_t;
+
+typedef struct {
+    uint32_t sequence;
+    uint32_t uptime_ms;
+    uint32_t window_us;         // run time between this sample and the last one
+    uint32_t collect_us;        // what taking this sample cost
+    uint32_t collect_max_us;
+    uint32_t heap_free;
+    uint32_t heap_min_free;
+    uint32_t heap_total;
+    uint32_t link_xmit;
+    uint32_t link_recv;
+    uint32_t link_drop;
+    uint32_t link_memerr;
+    uint32_t link_err;
+    metrics_pool_t mem;         // lwIP's own heap, MEM_SIZE bytes
+    metrics_pool_t pools[METRICS_POOL_COUNT];
+    uint8_t task_count;
+    uint8_t tasks_total;
+    metrics_task_t tasks[METRICS_MAX_TASKS];
+} metrics_snapshot_t;
+
+
+/**
+ * Samples where the CPU, the stacks and the memory are going, once every
+ * METRICS_SAMPLE_INTERVAL_MS, and answers any datagram sent to METRICS_PORT
+ * with the latest sample as a compact binary snapshot.
+ *
+ * Per-task CPU share comes from FreeRTOS run time stats, counted on the
+ * microsecond timer, over the window since the previous sample. Stack high
+ * water marks, heap4's free and least-ever-free bytes, and lwIP's memory,
+ * pool and link counters come along with it. A sample walks every task and
+ * its unused stack with the scheduler suspended, so its cost goes into the
+ * snapshot as well, and the interval keeps it to well under a tenth of a
+ * percent.
+ */
+class SystemMetrics {
+    public:
+        void init();
+        void set_wifi_connection(WifiConnection *wifi) { this->wifi = wifi; };
+        void sample();
+        const metrics_snapshot_t *get_snapshot() { return &snapshot; };
+        static const char *get_pool_name(int pool);
+
+        static void metrics_task(void *params);
+
+        static SystemMetrics& getInstance() {
+            static SystemMetrics instance;
+            return instance;
+        }
+
+    private:
+        SystemMetrics() {
+            wifi = NULL;
+            pcb = NULL;
+            metrics_task_handle = (TaskHandle_t)0;
+            last_total = 0;
+            packet_len = 0;
+            memset(&snapshot, 0, sizeof(snapshot));
+            memset(last_numbers, 0, sizeof(last_numbers));
+            memset(last_counters, 0, sizeof(last_counters));
+        };
+
+        void sample_tasks();
+        void sample_lwip();
+        size_t encode(uint8_t *packet);
+
+        static void metrics_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+
+        WifiConnection *wifi;
+        struct udp_pcb *pcb;
+        TaskHandle_t metrics_task_handle;
+        StaticTask<METRICS_TASK_STACK_SIZE> metrics_task_storage;
+        metrics_snapshot_t snapshot;
+        TaskStatus_t task_status[METRICS_MAX_TASKS];
+        UBaseType_t last_numbers[METRICS_MAX_TASKS];
+        configRUN_TIME_COUNTER_TYPE last_counters[METRICS_MAX_TASKS];
+        configRUN_TIME_COUNTER_TYPE last_total;
+        uint8_t packet[METRICS_PACKET_MAX_LEN];
+        size_t packet_len;
+};
+
+#endif
@@ -0,0 +1,285 @@
+#include <stdlib.h>
+#include <string.h>
+#include "throughput_server.h"
+#include "logger.h"
+#include "pico/cyw43_arch.h"
+
+extern "C" {
+    #include "lwip/api.h"
+    #include "lwip/sockets.h"
+}
+
+
+static const char *variant_names[THROUGHPUT_VARIANTS] = {
+    "RAW",
+    "NETCONN",
+    "SOCKET",
+    "UDP"
+};
+
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+static inline void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+
+/**
+ * Starts the netconn and socket server tasks. The netconn task also starts
+ * the raw-API servers, once wifi has brought lwIP up.
+ */
+void ThroughputServer::init() {
+    netconn_task_handle = netconn_task_storage.create(netconn_task, "Netconn Server", this, 1);
+    socket_task_handle = socket_task_storage.create(socket_task, "Socket Server", this, 1);
+}
+
+
+const char *ThroughputServer::get_variant_name(throughput_variant_t variant) {
+    return variant < THROUGHPUT_VARIANTS ? variant_names[variant] : "?";
+}
+
+
+/***
+ * A session is over. kbit/s is bits per millisecond, so no division by
+ * 1000 is needed.
+ */
+void ThroughputServer::record(throughput_variant_t variant, uint32_t bytes, uint32_t ms, bool aborted) {
+    throughput_stats_t *s = &stats[variant];
+
+    s->sessions++;
+    if(aborted) {
+        s->aborted++;
+    }
+    s->last_bytes = bytes;
+    s->last_ms = ms;
+    s->last_kbps = ms ? (uint32_t)((uint64_t)bytes * 8 / ms) : 0;
+    if(s->last_kbps > s->best_kbps) {
+        s->best_kbps = s->last_kbps;
+    }
+
+    LOG_INFO("THROUGHPUT %s: %lu BYTES IN %lu ms, %lu kbit/s%s", get_variant_name(variant),
+             (unsigned long)bytes, (unsigned long)ms, (unsigned long)s->last_kbps, aborted ? ", ABORTED" : "");
+}
+
+
+/***
+ * Runs on the tcpip thread when an lwiperf session ends. Only the server's
+ * own reports come here.
+ */
+void ThroughputServer::lwiperf_report(void *arg, enum lwiperf_report_type report_type,
+                                      const ip_addr_t *local_addr, u16_t local_port,
+                                      const ip_addr_t *remote_addr, u16_t remote_port,
+                                      u32_t bytes_transferred, u32_t ms_duration, u32_t bandwidth_kbitpsec) {
+    ThroughputServer *server = (ThroughputServer *)arg;
+
+    server->record(THROUGHPUT_RAW, bytes_transferred, ms_duration, report_type != LWIPERF_TCP_DONE_SERVER);
+}
+
+
+/***
+ * Counts one of the client's datagrams. A datagram numbered 0, or the first
+ * after a report, starts a new session. Transit times are taken against the
+ * client's clock, which is fine for jitter, since only their differences
+ * count.
+ */
+void ThroughputServer::udp_datagram(struct pbuf *p, uint64_t rx_us) {
+    uint8_t header[IPERF_UDP_HEADER_LEN];
+    int32_t id;
+    int64_t transit_us;
+
+    pbuf_copy_partial(p, header, sizeof(header), 0);
+    id = (int32_t)get_be32(header);
+
+    if(!udp_active || id == 0) {
+        udp_active = true;
+        udp_next_id = 0;
+        udp_bytes = 0;
+        udp_start_us = rx_us;
+        udp_jitter_16 = 0;
+        udp_stats.datagrams = 0;
+        udp_stats.lost = 0;
+        udp_stats.out_of_order = 0;
+        udp_stats.jitter_us = 0;
+    }
+
+    udp_stats.datagrams++;
+    udp_bytes += p->tot_len;
+
+    if(id > udp_next_id) {
+        udp_stats.lost += (uint32_t)(id - udp_next_id);
+    }
+    else if(id < udp_next_id) {
+        udp_stats.out_of_order++;
+        if(udp_stats.lost) {
+            udp_stats.lost--;
+        }
+    }
+    if(id >= udp_next_id) {
+        udp_next_id = id + 1;
+    }
+
+    transit_us = (int64_t)rx_us - ((int64_t)get_be32(&header[4]) * 1000000 + get_be32(&header[8]));
+    if(udp_stats.datagrams > 1) {
+        int64_t d = transit_us - udp_last_transit_us;
+        udp_jitter_16 += (uint32_t)(d < 0 ? -d : d) - ((udp_jitter_16 + 8) >> 4);
+        udp_stats.jitter_us = udp_jitter_16 >> 4;
+    }
+    udp_last_transit_us = transit_us;
+}
+
+
+/***
+ * The client's last datagram has a negative number. It wants iperf's server
+ * report back, and sends the datagram again until it gets one, so every copy
+ * is answered, but only the first ends the session.
+ */
+void ThroughputServer::udp_report(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port,
+                                  uint64_t rx_us) {
+    uint8_t report[IPERF_UDP_HEADER_LEN + IPERF_SERVER_REPORT_LEN];
+    uint8_t *r = &report[IPERF_UDP_HEADER_LEN];
+    uint64_t duration_us = rx_us - udp_start_us;
+    int32_t id;
+    struct pbuf *reply;
+
+    pbuf_copy_partial(p, report, IPERF_UDP_HEADER_LEN, 0);
+    pbuf_free(p);
+    id = (int32_t)get_be32(report);
+
+    if(udp_active) {
+        udp_active = false;
+        record(THROUGHPUT_UDP, udp_bytes, (uint32_t)(duration_us / 1000), false);
+    }
+
+    memset(r, 0, IPERF_SERVER_REPORT_LEN);
+    put_be32(&r[0], IPERF_HEADER_VERSION1);
+    put_be32(&r[8], udp_bytes);
+    put_be32(&r[12], (uint32_t)(duration_us / 1000000));
+    put_be32(&r[16], (uint32_t)(duration_us % 1000000));
+    put_be32(&r[20], udp_stats.lost);
+    put_be32(&r[24], udp_stats.out_of_order);
+    put_be32(&r[28], (uint32_t)-id);
+    put_be32(&r[32], udp_stats.jitter_us / 1000000);
+    put_be32(&r[36], udp_stats.jitter_us % 1000000);
+
+    reply = pbuf_alloc(PBUF_TRANSPORT, sizeof(report), PBUF_RAM);
+    if(reply != NULL) {
+        pbuf_take(reply, report, sizeof(report));
+        if(udp_sendto(pcb, reply, addr, port) == ERR_OK) {
+            udp_stats.reports++;
+        }
+        pbuf_free(reply);
+    }
+}
+
+
+void ThroughputServer::udp_recv_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr,
+                                         u16_t port) {
+    uint64_t rx_us = time_us_64();
+    ThroughputServer *server = (ThroughputServer *)arg;
+    uint8_t id[4];
+
+    if(p->tot_len < IPERF_UDP_HEADER_LEN || pbuf_copy_partial(p, id, sizeof(id), 0) != sizeof(id)) {
+        pbuf_free(p);
+        return;
+    }
+    if((int32_t)get_be32(id) < 0) {
+        server->udp_report(pcb, p, addr, port, rx_us);
+        return;
+    }
+    server->udp_datagram(p, rx_us);
+    pbuf_free(p);
+}
+
+
+/***
+ * Starts lwiperf and the UDP sink, then serves netconn clients one at a
+ * time. Received pbufs are freed as they come, which is what opens the
+ * window again.
+ */
+void ThroughputServer::netconn_task(void *params) {
+    ThroughputServer *server = (ThroughputServer *)params;
+    struct netconn *listener;
+
+    server->wifi->wait_for_wifi_init();
+
+    cyw43_arch_lwip_begin();
+    lwiperf_start_tcp_server(IP_ADDR_ANY, THROUGHPUT_RAW_PORT, lwiperf_report, server);
+    server->udp_sink_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    udp_bind(server->udp_sink_pcb, IP_ANY_TYPE, THROUGHPUT_RAW_PORT);
+    udp_recv(server->udp_sink_pcb, udp_recv_callback, server);
+    cyw43_arch_lwip_end();
+
+    listener = netconn_new(NETCONN_TCP);
+    netconn_bind(listener, IP_ADDR_ANY, THROUGHPUT_NETCONN_PORT);
+    netconn_listen(listener);
+
+    LOG_INFO("THROUGHPUT SERVERS ON TCP %d (RAW), %d (NETCONN), %d (SOCKETS) AND UDP %d",
+             THROUGHPUT_RAW_PORT, THROUGHPUT_NETCONN_PORT, THROUGHPUT_SOCKET_PORT, THROUGHPUT_RAW_PORT);
+
+    for(;;) {
+        struct netconn *conn;
+        struct pbuf *p;
+        uint64_t start_us;
+        uint32_t bytes = 0;
+        err_t err;
+
+        if(netconn_accept(listener, &conn) != ERR_OK) {
+            continue;
+        }
+        start_us = time_us_64();
+        while((err = netconn_recv_tcp_pbuf(conn, &p)) == ERR_OK) {
+            bytes += p->tot_len;
+            pbuf_free(p);
+        }
+        server->record(THROUGHPUT_NETCONN, bytes, (uint32_t)((time_us_64() - start_us) / 1000), err != ERR_CLSD);
+        netconn_close(conn);
+        netconn_delete(conn);
+    }
+}
+
+
+/***
+ * Serves socket clients one at a time, reading into a buffer the size of
+ * two segments.
+ */
+void ThroughputServer::socket_task(void *params) {
+    ThroughputServer *server = (ThroughputServer *)params;
+    struct sockaddr_in addr;
+    int listener;
+
+    server->wifi->wait_for_wifi_init();
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = lwip_htons(THROUGHPUT_SOCKET_PORT);
+    addr.sin_addr.s_addr = PP_HTONL(INADDR_ANY);
+
+    listener = lwip_socket(AF_INET, SOCK_STREAM, 0);
+    lwip_bind(listener, (struct sockaddr *)&addr, sizeof(addr));
+    lwip_listen(listener, 1);
+
+    for(;;) {
+        uint64_t start_us;
+        uint32_t bytes = 0;
+        int len;
+        int s = lwip_accept(listener, NULL, NULL);
+
+        if(s < 0) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        start_us = time_us_64();
+        while((len = lwip_recv(s, server->socket_buffer, sizeof(server->socket_buffer), 0)) > 0) {
+            bytes += (uint32_t)len;
+        }
+        server->record(THROUGHPUT_SOCKET, bytes, (uint32_t)((time_us_64() - start_us) / 1000), len < 0);
+        lwip_close(s);
+    }
+}
@@ -0,0 +1,140 @@
+#ifndef __THROUGHPUT_SERVER_H__
+#define __THROUGHPUT_SERVER_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "FreeRTOSConfig.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "static_task.h"
+#include "wifi.h"
+
+extern "C" {
+    #include "lwip/pbuf.h"
+    #include "lwip/udp.h"
+    #include "lwip/apps/lwiperf.h"
+}
+
+#ifndef THROUGHPUT_TASK_STACK_SIZE
+#define THROUGHPUT_TASK_STACK_SIZE  1024
+#endif
+
+// One port per API, so a client picks which one it measures. UDP shares the
+// raw TCP port, as iperf's does.
+#define THROUGHPUT_RAW_PORT         5001        // lwiperf, and iperf UDP
+#define THROUGHPUT_NETCONN_PORT     5002
+#define THROUGHPUT_SOCKET_PORT      5003
+
+#define THROUGHPUT_SOCKET_BUFFER    (2 * TCP_MSS)
+
+// iperf 2's UDP datagram header and the server report it wants back after
+// the last one, all big-endian
+#define IPERF_UDP_HEADER_LEN        12
+#define IPERF_SERVER_REPORT_LEN     40
+#define IPERF_HEADER_VERSION1       0x80000000
+
+
+typedef enum {
+    THROUGHPUT_RAW = 0,
+    THROUGHPUT_NETCONN,
+    THROUGHPUT_SOCKET,
+    THROUGHPUT_UDP,
+    THROUGHPUT_VARIANTS
+} throughput_variant_t;
+
+typedef struct {
+    uint32_t sessions;
+    uint32_t aborted;           // ended by an error rather than the client closing
+    uint32_t last_bytes;
+    uint32_t last_ms;
+    uint32_t last_kbps;
+    uint32_t best_kbps;
+} throughput_stats_t;
+
+typedef struct {
+    uint32_t datagrams;
+    uint32_t lost;              // gaps in the client's numbering
+    uint32_t out_of_order;
+    uint32_t jitter_us;         // RFC 3550 interarrival jitter
+    uint32_t reports;           // server reports sent back
+} throughput_udp_stats_t;
+
+
+/**
+ * The device end of an iperf 2 throughput test, receiving, once for each of
+ * lwIP's three APIs so they can be compared on the same build:
+ *   - raw: lwIP's own lwiperf server, in the tcpip thread;
+ *   - netconn: a task taking pbufs with netconn_recv_tcp_pbuf();
+ *   - sockets: a task reading into a buffer with lwip_recv();
+ *   - UDP: a raw-API sink that keeps iperf's loss, reordering and jitter
+ *     counts and answers the client's final datagram with iperf's server
+ *     report.
+ * `iperf -c <address> -p 5002` and so on measures each; the netconn and
+ * socket servers don't do iperf's dual or tradeoff modes.
+ *
+ * Every session's bytes, time and rate go into the variant's stats.
+ */
+class ThroughputServer {
+    public:
+        void init();
+        void set_wifi_connection(WifiConnection *wifi) { this->wifi = wifi; };
+        const throughput_stats_t *get_stats(throughput_variant_t variant) { return &stats[variant]; };
+        const throughput_udp_stats_t *get_udp_stats() { return &udp_stats; };
+        static const char *get_variant_name(throughput_variant_t variant);
+
+        static void netconn_task(void *params);
+        static void socket_task(void *params);
+        static void lwiperf_report(void *arg, enum lwiperf_report_type report_type,
+                                   const ip_addr_t *local_addr, u16_t local_port,
+                                   const ip_addr_t *remote_addr, u16_t remote_port,
+                                   u32_t bytes_transferred, u32_t ms_duration, u32_t bandwidth_kbitpsec);
+        static void udp_recv_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr,
+                                      u16_t port);
+
+        static ThroughputServer& getInstance() {
+            static ThroughputServer instance;
+            return instance;
+        }
+
+    private:
+        ThroughputServer() {
+            wifi = NULL;
+            udp_sink_pcb = NULL;
+            netconn_task_handle = (TaskHandle_t)0;
+            socket_task_handle = (TaskHandle_t)0;
+            memset(stats, 0, sizeof(stats));
+            memset(&udp_stats, 0, sizeof(udp_stats));
+            udp_active = false;
+            udp_next_id = 0;
+            udp_bytes = 0;
+            udp_start_us = 0;
+            udp_last_transit_us = 0;
+            udp_jitter_16 = 0;
+        };
+
+        void record(throughput_variant_t variant, uint32_t bytes, uint32_t ms, bool aborted);
+        void udp_datagram(struct pbuf *p, uint64_t rx_us);
+        void udp_report(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port,
+                        uint64_t rx_us);
+
+        WifiConnection *wifi;
+        struct udp_pcb *udp_sink_pcb;
+        TaskHandle_t netconn_task_handle;
+        StaticTask<THROUGHPUT_TASK_STACK_SIZE> netconn_task_storage;
+        TaskHandle_t socket_task_handle;
+        StaticTask<THROUGHPUT_TASK_STACK_SIZE> socket_task_storage;
+        uint8_t socket_buffer[THROUGHPUT_SOCKET_BUFFER];
+        throughput_stats_t stats[THROUGHPUT_VARIANTS];
+        throughput_udp_stats_t udp_stats;
+
+        // The UDP session in progress
+        bool udp_active;
+        int32_t udp_next_id;
+        uint32_t udp_bytes;
+        uint64_t udp_start_us;
+        int64_t udp_last_transit_us;
+        uint32_t udp_jitter_16;     // jitter in microseconds, times 16
+};
+
+#endif
@@ -0,0 +1,53 @@
+#include <string.h>
+#include "tx_pbufs.h"
+
+BLOCK_POOL_STORAGE(small_storage, TX_PBUF_BLOCK_SIZE(TX_PBUF_SMALL_LEN), TX_PBUF_SMALL_COUNT);
+BLOCK_POOL_STORAGE(large_storage, TX_PBUF_BLOCK_SIZE(TX_PBUF_LARGE_LEN), TX_PBUF_LARGE_COUNT);
+
+
+/**
+ * Sets up the pools. Called once, before anything sends.
+ */
+void TxPbufs::init() {
+    if(initialized) {
+        return;
+    }
+    block_pool_init(&small, "TX_SMALL", small_storage, TX_PBUF_BLOCK_SIZE(TX_PBUF_SMALL_LEN), TX_PBUF_SMALL_COUNT);
+    block_pool_init(&large, "TX_LARGE", large_storage, TX_PBUF_BLOCK_SIZE(TX_PBUF_LARGE_LEN), TX_PBUF_LARGE_COUNT);
+    initialized = true;
+}
+
+
+/***
+ * A PBUF_TRANSPORT pbuf with len bytes of payload, or NULL if its class is
+ * out of blocks or it's bigger than a log line.
+ */
+struct pbuf *TxPbufs::alloc(u16_t len) {
+    uint8_t *block = (uint8_t *)block_pool_alloc_from(pools, 2, TX_PBUF_BLOCK_SIZE(len));
+    struct pbuf_custom *custom = (struct pbuf_custom *)block;
+    block_pool_t *pool;
+    struct pbuf *p;
+
+    if(block == NULL) {
+        return NULL;
+    }
+    pool = block_pool_owns(&small, block) ? &small : &large;
+
+    custom->custom_free_function = free_pbuf;
+    p = pbuf_alloced_custom(PBUF_TRANSPORT, len, PBUF_RAM, custom, block + sizeof(struct pbuf_custom),
+                            (u16_t)(pool->block_size - sizeof(struct pbuf_custom)));
+    if(p == NULL) {
+        block_pool_free(pool, block);
+    }
+    return p;
+}
+
+
+/***
+ * lwIP calls this when the last reference to one of ours goes, from whichever
+ * task or thread let go of it.
+ */
+void TxPbufs::free_pbuf(struct pbuf *p) {
+    TxPbufs& tx_pbufs = TxPbufs::getInstance();
+    block_pool_free_to(tx_pbufs.pools, 2, p);
+}
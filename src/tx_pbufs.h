@@ -0,0 +1,59 @@
+#ifndef __TX_PBUFS_H__
+#define __TX_PBUFS_H__
+
+#include <stdlib.h>
+#include "pico/stdlib.h"
+#include "block_pool.h"
+
+extern "C" {
+    #include "lwip/pbuf.h"
+}
+
+// Payload sizes of the two classes: NTP and LAN time messages, and log lines
+#define TX_PBUF_SMALL_LEN       64
+#define TX_PBUF_SMALL_COUNT     8
+#define TX_PBUF_LARGE_LEN       160
+#define TX_PBUF_LARGE_COUNT     4
+
+// Room for the UDP, IP and Ethernet headers in front of the payload
+#define TX_PBUF_HEADROOM        LWIP_MEM_ALIGN_SIZE(PBUF_LINK_ENCAPSULATION_HLEN + PBUF_LINK_HLEN + \
+                                                    PBUF_IP_HLEN + PBUF_TRANSPORT_HLEN)
+#define TX_PBUF_BLOCK_SIZE(len) (sizeof(struct pbuf_custom) + TX_PBUF_HEADROOM + (len))
+
+
+/**
+ * pbufs for the datagrams we send, from two fixed-block pools instead of
+ * lwIP's first-fit heap. Each block holds a custom pbuf and its payload, with
+ * room for the headers in front, and goes back to its pool when lwIP frees
+ * the pbuf. Allocating one never depends on how fragmented anything is, and
+ * each pool counts its high water mark and its failures, so a class that's
+ * too small shows up by name instead of as a full MEM_SIZE heap. Callers
+ * hold the lwIP lock, as they would for pbuf_alloc().
+ */
+class TxPbufs {
+    public:
+        void init();
+        struct pbuf *alloc(u16_t len);
+        const block_pool_t *get_pool(int index) { return pools[index]; };
+
+        static TxPbufs& getInstance() {
+            static TxPbufs instance;
+            return instance;
+        }
+
+    private:
+        TxPbufs() {
+            pools[0] = &small;
+            pools[1] = &large;
+            initialized = false;
+        };
+
+        static void free_pbuf(struct pbuf *p);
+
+        block_pool_t small;
+        block_pool_t large;
+        block_pool_t *pools[2];
+        bool initialized;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <string.h>
+#include "udp_log_sink.h"
+#include "tx_pbufs.h"
+#include "ip_checksum.h"
+#include "pico/cyw43_arch.h"
+
+
+void UdpLogSink::set_destination(const uint8_t *ip) {
+    IP_ADDR4(&destination, ip[0], ip[1], ip[2], ip[3]);
+}
+
+
+/***
+ * Logger sink: runs on the log task, so it's free to take the lwIP lock.
+ * Associated isn't enough; until DHCP has bound an address the lines would
+ * go nowhere, so they go to stdout instead.
+ */
+void UdpLogSink::sink(const char *line, size_t len, void *context) {
+    UdpLogSink *udp_sink = (UdpLogSink *)context;
+
+    if(udp_sink->wifi == NULL || !(udp_sink->wifi->get_events() & WIFI_EVENT_IP_BOUND)) {
+        fwrite(line, 1, len, stdout);
+        return;
+    }
+    udp_sink->send(line, len);
+}
+
+
+void UdpLogSink::send(const char *line, size_t len) {
+    struct pbuf *p;
+
+    cyw43_arch_lwip_begin();
+    if(pcb == NULL) {
+        pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+        ip_set_option(pcb, SOF_BROADCAST);
+    }
+    p = TxPbufs::getInstance().alloc((u16_t)len);
+    if(p != NULL) {
+#if LWIP_CHECKSUM_ON_COPY && CHECKSUM_GEN_UDP
+        // Sums the line on the way into the pbuf, so lwIP doesn't read it again
+        u16_t chksum = ip_checksum_copy(p->payload, line, (u16_t)len);
+        udp_sendto_chksum(pcb, p, &destination, LOG_UDP_PORT, 1, chksum);
+#else
+        memcpy(p->payload, line, len);
+        udp_sendto(pcb, p, &destination, LOG_UDP_PORT);
+#endif
+        pbuf_free(p);
+    }
+    cyw43_arch_lwip_end();
+}
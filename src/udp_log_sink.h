@@ -0,0 +1,48 @@
+#ifndef __UDP_LOG_SINK_H__
+#define __UDP_LOG_SINK_H__
+
+#include <stdlib.h>
+#include "pico/stdlib.h"
+#include "wifi.h"
+#include "logger.h"
+
+extern "C" {
+    #include "lwip/pbuf.h"
+    #include "lwip/udp.h"
+}
+
+#define LOG_UDP_PORT                4051
+
+
+/**
+ * A Logger sink that sends each line as a UDP datagram to LOG_UDP_PORT on a
+ * chosen host, or broadcasts it if none is chosen. Until wifi is up, and
+ * whenever it's down, lines go to stdout instead.
+ */
+class UdpLogSink {
+    public:
+        void set_destination(const uint8_t *ip);
+        void set_wifi_connection(WifiConnection *wifi) { this->wifi = wifi; };
+
+        static void sink(const char *line, size_t len, void *context);
+
+        static UdpLogSink& getInstance() {
+            static UdpLogSink instance;
+            return instance;
+        }
+
+    private:
+        UdpLogSink() {
+            wifi = NULL;
+            pcb = NULL;
+            ip_addr_copy(destination, *IP_ADDR_BROADCAST);
+        };
+
+        void send(const char *line, size_t len);
+
+        WifiConnection *wifi;
+        struct udp_pcb *pcb;
+        ip_addr_t destination;
+};
+
+#endif
@@ -7,110 +7,668 @@
 
 #include <time.h>
 #include "wifi.h"
+#include "logger.h"
 #include "pico/cyw43_arch.h"
 #include "FreeRTOS.h"
 #include "task.h"
+#include "lwip/dhcp.h"
+#include "lwip/dns.h"
+#include "lwip/prot/dhcp.h"
 
 
 /***
  * Initialize the CYW43 network controller and connect to the wireless network specified by
  * the SSID and password set in the class. If the connection fails, continue retrying periodically.
- * All of this work happens in the WifiConnection::connect_task() FreeRTOS task, which this function 
- * creates.
+ * All of this work happens on the event loop, which has to be set with set_event_loop() first;
+ * this just gets it started.
  */
 void WifiConnection::init() {
-    if(init_event_group == NULL) {
-        init_event_group = xEventGroupCreate();
+    if(state_event_group == NULL) {
+#if configSUPPORT_STATIC_ALLOCATION
+        state_event_group = xEventGroupCreateStatic(&state_event_group_storage);
+#else
+        state_event_group = xEventGroupCreate();
+#endif
     }
 
-    int r = xTaskCreate(connect_task, "Wifi Task", 1024, this, 2, &wifi_task_handle);
+    loop->post(start, this);
 }
 
 
-void WifiConnection::connect_task(void *params) {
-    TaskHandle_t task;
+/***
+ * Takes the network settings from a stored configuration: SSID and password,
+ * the power policy's latency budget (STRIP_PM_BUDGET_AWAKE is a budget of 0,
+ * STRIP_PM_BUDGET_DEFAULT is WIFI_POWER_BUDGET_DEFAULT_MS), and, if use_dhcp is false, the static
+ * address to use instead of DHCP. The configuration has to outlive the
+ * connection, since the SSID and password aren't copied.
+ */
+void WifiConnection::configure(const led_strip_config_t *config) {
+    if(config->pm_latency_budget == STRIP_PM_BUDGET_DEFAULT) {
+        set_power_latency_budget(WIFI_POWER_BUDGET_DEFAULT_MS);
+    } else if(config->pm_latency_budget == STRIP_PM_BUDGET_AWAKE) {
+        set_power_latency_budget(0);
+    } else {
+        set_power_latency_budget(config->pm_latency_budget * STRIP_PM_BUDGET_STEP_MS);
+    }
+    set_ssid(config->wifi_ssid);
+    set_password(config->wifi_password);
+    set_use_dhcp(config->use_dhcp);
+    if(!config->use_dhcp) {
+        set_static_ip(config->ip, config->netmask, config->gateway);
+    }
+}
+
+
+void WifiConnection::set_static_ip(const uint8_t *ip, const uint8_t *netmask, const uint8_t *gateway) {
+    IP4_ADDR(&static_ip, ip[0], ip[1], ip[2], ip[3]);
+    IP4_ADDR(&static_netmask, netmask[0], netmask[1], netmask[2], netmask[3]);
+    IP4_ADDR(&static_gateway, gateway[0], gateway[1], gateway[2], gateway[3]);
+}
+
+
+/***
+ * Low latency turns power saving off; performance is PM2, back to sleep 20ms
+ * after the last packet and awake for every beacon; power save is PM1, which
+ * sleeps straight away and polls the access point for buffered packets at
+ * each DTIM.
+ */
+void WifiConnection::apply_power_mode(power_mode_t mode) {
+    static const uint32_t cyw43_pm[POWER_MODE_COUNT] = { CYW43_NONE_PM, CYW43_PERFORMANCE_PM, CYW43_AGGRESSIVE_PM };
+
+    if(cyw43_wifi_pm(&cyw43_state, cyw43_pm[mode]) != 0) {
+        LOG_WARN("CYW43 PM CHANGE FAILED");
+        return;
+    }
+    power_mode = mode;
+    LOG_INFO("WIFI POWER MODE %s", PowerPolicy::get_mode_name(mode));
+}
+
+
+/***
+ * Skips DHCP entirely: the CYW43 driver starts the DHCP client when STA mode
+ * comes up, so stop it and give the interface its address before joining.
+ * The link is reported up as soon as association completes, since the
+ * interface already has an address. With no DHCP there's no DNS server from
+ * the lease either, so the gateway gets that job.
+ */
+void WifiConnection::apply_static_ip() {
+    struct netif *n = &cyw43_state.netif[CYW43_ITF_STA];
+    ip_addr_t dns_server;
+    char ip_str[20];
+
+    ip_addr_copy_from_ip4(dns_server, static_gateway);
+
+    cyw43_arch_lwip_begin();
+    dhcp_release_and_stop(n);
+    netif_set_addr(n, &static_ip, &static_netmask, &static_gateway);
+    dns_setserver(0, &dns_server);
+    cyw43_arch_lwip_end();
+
+    LOG_INFO("USING STATIC IP %s", ip4addr_ntoa_r(&static_ip, ip_str, sizeof(ip_str)));
+}
+
+
+/***
+ * The loop's first job. cyw43_arch_init() is the one step that blocks, and
+ * only this once, at boot. CYW43 link status appears to be inaccurate before
+ * the first attempt to join the network, so the supervision starts with a
+ * join rather than a look at the link.
+ */
+void WifiConnection::start(void *arg) {
+    WifiConnection *wifi = (WifiConnection *)arg;
+
+    LOG_INFO("WIFI STARTING");
+
+    if(cyw43_arch_init()) {
+        LOG_WARN("CYW43 INIT FAILED, WIFI STOPPED");
+        return;
+    }
+
+    LOG_INFO("CYW43 ARCH INIT COMPLETE");
+
+    wifi->power_policy.reset(time_us_64());
+    wifi->apply_power_mode(wifi->power_fixed ? wifi->fixed_power_mode : wifi->power_policy.get_mode());
+
+    LOG_INFO("CYW43 WIFI PM INIT COMPLETE");
+
+    // With no filter there's no traffic to go by, so the mode stays put
+    if(!wifi->power_fixed && wifi->packet_filter) {
+        wifi->power_packets = wifi->packet_filter->get_stats()->accepted;
+        wifi->loop->schedule(POWER_SAMPLE_MS, power_sample, wifi);
+    }
+
+    wifi->raise(WIFI_EVENT_CYW43_UP);
+    wifi->loop->set_conditions(EVENT_CYW43_READY);
+
+    LOG_INFO("JOINING '%s'", wifi->get_ssid());
+    wifi->begin_join();
+}
+
+
+/***
+ * The one timer the supervision ever has running: how long until the join in
+ * progress is looked at again, or until the link is.
+ */
+void WifiConnection::poll(void *arg) {
+    WifiConnection *wifi = (WifiConnection *)arg;
+
+    wifi->timer = EVENT_TIMER_NONE;
+    switch(wifi->state) {
+        case WIFI_STATE_FAST_JOINING:
+            wifi->check_fast_join();
+            break;
+        case WIFI_STATE_JOINING:
+            wifi->check_full_join();
+            break;
+        case WIFI_STATE_UP:
+            wifi->check_link();
+            break;
+        default:
+            break;
+    }
+}
+
+
+/***
+ * Posted by the netif callbacks: whatever the state, look now rather than
+ * at the next poll. Waiting out a backoff isn't cut short.
+ */
+void WifiConnection::link_event(void *arg) {
+    WifiConnection *wifi = (WifiConnection *)arg;
+
+    if(wifi->state == WIFI_STATE_BACKOFF || wifi->state == WIFI_STATE_IDLE) {
+        return;
+    }
+    wifi->loop->cancel(&wifi->timer);
+    poll(wifi);
+}
+
+
+/***
+ * Posted from the netif callbacks, so that listeners hear about the link on
+ * the loop rather than on the tcpip thread. The link can have gone again by
+ * the time this runs.
+ */
+void WifiConnection::associated_event(void *arg) {
+    WifiConnection *wifi = (WifiConnection *)arg;
+
+    if(netif_is_link_up(&cyw43_state.netif[CYW43_ITF_STA])) {
+        wifi->raise(WIFI_EVENT_ASSOCIATED);
+    }
+}
+
+
+void WifiConnection::link_lost_event(void *arg) {
+    ((WifiConnection *)arg)->raise(WIFI_EVENT_LINK_LOST);
+}
+
+
+/***
+ * Every POWER_SAMPLE_MS for as long as the node runs, joined or not: what the
+ * packet filter let in since last time goes to the policy, and the radio
+ * changes mode if the policy says so.
+ */
+void WifiConnection::power_sample(void *arg) {
+    WifiConnection *wifi = (WifiConnection *)arg;
+    uint32_t accepted = wifi->packet_filter->get_stats()->accepted;
+    uint32_t packets = accepted >= wifi->power_packets ? accepted - wifi->power_packets : accepted;
+    power_mode_t mode;
+
+    wifi->power_packets = accepted;
+    mode = wifi->power_policy.sample(time_us_64(), packets);
+    if(mode != wifi->power_mode) {
+        wifi->apply_power_mode(mode);
+    }
+    wifi->loop->schedule(POWER_SAMPLE_MS, power_sample, wifi);
+}
+
+
+void WifiConnection::retry(void *arg) {
+    WifiConnection *wifi = (WifiConnection *)arg;
+
+    wifi->timer = EVENT_TIMER_NONE;
+    LOG_INFO("JOINING '%s'", wifi->get_ssid());
+    if(wifi->retry_full_join) {
+        wifi->begin_full_join();
+    }
+    else {
+        wifi->begin_join();
+    }
+}
+
+
+/***
+ * Tries the access point we were last on first, if we know it, with a
+ * directed join: with the BSSID and channel the radio doesn't have to scan,
+ * which on a crowded 2.4GHz band is most of the time a join takes. The full
+ * join (the SDK's scan) is the fallback.
+ */
+void WifiConnection::begin_join() {
+    const char *pw = get_password();
+    uint32_t auth = pw ? (uint32_t)get_wifi_auth() : CYW43_AUTH_OPEN;
+
+    cyw43_arch_enable_sta_mode();
+    watch_netif();
+    if(!use_dhcp) {
+        apply_static_ip();
+    }
+    join_attempts = 0;
+
+    if(!reconnect_cache.valid) {
+        begin_full_join();
+        return;
+    }
+
+    if(use_dhcp) {
+        prime_dhcp();
+    }
+
+    LOG_INFO("FAST REJOIN TO %02X:%02X:%02X:%02X:%02X:%02X ON CHANNEL %u",
+             reconnect_cache.bssid[0], reconnect_cache.bssid[1], reconnect_cache.bssid[2],
+             reconnect_cache.bssid[3], reconnect_cache.bssid[4], reconnect_cache.bssid[5],
+             reconnect_cache.channel);
+
+    if(cyw43_wifi_join(&cyw43_state, strlen(get_ssid()), (const uint8_t *)get_ssid(), pw ? strlen(pw) : 0,
+                       (const uint8_t *)pw, auth, reconnect_cache.bssid, reconnect_cache.channel) != 0) {
+        link_stats.fast_join_failures++;
+        LOG_WARN("FAST REJOIN FAILED, SCANNING");
+        begin_full_join();
+        return;
+    }
+
+    state = WIFI_STATE_FAST_JOINING;
+    join_deadline_us = time_us_64() + (uint64_t)WIFI_FAST_JOIN_TIMEOUT_MS * 1000;
+    timer = loop->schedule(WIFI_JOIN_POLL_MS, poll, this);
+}
+
+
+/***
+ * Gives up on a directed join quickly if the access point isn't there or
+ * won't have us, since the full join is still to come.
+ */
+void WifiConnection::check_fast_join() {
+    int status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+
+    if(status == CYW43_LINK_UP) {
+        joined(true);
+        return;
+    }
+    if(status >= 0 && time_us_64() < join_deadline_us) {
+        timer = loop->schedule(WIFI_JOIN_POLL_MS, poll, this);
+        return;
+    }
+
+    cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+    link_stats.fast_join_failures++;
+    LOG_WARN("FAST REJOIN FAILED, SCANNING");
+    begin_full_join();
+}
+
+
+/***
+ * What cyw43_arch_wifi_connect_timeout_ms() does, without sitting in a loop
+ * to do it: start the join, then check on it every WIFI_JOIN_POLL_MS.
+ */
+void WifiConnection::begin_full_join() {
+    LOG_INFO("CONNECTING TO NETWORK '%s'", get_ssid());
+
+    join_attempts++;
+    if(cyw43_arch_wifi_connect_async(get_ssid(), get_password(), get_wifi_auth()) != 0) {
+        join_failed();
+        return;
+    }
+
+    state = WIFI_STATE_JOINING;
+    join_deadline_us = time_us_64() + (uint64_t)get_wifi_connect_timeout() * 1000;
+    timer = loop->schedule(WIFI_JOIN_POLL_MS, poll, this);
+}
+
+
+/***
+ * Like the SDK's connect loop, asks again if the access point wasn't found,
+ * until the connect timeout runs out.
+ */
+void WifiConnection::check_full_join() {
+    int status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+
+    if(status == CYW43_LINK_UP) {
+        joined(false);
+        return;
+    }
+    if(time_us_64() >= join_deadline_us || (status < 0 && status != CYW43_LINK_NONET)) {
+        join_failed();
+        return;
+    }
+    if(status == CYW43_LINK_NONET &&
+       cyw43_arch_wifi_connect_async(get_ssid(), get_password(), get_wifi_auth()) != 0) {
+        join_failed();
+        return;
+    }
+    timer = loop->schedule(WIFI_JOIN_POLL_MS, poll, this);
+}
+
+
+void WifiConnection::joined(bool fast) {
     uint8_t ip[4];
     char ip_str[20];
 
-    WifiConnection *wifi_utils = (WifiConnection *)params;
+    if(fast) {
+        link_stats.fast_joins++;
+    }
+    else {
+        link_stats.full_joins++;
+    }
+    backoff_ms = 0;
+    join_attempts = 0;
+    update_reconnect_cache();
+
+    LOG_INFO("JOINED '%s'", get_ssid());
+    if(get_ip_address(ip)) {
+        ip_to_string(ip, ip_str);
+        LOG_INFO("IP ADDRESS: %s", ip_str);
+    }
+
+    state = WIFI_STATE_UP;
+    check_link();
+}
+
 
-    printf("WIFI CONNECT TASK STARTING\n");
+/***
+ * A full join gets get_wifi_connect_retries() attempts, with a backoff
+ * between them, before the whole thing starts over from the fast join.
+ */
+void WifiConnection::join_failed() {
+    LOG_WARN("FAILED TO JOIN NETWORK");
+    link_stats.join_failures++;
 
-    int res = cyw43_arch_init();
-    if(res) {
-        printf("CYW43 INIT FAILED, EXITING connect_task\n");
-        sleep_ms(50);
-        vTaskDelete(NULL);
+    if(join_attempts >= get_wifi_connect_retries()) {
+        LOG_WARN("FAILED TO JOIN '%s'", get_ssid());
+        backoff(false);
+    }
+    else {
+        backoff(true);
     }
+}
+
+
+/***
+ * Joined, the connection looks at the link every WIFI_POLL_MS and whenever
+ * lwIP says something changed on the STA interface: the link going down (the
+ * CYW43 driver reports deauthentication, disassociation and beacon loss this
+ * way), or the address changing. Consumers are cut off in the netif callback
+ * itself, and rejoining starts here, straight away.
+ */
+void WifiConnection::check_link() {
+    uint8_t ip[4];
+
+    if(is_link_up()) {
+        if(!connected) {
+            link_restored();
+        }
+        else if(get_ip_address(ip) && memcmp(ip, bound_ip, 4) != 0) {
+            // A new lease without the link ever going down
+            memcpy(bound_ip, ip, 4);
+            LOG_INFO("IP ADDRESS CHANGED");
+            raise(WIFI_EVENT_IP_CHANGED);
+        }
+        last_seen_up_us = time_us_64();
+        timer = loop->schedule(WIFI_POLL_MS, poll, this);
+        return;
+    }
+
+    if(connected) {
+        // The callbacks didn't catch it, so the best we can say is that it
+        // went down some time after we last looked
+        link_lost(last_seen_up_us, false);
+    }
+    clear_states(WIFI_EVENT_IP_BOUND);
+
+    LOG_WARN("NOT CONNECTED TO WIFI");
+    LOG_INFO("JOINING '%s'", get_ssid());
+    begin_join();
+}
 
-    printf("CYW43 ARCH INIT COMPLETE\n");
 
-    cyw43_wifi_pm(&cyw43_state, CYW43_PERFORMANCE_PM);
+/***
+ * Sets the DHCP client up to ask for the cached lease back (INIT-REBOOT, one
+ * REQUEST and one ACK) when the link comes up, instead of starting over with
+ * DISCOVER. lwIP does this on its own when the lease is still bound, so this
+ * only matters after a reboot or once the client has given the lease up. If
+ * the server says no, lwIP falls back to DISCOVER by itself.
+ */
+void WifiConnection::prime_dhcp() {
+    struct netif *n = &cyw43_state.netif[CYW43_ITF_STA];
+    const uint8_t *ip = reconnect_cache.ip;
+    ip_addr_t dns_server;
+    struct dhcp *dhcp;
+
+    if((ip[0] | ip[1] | ip[2] | ip[3]) == 0) {
+        return;
+    }
 
-    printf("CYW43 WIFI PM INIT COMPLETE\n");
+    cyw43_arch_lwip_begin();
+    dhcp = netif_dhcp_data(n);
+    if(dhcp != NULL && dhcp->state != DHCP_STATE_BOUND) {
+        IP4_ADDR(&dhcp->offered_ip_addr, ip[0], ip[1], ip[2], ip[3]);
+        IP4_ADDR(&dhcp->offered_sn_mask, reconnect_cache.netmask[0], reconnect_cache.netmask[1],
+                 reconnect_cache.netmask[2], reconnect_cache.netmask[3]);
+        IP4_ADDR(&dhcp->offered_gw_addr, reconnect_cache.gateway[0], reconnect_cache.gateway[1],
+                 reconnect_cache.gateway[2], reconnect_cache.gateway[3]);
+        dhcp->state = DHCP_STATE_REBOOTING;
+        dhcp->tries = 0;
+
+        IP_ADDR4(&dns_server, reconnect_cache.dns[0], reconnect_cache.dns[1],
+                 reconnect_cache.dns[2], reconnect_cache.dns[3]);
+        dns_setserver(0, &dns_server);
+    }
+    cyw43_arch_lwip_end();
+}
 
-    wifi_utils->unblock_cyw43_init();
 
-    // CYW43 link status appears to be inaccurate before the first attempt to join the 
-    // network, so join before we loop
-    printf("JOINING '%s'\n", wifi_utils->get_ssid());
-    if(wifi_utils->join()) {
-        wifi_utils->get_ip_address(ip);
-        wifi_utils->ip_to_string(ip, ip_str);
-        printf("IP ADDRESS: %s\n", ip_str);
+/***
+ * Remembers where we just joined, and with which lease. The flash copy is
+ * only rewritten when something actually changed, so rejoining the same
+ * access point over and over costs nothing.
+ */
+void WifiConnection::update_reconnect_cache() {
+    struct netif *n = &cyw43_state.netif[CYW43_ITF_STA];
+    wifi_reconnect_cache_t cache;
+    uint32_t channel_info[3];
+
+    memset(&cache, 0, sizeof(cache));
+    if(cyw43_wifi_get_bssid(&cyw43_state, cache.bssid) != 0) {
+        return;
+    }
+    if(cyw43_ioctl(&cyw43_state, CYW43_IOCTL_GET_CHANNEL, sizeof(channel_info), (uint8_t *)channel_info,
+                   CYW43_ITF_STA) != 0) {
+        return;
     }
+    cache.channel = (uint8_t)channel_info[0];
+
+    if(use_dhcp) {
+        cyw43_arch_lwip_begin();
+        memcpy(cache.ip, netif_ip4_addr(n), 4);
+        memcpy(cache.netmask, netif_ip4_netmask(n), 4);
+        memcpy(cache.gateway, netif_ip4_gw(n), 4);
+        memcpy(cache.dns, ip_2_ip4(dns_getserver(0)), 4);
+        cyw43_arch_lwip_end();
+    }
+    cache.valid = true;
 
-    for(;;) {
-        if(wifi_utils->is_joined()) {
-            wifi_utils->unblock_wifi_init();
-            vTaskDelay(5000);
+    if(memcmp(&cache, &reconnect_cache, sizeof(cache)) != 0) {
+        memcpy(&reconnect_cache, &cache, sizeof(cache));
+        if(config_store && !config_store->save_reconnect_cache(&cache)) {
+            LOG_WARN("COULDN'T SAVE RECONNECT CACHE");
         }
-        else {
-            wifi_utils->block_wifi_init();
-            printf("NOT CONNECTED TO WIFI\n", wifi_utils->get_ssid());
-            printf("JOINING '%s'\n", wifi_utils->get_ssid());
-            if(wifi_utils->join()) {
-                printf("JOINED '%s'\n", wifi_utils->get_ssid());
-
-                // WifiConnection::getMACAddressStr(buffer);
-                // printf("MAC ADDRESS: %s\n", buffer);
-
-                wifi_utils->get_ip_address(ip);
-                wifi_utils->ip_to_string(ip, ip_str);
-                printf("IP ADDRESS: %s\n", ip_str);
-            }
-            else {
-                printf("FAILED TO JOIN '%s'\n", wifi_utils->get_ssid());
-            }
+    }
+}
+
+
+/***
+ * With a store, the reconnect cache survives reboots too: the first join
+ * after power-up can be a fast one.
+ */
+void WifiConnection::set_config_store(ConfigStore *store) {
+    config_store = store;
+    if(store && store->load_reconnect_cache(&reconnect_cache)) {
+        LOG_INFO("LOADED RECONNECT CACHE (CHANNEL %u)", reconnect_cache.channel);
+    }
+}
+
+
+/***
+ * Waits a bit longer after every failed attempt, from WIFI_BACKOFF_MIN_MS up
+ * to WIFI_BACKOFF_MAX_MS, so a missing access point doesn't get hammered.
+ * A successful join starts the next outage back at the minimum.
+ */
+void WifiConnection::backoff(bool full_join_next) {
+    if(backoff_ms == 0) {
+        backoff_ms = WIFI_BACKOFF_MIN_MS;
+    }
+    else if(backoff_ms < WIFI_BACKOFF_MAX_MS) {
+        backoff_ms *= 2;
+        if(backoff_ms > WIFI_BACKOFF_MAX_MS) {
+            backoff_ms = WIFI_BACKOFF_MAX_MS;
         }
     }
+
+    LOG_INFO("RETRYING IN %lu ms", (unsigned long)backoff_ms);
+    state = WIFI_STATE_BACKOFF;
+    retry_full_join = full_join_next;
+    timer = loop->schedule(backoff_ms, retry, this);
 }
 
 
-bool WifiConnection::join() {
-    cyw43_arch_enable_sta_mode();
+// The interface only exists once STA mode is enabled, so this happens on the
+// first join, and so does putting the packet filter in front of it
+void WifiConnection::watch_netif() {
+    struct netif *n = &cyw43_state.netif[CYW43_ITF_STA];
 
-    printf("CONNECTING TO NETWORK '%s'\n", get_ssid());
-
-    int r = -1;
-    int attempts = 0;
-    while(r < 0) {
-        attempts++;
-        r = cyw43_arch_wifi_connect_timeout_ms(get_ssid(), 
-                                               get_password(),
-                                               get_wifi_auth(),
-                                               get_wifi_connect_timeout());
-
-        if(r) {
-            printf("FAILED TO JOIN NETWORK\n");
-            if(attempts >= get_wifi_connect_retries()) {
-                return false;
-            }
-            vTaskDelay(2000);
+    if(netif_watched) {
+        return;
+    }
+
+    cyw43_arch_lwip_begin();
+    netif_set_link_callback(n, netif_link_callback);
+    netif_set_status_callback(n, netif_status_callback);
+    if(packet_filter) {
+        packet_filter->install(n);
+    }
+    cyw43_arch_lwip_end();
+
+    netif_watched = true;
+}
+
+
+// Joined, and with an address, which is what consumers actually care about
+bool WifiConnection::is_link_up() {
+    return cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA) == CYW43_LINK_UP;
+}
+
+
+/***
+ * These run with the lwIP core locked, on the tcpip thread or in the CYW43
+ * driver's async context, so they do as little as possible: a lost link is
+ * recorded and the states it takes away are cleared right here, so nobody
+ * waiting on them is let through late, and everything else, telling the
+ * listeners included, is posted to the event loop.
+ */
+void WifiConnection::netif_link_callback(struct netif *netif) {
+    WifiConnection& wifi = getInstance();
+
+    if(netif_is_link_up(netif)) {
+        wifi.loop->post(associated_event, &wifi);
+    }
+    else {
+        wifi.clear_states(WIFI_EVENT_ASSOCIATED);
+        wifi.link_lost(time_us_64(), true);
+    }
+    wifi.loop->post(link_event, &wifi);
+}
+
+
+void WifiConnection::netif_status_callback(struct netif *netif) {
+    WifiConnection& wifi = getInstance();
+
+    if(wifi.connected && (!netif_is_up(netif) || ip4_addr_isany_val(*netif_ip4_addr(netif)))) {
+        wifi.link_lost(time_us_64(), true);
+    }
+    wifi.loop->post(link_event, &wifi);
+}
+
+
+void WifiConnection::link_lost(uint64_t down_us, bool from_event) {
+    uint64_t now;
+    uint32_t latency;
+
+    taskENTER_CRITICAL();
+    if(!connected) {
+        taskEXIT_CRITICAL();
+        return;
+    }
+    connected = false;
+    taskEXIT_CRITICAL();
+
+    clear_states(WIFI_EVENT_IP_BOUND);
+    loop->clear_conditions(EVENT_WIFI_JOINED);
+    loop->post(link_lost_event, this);
+    now = time_us_64();
+    latency = (uint32_t)(now - down_us);
+
+    link_stats.link_downs++;
+    if(from_event) {
+        link_stats.event_detections++;
+    }
+    else {
+        link_stats.polled_detections++;
+    }
+    link_stats.last_link_down_us = down_us;
+    link_stats.last_detect_us = now;
+    link_stats.down_to_detect_last_us = latency;
+    if(latency > link_stats.down_to_detect_max_us) {
+        link_stats.down_to_detect_max_us = latency;
+    }
+    link_stats.down_to_detect_total_us += latency;
+
+    LOG_WARN("WIFI LINK LOST (%s)", from_event ? "EVENT" : "POLL");
+}
+
+
+/***
+ * Listeners hear IP_BOUND every time, and IP_CHANGED as well if the address
+ * isn't the one we had before the link went down.
+ */
+void WifiConnection::link_restored() {
+    uint64_t now = time_us_64();
+    uint8_t ip[4];
+    bool changed = false;
+
+    if(link_stats.link_downs > 0) {
+        uint32_t latency = (uint32_t)(now - link_stats.last_detect_us);
+
+        link_stats.rejoins++;
+        link_stats.last_rejoin_us = now;
+        link_stats.detect_to_rejoin_last_us = latency;
+        if(latency > link_stats.detect_to_rejoin_max_us) {
+            link_stats.detect_to_rejoin_max_us = latency;
         }
+        link_stats.detect_to_rejoin_total_us += latency;
+
+        LOG_INFO("WIFI LINK RESTORED AFTER %lu ms", (unsigned long)(latency / 1000));
+    }
+
+    if(get_ip_address(ip)) {
+        changed = (bound_ip[0] | bound_ip[1] | bound_ip[2] | bound_ip[3]) != 0 && memcmp(ip, bound_ip, 4) != 0;
+        memcpy(bound_ip, ip, 4);
     }
 
-    return true;
+    connected = true;
+    raise(WIFI_EVENT_IP_BOUND);
+    if(changed) {
+        LOG_INFO("IP ADDRESS CHANGED");
+        raise(WIFI_EVENT_IP_CHANGED);
+    }
+    loop->set_conditions(EVENT_WIFI_JOINED);
 }
 
 
@@ -215,43 +773,137 @@ bool WifiConnection::is_joined() {
 }
 
 
-void WifiConnection::unblock_wifi_init() { 
-    xEventGroupSetBits(init_event_group, WIFI_INIT_COMPLETE_BIT); 
+/***
+ * Calls back on the event loop with each of the events (WIFI_EVENT_*) asked
+ * for, as it happens. Events aren't replayed, so a listener that subscribes
+ * late should look at get_events() afterwards for the states that already
+ * hold. Returns WIFI_LISTENER_NONE if every slot is taken.
+ */
+wifi_listener_t WifiConnection::subscribe(uint32_t events, wifi_event_callback_t callback, void *arg) {
+    return add_listener(events, callback, arg, NULL);
 }
 
 
-void WifiConnection::unblock_cyw43_init() { 
-    xEventGroupSetBits(init_event_group, CYW43_INIT_COMPLETE_BIT); 
-};
+/***
+ * The same, but sets each event's bit in the task's notification value
+ * instead, for the task to pick up with take_events(). Bits that pile up
+ * between takes come out together, in no particular order, so get_events()
+ * is the word on what holds now. The task can't use its notification value
+ * for anything else.
+ */
+wifi_listener_t WifiConnection::subscribe_task(uint32_t events, TaskHandle_t task) {
+    return add_listener(events, NULL, NULL, task);
+}
+
 
+wifi_listener_t WifiConnection::add_listener(uint32_t events, wifi_event_callback_t callback, void *arg,
+                                             TaskHandle_t task) {
+    for(int i = 0; i < WIFI_MAX_LISTENERS; i++) {
+        listener_slot_t *listener = &listeners[i];
+
+        taskENTER_CRITICAL();
+        if(!listener->active) {
+            listener->events = events;
+            listener->callback = callback;
+            listener->arg = arg;
+            listener->task = task;
+            listener->active = true;
+            taskEXIT_CRITICAL();
+            return i;
+        }
+        taskEXIT_CRITICAL();
+    }
 
-void WifiConnection::block_wifi_init() { 
-    xEventGroupClearBits(init_event_group, WIFI_INIT_COMPLETE_BIT);
-};
+    LOG_WARN("WIFI OUT OF LISTENERS");
+    return WIFI_LISTENER_NONE;
+}
 
 
-bool WifiConnection::wait_for_wifi_init() {
-    EventBits_t bits = xEventGroupWaitBits(
-        init_event_group,
-        WIFI_INIT_COMPLETE_BIT,
-        pdFALSE,              // Don't clear bits after waiting
-        pdTRUE,               // Wait for all bits (just one in this case)
-        portMAX_DELAY
-    );
+/***
+ * Takes the listener out, and forgets the handle. A callback that is already
+ * on its way can still arrive if this isn't called from the event loop.
+ */
+void WifiConnection::unsubscribe(wifi_listener_t *listener) {
+    if(*listener != WIFI_LISTENER_NONE) {
+        taskENTER_CRITICAL();
+        listeners[*listener].active = false;
+        taskEXIT_CRITICAL();
+        *listener = WIFI_LISTENER_NONE;
+    }
+}
+
+
+/***
+ * For a task listener: waits up to timeout for any events, and returns the
+ * ones that came (0 if none did).
+ */
+uint32_t WifiConnection::take_events(TickType_t timeout) {
+    uint32_t bits = 0;
 
-    return (bits & WIFI_INIT_COMPLETE_BIT);
+    xTaskNotifyWait(0, WIFI_EVENT_ALL, &bits, timeout);
+    return bits & WIFI_EVENT_ALL;
 }
 
 
-bool WifiConnection::wait_for_cyw43_init() {
+// The states (WIFI_EVENT_STATES) that hold right now
+uint32_t WifiConnection::get_events() {
+    return state_event_group ? (uint32_t)xEventGroupGetBits(state_event_group) & WIFI_EVENT_STATES : 0;
+}
+
+
+/***
+ * Blocks until every one of the states holds, or timeout goes by. Returns
+ * whether they all held.
+ */
+bool WifiConnection::wait_for(uint32_t states, TickType_t timeout) {
+    states &= WIFI_EVENT_STATES;
+
     EventBits_t bits = xEventGroupWaitBits(
-        init_event_group,
-        CYW43_INIT_COMPLETE_BIT,
+        state_event_group,
+        states,
         pdFALSE,              // Don't clear bits after waiting
-        pdTRUE,               // Wait for all bits (just one in this case)
-        portMAX_DELAY
+        pdTRUE,               // Wait for all of them
+        timeout
     );
 
-    return (bits & CYW43_INIT_COMPLETE_BIT);
+    return (bits & states) == states;
+}
+
+
+/***
+ * Runs on the event loop. A state is set before anyone is told about it, so
+ * a listener that looks finds it already holds.
+ */
+void WifiConnection::raise(uint32_t event) {
+    if(event & WIFI_EVENT_STATES) {
+        set_states(event);
+    }
+
+    for(int i = 0; i < WIFI_MAX_LISTENERS; i++) {
+        listener_slot_t listener;
+
+        taskENTER_CRITICAL();
+        listener = listeners[i];
+        taskEXIT_CRITICAL();
+
+        if(!listener.active || !(listener.events & event)) {
+            continue;
+        }
+        if(listener.callback) {
+            listener.callback(listener.arg, event);
+        }
+        else if(listener.task) {
+            xTaskNotify(listener.task, event, eSetBits);
+        }
+    }
+}
+
+
+void WifiConnection::set_states(uint32_t states) {
+    xEventGroupSetBits(state_event_group, states);
 }
 
+
+void WifiConnection::clear_states(uint32_t states) {
+    xEventGroupClearBits(state_event_group, states);
+}
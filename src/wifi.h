@@ -8,22 +8,110 @@
 #define SRC_WIFIHELPER_H_
 
 #include <stdlib.h>
+#include <string.h>
 #include "pico/stdlib.h"
 #include "FreeRTOSConfig.h"
 #include "FreeRTOS.h"
+#include "task.h"
 #include "event_groups.h"
+#include "event_loop.h"
 #include "pico/cyw43_arch.h"
+#include "strip_config.h"
+#include "config_store.h"
+#include "packet_filter.h"
+#include "power_policy.h"
 
 
-#define CYW43_INIT_COMPLETE_BIT   0x1
-#define WIFI_INIT_COMPLETE_BIT    0x2
+// What a listener can subscribe to. The first three are also states, which
+// hold until they're undone and can be waited for with wait_for(); the last
+// two only happen.
+#define WIFI_EVENT_CYW43_UP       0x01    // the radio is initialized
+#define WIFI_EVENT_ASSOCIATED     0x02    // joined to the access point, maybe without an address yet
+#define WIFI_EVENT_IP_BOUND       0x04    // joined and with an address
+#define WIFI_EVENT_IP_CHANGED     0x08    // bound to a different address than last time
+#define WIFI_EVENT_LINK_LOST      0x10    // the link or the address went away
+#define WIFI_EVENT_ALL            0x1f
+#define WIFI_EVENT_STATES         (WIFI_EVENT_CYW43_UP | WIFI_EVENT_ASSOCIATED | WIFI_EVENT_IP_BOUND)
 
+#define WIFI_MAX_LISTENERS        8
+#define WIFI_LISTENER_NONE        (-1)
 
+// The netif callbacks do the real work; this just catches anything they miss
+#ifndef WIFI_POLL_MS
+#define WIFI_POLL_MS              1000
+#endif
+
+#define WIFI_BACKOFF_MIN_MS       250
+#define WIFI_BACKOFF_MAX_MS       8000
+
+// How long a directed rejoin to the cached access point gets before we scan
+#define WIFI_FAST_JOIN_TIMEOUT_MS 2000
+
+// How often a join in progress is checked on
+#define WIFI_JOIN_POLL_MS         10
+
+// How much latency the power policy may add to the first packet after a
+// quiet spell, unless the configuration says otherwise: enough for power save
+#define WIFI_POWER_BUDGET_DEFAULT_MS  500
+
+
+typedef enum {
+    WIFI_STATE_IDLE,            // before the CYW43 is up, or if it never came up
+    WIFI_STATE_FAST_JOINING,    // directed join to the cached access point
+    WIFI_STATE_JOINING,         // the SDK's scan-and-join
+    WIFI_STATE_BACKOFF,         // waiting to try again
+    WIFI_STATE_UP               // joined; watching for the link to drop
+} wifi_state_t;
+
+
+typedef struct {
+    uint32_t link_downs;
+    uint32_t event_detections;
+    uint32_t polled_detections;
+    uint32_t rejoins;
+    uint32_t join_failures;
+    uint32_t fast_joins;
+    uint32_t fast_join_failures;
+    uint32_t full_joins;
+    uint64_t last_link_down_us;
+    uint64_t last_detect_us;
+    uint64_t last_rejoin_us;
+    uint32_t down_to_detect_last_us;
+    uint32_t down_to_detect_max_us;
+    uint64_t down_to_detect_total_us;
+    uint32_t detect_to_rejoin_last_us;
+    uint32_t detect_to_rejoin_max_us;
+    uint64_t detect_to_rejoin_total_us;
+} wifi_link_stats_t;
+
+// Called on the event loop with one event at a time
+typedef void (*wifi_event_callback_t)(void *arg, uint32_t event);
+
+typedef int wifi_listener_t;
+
+
+/**
+ * Brings the CYW43 up and keeps the STA interface joined, as a state machine
+ * on the EventLoop: every step starts something and schedules a check on it,
+ * so joining, backing off and watching the link never hold the loop up.
+ * lwIP's link and status callbacks post a check straight away; the poll
+ * catches anything they miss.
+ *
+ * Other services hear about the network through subscribe(), with a
+ * callback on the event loop, or subscribe_task(), with the events' bits
+ * set in a task's notification value. Either way they're told the moment
+ * the link drops or the address changes, rather than finding out on their
+ * next send. wait_for() blocks a task until a state holds, with a timeout.
+ *
+ * The radio's power management follows the traffic the packet filter lets
+ * through (see PowerPolicy), within the configured latency budget, unless
+ * set_power_mode() pins it.
+ */
 class WifiConnection {
     public:
         void init();
-
-        static void connect_task(void *params);
+        void configure(const led_strip_config_t *config);
+        void set_event_loop(EventLoop *loop) { this->loop = loop; };
 
         bool get_ip_address(uint8_t *ip);
         char *ip_to_string(uint8_t *ip, char *ips);
@@ -31,8 +119,14 @@ class WifiConnection {
         bool get_net_mask(uint8_t *ip) ;
         bool get_mac_address(uint8_t *mac);
         bool get_mac_address_str(char *macStr);
-        bool join();
         bool is_joined();
+        wifi_state_t get_state() { return state; };
+        bool is_connected() { return connected; };
+        const wifi_link_stats_t *get_link_stats() { return &link_stats; };
+        void set_power_mode(power_mode_t mode) { fixed_power_mode = mode; power_fixed = true; };
+        void set_power_latency_budget(uint32_t budget_ms) { power_policy.set_latency_budget_ms(budget_ms); };
+        power_mode_t get_power_mode() { return power_mode; };
+        const power_policy_stats_t *get_power_stats() { return power_policy.get_stats(); };
         void set_wifi_connect_retries(int retries) { wifi_connect_retries = retries;}
         int get_wifi_connect_retries() { return wifi_connect_retries; }
         void set_wifi_auth(int auth) { wifi_auth = auth; }
@@ -43,38 +137,140 @@ class WifiConnection {
         void set_password(const char *password) { this->password = (char *)password; };
         char *get_ssid() { return ssid; };
         char *get_password() { return password; };
+        void set_static_ip(const uint8_t *ip, const uint8_t *netmask, const uint8_t *gateway);
+        void set_use_dhcp(bool use_dhcp) { this->use_dhcp = use_dhcp; };
+        bool get_use_dhcp() { return use_dhcp; };
+        void set_config_store(ConfigStore *store);
+        void set_packet_filter(PacketFilter *filter) { packet_filter = filter; };
+        const wifi_reconnect_cache_t *get_reconnect_cache() { return &reconnect_cache; };
+        void clear_reconnect_cache() { memset(&reconnect_cache, 0, sizeof(reconnect_cache)); };
 
-        bool wait_for_cyw43_init();
-        bool wait_for_wifi_init();
+        wifi_listener_t subscribe(uint32_t events, wifi_event_callback_t callback, void *arg);
+        wifi_listener_t subscribe_task(uint32_t events, TaskHandle_t task);
+        void unsubscribe(wifi_listener_t *listener);
+        static uint32_t take_events(TickType_t timeout);
+        uint32_t get_events();
+        bool wait_for(uint32_t states, TickType_t timeout);
+        bool wait_for_cyw43_init(TickType_t timeout = portMAX_DELAY) { return wait_for(WIFI_EVENT_CYW43_UP, timeout); };
+        bool wait_for_wifi_init(TickType_t timeout = portMAX_DELAY) { return wait_for(WIFI_EVENT_IP_BOUND, timeout); };
 
 
         static WifiConnection& getInstance() {
             static WifiConnection instance;
-            
-            instance.init_event_group = NULL;
-            instance.wifi_connect_retries = 3;
-            instance.wifi_auth = CYW43_AUTH_WPA2_AES_PSK;
-            instance.wifi_connect_timeout = 60000;
-
             return instance;
         }
 
 
     private:
-        WifiConnection() {};
+        WifiConnection() {
+            state_event_group = NULL;
+            loop = NULL;
+            state = WIFI_STATE_IDLE;
+            timer = EVENT_TIMER_NONE;
+            join_attempts = 0;
+            join_deadline_us = 0;
+            retry_full_join = false;
+            wifi_connect_retries = 3;
+            wifi_auth = CYW43_AUTH_WPA2_AES_PSK;
+            wifi_connect_timeout = 60000;
+            ssid = NULL;
+            password = NULL;
+            use_dhcp = true;
+            ip4_addr_set_zero(&static_ip);
+            ip4_addr_set_zero(&static_netmask);
+            ip4_addr_set_zero(&static_gateway);
+            connected = false;
+            netif_watched = false;
+            backoff_ms = 0;
+            last_seen_up_us = 0;
+            config_store = NULL;
+            packet_filter = NULL;
+            power_policy.set_latency_budget_ms(WIFI_POWER_BUDGET_DEFAULT_MS);
+            power_mode = POWER_MODE_LOW_LATENCY;
+            fixed_power_mode = POWER_MODE_PERFORMANCE;
+            power_fixed = false;
+            power_packets = 0;
+            memset(&reconnect_cache, 0, sizeof(reconnect_cache));
+            memset(&link_stats, 0, sizeof(link_stats));
+            memset(bound_ip, 0, sizeof(bound_ip));
+            memset(listeners, 0, sizeof(listeners));
+        };
+
+        typedef struct {
+            uint32_t events;
+            wifi_event_callback_t callback;
+            void *arg;
+            TaskHandle_t task;          // notified instead, if there's no callback
+            bool active;
+        } listener_slot_t;
 
-        EventGroupHandle_t init_event_group;
-        TaskHandle_t wifi_task_handle;
+        EventGroupHandle_t state_event_group;
+#if configSUPPORT_STATIC_ALLOCATION
+        StaticEventGroup_t state_event_group_storage;
+#endif
+        listener_slot_t listeners[WIFI_MAX_LISTENERS];
+        uint8_t bound_ip[4];
+        EventLoop *loop;
+        wifi_state_t state;
+        event_timer_t timer;
+        int join_attempts;
+        uint64_t join_deadline_us;
+        bool retry_full_join;
 
         int wifi_connect_retries;
         int wifi_auth;
         int wifi_connect_timeout;
         char *ssid;
         char *password;
+        bool use_dhcp;
+        ip4_addr_t static_ip;
+        ip4_addr_t static_netmask;
+        ip4_addr_t static_gateway;
+
+        volatile bool connected;
+        bool netif_watched;
+        uint32_t backoff_ms;
+        uint64_t last_seen_up_us;
+        wifi_link_stats_t link_stats;
+        wifi_reconnect_cache_t reconnect_cache;
+        ConfigStore *config_store;
+        PacketFilter *packet_filter;
+        PowerPolicy power_policy;
+        power_mode_t power_mode;
+        power_mode_t fixed_power_mode;
+        bool power_fixed;
+        uint32_t power_packets;
+
+        static void netif_link_callback(struct netif *netif);
+        static void netif_status_callback(struct netif *netif);
+        static void start(void *arg);
+        static void poll(void *arg);
+        static void link_event(void *arg);
+        static void retry(void *arg);
+        static void associated_event(void *arg);
+        static void link_lost_event(void *arg);
+        static void power_sample(void *arg);
 
-        void unblock_cyw43_init();
-        void unblock_wifi_init();
-        void block_wifi_init();
+        void begin_join();
+        void begin_full_join();
+        void check_fast_join();
+        void check_full_join();
+        void check_link();
+        void joined(bool fast);
+        void join_failed();
+        void backoff(bool full_join_next);
+        void watch_netif();
+        bool is_link_up();
+        void link_lost(uint64_t down_us, bool from_event);
+        void link_restored();
+        void prime_dhcp();
+        void update_reconnect_cache();
+        void apply_static_ip();
+        void apply_power_mode(power_mode_t mode);
+        wifi_listener_t add_listener(uint32_t events, wifi_event_callback_t callback, void *arg, TaskHandle_t task);
+        void raise(uint32_t event);
+        void set_states(uint32_t states);
+        void clear_states(uint32_t states);
 };
 
 #endif